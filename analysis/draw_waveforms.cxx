@@ -20,6 +20,10 @@
 
 #include <csignal>
 
+// The fits run in the decoder library, see src/waveform_fitter.h
+#include "../src/waveform_fitter.h"
+R__LOAD_LIBRARY(libh2g_decode)
+
 volatile sig_atomic_t gSignalStatus = 0;
 
 void signal_handler(int signal) {
@@ -238,21 +242,12 @@ void draw_waveforms(int run_number) {
     histo->SetMinimum(65);
 
 
-    // Initial fit parameters
-    double par[7];
-    // mod_gauss
-    // par[0]=2.5;
-    // par[1]=1;
-    // par[2]=1;
-    // par[3]=100;
-    
-    // Crystal ball
-    par[0] = 2; // alpha
-    par[1] = 0.2; // n
-    par[2] = 2; // x_bar
-    par[3] = 0.25; // sigma
-    par[4] = 0; // N
-    par[5] = 100; // offset
+    // Crystal ball with the tail fixed, x_bar, sigma and N are fitted.  The TF1 fit this
+    // replaced let alpha vary in [1, 1.2] and n in [0.2, 0.6].
+    waveform_fitter fitter(10, 1.1, 0.43);
+    double par[6];
+    std::cout << "Crystal ball tail fixed at alpha = " << fitter.get_alpha() << ", n = " << fitter.get_n()
+              << " (the TF1 fit let them vary in [1, 1.2] and [0.2, 0.6])" << std::endl;
 
     // Histograms of the fit parameters
     int bins = 50;
@@ -264,11 +259,23 @@ void draw_waveforms(int run_number) {
     TH3F *N_hist = new TH3F("N_hist", "N;Channel;Value", channels, 0, channels, bins, 0, 2000, 250, 0, 1000);
     TH3F *offset_hist = new TH3F("offset_hist", "offset;Channel;Value", channels, 0, channels, bins, 0, 150, 250, 0, 1000);
 
-    // attempt to open the pedestal file
-    TFile *pedestal_file = TFile::Open(Form("pedestals_run%d.root", run_number));
-    TH1F *pedestals = nullptr;
-    if (pedestal_file) {
-        pedestal_file->GetObject("pedestals", pedestals);
+    // Pedestals accumulated by the decoder, see src/pedestal_accumulator.h
+    std::vector<double> pedestals(576, 0);
+    TTree *pedestal_tree = nullptr;
+    file->GetObject("pedestals", pedestal_tree);
+    if (pedestal_tree) {
+        uint pedestal_channel;
+        double pedestal;
+        pedestal_tree->SetBranchAddress("channel", &pedestal_channel);
+        pedestal_tree->SetBranchAddress("pedestal", &pedestal);
+        for (int i = 0; i < pedestal_tree->GetEntries(); i++) {
+            pedestal_tree->GetEntry(i);
+            if (pedestal_channel < 576) {
+                pedestals[pedestal_channel] = pedestal;
+            }
+        }
+    } else {
+        std::cerr << "No pedestals in " << file_name << ", using the ends of each waveform" << std::endl;
     }
 
     // maximums 
@@ -290,9 +297,6 @@ void draw_waveforms(int run_number) {
             std::cout << "\rProcessing entry " << i << std::flush;
         }
         tree->GetEntry(i);
-        if (i > 30000) {    // I don't know why but the program crashes at entry 31401
-            break;
-        }
        
         // To identify muon tracks, we'll take the sum of N for each column
         float column_sum[8];
@@ -311,63 +315,31 @@ void draw_waveforms(int run_number) {
             if (!good_channel[channel]) {
                 continue;
             }
-            auto graph = new TGraph(10);
             for (int j = 0; j < 10; j++) {
-                graph->SetPoint(j, j, waveform[channel][j]);
                 per_channel_waveform[channel]->Fill(j, waveform[channel][j]);
             }
-            // Try fitting with a constant first
-            auto *constant_fit = new TF1("constant", "[0]", 0, 9);
-            if (pedestals) {
-                constant_fit->SetParameter(0, pedestals->GetBinContent(channel));
-                constant_fit->SetParLimits(0, pedestals->GetBinContent(channel) * 0.9, pedestals->GetBinContent(channel) * 1.1);
-            } else {
-                constant_fit->SetParameter(0, 70);
-                constant_fit->SetParLimits(0, 63, 77);
-            }
-            auto fit_results = graph->Fit(constant_fit, "Q0", "");
-            // if this fits well, there probably isn't a signal
-            double constant_chi2 = constant_fit->GetChisquare();// / constant_fit->GetNDF();
-
-
-            // Fit the graph with a landau curve
-            // TF1 *fit = new TF1("fit", "landau", 0, 10);
-            // fit->SetParameter(1, 3);
-            TF1 *fit = new TF1("fit", crystal_ball, 0, 9.5, 6);
-            // TF1 *fit = new TF1("fit", exp_mod_gaussian, 0, 10, 4);
-            fit->SetParameters(par);
-            // fit->FixParameter(0, 2);
-            // fit->FixParameter(1, 500);
-            // fit->FixParameter(3, 1);
-            fit->SetParLimits(0, 1, 1.2);   // alpha
-            // fit->SetParLimits(0, 0, 5);   // alpha
-            // fit->FixParameter(0, 1.1);   // alpha
-            // fit->FixParameter(1, 0.43);   // alpha
-            fit->SetParLimits(1, 0.2, 0.6);   // n
-            fit->SetParLimits(2, 0.5, 4.5);   // x_bar
-            fit->SetParLimits(3, 0.25, 0.65);   // sigma
-            // fit->FixParameter(3, 0.25);
-            fit->SetParLimits(4, 0, 2000);  // N
-            // Set offset
-            if (true && pedestals) {
-                fit->FixParameter(5, pedestals->GetBinContent(channel));
-            } else {
-                fit->FixParameter(5, (waveform[channel][0] + waveform[channel][9]) / 2);
+            double pedestal = pedestal_tree ? pedestals[channel] : (waveform[channel][0] + waveform[channel][9]) / 2;
+            // How far the waveform strays from a flat pedestal, if not far there probably isn't a signal
+            double constant_chi2 = 0;
+            for (int j = 0; j < 10; j++) {
+                constant_chi2 += (waveform[channel][j] - pedestal) * (waveform[channel][j] - pedestal);
             }
+
+
+            // Limits as before: x_bar 0.5 to 4.5, sigma 0.25 to 0.65, N 0 to 2000
+            waveform_fit result = {0, 0, 0, 0, 1, 0, false};
             double N = 0;
             if (constant_chi2 > 500) {
-                graph->Fit(fit, "Q0", "", 0, 9);
-                N = fit->GetParameter(4);
-                // if (N > 200) {
-                    alpha_hist->Fill(channel, fit->GetParameter(0), N);
-                    n_hist->Fill(channel, fit->GetParameter(1), N);
-                    x_bar_hist->Fill(channel, fit->GetParameter(2), N);
-                    sigma_hist->Fill(channel, fit->GetParameter(3), N);
-                    N_hist->Fill(channel, fit->GetParameter(4), N);
-                    offset_hist->Fill(channel, fit->GetParameter(5), N);
-                // }
+                result = fitter.fit(waveform[channel], pedestal);
+                N = result.amplitude;
+                alpha_hist->Fill(channel, fitter.get_alpha(), N);
+                n_hist->Fill(channel, fitter.get_n(), N);
+                x_bar_hist->Fill(channel, result.peak_time, N);
+                sigma_hist->Fill(channel, result.sigma, N);
+                N_hist->Fill(channel, N, N);
+                offset_hist->Fill(channel, pedestal, N);
             }
-            double crystal_ball_chi2 = fit->GetChisquare() / fit->GetNDF();
+            double crystal_ball_chi2 = result.chi2 / result.ndf;
             // Save the fit parameters
 
             // auto mpv = fit->GetParameter(1);
@@ -409,8 +381,20 @@ void draw_waveforms(int run_number) {
                 histo->GetXaxis()->SetTitleOffset(0.795);
                 histo->GetYaxis()->SetTitleSize(0.05);
                 histo->GetYaxis()->SetTitleOffset(0.81);
+                auto graph = new TGraph(10);
+                for (int j = 0; j < 10; j++) {
+                    graph->SetPoint(j, j, waveform[channel][j]);
+                }
                 graph->SetMarkerStyle(20);
                 graph->Draw("same p");
+                par[0] = fitter.get_alpha();
+                par[1] = fitter.get_n();
+                par[2] = result.peak_time;
+                par[3] = result.sigma;
+                par[4] = result.amplitude;
+                par[5] = pedestal;
+                TF1 *fit = new TF1("fit", crystal_ball, 0, 9.5, 6);
+                fit->SetParameters(par);
                 fit->SetFillColorAlpha(kAzure+6, 0.15);
                 fit->SetFillStyle(1001);
                 fit->SetLineColor(kBlue);
@@ -442,8 +426,8 @@ void draw_waveforms(int run_number) {
                 latex.SetTextFont(62);
                 latex.DrawLatex(0.65, 0.9, "Crystal Ball Fit Parameters");
                 latex.SetTextFont(42);
-                latex.DrawLatex(0.65, 0.86, Form("#alpha = %.2f", fit->GetParameter(0)));
-                latex.DrawLatex(0.65, 0.82, Form("n = %.2f", fit->GetParameter(1)));
+                latex.DrawLatex(0.65, 0.86, Form("#alpha = %.2f (fixed)", fit->GetParameter(0)));
+                latex.DrawLatex(0.65, 0.82, Form("n = %.2f (fixed)", fit->GetParameter(1)));
                 latex.DrawLatex(0.65, 0.78, Form("#bar{x} = %.2f", fit->GetParameter(2)));
                 latex.DrawLatex(0.65, 0.74, Form("#sigma = %.2f", fit->GetParameter(3)));
                 latex.DrawLatex(0.65, 0.70, Form("N = %.2f", fit->GetParameter(4)));
@@ -456,9 +440,10 @@ void draw_waveforms(int run_number) {
                     // std::cout << "saving waveform" << std::endl;
                     canvas->Print(Form("candidate_waveforms/waveform_run%d_event%d_channel%d.png", run_number, i, channel));
                 }
+                delete fit_copy;
+                delete fit;
+                delete graph;
             }
-            delete graph;
-    
         }
         // identify if we have a muon track
         int muon_tracks = identify_muon_track(column_sum, column_N);
@@ -529,10 +514,6 @@ void draw_waveforms(int run_number) {
     std::cout << "Muons searched for: " << muons_searched_for << std::endl;
     std::cout << "Muons identified: " << muons_identified << std::endl;
 
-    if (pedestal_file) {
-        pedestal_file->Close();
-    }
-
     // Draw all waveforms
     canvas->Print(Form("waveforms_all_run%d.pdf[", run_number));
     for (int i = 0; i < 576; i++) {
@@ -669,33 +650,8 @@ void draw_waveforms(int run_number) {
     }
     canvas->Print(Form("fit_parameters_run%d.pdf]", run_number));
 
-    // Save a root file with the pedestal for each channel
-    TFile *output_file = TFile::Open(Form("pedestals_run%d.root.new", run_number), "RECREATE");
-    pedestals = new TH1F("pedestals", "Pedestals", 576, 0, 576);
-    canvas->Clear();
-    canvas->Print(Form("pedestals_run%d.pdf[", run_number));
-    for (int i = 0; i < 576; i++) {
-        auto profile = per_channel_waveform[i]->ProjectionY();
-        int max_bin = profile->GetMaximumBin();
-        double pedestal = profile->GetBinCenter(max_bin);
-
-        profile->SetTitle(Form("Pedestal Channel %d", i));
-        profile->Draw();
-        TLatex latex;
-        latex.SetNDC();
-        latex.SetTextSize(0.03);
-        latex.DrawLatex(0.55, 0.85, Form("Pedestal = %.2f", pedestal));
-        canvas->Update();
-        canvas->Print(Form("pedestals_run%d.pdf", run_number));
-        // find the maximum bin
-        pedestals->SetBinContent(i, pedestal);
-    }
-    canvas->Print(Form("pedestals_run%d.pdf]", run_number));
-    pedestals->Write();
-    output_file->Close();
-
     // Save all histograms to a root file
-    output_file = TFile::Open(Form("waveforms_run%d.root", run_number), "RECREATE");
+    TFile *output_file = TFile::Open(Form("waveforms_run%d.root", run_number), "RECREATE");
     for (int i = 0; i < 576; i++) {
         per_channel_waveform[i]->Write();
         fit_magnitude[i]->Write();
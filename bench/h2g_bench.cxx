@@ -0,0 +1,371 @@
+/*
+Benchmarks for each stage of the decoder and for the decoder as a whole.
+
+The input is generated with h2g_generator (or read from -f FILE) and held in memory, so
+the stage benchmarks do not include disk reads.  Each benchmark is repeated and the
+best and median times are reported; compare the best times between commits.
+
+    h2g_bench -e 5000 -r 5 -j results.json
+*/
+
+#include "h2g_generator.h"
+#include "file_stream.h"
+#include "line_builder.h"
+#include "waveform_builder.h"
+#include "event_aligner.h"
+#include "tree_writer.h"
+#include "binary_writer.h"
+#include "hgc_decoder.h"
+#include "pedestal_accumulator.h"
+#include "waveform_fitter.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifndef H2G_GIT_VERSION
+#define H2G_GIT_VERSION "unknown"
+#endif
+
+struct bench_result {
+    std::string name;
+    std::string unit;           // What one item is, e.g. line, packet, event
+    int64_t items = 0;          // Items per repetition
+    std::vector<double> seconds;
+
+    double best() const {return *std::min_element(seconds.begin(), seconds.end());}
+    double median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void print_usage() {
+    std::cout << "Usage: h2g_bench [-e EVENTS] [-n KCU] [-s SAMPLES] [-r REPEAT] [-f FILE] [-j FILE]" << std::endl;
+    std::cout << "  -e, --events      Events to generate (default: 2000)" << std::endl;
+    std::cout << "  -n, --num-kcu     Number of KCUs (default: 4)" << std::endl;
+    std::cout << "  -s, --samples     Samples per waveform (default: 10)" << std::endl;
+    std::cout << "  -r, --repeat      Repetitions of each benchmark (default: 5)" << std::endl;
+    std::cout << "  -f, --file        Benchmark on an existing .h2g file instead of generated data" << std::endl;
+    std::cout << "  -j, --json        Also write the results to FILE as JSON" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+}
+
+// Load all data packets of a file into memory, heartbeats are dropped
+std::vector<uint8_t> load_packets(const std::string &file_name, int num_kcu, int &num_samples) {
+    file_stream fs(file_name.c_str(), num_kcu);
+    num_samples = fs.get_number_samples();
+    std::vector<uint8_t> packets;
+    uint8_t buffer[h2g_generator::PACKET_SIZE];
+    int ret;
+    while ((ret = fs.read_packet(buffer)) != 0) {
+        if (ret == 1) {
+            packets.insert(packets.end(), buffer, buffer + h2g_generator::PACKET_SIZE);
+        }
+    }
+    return packets;
+}
+
+void bench_decode_line(std::vector<uint8_t> &packets, int num_kcu, bench_result &result) {
+    line_builder lb(num_kcu);
+    line l;
+    size_t num_packets = packets.size() / h2g_generator::PACKET_SIZE;
+    uint64_t start = now_ns();
+    for (size_t p = 0; p < num_packets; p++) {
+        uint8_t *packet = packets.data() + p * h2g_generator::PACKET_SIZE + h2g_generator::PACKET_HEADER_SIZE;
+        for (int i = 0; i < h2g_generator::LINES_PER_PACKET; i++) {
+            lb.decode_line(packet + i * h2g_generator::LINE_SIZE, &l);
+        }
+    }
+    result.seconds.push_back((now_ns() - start) / 1e9);
+    result.items = num_packets * h2g_generator::LINES_PER_PACKET;
+}
+
+// Stages timed by bench_pipeline.  Without ROOT event_writer is an empty stub, so it only
+// gets a row of its own in a ROOT build.
+#ifdef USE_ROOT
+const int PIPELINE_STAGES = 7;
+#else
+const int PIPELINE_STAGES = 6;
+#endif
+
+// Run the pipeline once over the packets, timing each stage separately
+void bench_pipeline(std::vector<uint8_t> &packets, int num_kcu, int num_samples,
+                    const std::string &output_base, bench_result *results) {
+    line_builder lb(num_kcu);
+    std::vector<waveform_builder*> wbs;
+    for (int i = 0; i < num_kcu; i++) {
+        wbs.push_back(new waveform_builder(i, num_samples));
+    }
+    event_aligner aligner(num_kcu);
+#ifdef USE_ROOT
+    event_writer writer(output_base + ".root", num_kcu, num_samples, 0);
+#endif
+    binary_writer bwriter(output_base + ".h2d", num_kcu, num_samples, 0);
+    std::list<kcu_event*> **single_kcu_events = new std::list<kcu_event*>*[num_kcu];
+
+    uint64_t elapsed[PIPELINE_STAGES] = {};
+    int64_t events = 0;
+    size_t num_packets = packets.size() / h2g_generator::PACKET_SIZE;
+    for (size_t p = 0; p < num_packets; p++) {
+        uint64_t t0 = now_ns();
+        lb.process_packet(packets.data() + p * h2g_generator::PACKET_SIZE);
+        uint64_t t1 = now_ns();
+        lb.process_complete();
+        uint64_t t2 = now_ns();
+        elapsed[0] += t1 - t0;
+        elapsed[1] += t2 - t1;
+        for (int i = 0; i < num_kcu; i++) {
+            uint64_t t3 = now_ns();
+            wbs[i]->build(lb.get_completed(i));
+            uint64_t t4 = now_ns();
+            wbs[i]->unwrap_counters();
+            elapsed[2] += t4 - t3;
+            elapsed[3] += now_ns() - t4;
+            single_kcu_events[i] = wbs[i]->get_complete();
+        }
+        uint64_t t5 = now_ns();
+        aligner.align(single_kcu_events);
+        uint64_t t6 = now_ns();
+        elapsed[4] += t6 - t5;
+        for (auto event : *aligner.get_complete()) {
+            uint64_t t7 = now_ns();
+            bwriter.write_event(event);
+            uint64_t t8 = now_ns();
+            elapsed[5] += t8 - t7;
+#ifdef USE_ROOT
+            writer.write_event(event);
+            elapsed[6] += now_ns() - t8;
+#endif
+            delete event;
+            events++;
+        }
+        aligner.clear_complete();
+    }
+#ifdef USE_ROOT
+    writer.close();
+#endif
+    bwriter.close();
+    delete[] single_kcu_events;
+    for (auto wb : wbs) {
+        delete wb;
+    }
+
+    int64_t items[] = {(int64_t)num_packets, (int64_t)num_packets, (int64_t)num_packets * num_kcu,
+                       (int64_t)num_packets * num_kcu, (int64_t)num_packets, events, events};
+    for (int i = 0; i < PIPELINE_STAGES; i++) {
+        results[i].seconds.push_back(elapsed[i] / 1e9);
+        results[i].items = items[i];
+    }
+}
+
+void bench_end_to_end(const std::string &file_name, int num_kcu, bench_result &events_result, int64_t &bytes) {
+    uint64_t start = now_ns();
+    auto decoder = new hgc_decoder(file_name.c_str(), 0, num_kcu);
+    int64_t events = 0;
+    for (auto event : *decoder) {
+        delete event;
+        events++;
+    }
+    delete decoder;
+    events_result.seconds.push_back((now_ns() - start) / 1e9);
+    events_result.items = events;
+    bytes = std::filesystem::file_size(file_name);
+}
+
+// Waveforms of the channels that fired, those whose largest sample is PULSE_THRESHOLD over
+// the pedestal, with the pedestal of each
+const double PULSE_THRESHOLD = 30;
+
+void load_pulses(const std::string &file_name, int num_kcu, int num_samples,
+                 std::vector<uint32_t> &pulses, std::vector<double> &pedestals) {
+    // Pedestals first, so the selection does not depend on the order of the events
+    pedestal_accumulator accumulator(num_kcu, num_samples);
+    auto decoder = new hgc_decoder(file_name.c_str(), 0, num_kcu);
+    for (auto event : *decoder) {
+        accumulator.add(event);
+        delete event;
+    }
+    delete decoder;
+
+    decoder = new hgc_decoder(file_name.c_str(), 0, num_kcu);
+    for (auto event : *decoder) {
+        for (int i = 0; i < num_kcu; i++) {
+            kcu_event *e = event->get_event(i);
+            for (int j = 0; j < 144; j++) {
+                const uint32_t *adc = e->get_adc(j);
+                double pedestal = accumulator.get_pedestal(i * 144 + j);
+                if (*std::max_element(adc, adc + num_samples) >= pedestal + PULSE_THRESHOLD) {
+                    pulses.insert(pulses.end(), adc, adc + num_samples);
+                    pedestals.push_back(pedestal);
+                }
+            }
+        }
+        delete event;
+    }
+    delete decoder;
+}
+
+void bench_waveform_fit(const std::vector<uint32_t> &pulses, const std::vector<double> &pedestals, int num_samples,
+                        bench_result &result) {
+    waveform_fitter fitter(num_samples);
+    std::vector<waveform_fit> fits(pedestals.size());
+    uint64_t start = now_ns();
+    fitter.fit(pulses.data(), num_samples, pedestals.data(), pedestals.size(), fits.data());
+    result.seconds.push_back((now_ns() - start) / 1e9);
+    result.items = pedestals.size();
+}
+
+int main(int argc, char **argv) {
+    generator_config gen;
+    gen.num_events = 2000;
+    int repeat = 5;
+    std::string input_file;
+    std::string json_file;
+
+    const struct option long_options[] = {
+        {"events", required_argument, nullptr, 'e'},
+        {"num-kcu", required_argument, nullptr, 'n'},
+        {"samples", required_argument, nullptr, 's'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"file", required_argument, nullptr, 'f'},
+        {"json", required_argument, nullptr, 'j'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:n:s:r:f:j:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'e':
+                gen.num_events = std::stoll(optarg);
+                break;
+            case 'n':
+                gen.num_kcu = std::stoi(optarg);
+                break;
+            case 's':
+                gen.num_samples = std::stoi(optarg);
+                break;
+            case 'r':
+                repeat = std::max(1, std::stoi(optarg));
+                break;
+            case 'f':
+                input_file = optarg;
+                break;
+            case 'j':
+                json_file = optarg;
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(DEBUG_ERROR);
+
+    std::string temp_base = (std::filesystem::temp_directory_path() / ("h2g_bench_" + std::to_string(getpid()))).string();
+    bool generated = input_file.empty();
+    if (generated) {
+        input_file = temp_base + ".h2g";
+        try {
+            h2g_generator generator(gen);
+            generator.write(input_file);
+        } catch (const std::runtime_error &e) {
+            LOG_MESSAGE(DEBUG_ERROR, std::string("Could not generate input: ") + e.what());
+            return 1;
+        }
+    }
+
+    int num_samples = 0;
+    std::vector<uint8_t> packets;
+    try {
+        packets = load_packets(input_file, gen.num_kcu, num_samples);
+    } catch (const std::runtime_error &e) {
+        LOG_MESSAGE(DEBUG_ERROR, std::string("Could not read input: ") + e.what());
+        return 1;
+    }
+
+    std::vector<bench_result> results = {
+        {"decode_line", "line", 0, {}},
+        {"process_packet", "packet", 0, {}},
+        {"process_complete", "packet", 0, {}},
+        {"waveform_builder::build", "packet", 0, {}},
+        {"waveform_builder::unwrap_counters", "packet", 0, {}},
+        {"event_aligner::align", "packet", 0, {}},
+        {"binary_writer::write_event", "event", 0, {}},
+#ifdef USE_ROOT
+        {"event_writer::write_event", "event", 0, {}},
+#endif
+        {"end_to_end", "event", 0, {}},
+        {"waveform_fitter::fit", "fit", 0, {}},
+    };
+    bench_result &end_to_end_result = results[1 + PIPELINE_STAGES];
+    bench_result &fit_result = results[2 + PIPELINE_STAGES];
+    std::vector<uint32_t> pulses;
+    std::vector<double> pedestals;
+    load_pulses(input_file, gen.num_kcu, num_samples, pulses, pedestals);
+    int64_t bytes = 0;
+    for (int r = 0; r < repeat; r++) {
+        bench_decode_line(packets, gen.num_kcu, results[0]);
+        bench_pipeline(packets, gen.num_kcu, num_samples, temp_base, &results[1]);
+        bench_end_to_end(input_file, gen.num_kcu, end_to_end_result, bytes);
+        bench_waveform_fit(pulses, pedestals, num_samples, fit_result);
+    }
+    std::remove((temp_base + ".root").c_str());
+    std::remove((temp_base + ".h2d").c_str());
+    if (generated) {
+        std::remove(input_file.c_str());
+    }
+
+    // Fixed layout so runs from different commits can be diffed
+    double end_to_end = end_to_end_result.best();
+    printf("# h2g_bench %s\n", H2G_GIT_VERSION);
+    printf("# kcu %d, samples %d, packets %zu, bytes %lld, repeat %d\n", gen.num_kcu, num_samples,
+           packets.size() / h2g_generator::PACKET_SIZE, (long long)bytes, repeat);
+    printf("%-36s %12s %8s %14s %14s %14s\n", "benchmark", "items", "unit", "best ns/item", "median ns/item", "best items/s");
+    for (auto &r : results) {
+        double items = r.items > 0 ? r.items : 1;
+        printf("%-36s %12lld %8s %14.1f %14.1f %14.0f\n", r.name.c_str(), (long long)r.items, r.unit.c_str(),
+               r.best() * 1e9 / items, r.median() * 1e9 / items, r.best() > 0 ? r.items / r.best() : 0.0);
+    }
+    printf("%-36s %12.1f MB/s\n", "end_to_end_throughput", end_to_end > 0 ? bytes / end_to_end / 1e6 : 0.0);
+    printf("%-36s %12.1f events/s\n", "end_to_end_rate", end_to_end > 0 ? end_to_end_result.items / end_to_end : 0.0);
+
+    if (!json_file.empty()) {
+        FILE *out = fopen(json_file.c_str(), "w");
+        if (out == nullptr) {
+            LOG_MESSAGE(DEBUG_ERROR, "Could not open " + json_file);
+            return 1;
+        }
+        fprintf(out, "{\"version\":\"%s\",\"num_kcu\":%d,\"num_samples\":%d,\"bytes\":%lld,\"repeat\":%d,\n",
+                H2G_GIT_VERSION, gen.num_kcu, num_samples, (long long)bytes, repeat);
+        fprintf(out, "\"mb_per_s\":%.3f,\"events_per_s\":%.3f,\n\"benchmarks\":[",
+                end_to_end > 0 ? bytes / end_to_end / 1e6 : 0.0, end_to_end > 0 ? end_to_end_result.items / end_to_end : 0.0);
+        for (size_t i = 0; i < results.size(); i++) {
+            auto &r = results[i];
+            double items = r.items > 0 ? r.items : 1;
+            fprintf(out, "%s\n{\"name\":\"%s\",\"unit\":\"%s\",\"items\":%lld,\"best_ns\":%.1f,\"median_ns\":%.1f}",
+                    i ? "," : "", r.name.c_str(), r.unit.c_str(), (long long)r.items,
+                    r.best() * 1e9 / items, r.median() * 1e9 / items);
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+    return 0;
+}
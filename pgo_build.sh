@@ -0,0 +1,34 @@
+#!/bin/bash
+# Two phase profile guided build: instrument, train on synthetic data, rebuild.
+#
+#   ./pgo_build.sh [build directory] [extra cmake arguments...]
+#
+# Both phases use the same build directory, since gcc finds the profile of each object
+# by its path.  Training runs h2g_bench (the shared library) and h2g_run on generated data.
+set -e
+
+SOURCE_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR=${1:-build}
+shift || true
+BUILD_DIR=$(mkdir -p "$BUILD_DIR" && cd "$BUILD_DIR" && pwd)
+PROFILE_DIR="$BUILD_DIR/pgo-profiles"
+TRAIN_DIR="$BUILD_DIR/pgo-train"
+JOBS=$(nproc 2>/dev/null || echo 4)
+
+rm -rf "$PROFILE_DIR" "$TRAIN_DIR"
+mkdir -p "$TRAIN_DIR"
+
+echo "=== Building instrumented binaries"
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DH2G_PGO=generate -DH2G_PGO_DIR="$PROFILE_DIR" "$@"
+cmake --build "$BUILD_DIR" -j"$JOBS"
+
+echo "=== Training"
+"$BUILD_DIR/h2g_bench" -e 3000 -r 1
+DATA_DIRECTORY="$TRAIN_DIR" "$BUILD_DIR/h2g_generate" -r 999 -e 3000 -L 0.0005 -O 0.005 -H 500 -G 2
+DATA_DIRECTORY="$TRAIN_DIR" OUTPUT_DIRECTORY="$TRAIN_DIR" "$BUILD_DIR/h2g_run" -r 999 -b
+
+echo "=== Building with profiles"
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR" -DH2G_PGO=use "$@"
+cmake --build "$BUILD_DIR" -j"$JOBS"
+rm -rf "$TRAIN_DIR"
+echo "=== Done, profile guided binaries are in $BUILD_DIR"
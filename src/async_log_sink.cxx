@@ -0,0 +1,150 @@
+#include "async_log_sink.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+AsyncLogSink::AsyncLogSink(const std::string& fileName, uint64_t capacity) {
+    this->fileName = fileName;
+    uint64_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mask = size - 1;
+    slots = new Slot[size];
+    for (uint64_t i = 0; i < size; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueuePos.store(0, std::memory_order_relaxed);
+    dequeuePos = 0;
+    dropped.store(0, std::memory_order_relaxed);
+    written.store(0, std::memory_order_relaxed);
+
+    file = fopen(fileName.c_str(), "w");
+    if (file == nullptr) {
+        delete[] slots;
+        std::cerr << "Error opening log file " << fileName << std::endl;
+        throw std::runtime_error("Error opening log file");
+    }
+    // Large stdio buffer so the writer thread issues few write calls
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    running.store(true);
+    writer = std::thread(&AsyncLogSink::run, this);
+}
+
+AsyncLogSink::~AsyncLogSink() {
+    stop();
+    delete[] slots;
+}
+
+bool AsyncLogSink::push(int level, const std::string& component, const std::string& message) {
+    Slot *slot;
+    uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        slot = &slots[pos & mask];
+        uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The writer thread has not freed this slot yet, the ring is full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord &r = slot->record;
+    r.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    r.level = level;
+    size_t componentLength = std::min(component.size(), sizeof(r.component) - 1);
+    memcpy(r.component, component.data(), componentLength);
+    r.component[componentLength] = '\0';
+    r.messageLength = std::min(message.size(), sizeof(r.message));
+    memcpy(r.message, message.data(), r.messageLength);
+
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+// Single consumer, so no compare and swap is needed on this side
+bool AsyncLogSink::pop(LogRecord &record) {
+    Slot &slot = slots[dequeuePos & mask];
+    uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+    if (seq != dequeuePos + 1) {
+        return false;
+    }
+    record = slot.record;
+    slot.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+void AsyncLogSink::writeRecord(const LogRecord &record) {
+    time_t seconds = record.timestampNs / 1000000000;
+    int ms = (record.timestampNs / 1000000) % 1000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char timestamp[16];
+    strftime(timestamp, sizeof(timestamp), "%H:%M:%S", &local);
+
+    fprintf(file, "[%s.%03d] [%s] ", timestamp, ms, DebugLogger::getLevelName(record.level).c_str());
+    if (record.component[0] != '\0') {
+        fprintf(file, "[%s] ", record.component);
+    }
+    fwrite(record.message, 1, record.messageLength, file);
+    fputc('\n', file);
+    written.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncLogSink::drain() {
+    LogRecord record;
+    while (pop(record)) {
+        writeRecord(record);
+    }
+}
+
+void AsyncLogSink::run() {
+    uint64_t reportedDrops = 0;
+    while (running.load(std::memory_order_acquire)) {
+        LogRecord record;
+        if (!pop(record)) {
+            // Nothing queued, flush what we have and back off briefly
+            fflush(file);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        writeRecord(record);
+
+        uint64_t drops = dropped.load(std::memory_order_relaxed);
+        if (drops != reportedDrops) {
+            fprintf(file, "[%s] [AsyncLogSink] %llu messages dropped so far, log ring is full\n",
+                    DebugLogger::getLevelName(DEBUG_WARNING).c_str(), (unsigned long long)drops);
+            reportedDrops = drops;
+        }
+    }
+    drain();
+}
+
+void AsyncLogSink::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    writer.join();
+    uint64_t drops = dropped.load();
+    if (drops > 0) {
+        fprintf(file, "[%s] [AsyncLogSink] %llu messages dropped in total\n",
+                DebugLogger::getLevelName(DEBUG_WARNING).c_str(), (unsigned long long)drops);
+        std::cerr << "Async log dropped " << drops << " messages, see " << fileName << std::endl;
+    }
+    fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,68 @@
+/*
+Asynchronous backend for DebugLogger.
+
+Producers copy the raw message into a preallocated lock-free ring of fixed size
+binary records, which costs a few hundred bytes of memcpy and no system calls.  A
+background thread formats the timestamps and writes the records to a file.  When the
+ring is full, messages are dropped and counted instead of stalling the decoder.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+struct LogRecord {
+    int64_t timestampNs;        // system_clock time, formatted later by the writer thread
+    uint32_t level;
+    uint32_t messageLength;
+    char component[24];
+    char message[208];
+};
+
+class AsyncLogSink {
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        LogRecord record;
+    };
+
+    Slot *slots;
+    uint64_t mask;
+
+    // Keep the producer and consumer positions on separate cache lines
+    alignas(64) std::atomic<uint64_t> enqueuePos;
+    alignas(64) uint64_t dequeuePos;
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> written;
+
+    std::atomic<bool> running;
+    std::thread writer;
+    FILE *file;
+    std::string fileName;
+
+    bool pop(LogRecord &record);
+    void drain();
+    void writeRecord(const LogRecord &record);
+    void run();
+
+public:
+    // capacity is rounded up to a power of two
+    AsyncLogSink(const std::string& fileName, uint64_t capacity = 1 << 16);
+    ~AsyncLogSink();
+
+    AsyncLogSink(const AsyncLogSink&) = delete;
+    AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+    // Never blocks; returns false and counts a drop if the ring is full
+    bool push(int level, const std::string& component, const std::string& message);
+
+    // Stop the writer thread after everything queued so far has been written
+    void stop();
+
+    uint64_t getDroppedCount() const {return dropped.load(std::memory_order_relaxed);}
+    uint64_t getWrittenCount() const {return written.load(std::memory_order_relaxed);}
+};
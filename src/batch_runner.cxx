@@ -0,0 +1,213 @@
+#include "batch_runner.h"
+#include "run_logbook.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef USE_ROOT
+#include <TROOT.h>
+#endif
+
+namespace {
+void add_runs(const std::string &item, std::vector<int> &runs) {
+    size_t dash = item.find('-', 1);
+    size_t used = 0;
+    int first = std::stoi(item, &used);
+    int last = first;
+    if (dash != std::string::npos) {
+        if (used != dash) {
+            throw std::invalid_argument("Bad run range " + item);
+        }
+        last = std::stoi(item.substr(dash + 1), &used);
+        used += dash + 1;
+    }
+    if (used != item.size() || first < 0 || last < first) {
+        throw std::invalid_argument("Bad run range " + item);
+    }
+    for (int run = first; run <= last; run++) {
+        runs.push_back(run);
+    }
+}
+
+std::string json_escape(const std::string &text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+        }
+        out.push_back(c == '\n' ? ' ' : c);
+    }
+    return out;
+}
+
+double percent(int64_t part, int64_t total) {
+    return total > 0 ? 100.0 * part / total : 0.0;
+}
+}
+
+std::vector<int> parse_run_list(const std::string &list) {
+    std::string text = list;
+    if (!list.empty() && list[0] == '@') {
+        std::ifstream file(list.substr(1));
+        if (!file.good()) {
+            throw std::invalid_argument("Cannot read run list " + list.substr(1));
+        }
+        text.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            text += line.substr(0, line.find('#')) + ",";
+        }
+    }
+    std::replace_if(text.begin(), text.end(), [](char c) {return std::isspace((unsigned char)c);}, ',');
+    std::vector<int> runs;
+    std::istringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (!item.empty()) {
+            add_runs(item, runs);
+        }
+    }
+    std::sort(runs.begin(), runs.end());
+    runs.erase(std::unique(runs.begin(), runs.end()), runs.end());
+    return runs;
+}
+
+batch_runner::batch_runner(const config &base, const std::string &data_directory, const std::string &output_directory,
+                           unsigned jobs)
+    : base(base), data_directory(data_directory), output_directory(output_directory), pool(jobs) {
+    logbook = nullptr;
+    wall_seconds = 0;
+#ifdef USE_ROOT
+    // Every worker writes its own TFile
+    ROOT::EnableThreadSafety();
+#endif
+}
+
+int batch_runner::run(const std::vector<int> &runs) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Largest input first, so the longest runs are not the last ones started
+    std::vector<std::pair<int64_t, config>> queue;
+    for (int run_number : runs) {
+        config cfg = base;
+        cfg.run_number = run_number;
+        cfg.pool = &pool;
+        if (logbook && !logbook->configure(cfg)) {
+            LOG_MESSAGE(DEBUG_WARNING, "Batch", "Run " + std::to_string(run_number) +
+                        " is not in the logbook, using detector " + std::to_string(cfg.detector_id) +
+                        " and " + std::to_string(cfg.num_kcu) + " KCUs");
+        }
+        set_run_files(cfg, data_directory, output_directory);
+        std::error_code error;
+        int64_t size = std::filesystem::file_size(cfg.file_name, error);
+        queue.push_back({error ? -1 : size, cfg});
+    }
+    std::stable_sort(queue.begin(), queue.end(), [](const auto &a, const auto &b) {return a.first > b.first;});
+    LOG_MESSAGE(DEBUG_INFO, "Batch", "Decoding " + std::to_string(queue.size()) + " runs on " +
+                std::to_string(pool.get_num_threads()) + " workers, largest first");
+
+    std::atomic<int> finished(0);
+    int total = queue.size();
+    std::vector<std::future<run_summary>> pending;
+    for (auto &item : queue) {
+        pending.push_back(pool.submit([cfg = item.second, &finished, total]() mutable {
+            run_summary summary = {};
+            summary.run_number = cfg.run_number;
+            if (stop_requested()) {
+                summary.error = "not started, interrupted";
+                return summary;
+            }
+            try {
+                summary = test_line_builder(cfg);
+            } catch (const std::exception &e) {
+                summary.error = e.what();
+            }
+            int done = ++finished;
+            LOG_MESSAGE(summary.ok ? DEBUG_INFO : DEBUG_ERROR, "Batch", "Run " + std::to_string(cfg.run_number) +
+                        (summary.ok ? " done, " + std::to_string(summary.events) + " events" : " failed: " + summary.error) +
+                        " (" + std::to_string(done) + "/" + std::to_string(total) + ")");
+            return summary;
+        }));
+    }
+
+    results.clear();
+    int failed = 0;
+    for (auto &result : pending) {
+        results.push_back(result.get());
+        failed += !results.back().ok;
+    }
+    std::sort(results.begin(), results.end(),
+              [](const run_summary &a, const run_summary &b) {return a.run_number < b.run_number;});
+    wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return failed;
+}
+
+void batch_runner::print_report(std::ostream &out) {
+    run_summary totals = {};
+    double cpu_seconds = 0;
+    char line[256];
+    snprintf(line, sizeof(line), "%6s  %-6s %10s %11s %10s %9s %8s %11s %15s",
+             "Run", "Status", "Events", "Packets", "Input MB", "Seconds", "MB/s", "Lines lost", "Waveforms lost");
+    out << line << std::endl;
+    for (auto &r : results) {
+        snprintf(line, sizeof(line), "%6d  %-6s %10lld %11lld %10.1f %9.2f %8.1f %10.2f%% %14.2f%%",
+                 r.run_number, r.ok ? "ok" : "FAILED", (long long)r.events, (long long)r.packets, r.input_bytes / 1e6,
+                 r.seconds, r.seconds > 0 ? r.bytes_read / r.seconds / 1e6 : 0.0,
+                 percent(r.incomplete_lines, r.complete_lines + r.incomplete_lines),
+                 percent(r.waveforms_aborted, r.waveforms_in_order + r.waveforms_aborted));
+        out << line;
+        if (!r.ok) {
+            out << "  " << r.error;
+        }
+        out << std::endl;
+        totals.events += r.events;
+        totals.packets += r.packets;
+        totals.input_bytes += r.input_bytes;
+        totals.bytes_read += r.bytes_read;
+        totals.complete_lines += r.complete_lines;
+        totals.incomplete_lines += r.incomplete_lines;
+        totals.waveforms_in_order += r.waveforms_in_order;
+        totals.waveforms_aborted += r.waveforms_aborted;
+        cpu_seconds += r.seconds;
+    }
+    snprintf(line, sizeof(line), "%6s  %-6s %10lld %11lld %10.1f %9.2f %8.1f %10.2f%% %14.2f%%",
+             "Total", "", (long long)totals.events, (long long)totals.packets, totals.input_bytes / 1e6,
+             wall_seconds, wall_seconds > 0 ? totals.bytes_read / wall_seconds / 1e6 : 0.0,
+             percent(totals.incomplete_lines, totals.complete_lines + totals.incomplete_lines),
+             percent(totals.waveforms_aborted, totals.waveforms_in_order + totals.waveforms_aborted));
+    out << line << std::endl;
+    int failed = std::count_if(results.begin(), results.end(), [](const run_summary &r) {return !r.ok;});
+    snprintf(line, sizeof(line), "%zu runs, %d failed, on %u workers: %.1f s wall, %.1f s of decoding (%.0f%% of the workers)",
+             results.size(), failed, pool.get_num_threads(), wall_seconds, cpu_seconds,
+             percent(cpu_seconds * 1000, wall_seconds * 1000 * pool.get_num_threads()));
+    out << line << std::endl;
+}
+
+void batch_runner::write_report_json(std::ostream &out) {
+    int64_t events = 0;
+    int64_t bytes = 0;
+    int failed = 0;
+    for (auto &r : results) {
+        out << "{\"type\":\"run\",\"run\":" << r.run_number << ",\"ok\":" << (r.ok ? "true" : "false")
+            << ",\"error\":\"" << json_escape(r.error) << "\",\"seconds\":" << r.seconds
+            << ",\"input_bytes\":" << r.input_bytes << ",\"packets\":" << r.packets << ",\"bytes_read\":" << r.bytes_read
+            << ",\"complete_lines\":" << r.complete_lines << ",\"incomplete_lines\":" << r.incomplete_lines
+            << ",\"waveforms_in_order\":" << r.waveforms_in_order << ",\"waveforms_aborted\":" << r.waveforms_aborted
+            << ",\"events\":" << r.events << "}\n";
+        events += r.events;
+        bytes += r.bytes_read;
+        failed += !r.ok;
+    }
+    out << "{\"type\":\"batch\",\"runs\":" << results.size() << ",\"failed\":" << failed
+        << ",\"workers\":" << pool.get_num_threads() << ",\"wall_seconds\":" << wall_seconds
+        << ",\"bytes_read\":" << bytes << ",\"events\":" << events << "}" << std::endl;
+}
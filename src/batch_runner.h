@@ -0,0 +1,54 @@
+/*
+Decodes a list of runs on one worker pool, for reprocessing a campaign in a single
+process:
+
+    h2g_run -R 100-180,200 -j 16
+    h2g_run -R @runs.txt
+
+Runs are started largest input first, so one big run is not left decoding alone at the
+end.  Each run is decoded on one worker as it would be by h2g_run -r, writing the same
+outputs; compressed inputs hand their frames to the same pool, which the waiting run
+helps to work through.  With a logbook, each run takes its detector, KCU count and
+number of samples from it.  A table of every run and the campaign totals is printed at the
+end, and can also be written as JSON lines.
+*/
+
+#pragma once
+
+#include "hgc_decoder.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class run_logbook;
+
+// Parses "12,15-20,31", or "@FILE" for a file of run numbers separated by whitespace or
+// commas with # comments.  Throws std::invalid_argument on anything else.
+std::vector<int> parse_run_list(const std::string &list);
+
+class batch_runner {
+private:
+    config base;
+    std::string data_directory;
+    std::string output_directory;
+    thread_pool pool;
+    const run_logbook *logbook;
+    std::vector<run_summary> results;
+    double wall_seconds;
+
+public:
+    // base holds the settings shared by every run; 0 jobs uses one per hardware thread
+    batch_runner(const config &base, const std::string &data_directory, const std::string &output_directory, unsigned jobs = 0);
+
+    // Configures each run from logbook, which must outlive the batch; runs missing from it keep base
+    void set_logbook(const run_logbook *logbook) {this->logbook = logbook;}
+
+    // Decodes every run and returns how many failed
+    int run(const std::vector<int> &runs);
+
+    void print_report(std::ostream &out);
+    // One JSON object per run and a final "batch" object with the totals
+    void write_report_json(std::ostream &out);
+};
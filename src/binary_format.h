@@ -0,0 +1,133 @@
+/*
+Native on-disk layout for decoded events (.h2d).
+
+A fixed header is followed by fixed size event records, so a file can be memory
+mapped and any event or channel found with simple pointer arithmetic.  Each record is
+
+    uint64_t event_number
+    int64_t  timestamps[num_kcu]
+    uint16_t adc[num_channels][num_samples]
+    uint16_t toa[num_channels][num_samples]
+    uint16_t tot[num_channels][num_samples]
+    uint16_t hamming[num_channels][num_samples]
+
+ADC and TOA are 10 bits and the decoded TOT is at most 12 bits, so 16 bit words
+hold everything without loss while halving the footprint of the TTree's 32 bit arrays.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+constexpr uint32_t H2D_MAGIC = 0x44324748;  // "HG2D" when read as little endian bytes
+constexpr uint32_t H2D_VERSION = 1;
+
+struct h2d_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_kcu;
+    uint32_t num_samples;
+    uint32_t num_channels;
+    uint32_t detector;
+    uint64_t num_events;    // Patched when the writer is closed
+    uint64_t record_size;   // Bytes per event record
+    uint64_t header_size;   // Offset of the first record
+};
+
+// Byte offsets of each block inside a record
+struct h2d_layout {
+    size_t timestamps;
+    size_t adc;
+    size_t toa;
+    size_t tot;
+    size_t hamming;
+    size_t record_size;
+
+    h2d_layout(uint32_t num_kcu, uint32_t num_channels, uint32_t num_samples) {
+        size_t block = (size_t)num_channels * num_samples * sizeof(uint16_t);
+        timestamps = sizeof(uint64_t);
+        adc = timestamps + num_kcu * sizeof(int64_t);
+        toa = adc + block;
+        tot = toa + block;
+        hamming = tot + block;
+        record_size = hamming + block;
+        // Keep every record 8 byte aligned
+        record_size = (record_size + 7) & ~(size_t)7;
+    }
+};
+
+/*
+Hits found by hit_finder (.h2h).  A fixed header is followed by one record per event,
+
+    uint64_t event_number
+    uint32_t num_hits
+    uint32_t reserved
+    h2h_hit  hits[num_hits]
+
+Records vary in length, so they are found by walking the record headers once.
+*/
+
+constexpr uint32_t H2H_MAGIC = 0x48324748;  // "HG2H"
+constexpr uint32_t H2H_VERSION = 1;
+
+struct h2h_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_kcu;
+    uint32_t num_samples;
+    uint32_t num_channels;
+    uint32_t detector;
+    uint64_t num_events;    // Patched when the writer is closed
+    float threshold;        // Smallest amplitude kept, ADC counts above pedestal
+    uint32_t reserved;
+    uint64_t header_size;   // Offset of the first record
+};
+
+struct h2h_record_header {
+    uint64_t event_number;
+    uint32_t num_hits;
+    uint32_t reserved;
+};
+
+struct h2h_hit {
+    uint32_t channel;
+    uint16_t peak_sample;
+    uint16_t toa;           // TOA of the first sample that has one, 0 if none does
+    float amplitude;        // Largest sample above pedestal, ADC counts
+    float charge;           // Sum of all samples above pedestal, ADC counts
+};
+
+/*
+Online histograms of dqm_histogrammer (.dqm), rewritten whole at every snapshot.  A fixed
+header is followed by
+
+    uint32_t adc[num_channels][num_bins]        largest sample of each waveform
+    uint32_t toa[num_channels][num_bins]        every sample with a TOA
+    uint32_t tot[num_channels][num_bins]        every sample with a TOT, over 2^tot_shift a bin
+    uint64_t occupied[num_channels]             waveforms whose largest sample is more than
+                                                threshold over their first
+    uint64_t hamming_errors[num_channels]       samples with a hamming error
+
+Values past the last bin are counted in it.
+*/
+
+constexpr uint32_t DQM_MAGIC = 0x51324748;  // "HG2Q"
+constexpr uint32_t DQM_VERSION = 1;
+
+struct dqm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_kcu;
+    uint32_t num_samples;
+    uint32_t num_channels;
+    uint32_t detector;
+    int32_t run_number;
+    uint32_t num_bins;
+    uint32_t tot_shift;
+    uint32_t threshold;     // ADC counts, for occupied
+    uint64_t events;        // Histogrammed so far
+    uint64_t dropped;       // Decoded but not histogrammed, the histogramming threads were behind
+    int64_t time;           // Of the snapshot, seconds since the epoch
+    uint64_t header_size;   // Offset of the adc histograms
+};
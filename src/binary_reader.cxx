@@ -0,0 +1,266 @@
+#include "binary_reader.h"
+
+#include "debug_logger.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+binary_reader::binary_reader(const std::string &file_name) : layout(0, 0, 0) {
+    this->file_name = file_name;
+    map = nullptr;
+    map_size = 0;
+
+    fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(h2d_header)) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is too short to be an h2d file");
+        throw std::runtime_error("Invalid h2d file");
+    }
+    map_size = st.st_size;
+    void *m = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error mapping file " + file_name);
+        throw std::runtime_error("Error mapping file");
+    }
+    map = static_cast<const uint8_t*>(m);
+    memcpy(&header, map, sizeof(header));
+
+    if (header.magic != H2D_MAGIC || header.version != H2D_VERSION) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is not a version " +
+                    std::to_string(H2D_VERSION) + " h2d file");
+        throw std::runtime_error("Invalid h2d file");
+    }
+    layout = h2d_layout(header.num_kcu, header.num_channels, header.num_samples);
+    if (layout.record_size != header.record_size) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Record size mismatch in " + file_name);
+        throw std::runtime_error("Invalid h2d file");
+    }
+    // A corrupt or truncated header must not point past the end of the file
+    if (header.header_size < sizeof(h2d_header) || header.header_size > map_size || header.record_size == 0) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Bad header size " + std::to_string(header.header_size) + " in " +
+                    file_name + " of " + std::to_string(map_size) + " bytes");
+        throw std::runtime_error("Invalid h2d file");
+    }
+
+    // A writer that never got closed leaves the count at zero, so trust the file size instead
+    uint64_t events_on_disk = (map_size - header.header_size) / header.record_size;
+    num_events = header.num_events;
+    if (num_events == 0 || num_events > events_on_disk) {
+        if (num_events != events_on_disk) {
+            LOG_MESSAGE(DEBUG_WARNING, "BinaryReader", "Header claims " + std::to_string(num_events) +
+                        " events, file holds " + std::to_string(events_on_disk));
+        }
+        num_events = events_on_disk;
+    }
+    LOG_MESSAGE(DEBUG_INFO, "BinaryReader", "Opened " + file_name + " with " + std::to_string(num_events) +
+                " events, " + std::to_string(header.num_kcu) + " KCUs, and " +
+                std::to_string(header.num_samples) + " samples");
+}
+
+binary_reader::~binary_reader() {
+    if (map != nullptr) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+event_view make_event_view(const uint8_t *r, const h2d_layout &layout, uint32_t num_channels, uint32_t num_samples) {
+    event_view v;
+    memcpy(&v.event_number, r, sizeof(uint64_t));
+    v.timestamps = reinterpret_cast<const int64_t*>(r + layout.timestamps);
+    v.adc_block = reinterpret_cast<const uint16_t*>(r + layout.adc);
+    v.toa_block = reinterpret_cast<const uint16_t*>(r + layout.toa);
+    v.tot_block = reinterpret_cast<const uint16_t*>(r + layout.tot);
+    v.hamming_block = reinterpret_cast<const uint16_t*>(r + layout.hamming);
+    v.num_channels = num_channels;
+    v.num_samples = num_samples;
+    return v;
+}
+
+event_view binary_reader::event(uint64_t event) const {
+    return make_event_view(record(event), layout, header.num_channels, header.num_samples);
+}
+
+uint64_t binary_reader::event_number(uint64_t event) const {
+    uint64_t n;
+    memcpy(&n, record(event), sizeof(n));
+    return n;
+}
+
+int64_t binary_reader::timestamp(uint64_t event, int kcu) const {
+    return reinterpret_cast<const int64_t*>(record(event) + layout.timestamps)[kcu];
+}
+
+sample_view binary_reader::adc(uint64_t event, int channel) const {
+    auto data = reinterpret_cast<const uint16_t*>(record(event) + layout.adc);
+    return {data + (size_t)channel * header.num_samples, header.num_samples};
+}
+
+sample_view binary_reader::toa(uint64_t event, int channel) const {
+    auto data = reinterpret_cast<const uint16_t*>(record(event) + layout.toa);
+    return {data + (size_t)channel * header.num_samples, header.num_samples};
+}
+
+sample_view binary_reader::tot(uint64_t event, int channel) const {
+    auto data = reinterpret_cast<const uint16_t*>(record(event) + layout.tot);
+    return {data + (size_t)channel * header.num_samples, header.num_samples};
+}
+
+sample_view binary_reader::hamming(uint64_t event, int channel) const {
+    auto data = reinterpret_cast<const uint16_t*>(record(event) + layout.hamming);
+    return {data + (size_t)channel * header.num_samples, header.num_samples};
+}
+
+hit_reader::hit_reader(const std::string &file_name) {
+    this->file_name = file_name;
+    map = nullptr;
+    map_size = 0;
+
+    fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(h2h_header)) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is too short to be an h2h file");
+        throw std::runtime_error("Invalid h2h file");
+    }
+    map_size = st.st_size;
+    void *m = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error mapping file " + file_name);
+        throw std::runtime_error("Error mapping file");
+    }
+    map = static_cast<const uint8_t*>(m);
+    memcpy(&header, map, sizeof(header));
+
+    if (header.magic != H2H_MAGIC || header.version != H2H_VERSION) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is not a version " +
+                    std::to_string(H2H_VERSION) + " h2h file");
+        throw std::runtime_error("Invalid h2h file");
+    }
+
+    // Only the record headers are touched; a record cut short by a crash is left out
+    size_t offset = header.header_size;
+    while (offset + sizeof(h2h_record_header) <= map_size) {
+        h2h_record_header record;
+        memcpy(&record, map + offset, sizeof(record));
+        size_t size = sizeof(record) + (size_t)record.num_hits * sizeof(h2h_hit);
+        if (record.num_hits > header.num_channels || offset + size > map_size) {
+            break;
+        }
+        offsets.push_back(offset);
+        offset += size;
+    }
+    if (header.num_events != 0 && header.num_events != offsets.size()) {
+        LOG_MESSAGE(DEBUG_WARNING, "BinaryReader", "Header claims " + std::to_string(header.num_events) +
+                    " events, file holds " + std::to_string(offsets.size()));
+    }
+    LOG_MESSAGE(DEBUG_INFO, "BinaryReader", "Opened " + file_name + " with " + std::to_string(offsets.size()) +
+                " events of hits above " + std::to_string(header.threshold) + " ADC counts");
+}
+
+hit_reader::~hit_reader() {
+    if (map != nullptr) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+hit_view hit_reader::event(uint64_t event) const {
+    const uint8_t *r = map + offsets[event];
+    h2h_record_header record;
+    memcpy(&record, r, sizeof(record));
+    return {record.event_number, reinterpret_cast<const h2h_hit*>(r + sizeof(record)), record.num_hits};
+}
+
+dqm_reader::dqm_reader(const std::string &file_name) {
+    this->file_name = file_name;
+    map = nullptr;
+    map_size = 0;
+
+    fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(dqm_header)) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is too short to be a dqm file");
+        throw std::runtime_error("Invalid dqm file");
+    }
+    map_size = st.st_size;
+    void *m = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "Error mapping file " + file_name);
+        throw std::runtime_error("Error mapping file");
+    }
+    map = static_cast<const uint8_t*>(m);
+    memcpy(&header, map, sizeof(header));
+
+    if (header.magic != DQM_MAGIC || header.version != DQM_VERSION) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " is not a version " +
+                    std::to_string(DQM_VERSION) + " dqm file");
+        throw std::runtime_error("Invalid dqm file");
+    }
+    // Three histograms and two counters per channel, nothing more or less
+    histogram_size = (size_t)header.num_channels * header.num_bins * sizeof(uint32_t);
+    size_t expected = header.header_size + 3 * histogram_size + 2 * (size_t)header.num_channels * sizeof(uint64_t);
+    if (header.header_size < sizeof(dqm_header) || header.header_size % sizeof(uint32_t) != 0 || expected != map_size) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        ::close(fd);
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryReader", "File " + file_name + " has " + std::to_string(map_size) +
+                    " bytes, its header describes " + std::to_string(expected));
+        throw std::runtime_error("Invalid dqm file");
+    }
+    LOG_MESSAGE(DEBUG_INFO, "BinaryReader", "Opened " + file_name + " with histograms of " +
+                std::to_string(header.events) + " events of run " + std::to_string(header.run_number));
+}
+
+dqm_reader::~dqm_reader() {
+    if (map != nullptr) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+uint64_t dqm_reader::total(size_t offset, int channel) const {
+    // The counters follow the histograms, and need not be 8 byte aligned
+    uint64_t n;
+    memcpy(&n, map + header.header_size + 3 * histogram_size + offset + (size_t)channel * sizeof(uint64_t), sizeof(n));
+    return n;
+}
@@ -0,0 +1,203 @@
+/*
+Memory maps a native .h2d file and exposes zero-copy views of its events.
+
+    binary_reader reader("Run123.h2d");
+    for (uint64_t i = 0; i < reader.get_num_events(); i++) {
+        auto adc = reader.adc(i, channel);   // num_samples contiguous ADC values
+        pedestal += adc[0];
+    }
+
+The views point straight into the mapping, so nothing is copied or widened to 32 bits as
+GetEntry does.  The file is still read whole, even by a loop over ADC only: a record holds
+the ADC, TOA, TOT and hamming blocks of its event back to back, about 11 KB each for 576
+channels and 10 samples, and the kernel's readahead brings in the other blocks with it.
+
+hit_reader does the same for the .h2h hits written with -H:
+
+    hit_reader hits("Run123.h2h");
+    for (uint64_t i = 0; i < hits.get_num_events(); i++) {
+        for (auto &hit : hits.event(i)) {
+            charge[hit.channel] += hit.charge;
+        }
+    }
+
+and dqm_reader for a snapshot of the online histograms written with -D:
+
+    dqm_reader dqm("Run123.dqm");
+    for (uint32_t channel = 0; channel < dqm.get_num_channels(); channel++) {
+        occupancy[channel] = (double)dqm.occupied(channel) / dqm.get_events();
+    }
+
+The decoder replaces the .dqm by renaming a new snapshot over it, so a reader keeps the
+snapshot it opened.  Open the file again for the next one.
+*/
+
+#pragma once
+
+#include "binary_format.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read only view of the samples of one channel, or of a whole block
+struct sample_view {
+    const uint16_t *data;
+    size_t count;
+
+    uint16_t operator[](size_t i) const {return data[i];}
+    size_t size() const {return count;}
+    const uint16_t *begin() const {return data;}
+    const uint16_t *end() const {return data + count;}
+};
+
+// Read only view of a whole event record
+struct event_view {
+    uint64_t event_number;
+    const int64_t *timestamps;
+    const uint16_t *adc_block;
+    const uint16_t *toa_block;
+    const uint16_t *tot_block;
+    const uint16_t *hamming_block;
+    uint32_t num_channels;
+    uint32_t num_samples;
+
+    sample_view adc(int channel) const {return {adc_block + (size_t)channel * num_samples, num_samples};}
+    sample_view toa(int channel) const {return {toa_block + (size_t)channel * num_samples, num_samples};}
+    sample_view tot(int channel) const {return {tot_block + (size_t)channel * num_samples, num_samples};}
+    sample_view hamming(int channel) const {return {hamming_block + (size_t)channel * num_samples, num_samples};}
+    // All channels back to back, indexed as [channel * num_samples + sample]
+    sample_view adc() const {return {adc_block, (size_t)num_channels * num_samples};}
+    sample_view toa() const {return {toa_block, (size_t)num_channels * num_samples};}
+    sample_view tot() const {return {tot_block, (size_t)num_channels * num_samples};}
+    sample_view hamming() const {return {hamming_block, (size_t)num_channels * num_samples};}
+};
+
+// View of a record laid out as in binary_format.h
+event_view make_event_view(const uint8_t *record, const h2d_layout &layout, uint32_t num_channels, uint32_t num_samples);
+
+class binary_reader {
+private:
+    std::string file_name;
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    h2d_header header;
+    h2d_layout layout;
+    uint64_t num_events;
+
+    const uint8_t *record(uint64_t event) const {return map + header.header_size + event * header.record_size;}
+
+public:
+    binary_reader(const std::string &file_name);
+    ~binary_reader();
+
+    binary_reader(const binary_reader&) = delete;
+    binary_reader& operator=(const binary_reader&) = delete;
+
+    uint64_t get_num_events() const {return num_events;}
+    uint32_t get_num_kcu() const {return header.num_kcu;}
+    uint32_t get_num_samples() const {return header.num_samples;}
+    uint32_t get_num_channels() const {return header.num_channels;}
+    uint32_t get_detector() const {return header.detector;}
+
+    event_view event(uint64_t event) const;
+    uint64_t event_number(uint64_t event) const;
+    int64_t timestamp(uint64_t event, int kcu) const;
+    sample_view adc(uint64_t event, int channel) const;
+    sample_view toa(uint64_t event, int channel) const;
+    sample_view tot(uint64_t event, int channel) const;
+    sample_view hamming(uint64_t event, int channel) const;
+};
+
+// Read only view of the hits of one event
+struct hit_view {
+    uint64_t event_number;
+    const h2h_hit *hits;
+    uint32_t count;
+
+    const h2h_hit &operator[](size_t i) const {return hits[i];}
+    size_t size() const {return count;}
+    const h2h_hit *begin() const {return hits;}
+    const h2h_hit *end() const {return hits + count;}
+};
+
+class hit_reader {
+private:
+    std::string file_name;
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    h2h_header header;
+    std::vector<size_t> offsets;    // Of each event record
+
+public:
+    hit_reader(const std::string &file_name);
+    ~hit_reader();
+
+    hit_reader(const hit_reader&) = delete;
+    hit_reader& operator=(const hit_reader&) = delete;
+
+    uint64_t get_num_events() const {return offsets.size();}
+    uint32_t get_num_kcu() const {return header.num_kcu;}
+    uint32_t get_num_samples() const {return header.num_samples;}
+    uint32_t get_num_channels() const {return header.num_channels;}
+    uint32_t get_detector() const {return header.detector;}
+    float get_threshold() const {return header.threshold;}
+
+    hit_view event(uint64_t event) const;
+};
+
+// Read only view of the bins of one histogram
+struct count_view {
+    const uint32_t *data;
+    size_t count;
+
+    uint32_t operator[](size_t i) const {return data[i];}
+    size_t size() const {return count;}
+    const uint32_t *begin() const {return data;}
+    const uint32_t *end() const {return data + count;}
+};
+
+class dqm_reader {
+private:
+    std::string file_name;
+    int fd;
+    const uint8_t *map;
+    size_t map_size;
+    dqm_header header;
+    size_t histogram_size;      // Bytes of the adc, toa or tot histograms of all channels
+
+    const uint32_t *counts(size_t block, int channel) const {
+        return reinterpret_cast<const uint32_t*>(map + header.header_size + block * histogram_size) +
+               (size_t)channel * header.num_bins;
+    }
+    uint64_t total(size_t offset, int channel) const;
+
+public:
+    // Throws std::runtime_error if the file is not a whole snapshot
+    dqm_reader(const std::string &file_name);
+    ~dqm_reader();
+
+    dqm_reader(const dqm_reader&) = delete;
+    dqm_reader& operator=(const dqm_reader&) = delete;
+
+    uint32_t get_num_kcu() const {return header.num_kcu;}
+    uint32_t get_num_samples() const {return header.num_samples;}
+    uint32_t get_num_channels() const {return header.num_channels;}
+    uint32_t get_detector() const {return header.detector;}
+    int get_run_number() const {return header.run_number;}
+    uint32_t get_num_bins() const {return header.num_bins;}
+    uint32_t get_tot_shift() const {return header.tot_shift;}
+    uint32_t get_threshold() const {return header.threshold;}
+    uint64_t get_events() const {return header.events;}
+    uint64_t get_dropped() const {return header.dropped;}
+    int64_t get_time() const {return header.time;}
+
+    count_view adc(int channel) const {return {counts(0, channel), header.num_bins};}
+    count_view toa(int channel) const {return {counts(1, channel), header.num_bins};}
+    count_view tot(int channel) const {return {counts(2, channel), header.num_bins};}
+    uint64_t occupied(int channel) const {return total(0, channel);}
+    uint64_t hamming_errors(int channel) const {return total((size_t)header.num_channels * sizeof(uint64_t), channel);}
+};
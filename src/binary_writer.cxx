@@ -0,0 +1,137 @@
+#include "binary_writer.h"
+
+#include "event_aligner.h"
+#include "waveform_builder.h"
+#include "debug_logger.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+binary_writer::binary_writer(const std::string &file_name, int num_kcu, int num_samples, int detector, int64_t resume_events)
+    : layout(num_kcu, 144 * num_kcu, num_samples) {
+    this->file_name = file_name;
+    this->num_kcu = num_kcu;
+    this->num_samples = num_samples;
+    num_channels = 144 * num_kcu;
+    closed = false;
+    first_event_number = 0;
+
+    header.magic = H2D_MAGIC;
+    header.version = H2D_VERSION;
+    header.num_kcu = num_kcu;
+    header.num_samples = num_samples;
+    header.num_channels = num_channels;
+    header.detector = detector;
+    header.num_events = 0;
+    header.record_size = layout.record_size;
+    header.header_size = sizeof(h2d_header);
+
+    LOG_MESSAGE(DEBUG_DEBUG, "BinaryWriter", "Making binary writer with " + std::to_string(num_kcu) +
+               " KCUs, " + std::to_string(num_samples) + " samples, and " +
+               std::to_string(layout.record_size) + " bytes per event");
+
+    record.resize(layout.record_size, 0);
+    if (resume_events >= 0) {
+        resume(resume_events);
+        return;
+    }
+    file.open(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good()) {
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryWriter", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void binary_writer::resume(uint64_t num_events) {
+    h2d_header existing;
+    std::ifstream in(file_name, std::ios::in | std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(&existing), sizeof(existing)) || existing.magic != H2D_MAGIC ||
+        existing.version != H2D_VERSION || existing.num_kcu != header.num_kcu ||
+        existing.num_samples != header.num_samples || existing.record_size != header.record_size ||
+        existing.header_size != header.header_size) {
+        throw std::runtime_error("Cannot continue " + file_name + ", it is missing or has a different layout");
+    }
+    in.close();
+    uint64_t size = header.header_size + num_events * header.record_size;
+    std::error_code error;
+    if (std::filesystem::file_size(file_name, error) < size || error) {
+        throw std::runtime_error("Cannot continue " + file_name + ", it has fewer than " +
+                                 std::to_string(num_events) + " events");
+    }
+    // Events written after the checkpoint are decoded again
+    std::filesystem::resize_file(file_name, size);
+    file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.good()) {
+        LOG_MESSAGE(DEBUG_ERROR, "BinaryWriter", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    file.seekp(0, std::ios::end);
+    header.num_events = num_events;
+    LOG_MESSAGE(DEBUG_INFO, "BinaryWriter", "Continuing " + file_name + " after event " + std::to_string(num_events));
+}
+
+binary_writer::~binary_writer() {
+    close();
+}
+
+void pack_event(aligned_event *event, uint64_t event_number, const h2d_layout &layout, int num_kcu, int num_samples,
+                uint8_t *r) {
+    memcpy(r, &event_number, sizeof(event_number));
+
+    auto timestamps = reinterpret_cast<int64_t*>(r + layout.timestamps);
+    auto adc = reinterpret_cast<uint16_t*>(r + layout.adc);
+    auto toa = reinterpret_cast<uint16_t*>(r + layout.toa);
+    auto tot = reinterpret_cast<uint16_t*>(r + layout.tot);
+    auto hamming = reinterpret_cast<uint16_t*>(r + layout.hamming);
+
+    for (int i = 0; i < num_kcu; i++) {
+        auto e = event->get_event(i);
+        timestamps[i] = e->get_timestamp();
+        for (int j = 0; j < 144; j++) {
+            int offset = (i * 144 + j) * num_samples;
+            for (int k = 0; k < num_samples; k++) {
+                adc[offset + k] = e->get_sample_adc(j, k);
+                toa[offset + k] = e->get_sample_toa(j, k);
+                tot[offset + k] = e->get_sample_tot(j, k);
+                hamming[offset + k] = e->get_sample_hamming(j, k);
+            }
+        }
+    }
+}
+
+void binary_writer::write_event(aligned_event *event) {
+    pack_event(event, first_event_number + header.num_events, layout, num_kcu, num_samples, record.data());
+    file.write(reinterpret_cast<const char*>(record.data()), record.size());
+    header.num_events++;
+}
+
+void binary_writer::flush() {
+    if (closed) {
+        return;
+    }
+    std::streampos end = file.tellp();
+    file.seekp(0, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.seekp(end);
+    file.flush();
+    if (!file.good()) {
+        throw std::runtime_error("Error writing " + file_name);
+    }
+}
+
+void binary_writer::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+    LOG_MESSAGE(DEBUG_DEBUG, "BinaryWriter", "Closing file " + file_name + " with " +
+               std::to_string(header.num_events) + " events");
+    // Patch the event count now that it is known
+    file.seekp(0, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+}
@@ -0,0 +1,49 @@
+/*
+Writes aligned events in the native .h2d format described in binary_format.h.
+Unlike event_writer this does not depend on ROOT.
+*/
+
+#pragma once
+
+#include "event_aligner.h"
+#include "binary_format.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Fills record, of layout.record_size bytes, with an event as binary_writer writes it
+void pack_event(aligned_event *event, uint64_t event_number, const h2d_layout &layout, int num_kcu, int num_samples,
+                uint8_t *record);
+
+class binary_writer {
+private:
+    std::string file_name;
+    std::ofstream file;
+    h2d_header header;
+    h2d_layout layout;
+    std::vector<uint8_t> record;
+    bool closed;
+    uint64_t first_event_number;
+
+    void resume(uint64_t num_events);
+
+    int num_kcu;
+    int num_samples;
+    int num_channels;
+
+public:
+    // resume_events >= 0 continues an existing file after its first resume_events events,
+    // dropping any written after them; throws std::runtime_error if it does not match
+    binary_writer(const std::string &file_name, int num_kcu, int num_samples, int detector, int64_t resume_events = -1);
+    ~binary_writer();
+
+    void write_event(aligned_event *event);
+    // Numbering of the next event, for part of a run (events are numbered from 0 by default)
+    void set_event_number(uint64_t event_number) {first_event_number = event_number - header.num_events;}
+    // Updates the event count in the header and flushes, the file is complete up to here
+    void flush();
+    void close();
+    uint64_t get_num_events() {return header.num_events;}
+};
@@ -0,0 +1,60 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+checkpoint_writer::checkpoint_writer(const std::string &file_name)
+    : file_name(file_name), temp_name(file_name + ".tmp") {
+    file.open(temp_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good()) {
+        throw std::runtime_error("Error opening checkpoint " + temp_name);
+    }
+}
+
+void checkpoint_writer::put_string(const std::string &text) {
+    put<uint32_t>(text.size());
+    file.write(text.data(), text.size());
+}
+
+void checkpoint_writer::commit() {
+    file.close();
+    if (file.fail()) {
+        std::remove(temp_name.c_str());
+        throw std::runtime_error("Error writing checkpoint " + temp_name);
+    }
+    // The rename must not reach the disk before the data does
+    int fd = open(temp_name.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+    if (std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+        std::remove(temp_name.c_str());
+        throw std::runtime_error("Error replacing checkpoint " + file_name);
+    }
+}
+
+checkpoint_reader::checkpoint_reader(const std::string &file_name) : file_name(file_name) {
+    file.open(file_name, std::ios::in | std::ios::binary);
+    if (!file.good()) {
+        throw std::runtime_error("Error opening checkpoint " + file_name);
+    }
+}
+
+void checkpoint_reader::check() {
+    if (!file.good()) {
+        throw std::runtime_error("Checkpoint " + file_name + " is truncated");
+    }
+}
+
+std::string checkpoint_reader::get_string() {
+    uint32_t size = get<uint32_t>();
+    if (size > (1 << 20)) {
+        throw std::runtime_error("Checkpoint " + file_name + " is corrupt");
+    }
+    std::string text(size, '\0');
+    file.read(&text[0], size);
+    check();
+    return text;
+}
@@ -0,0 +1,81 @@
+/*
+Binary checkpoint files, so a long decode that is interrupted can carry on where it left
+off instead of starting over:
+
+    h2g_run -r 42 -C 60      # checkpoint every minute to $OUTPUT_DIRECTORY/Run042.ckpt
+    ^C                       # finishes the packet in hand and checkpoints before exiting
+    h2g_run -r 42 -C 60      # picks up from Run042.ckpt
+
+A checkpoint holds the number of packets read so far, the events written to each output
+and the in-flight state of every decoder module: partial line streams and samples in
+line_builder, partial waveforms and the unwrap counters in waveform_builder, and the run
+statistics.  It is only taken once every aligned event of the last packet has been
+written, so event_aligner has nothing in flight.
+
+checkpoint_writer writes to FILE.tmp and renames it over FILE on commit, so a crash while
+checkpointing leaves the previous checkpoint intact.  Values are written in host byte
+order; checkpoints are meant to be resumed on the machine that wrote them.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+class checkpoint_writer {
+private:
+    std::string file_name;
+    std::string temp_name;
+    std::ofstream file;
+
+public:
+    // Throws std::runtime_error if FILE.tmp cannot be created
+    checkpoint_writer(const std::string &file_name);
+
+    template <typename T>
+    void put(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template <typename T>
+    void put_array(const T *values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        file.write(reinterpret_cast<const char*>(values), sizeof(T) * count);
+    }
+    void put_string(const std::string &text);
+
+    // Syncs the file to disk and moves it into place, throws std::runtime_error on failure
+    void commit();
+};
+
+class checkpoint_reader {
+private:
+    std::string file_name;
+    std::ifstream file;
+
+    void check();
+
+public:
+    // Throws std::runtime_error if the file cannot be opened
+    checkpoint_reader(const std::string &file_name);
+
+    // All of these throw std::runtime_error if the file ends early
+    template <typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        T value;
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        check();
+        return value;
+    }
+    template <typename T>
+    void get_array(T *values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        file.read(reinterpret_cast<char*>(values), sizeof(T) * count);
+        check();
+    }
+    std::string get_string();
+};
@@ -0,0 +1,369 @@
+#include "compressed_source.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef H2G_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef H2G_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+// Decompressed chunks the producer may run ahead of the decoder
+const size_t MAX_QUEUED_CHUNKS = 4;
+// Frames larger than this are streamed instead of held in memory whole
+const size_t MAX_PARALLEL_FRAME = 256 << 20;
+
+#ifdef H2G_HAVE_ZSTD
+std::vector<uint8_t> decompress_frame(const uint8_t *data, size_t size, size_t content_size) {
+    std::vector<uint8_t> out(content_size);
+    size_t n = ZSTD_decompress(out.data(), out.size(), data, size);
+    if (ZSTD_isError(n)) {
+        throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+    }
+    out.resize(n);
+    return out;
+}
+#endif
+}
+
+compressed_source::format compressed_source::detect(const std::string &file_name) {
+    uint8_t magic[4] = {0, 0, 0, 0};
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NONE;
+    }
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return GZIP;
+    }
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return ZSTD;
+    }
+    return NONE;
+}
+
+compressed_source::compressed_source(const std::string &file_name, uint32_t num_fpgas, int num_samples, int num_threads,
+                                     thread_pool *shared_pool)
+    : stream_source(file_name, num_fpgas) {
+    mapped = nullptr;
+    mapped_size = 0;
+    pool = nullptr;
+    owns_pool = false;
+    next_frame = 0;
+    producer_done = false;
+    stopping = false;
+    current_pos = 0;
+    decompressed = 0;
+    content_size = 0;
+
+    type = detect(file_name);
+    const char *missing = nullptr;
+    if (type == NONE) {
+        missing = "it is not a gzip or zstd file";
+    }
+#ifndef H2G_HAVE_ZLIB
+    if (type == GZIP) {
+        missing = "this build has no zlib support";
+    }
+#endif
+#ifndef H2G_HAVE_ZSTD
+    if (type == ZSTD) {
+        missing = "this build has no zstd support";
+    }
+#endif
+    if (missing) {
+        LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "Cannot read " + file_name + ", " + missing);
+        throw std::runtime_error("Unsupported compression");
+    }
+
+    int map_fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (map_fd < 0 || fstat(map_fd, &st) < 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "Error opening file " + file_name + ": " + strerror(errno));
+        if (map_fd >= 0) {
+            close(map_fd);
+        }
+        throw std::runtime_error("Error opening file");
+    }
+    mapped_size = st.st_size;
+    void *map = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, map_fd, 0);
+    close(map_fd);
+    if (map == MAP_FAILED) {
+        LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "Error mapping file " + file_name + ": " + strerror(errno));
+        throw std::runtime_error("Error opening file");
+    }
+    mapped = static_cast<const uint8_t*>(map);
+    madvise(map, mapped_size, MADV_SEQUENTIAL);
+
+    if (type == ZSTD && find_frames()) {
+        pool = shared_pool;
+        if (pool == nullptr) {
+            pool = new thread_pool(num_threads);
+            owns_pool = true;
+        }
+        LOG_MESSAGE(DEBUG_INFO, "CompressedSource", "Decompressing " + std::to_string(frames.size()) +
+                    " zstd frames of " + file_name + " on " + std::to_string(pool->get_num_threads()) + " threads");
+    } else {
+        LOG_MESSAGE(DEBUG_INFO, "CompressedSource", std::string("Decompressing ") + (type == GZIP ? "gzip" : "zstd") +
+                    " stream " + file_name + " on a background thread");
+        producer = std::thread(&compressed_source::produce, this);
+    }
+
+    try {
+        read_header(num_samples);
+    } catch (...) {
+        shutdown();
+        throw;
+    }
+}
+
+compressed_source::~compressed_source() {
+    shutdown();
+    LOG_MESSAGE(DEBUG_INFO, "CompressedSource", "Decompressed " + std::to_string(decompressed) + " bytes from " +
+                std::to_string(mapped_size));
+}
+
+void compressed_source::shutdown() {
+    if (producer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        producer.join();
+    }
+    wait_for_frames();
+    if (owns_pool) {
+        delete pool;
+    }
+    pool = nullptr;
+    if (mapped) {
+        munmap(const_cast<uint8_t*>(mapped), mapped_size);
+        mapped = nullptr;
+    }
+}
+
+// Frames that were handed out still read the mapping, so they must be finished before it
+// goes; their results are thrown away
+void compressed_source::wait_for_frames() {
+    for (auto &result : pending) {
+        try {
+            pool->wait_for(result);
+        } catch (const std::exception &e) {
+        }
+    }
+    pending.clear();
+}
+
+// Splits a zstd file into its frames, returns false unless it is worth decompressing them in parallel
+bool compressed_source::find_frames() {
+#ifdef H2G_HAVE_ZSTD
+    size_t pos = 0;
+    size_t total = 0;
+    bool sizes_known = true;
+    while (pos < mapped_size) {
+        size_t size = ZSTD_findFrameCompressedSize(mapped + pos, mapped_size - pos);
+        if (ZSTD_isError(size)) {
+            LOG_MESSAGE(DEBUG_WARNING, "CompressedSource", "Bad zstd frame at byte " + std::to_string(pos) + ": " +
+                        ZSTD_getErrorName(size));
+            frames.clear();
+            return false;
+        }
+        uint32_t magic;
+        std::memcpy(&magic, mapped + pos, sizeof(magic));
+        // Skippable frames hold metadata such as seek tables, not data
+        if ((magic & 0xFFFFFFF0) != 0x184D2A50) {
+            unsigned long long content = ZSTD_getFrameContentSize(mapped + pos, size);
+            if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR || content > MAX_PARALLEL_FRAME) {
+                sizes_known = false;
+            } else {
+                total += content;
+            }
+            frames.push_back({pos, size, (size_t)content});
+        }
+        pos += size;
+    }
+    if (sizes_known) {
+        content_size = total;
+    }
+    if (frames.size() < 2 || !sizes_known) {
+        frames.clear();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void compressed_source::produce() {
+    if (type == GZIP) {
+        produce_gzip();
+    } else {
+        produce_zstd();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        producer_done = true;
+    }
+    changed.notify_all();
+}
+
+// Hands a full chunk to the decoder, blocking while it is behind; false once stopping
+bool compressed_source::push_chunk(std::vector<uint8_t> &chunk) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] {return stopping || chunks.size() < MAX_QUEUED_CHUNKS;});
+    if (stopping) {
+        return false;
+    }
+    chunks.push_back(std::move(chunk));
+    changed.notify_all();
+    chunk = std::vector<uint8_t>(CHUNK_SIZE);
+    return true;
+}
+
+void compressed_source::produce_gzip() {
+#ifdef H2G_HAVE_ZLIB
+    z_stream zs = {};
+    // 32 accepts both gzip and zlib headers
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "Cannot initialise zlib");
+        return;
+    }
+    std::vector<uint8_t> chunk(CHUNK_SIZE);
+    zs.next_out = chunk.data();
+    zs.avail_out = CHUNK_SIZE;
+    size_t in_pos = 0;
+    while (true) {
+        if (zs.avail_in == 0 && in_pos < mapped_size) {
+            // avail_in is 32 bits, so large files go in slices
+            size_t n = std::min(mapped_size - in_pos, (size_t)1 << 30);
+            zs.next_in = const_cast<Bytef*>(mapped + in_pos);
+            zs.avail_in = n;
+            in_pos += n;
+        }
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        if (zs.avail_out == 0) {
+            if (!push_chunk(chunk)) {
+                break;
+            }
+            zs.next_out = chunk.data();
+            zs.avail_out = CHUNK_SIZE;
+        }
+        if (ret == Z_STREAM_END) {
+            if (zs.avail_in == 0 && in_pos == mapped_size) {
+                break;
+            }
+            // Concatenated members, as written by pigz or cat
+            inflateReset(&zs);
+        } else if (ret != Z_OK) {
+            LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "gzip error in " + name + ": " +
+                        (zs.msg ? zs.msg : (in_pos == mapped_size ? "truncated file" : "unknown")));
+            break;
+        }
+    }
+    chunk.resize(CHUNK_SIZE - zs.avail_out);
+    if (!chunk.empty()) {
+        push_chunk(chunk);
+    }
+    inflateEnd(&zs);
+#endif
+}
+
+void compressed_source::produce_zstd() {
+#ifdef H2G_HAVE_ZSTD
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = {mapped, mapped_size, 0};
+    std::vector<uint8_t> chunk(CHUNK_SIZE);
+    ZSTD_outBuffer out = {chunk.data(), CHUNK_SIZE, 0};
+    size_t ret = 0;
+    bool flushing = false;
+    while (in.pos < in.size || flushing) {
+        ret = ZSTD_decompressStream(dctx, &out, &in);
+        if (ZSTD_isError(ret)) {
+            LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "zstd error in " + name + ": " + ZSTD_getErrorName(ret));
+            break;
+        }
+        // A full output buffer may leave more data inside the context
+        flushing = out.pos == out.size;
+        if (flushing) {
+            if (!push_chunk(chunk)) {
+                break;
+            }
+            out = {chunk.data(), CHUNK_SIZE, 0};
+        }
+    }
+    if (ret != 0 && !ZSTD_isError(ret)) {
+        LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "zstd stream " + name + " is truncated");
+    }
+    chunk.resize(out.pos);
+    if (!chunk.empty()) {
+        push_chunk(chunk);
+    }
+    ZSTD_freeDCtx(dctx);
+#endif
+}
+
+bool compressed_source::next_chunk() {
+    if (pool) {
+        // Keep every worker busy with a couple of frames in hand
+#ifdef H2G_HAVE_ZSTD
+        while (next_frame < frames.size() && pending.size() < 2 * pool->get_num_threads()) {
+            const uint8_t *data = mapped + frames[next_frame].offset;
+            size_t size = frames[next_frame].size;
+            size_t content = frames[next_frame].content_size;
+            pending.push_back(pool->submit([data, size, content] {return decompress_frame(data, size, content);}, true));
+            next_frame++;
+        }
+#endif
+        if (pending.empty()) {
+            return false;
+        }
+        try {
+            current = pool->wait_for(pending.front());
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, "CompressedSource", "Error in frame " + std::to_string(next_frame - pending.size()) +
+                        " of " + name + ": " + e.what());
+            pending.pop_front();
+            wait_for_frames();
+            next_frame = frames.size();
+            return false;
+        }
+        pending.pop_front();
+    } else {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] {return !chunks.empty() || producer_done;});
+        if (chunks.empty()) {
+            return false;
+        }
+        current = std::move(chunks.front());
+        chunks.pop_front();
+        changed.notify_all();
+    }
+    current_pos = 0;
+    decompressed += current.size();
+    return true;
+}
+
+ssize_t compressed_source::read_some(uint8_t *dst, size_t n) {
+    while (current_pos == current.size()) {
+        if (!next_chunk()) {
+            return 0;
+        }
+    }
+    size_t count = std::min(n, current.size() - current_pos);
+    std::memcpy(dst, current.data() + current_pos, count);
+    current_pos += count;
+    return count;
+}
@@ -0,0 +1,93 @@
+/*
+Reads gzip or zstd compressed runs without unpacking them to disk first:
+
+    h2g_run -r 42       # reads Run042.h2g, or Run042.h2g.zst / Run042.h2g.gz if that is all there is
+    h2g_run -r 42 -i /archive/Run042.h2g.zst
+
+The format is recognised from the first bytes of the file.  A zstd file made of many
+independent frames, as written by h2g_compress or pzstd, is decompressed a frame at a
+time on a thread pool and handed to the decoder in order.  gzip files, and zstd files
+written as a single frame, can only be decompressed front to back; that runs on one
+background thread so it still overlaps with decoding.
+
+Support for each format depends on the library being found at build time
+(H2G_HAVE_ZLIB, H2G_HAVE_ZSTD).
+*/
+
+#pragma once
+
+#include "stream_source.h"
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class compressed_source : public stream_source {
+public:
+    enum format {NONE, GZIP, ZSTD};
+
+private:
+    format type;
+    const uint8_t *mapped;
+    size_t mapped_size;
+
+    struct frame {
+        size_t offset;
+        size_t size;
+        size_t content_size;
+    };
+
+    // Independent frames, decompressed in parallel and handed out in order
+    thread_pool *pool;
+    bool owns_pool;
+    std::vector<frame> frames;
+    size_t next_frame;
+    std::deque<std::future<std::vector<uint8_t>>> pending;
+
+    // Anything else is decompressed front to back by the producer thread
+    std::thread producer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> chunks;
+    bool producer_done;
+    bool stopping;
+
+    std::vector<uint8_t> current;
+    size_t current_pos;
+    int64_t decompressed;
+    int64_t content_size;
+
+    bool find_frames();
+    void wait_for_frames();
+    void shutdown();
+    void produce();
+    void produce_gzip();
+    void produce_zstd();
+    bool push_chunk(std::vector<uint8_t> &chunk);
+    bool next_chunk();
+
+protected:
+    ssize_t read_some(uint8_t *dst, size_t n) override;
+
+public:
+    static const size_t CHUNK_SIZE = 4 << 20;
+
+    // 0 threads uses one per hardware thread, or frames go to shared_pool as urgent jobs when
+    // it is given.  Throws std::runtime_error if the file cannot be read or its format is not
+    // supported by this build.
+    compressed_source(const std::string &file_name, uint32_t num_fpgas, int num_samples = 0, int num_threads = 0,
+                      thread_pool *shared_pool = nullptr);
+    ~compressed_source();
+
+    bool is_live() override {return false;}
+    // Decompressed size when every zstd frame records it, otherwise 0
+    int64_t get_size() override {return content_size;}
+
+    // Looks at the first bytes of a file, NONE if it is not compressed or cannot be read
+    static format detect(const std::string &file_name);
+};
@@ -1,4 +1,5 @@
 #include "debug_logger.h"
+#include "async_log_sink.h"
 
 // Initialize static member
 DebugLogger* DebugLogger::instance = nullptr;
@@ -15,6 +16,10 @@ DebugLogger* DebugLogger::getInstance() {
 void DebugLogger::setLevel(int level) {
     if (level >= DEBUG_OFF && level <= DEBUG_TRACE) {
         this->level = level;
+        if (level > H2G_LOG_COMPILE_LEVEL) {
+            std::cerr << "Debug level " << getLevelName(level) << " requested, but messages above "
+                      << getLevelName(H2G_LOG_COMPILE_LEVEL) << " were compiled out of this build." << std::endl;
+        }
     } else {
         std::cerr << "Invalid debug level: " << level << ". Using DEBUG_INFO level." << std::endl;
         this->level = DEBUG_INFO;
@@ -48,8 +53,11 @@ std::string DebugLogger::getCurrentTimestamp() const {
     auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
         now.time_since_epoch()) % 1000;
     
+    // localtime() shares one buffer between threads, and many threads log at once
+    struct tm local;
+    localtime_r(&nowTime, &local);
     std::stringstream ss;
-    ss << std::put_time(std::localtime(&nowTime), "%H:%M:%S");
+    ss << std::put_time(&local, "%H:%M:%S");
     ss << '.' << std::setfill('0') << std::setw(3) << nowMs.count();
     
     return ss.str();
@@ -64,33 +72,78 @@ std::string DebugLogger::getLevelName(int level) {
     return "UNKNOWN";
 }
 
+// Send messages to a background thread that writes them to a file
+void DebugLogger::enableAsync(const std::string& fileName, uint64_t capacity) {
+    disableAsync();
+    asyncSink = new AsyncLogSink(fileName, capacity);
+}
+
+// Flush the queued messages and go back to writing to the console
+void DebugLogger::disableAsync() {
+    if (asyncSink == nullptr) {
+        return;
+    }
+    auto sink = asyncSink;
+    asyncSink = nullptr;
+    sink->stop();
+    delete sink;
+}
+
+// Messages lost because the async ring was full
+uint64_t DebugLogger::getDroppedCount() const {
+    if (asyncSink == nullptr) {
+        return 0;
+    }
+    return asyncSink->getDroppedCount();
+}
+
 // Log a message at the specified level
 void DebugLogger::log(int messageLevel, const std::string& message) {
     if (messageLevel <= level) {
-        std::stringstream logStream;
-        
-        // Add timestamp if enabled
-        if (showTimestamp) {
-            logStream << "[" << getCurrentTimestamp() << "] ";
-        }
-        
-        // Add level prefix
-        logStream << "[" << getLevelName(messageLevel) << "] ";
-        
-        // Add component prefix if set
-        if (!componentPrefix.empty()) {
-            logStream << "[" << componentPrefix << "] ";
-        }
-        
-        // Add the message
-        logStream << message;
-        
-        // Output to correct stream
-        if (messageLevel == DEBUG_ERROR) {
-            std::cerr << logStream.str() << std::endl;
-        } else {
-            std::cout << logStream.str() << std::endl;
+        write(messageLevel, componentPrefix, message);
+    }
+}
+
+// Log a message at the specified level with a one-off component prefix
+void DebugLogger::log(int messageLevel, const std::string& component, const std::string& message) {
+    if (messageLevel <= level) {
+        write(messageLevel, component, message);
+    }
+}
+
+// Format and print a message
+void DebugLogger::write(int messageLevel, const std::string& component, const std::string& message) {
+    if (asyncSink != nullptr) {
+        asyncSink->push(messageLevel, component, message);
+        if (messageLevel != DEBUG_ERROR) {
+            return;
         }
+        // Errors are rare enough to also show on the console right away
+    }
+
+    std::stringstream logStream;
+    
+    // Add timestamp if enabled
+    if (showTimestamp) {
+        logStream << "[" << getCurrentTimestamp() << "] ";
+    }
+    
+    // Add level prefix
+    logStream << "[" << getLevelName(messageLevel) << "] ";
+    
+    // Add component prefix if set
+    if (!component.empty()) {
+        logStream << "[" << component << "] ";
+    }
+    
+    // Add the message
+    logStream << message;
+    
+    // Output to correct stream
+    if (messageLevel == DEBUG_ERROR) {
+        std::cerr << logStream.str() << std::endl;
+    } else {
+        std::cout << logStream.str() << std::endl;
     }
 }
 
@@ -101,15 +154,5 @@ void log_message(int level, const std::string& message) {
 
 // Global function to log a message with a component prefix
 void log_message(int level, const std::string& component, const std::string& message) {
-    // Store the previous component prefix
-    std::string previousPrefix = DebugLogger::getInstance()->getComponentPrefix();
-    
-    // Set the new component prefix
-    DebugLogger::getInstance()->setComponentPrefix(component);
-    
-    // Log the message
-    DebugLogger::getInstance()->log(level, message);
-    
-    // Restore the previous component prefix
-    DebugLogger::getInstance()->setComponentPrefix(previousPrefix);
+    DebugLogger::getInstance()->log(level, component, message);
 }
\ No newline at end of file
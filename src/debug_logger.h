@@ -6,6 +6,8 @@
 #include <iomanip>
 #include <sstream>
 
+class AsyncLogSink;
+
 // Debug levels
 enum DebugLevel {
     DEBUG_OFF = 0,
@@ -16,10 +18,16 @@ enum DebugLevel {
     DEBUG_TRACE = 5
 };
 
+// Messages more verbose than this are compiled out entirely.  Release builds set it to
+// DEBUG_INFO so the TRACE/DEBUG calls in the decode loop cost nothing.
+#ifndef H2G_LOG_COMPILE_LEVEL
+#define H2G_LOG_COMPILE_LEVEL DEBUG_TRACE
+#endif
+
 class DebugLogger {
 private:
     // Private constructor for singleton pattern
-    DebugLogger() : level(DEBUG_OFF), showTimestamp(true), componentPrefix("") {}
+    DebugLogger() : level(DEBUG_OFF), showTimestamp(true), componentPrefix(""), asyncSink(nullptr) {}
     
     // Singleton instance
     static DebugLogger* instance;
@@ -32,9 +40,15 @@ private:
     
     // Component prefix for log messages
     std::string componentPrefix;
+
+    // Background writer, messages go to the console when this is null
+    AsyncLogSink* asyncSink;
     
     // Get current timestamp as string
     std::string getCurrentTimestamp() const;
+
+    // Format and print a message
+    void write(int messageLevel, const std::string& component, const std::string& message);
     
 public:
     // Delete copy constructor and assignment operator
@@ -61,13 +75,46 @@ public:
     
     // Log a message at the specified level
     void log(int messageLevel, const std::string& message);
+
+    // Log a message at the specified level with a one-off component prefix
+    void log(int messageLevel, const std::string& component, const std::string& message);
+
+    // Cheap check used by LOG_MESSAGE before any message is built
+    static bool isEnabled(int messageLevel) {
+        return instance != nullptr && messageLevel <= instance->level;
+    }
     
     // Get level name as string
     static std::string getLevelName(int level);
+
+    // Send messages to a background thread that writes them to fileName.  Call this
+    // before starting any decoding threads.
+    void enableAsync(const std::string& fileName, uint64_t capacity = 1 << 16);
+
+    // Flush the queued messages and go back to writing to the console
+    void disableAsync();
+
+    // Messages lost because the async ring was full
+    uint64_t getDroppedCount() const;
 };
 
 // Global function to log a message - easier to use than the singleton directly
 void log_message(int level, const std::string& message);
 
 // Global function to log a message with a component prefix
-void log_message(int level, const std::string& component, const std::string& message);
\ No newline at end of file
+void log_message(int level, const std::string& component, const std::string& message);
+
+// True if a message at this level would be printed.  Use it to guard any work that
+// only exists to build a log message.
+#define LOG_ENABLED(level) \
+    ((level) <= H2G_LOG_COMPILE_LEVEL && DebugLogger::isEnabled(level))
+
+// Lazy front end to log_message: the message arguments are only evaluated when the
+// level is enabled, and calls above H2G_LOG_COMPILE_LEVEL are removed by the compiler.
+//     LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "CRC is " + std::to_string(crc));
+#define LOG_MESSAGE(level, ...) \
+    do { \
+        if (LOG_ENABLED(level)) { \
+            log_message((level), __VA_ARGS__); \
+        } \
+    } while (0)
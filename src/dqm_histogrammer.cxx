@@ -0,0 +1,250 @@
+#include "dqm_histogrammer.h"
+
+#include "binary_writer.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+// Counters have one writer, so a load and a store are enough and cost no more than a plain add
+template <typename T>
+inline void add_to(std::atomic<T> &counter, T n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+}
+
+dqm_histogrammer::accumulator::accumulator(int num_channels)
+    : adc((size_t)num_channels * BINS), toa((size_t)num_channels * BINS), tot((size_t)num_channels * BINS),
+      occupied(num_channels), hamming_errors(num_channels), events(0) {}
+
+dqm_histogrammer::dqm_histogrammer(const std::string &file_name, int num_kcu, int num_samples, int detector,
+                                   int run_number, double interval, int threads, uint64_t capacity)
+    : file_name(file_name), num_kcu(num_kcu), num_samples(num_samples), num_channels(144 * num_kcu),
+      detector(detector), run_number(run_number), layout(num_kcu, 144 * num_kcu, num_samples), interval(interval) {
+    uint64_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mask = size - 1;
+    slots = new slot[size];
+    records = new uint8_t[size * layout.record_size];
+    for (uint64_t i = 0; i < size; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+        slots[i].record = records + i * layout.record_size;
+    }
+    enqueue_position = 0;
+    dequeue_position.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+
+    running.store(true);
+    for (int i = 0; i < std::max(threads, 1); i++) {
+        accumulators.push_back(new accumulator(num_channels));
+    }
+    for (accumulator *a : accumulators) {
+        workers.emplace_back(&dqm_histogrammer::work, this, a);
+    }
+    snapshot_thread = std::thread(&dqm_histogrammer::take_snapshots, this);
+    LOG_MESSAGE(DEBUG_INFO, "DQM", "Histogramming with " + std::to_string(accumulators.size()) +
+                " threads, writing " + file_name + " every " + std::to_string(interval) + " s");
+}
+
+dqm_histogrammer::~dqm_histogrammer() {
+    try {
+        close();
+    } catch (const std::exception &e) {
+        LOG_MESSAGE(DEBUG_ERROR, "DQM", e.what());
+    }
+    for (accumulator *a : accumulators) {
+        delete a;
+    }
+    delete[] slots;
+    delete[] records;
+}
+
+bool dqm_histogrammer::add(aligned_event *event, uint64_t event_number) {
+    slot &s = slots[enqueue_position & mask];
+    if (s.sequence.load(std::memory_order_acquire) != enqueue_position) {
+        // The histogramming threads have not finished with this slot yet, the ring is full
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    pack_event(event, event_number, layout, num_kcu, num_samples, s.record);
+    s.sequence.store(enqueue_position + 1, std::memory_order_release);
+    enqueue_position++;
+    return true;
+}
+
+// Claims the next queued event for this thread, which gives the slot back once it is filled
+bool dqm_histogrammer::pop(uint64_t &position) {
+    position = dequeue_position.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t sequence = slots[position & mask].sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)(position + 1);
+        if (diff == 0) {
+            if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            position = dequeue_position.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void dqm_histogrammer::fill(accumulator &out, const event_view &event) {
+    for (int channel = 0; channel < num_channels; channel++) {
+        size_t offset = (size_t)channel * num_samples;
+        const uint16_t *adc = event.adc_block + offset;
+        const uint16_t *toa = event.toa_block + offset;
+        const uint16_t *tot = event.tot_block + offset;
+        const uint16_t *hamming = event.hamming_block + offset;
+        size_t row = (size_t)channel * BINS;
+        uint16_t max = adc[0];
+        uint64_t errors = 0;
+        for (int k = 0; k < num_samples; k++) {
+            max = std::max(max, adc[k]);
+            if (toa[k] != 0) {
+                add_to<uint32_t>(out.toa[row + std::min<int>(toa[k], BINS - 1)], 1);
+            }
+            if (tot[k] != 0) {
+                add_to<uint32_t>(out.tot[row + std::min<int>(tot[k] >> TOT_SHIFT, BINS - 1)], 1);
+            }
+            errors += hamming[k] != 0;
+        }
+        add_to<uint32_t>(out.adc[row + std::min<int>(max, BINS - 1)], 1);
+        if (max - adc[0] > THRESHOLD) {
+            add_to<uint64_t>(out.occupied[channel], 1);
+        }
+        if (errors) {
+            add_to<uint64_t>(out.hamming_errors[channel], errors);
+        }
+    }
+    add_to<uint64_t>(out.events, 1);
+}
+
+void dqm_histogrammer::work(accumulator *out) {
+    while (true) {
+        // Read first, so that once it is false every event added before close() can be popped
+        bool stopping = !running.load(std::memory_order_acquire);
+        uint64_t position;
+        if (pop(position)) {
+            slot &s = slots[position & mask];
+            fill(*out, make_event_view(s.record, layout, num_channels, num_samples));
+            s.sequence.store(position + mask + 1, std::memory_order_release);
+        } else if (stopping) {
+            return;
+        } else {
+            // Nothing queued, back off briefly
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void dqm_histogrammer::take_snapshots() {
+    std::unique_lock<std::mutex> lock(snapshot_mutex);
+    while (true) {
+        snapshot_wake.wait_for(lock, std::chrono::duration<double>(interval),
+                               [this] {return !running.load(std::memory_order_acquire);});
+        if (!running.load(std::memory_order_acquire)) {
+            return;
+        }
+        lock.unlock();
+        try {
+            write_snapshot();
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, "DQM", e.what());
+        }
+        lock.lock();
+    }
+}
+
+void dqm_histogrammer::close() {
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        if (!running.exchange(false)) {
+            return;
+        }
+    }
+    snapshot_wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    snapshot_thread.join();
+    write_snapshot();
+    uint64_t drops = dropped.load();
+    LOG_MESSAGE(drops > 0 ? DEBUG_WARNING : DEBUG_INFO, "DQM", "Histogrammed " + std::to_string(get_events()) +
+                " events to " + file_name + (drops > 0 ? ", " + std::to_string(drops) + " dropped as the ring was full" : ""));
+}
+
+uint64_t dqm_histogrammer::get_events() const {
+    uint64_t events = 0;
+    for (accumulator *a : accumulators) {
+        events += a->events.load(std::memory_order_relaxed);
+    }
+    return events;
+}
+
+void dqm_histogrammer::write_snapshot() {
+    // Only one snapshot at a time, from the snapshot thread or close()
+    std::lock_guard<std::mutex> lock(write_mutex);
+
+    size_t size = (size_t)num_channels * BINS;
+    std::vector<uint32_t> adc(size, 0);
+    std::vector<uint32_t> toa(size, 0);
+    std::vector<uint32_t> tot(size, 0);
+    std::vector<uint64_t> occupied(num_channels, 0);
+    std::vector<uint64_t> hamming_errors(num_channels, 0);
+    // The threads keep filling meanwhile, so counters can be an event or so apart
+    for (accumulator *a : accumulators) {
+        for (size_t i = 0; i < size; i++) {
+            adc[i] += a->adc[i].load(std::memory_order_relaxed);
+            toa[i] += a->toa[i].load(std::memory_order_relaxed);
+            tot[i] += a->tot[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < num_channels; i++) {
+            occupied[i] += a->occupied[i].load(std::memory_order_relaxed);
+            hamming_errors[i] += a->hamming_errors[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    dqm_header header;
+    header.magic = DQM_MAGIC;
+    header.version = DQM_VERSION;
+    header.num_kcu = num_kcu;
+    header.num_samples = num_samples;
+    header.num_channels = num_channels;
+    header.detector = detector;
+    header.run_number = run_number;
+    header.num_bins = BINS;
+    header.tot_shift = TOT_SHIFT;
+    header.threshold = THRESHOLD;
+    header.events = get_events();
+    header.dropped = dropped.load(std::memory_order_relaxed);
+    header.time = std::time(nullptr);
+    header.header_size = sizeof(dqm_header);
+
+    // Written next to the target and renamed, so a viewer only ever sees a complete file
+    std::string tmp_name = file_name + ".tmp";
+    std::ofstream out(tmp_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(adc.data()), adc.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(toa.data()), toa.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(tot.data()), tot.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(occupied.data()), occupied.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(hamming_errors.data()), hamming_errors.size() * sizeof(uint64_t));
+    out.close();
+    if (!out.good()) {
+        std::remove(tmp_name.c_str());
+        throw std::runtime_error("Error writing " + tmp_name);
+    }
+    if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        throw std::runtime_error("Error renaming " + tmp_name + " to " + file_name);
+    }
+    LOG_MESSAGE(DEBUG_DEBUG, "DQM", "Snapshot of " + std::to_string(header.events) + " events in " + file_name);
+}
@@ -0,0 +1,110 @@
+/*
+Data quality histograms filled while decoding, off the decode thread:
+
+    h2g_run -r 42 -F -D 10          # Run042.dqm rewritten every 10 s
+    h2g_run -r 42 -F -D 10:2        # filled by 2 threads
+
+For every channel there are ADC (largest sample of each waveform), TOA and TOT spectra of
+1024 bins, the number of waveforms over threshold for the occupancy, and the number of
+samples with hamming errors.  The layout of .dqm is in binary_format.h.
+
+The decode thread only copies each event into a slot of a preallocated ring, as a .h2d
+record, and carries on.  When the ring is full the event is dropped and counted instead of
+stalling the decoder.  Histogramming threads take events from the ring and fill histograms
+of their own, [channel][bin] so that each waveform touches a few contiguous rows.  Each
+counter has a single writer, so it is updated with a plain load and store, and another
+thread can read it at any time without locks.  A snapshot thread adds up the histograms of
+every thread and writes them to a temporary file.  It then renames that file, so a viewer
+never sees a half written one.
+*/
+
+#pragma once
+
+#include "binary_format.h"
+#include "binary_reader.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class aligned_event;
+
+class dqm_histogrammer {
+public:
+    static const int BINS = 1024;           // ADC and TOA are 10 bits
+    static const int TOT_SHIFT = 2;         // TOT is up to 12 bits, 4 values a bin
+    static const int THRESHOLD = 30;        // ADC counts over the first sample for occupancy
+
+private:
+    // The histograms of one thread
+    struct accumulator {
+        std::vector<std::atomic<uint32_t>> adc;     // [channel * BINS + bin]
+        std::vector<std::atomic<uint32_t>> toa;
+        std::vector<std::atomic<uint32_t>> tot;
+        std::vector<std::atomic<uint64_t>> occupied;
+        std::vector<std::atomic<uint64_t>> hamming_errors;
+        std::atomic<uint64_t> events;
+
+        accumulator(int num_channels);
+    };
+
+    struct slot {
+        std::atomic<uint64_t> sequence;
+        uint8_t *record;
+    };
+
+    std::string file_name;
+    int num_kcu;
+    int num_samples;
+    int num_channels;
+    int detector;
+    int run_number;
+    h2d_layout layout;
+    double interval;
+
+    slot *slots;
+    uint8_t *records;
+    uint64_t mask;
+    alignas(64) uint64_t enqueue_position;      // Only the decode thread adds events
+    alignas(64) std::atomic<uint64_t> dequeue_position;
+    alignas(64) std::atomic<uint64_t> dropped;
+
+    std::vector<accumulator*> accumulators;
+    std::vector<std::thread> workers;
+    std::thread snapshot_thread;
+    std::atomic<bool> running;
+    std::mutex snapshot_mutex;
+    std::condition_variable snapshot_wake;
+    std::mutex write_mutex;
+
+    bool pop(uint64_t &position);
+    void fill(accumulator &out, const event_view &event);
+    void work(accumulator *out);
+    void take_snapshots();
+
+public:
+    // threads fill the histograms, and a snapshot is written every interval seconds;
+    // capacity, the events the ring holds, is rounded up to a power of two
+    dqm_histogrammer(const std::string &file_name, int num_kcu, int num_samples, int detector, int run_number,
+                     double interval, int threads = 1, uint64_t capacity = 64);
+    ~dqm_histogrammer();
+
+    dqm_histogrammer(const dqm_histogrammer&) = delete;
+    dqm_histogrammer& operator=(const dqm_histogrammer&) = delete;
+
+    // Never blocks; returns false and counts a drop if the ring is full
+    bool add(aligned_event *event, uint64_t event_number);
+    // Histograms everything queued so far, stops the threads and writes the last snapshot.
+    // Throws std::runtime_error if it cannot be written.
+    void close();
+    // Adds up the histograms of all threads and writes them, throws std::runtime_error if
+    // the file cannot be written
+    void write_snapshot();
+
+    uint64_t get_dropped() const {return dropped.load(std::memory_order_relaxed);}
+    uint64_t get_events() const;
+};
@@ -36,7 +36,7 @@ event_aligner::event_aligner(uint32_t num_fpga) {
 }
 
 event_aligner::~event_aligner() {
-    log_message(DEBUG_DEBUG, "EventAligner", "Ended with " + std::to_string(complete->size()) + " complete");
+    LOG_MESSAGE(DEBUG_DEBUG, "EventAligner", "Ended with " + std::to_string(complete->size()) + " complete");
     for (auto it = complete->begin(); it != complete->end(); it++) {
         delete *it;
     }
@@ -65,7 +65,7 @@ bool event_aligner::align(std::list<kcu_event*> **single_kcu_events) {
     }
 
     while (!done) {
-        log_message(DEBUG_TRACE, "EventAligner", "Processing new timestamp deltas");
+        LOG_MESSAGE(DEBUG_TRACE, "EventAligner", "Processing new timestamp deltas");
         std::vector<long> timestamp_delta;
         long avg = 0;
         for (int i = 0; i < num_fpga; i++) {
@@ -73,12 +73,12 @@ bool event_aligner::align(std::list<kcu_event*> **single_kcu_events) {
             auto next = iter;
             next++;
             if (next == single_kcu_events[i]->end()) {
-                log_message(DEBUG_DEBUG, "EventAligner", "End of events for FPGA " + std::to_string(i));
+                LOG_MESSAGE(DEBUG_DEBUG, "EventAligner", "End of events for FPGA " + std::to_string(i));
                 done = true;
                 break;
             }
             timestamp_delta.push_back((*next)->get_timestamp() -  last_good_timestamp[i]);
-            log_message(DEBUG_TRACE, "EventAligner", "FPGA " + std::to_string(i) + 
+            LOG_MESSAGE(DEBUG_TRACE, "EventAligner", "FPGA " + std::to_string(i) + 
                         " timestamp delta: " + std::to_string((*next)->get_timestamp()) + 
                         " - " + std::to_string(last_good_timestamp[i]) + 
                         " = " + std::to_string(timestamp_delta.back()));
@@ -90,11 +90,13 @@ bool event_aligner::align(std::list<kcu_event*> **single_kcu_events) {
         }
 
         // Log all deltas at trace level
-        std::string deltas_str = "Deltas: ";
-        for (int i = 0; i < num_fpga; i++) {
-            deltas_str += std::to_string(timestamp_delta[i]) + " ";
+        if (LOG_ENABLED(DEBUG_TRACE)) {
+            std::string deltas_str = "Deltas: ";
+            for (int i = 0; i < num_fpga; i++) {
+                deltas_str += std::to_string(timestamp_delta[i]) + " ";
+            }
+            LOG_MESSAGE(DEBUG_TRACE, "EventAligner", deltas_str);
         }
-        log_message(DEBUG_TRACE, "EventAligner", deltas_str);
 
         // check range of deltas;
         long max_range = 0;
@@ -108,62 +110,72 @@ bool event_aligner::align(std::list<kcu_event*> **single_kcu_events) {
             }
         }
 
-        log_message(DEBUG_TRACE, "EventAligner", "Average delta: " + std::to_string(avg) + 
+        LOG_MESSAGE(DEBUG_TRACE, "EventAligner", "Average delta: " + std::to_string(avg) + 
                             ", Max range: " + std::to_string(max_range));
 
-        log_message(DEBUG_TRACE, "EventAligner", "Farthest off: " + std::to_string(timestamp_delta[farthest_off]) + 
+        LOG_MESSAGE(DEBUG_TRACE, "EventAligner", "Farthest off: " + std::to_string(timestamp_delta[farthest_off]) + 
                             " Average: " + std::to_string(avg) + 
                             " Difference: " + std::to_string(timestamp_delta[farthest_off] - avg));
         
         if (std::abs(max_range) < 1) {
-            log_message(DEBUG_DEBUG, "EventAligner", "Creating new aligned event - timestamps within range");
+            LOG_MESSAGE(DEBUG_DEBUG, "EventAligner", "Creating new aligned event - timestamps within range");
             // Build a new aligned event
             aligned_event *ae = new aligned_event(num_fpga, 144);   // Number of channels is hardcoded for now
             
-            std::string event_counters = "Event counters: ";
+            std::string event_counters;
             for (uint32_t i = 0; i < num_fpga; i++) {
-                event_counters += "FPGA " + std::to_string(i) + ": " + 
-                           std::to_string((*iters[i])->get_event_counter()) + "\t";
+                if (LOG_ENABLED(DEBUG_TRACE)) {
+                    event_counters += "FPGA " + std::to_string(i) + ": " + 
+                               std::to_string((*iters[i])->get_event_counter()) + "\t";
+                }
                 ae->events[i] = *iters[i];
                 (*iters[i])->is_aligned();
                 ae->timestamp[i] = (*iters[i])->get_timestamp();
                 iters[i]++;
                 last_good_timestamp[i] = (*iters[i])->get_timestamp();
             }
-            log_message(DEBUG_TRACE, "EventAligner", event_counters);
+            LOG_MESSAGE(DEBUG_TRACE, "EventAligner", "Event counters: " + event_counters);
             
-            std::string time_stamps = "Time stamps: ";
-            for (uint32_t i = 0; i < num_fpga; i++) {
-                time_stamps += "FPGA " + std::to_string(i) + ": " + 
-                          std::to_string(ae->timestamp[i]) + "\t";
+            if (LOG_ENABLED(DEBUG_TRACE)) {
+                std::string time_stamps = "Time stamps: ";
+                for (uint32_t i = 0; i < num_fpga; i++) {
+                    time_stamps += "FPGA " + std::to_string(i) + ": " + 
+                              std::to_string(ae->timestamp[i]) + "\t";
+                }
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", time_stamps);
             }
-            log_message(DEBUG_TRACE, "EventAligner", time_stamps);
             complete->push_back(ae);
+            if (stats) {
+                stats->add_aligned_events(1);
+                stats->update_timestamps(ae->timestamp[0]);
+            }
         }
 
         // Check if the farthest off is too close or too far
         else if (timestamp_delta[farthest_off] - avg > 0) {
-            log_message(DEBUG_DEBUG, "EventAligner", "Farthest (" + std::to_string(farthest_off) + 
+            LOG_MESSAGE(DEBUG_DEBUG, "EventAligner", "Farthest (" + std::to_string(farthest_off) + 
                                    ") is too far ahead with max range of " + std::to_string(max_range));
             
-            std::string timestamp_str = "Avg: " + std::to_string(avg);
-            for (uint32_t i = 0; i < num_fpga; i++) {
-                timestamp_str += " T" + std::to_string(i) + ": " + std::to_string(last_good_timestamp[i]);
-            }
-            log_message(DEBUG_TRACE, "EventAligner", timestamp_str);
+            if (LOG_ENABLED(DEBUG_TRACE)) {
+                std::string timestamp_str = "Avg: " + std::to_string(avg);
+                for (uint32_t i = 0; i < num_fpga; i++) {
+                    timestamp_str += " T" + std::to_string(i) + ": " + std::to_string(last_good_timestamp[i]);
+                }
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", timestamp_str);
             
-            std::string current_timestamps = "Timestamps: ";
-            std::string deltas = "Delta: ";
-            std::string event_counters = "Event counters: ";
-            for (uint32_t i = 0; i < num_fpga; i++) {
-                current_timestamps += std::to_string((*iters[i])->get_timestamp()) + " ";
-                deltas += std::to_string(timestamp_delta[i]) + " ";
-                event_counters += std::to_string((*iters[i])->get_event_counter()) + " ";
-            }
+                std::string current_timestamps = "Timestamps: ";
+                std::string deltas = "Delta: ";
+                std::string event_counters = "Event counters: ";
+                for (uint32_t i = 0; i < num_fpga; i++) {
+                    current_timestamps += std::to_string((*iters[i])->get_timestamp()) + " ";
+                    deltas += std::to_string(timestamp_delta[i]) + " ";
+                    event_counters += std::to_string((*iters[i])->get_event_counter()) + " ";
+                }
             
-            log_message(DEBUG_TRACE, "EventAligner", current_timestamps);
-            log_message(DEBUG_TRACE, "EventAligner", deltas);
-            log_message(DEBUG_TRACE, "EventAligner", event_counters);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", current_timestamps);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", deltas);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", event_counters);
+            }
             
             // Move the other three forwards
             for (uint32_t i = 0; i < num_fpga; i++) {
@@ -172,27 +184,29 @@ bool event_aligner::align(std::list<kcu_event*> **single_kcu_events) {
                 }
             }
         } else {
-            log_message(DEBUG_DEBUG, "EventAligner", "Farthest (" + std::to_string(farthest_off) + 
+            LOG_MESSAGE(DEBUG_DEBUG, "EventAligner", "Farthest (" + std::to_string(farthest_off) + 
                                    ") is too far behind with max range of " + std::to_string(max_range));
             
-            std::string timestamp_str = "Avg: " + std::to_string(avg);
-            for (uint32_t i = 0; i < num_fpga; i++) {
-                timestamp_str += " T" + std::to_string(i) + ": " + std::to_string(last_good_timestamp[i]);
-            }
-            log_message(DEBUG_TRACE, "EventAligner", timestamp_str);
+            if (LOG_ENABLED(DEBUG_TRACE)) {
+                std::string timestamp_str = "Avg: " + std::to_string(avg);
+                for (uint32_t i = 0; i < num_fpga; i++) {
+                    timestamp_str += " T" + std::to_string(i) + ": " + std::to_string(last_good_timestamp[i]);
+                }
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", timestamp_str);
             
-            std::string current_timestamps = "Timestamps: ";
-            std::string deltas = "Delta: ";
-            std::string event_counters = "Event counters: ";
-            for (uint32_t i = 0; i < num_fpga; i++) {
-                current_timestamps += std::to_string((*iters[i])->get_timestamp()) + " ";
-                deltas += std::to_string(timestamp_delta[i]) + " ";
-                event_counters += std::to_string((*iters[i])->get_event_counter()) + " ";
-            }
+                std::string current_timestamps = "Timestamps: ";
+                std::string deltas = "Delta: ";
+                std::string event_counters = "Event counters: ";
+                for (uint32_t i = 0; i < num_fpga; i++) {
+                    current_timestamps += std::to_string((*iters[i])->get_timestamp()) + " ";
+                    deltas += std::to_string(timestamp_delta[i]) + " ";
+                    event_counters += std::to_string((*iters[i])->get_event_counter()) + " ";
+                }
             
-            log_message(DEBUG_TRACE, "EventAligner", current_timestamps);
-            log_message(DEBUG_TRACE, "EventAligner", deltas);
-            log_message(DEBUG_TRACE, "EventAligner", event_counters);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", current_timestamps);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", deltas);
+                LOG_MESSAGE(DEBUG_TRACE, "EventAligner", event_counters);
+            }
             
             // move this one forward
             iters[farthest_off]++;
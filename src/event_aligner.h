@@ -5,6 +5,7 @@ Takes a collection of built waveforms and attempts to align them across multiple
 #pragma once
 
 #include "waveform_builder.h"
+#include "stat_logger.h"
 
 #include <list>
 #include <cstdint>
@@ -33,6 +34,7 @@ class event_aligner {
 private:
     uint32_t num_fpga;
     std::list<aligned_event*> *complete;
+    stat_logger *stats = nullptr;
 
 public:
     event_aligner(uint32_t num_fpga);
@@ -40,4 +42,5 @@ public:
     bool align(std::list<kcu_event*> **single_kcu_events);
     std::list<aligned_event*> *get_complete() {return complete;}
     void clear_complete() {complete->clear();}
+    void set_stat_logger(stat_logger *stats) {this->stats = stats;}
 };
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "event_compare.h"
+#include "debug_logger.h"
+
+#include <string>
+
+void golden_event::fill(aligned_event *event, int num_samples, uint64_t event_number) {
+    int num_kcu = event->get_num_fpga();
+    size_t block = (size_t)num_kcu * 144 * num_samples;
+    this->event_number = event_number;
+    this->num_samples = num_samples;
+    timestamps.resize(num_kcu);
+    event_counters.resize(num_kcu);
+    adc.resize(block);
+    toa.resize(block);
+    tot.resize(block);
+    hamming.resize(block);
+    for (int i = 0; i < num_kcu; i++) {
+        auto e = event->get_event(i);
+        timestamps[i] = e->get_timestamp();
+        event_counters[i] = e->get_event_counter();
+        for (int j = 0; j < 144; j++) {
+            size_t offset = (size_t)(i * 144 + j) * num_samples;
+            for (int k = 0; k < num_samples; k++) {
+                adc[offset + k] = e->get_sample_adc(j, k);
+                toa[offset + k] = e->get_sample_toa(j, k);
+                tot[offset + k] = e->get_sample_tot(j, k);
+                hamming[offset + k] = e->get_sample_hamming(j, k);
+            }
+        }
+    }
+}
+
+void golden_event::fill(const binary_reader &reader, uint64_t event) {
+    fill(reader.event(event), reader.get_num_kcu());
+}
+
+void golden_event::fill(const event_view &view, int num_kcu) {
+    size_t block = (size_t)view.num_channels * view.num_samples;
+    event_number = view.event_number;
+    num_samples = view.num_samples;
+    timestamps.assign(view.timestamps, view.timestamps + num_kcu);
+    event_counters.resize(num_kcu);
+    for (int i = 0; i < num_kcu; i++) {
+        // The stored timestamp is the unwrapped event counter
+        event_counters[i] = timestamps[i] & 0b111111;
+    }
+    adc.assign(view.adc_block, view.adc_block + block);
+    toa.assign(view.toa_block, view.toa_block + block);
+    tot.assign(view.tot_block, view.tot_block + block);
+    hamming.assign(view.hamming_block, view.hamming_block + block);
+}
+
+decoder_source::decoder_source(const std::string &file_name, int num_kcu, int detector)
+    : it(nullptr), end(nullptr) {
+    decoder = new hgc_decoder(file_name.c_str(), detector, num_kcu);
+    count = 0;
+    started = false;
+}
+
+decoder_source::decoder_source(packet_source *source, int num_kcu, int detector)
+    : it(nullptr), end(nullptr) {
+    decoder = new hgc_decoder(source, detector, num_kcu);
+    count = 0;
+    started = false;
+}
+
+decoder_source::~decoder_source() {
+    delete decoder;
+}
+
+bool decoder_source::next(golden_event &event) {
+    if (!started) {
+        started = true;
+        it = decoder->begin();
+        end = decoder->end();
+    } else {
+        ++it;
+    }
+    if (!(it != end)) {
+        return false;
+    }
+    event.fill(*it, decoder->get_num_samples(), count++);
+    return true;
+}
+
+bool h2d_source::next(golden_event &event) {
+    if (count >= reader.get_num_events()) {
+        return false;
+    }
+    event.fill(reader, count++);
+    return true;
+}
+
+std::string compare_events(const golden_event &a, const golden_event &b) {
+    std::string where = "event " + std::to_string(a.event_number) + ": ";
+    if (a.event_number != b.event_number) {
+        return where + "event number " + std::to_string(a.event_number) + " != " + std::to_string(b.event_number);
+    }
+    if (a.timestamps.size() != b.timestamps.size() || a.num_samples != b.num_samples) {
+        return where + "shape " + std::to_string(a.timestamps.size()) + " KCUs x " + std::to_string(a.num_samples) +
+               " samples != " + std::to_string(b.timestamps.size()) + " KCUs x " + std::to_string(b.num_samples) + " samples";
+    }
+    for (size_t i = 0; i < a.timestamps.size(); i++) {
+        if (a.timestamps[i] != b.timestamps[i]) {
+            return where + "KCU " + std::to_string(i) + " timestamp " + std::to_string(a.timestamps[i]) +
+                   " != " + std::to_string(b.timestamps[i]);
+        }
+        if (a.event_counters[i] != b.event_counters[i]) {
+            return where + "KCU " + std::to_string(i) + " event counter " + std::to_string(a.event_counters[i]) +
+                   " != " + std::to_string(b.event_counters[i]);
+        }
+    }
+    const std::vector<uint16_t> *blocks_a[4] = {&a.adc, &a.toa, &a.tot, &a.hamming};
+    const std::vector<uint16_t> *blocks_b[4] = {&b.adc, &b.toa, &b.tot, &b.hamming};
+    const char *names[4] = {"ADC", "TOA", "TOT", "hamming"};
+    for (int f = 0; f < 4; f++) {
+        const auto &x = *blocks_a[f];
+        const auto &y = *blocks_b[f];
+        for (size_t i = 0; i < x.size(); i++) {
+            if (x[i] != y[i]) {
+                return where + names[f] + " channel " + std::to_string(i / a.num_samples) + " sample " +
+                       std::to_string(i % a.num_samples) + ": " + std::to_string(x[i]) + " != " + std::to_string(y[i]);
+            }
+        }
+    }
+    return "";
+}
+
+event_comparison compare_sources(event_source &a, event_source &b, uint64_t max_mismatches) {
+    event_comparison result = {true, 0, 0, 0, 0, ""};
+    golden_event event_a;
+    golden_event event_b;
+    while (true) {
+        bool more_a = a.next(event_a);
+        bool more_b = b.next(event_b);
+        result.events_a += more_a;
+        result.events_b += more_b;
+        if (!more_a || !more_b) {
+            // Count whatever is left on the longer side
+            while (more_a && (more_a = a.next(event_a))) {
+                result.events_a++;
+            }
+            while (more_b && (more_b = b.next(event_b))) {
+                result.events_b++;
+            }
+            break;
+        }
+        result.events_compared++;
+        std::string mismatch = compare_events(event_a, event_b);
+        if (!mismatch.empty()) {
+            LOG_MESSAGE(DEBUG_DEBUG, "EventCompare", mismatch);
+            if (result.first_mismatch.empty()) {
+                result.first_mismatch = mismatch;
+            }
+            result.events_mismatched++;
+            if (result.events_mismatched >= max_mismatches) {
+                break;
+            }
+        }
+    }
+    if (result.events_a != result.events_b && result.events_mismatched < max_mismatches) {
+        if (result.first_mismatch.empty()) {
+            result.first_mismatch = "event count " + std::to_string(result.events_a) + " != " + std::to_string(result.events_b);
+        }
+    }
+    result.match = result.first_mismatch.empty();
+    return result;
+}
@@ -0,0 +1,89 @@
+/*
+Field by field comparison of decoded events, used to check that an alternative decode
+path (binary output, compressed input, resumed runs, ...) builds and aligns exactly the
+same events as the reference hgc_decoder.
+
+Events from any path are copied into a golden_event and pulled one at a time from an
+event_source, so whole runs can be compared without holding them in memory.
+
+    decoder_source reference("Run001.h2g", 4);
+    h2d_source binary("Run001.h2d");
+    event_comparison result = compare_sources(reference, binary);
+    if (!result.match) std::cout << result.first_mismatch << std::endl;
+*/
+
+#pragma once
+
+#include "event_aligner.h"
+#include "hgc_decoder.h"
+#include "binary_reader.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct golden_event {
+    uint64_t event_number;
+    std::vector<int64_t> timestamps;        // Per KCU, the value written to the outputs
+    std::vector<uint32_t> event_counters;   // Per KCU, the 6 bit counter of the first sample
+    // Indexed as [channel * num_samples + sample]
+    std::vector<uint16_t> adc;
+    std::vector<uint16_t> toa;
+    std::vector<uint16_t> tot;
+    std::vector<uint16_t> hamming;
+    int num_samples;
+
+    void fill(aligned_event *event, int num_samples, uint64_t event_number);
+    void fill(const binary_reader &reader, uint64_t event);
+    // From a .h2d record, read from a file or an event ring
+    void fill(const event_view &view, int num_kcu);
+};
+
+class event_source {
+public:
+    virtual ~event_source() {}
+    // Returns false once there are no more events
+    virtual bool next(golden_event &event) = 0;
+};
+
+// The reference path, hgc_decoder reading a .h2g file
+class decoder_source : public event_source {
+private:
+    hgc_decoder *decoder;
+    hgc_decoder::iterator it;
+    hgc_decoder::iterator end;
+    uint64_t count;
+    bool started;
+
+public:
+    decoder_source(const std::string &file_name, int num_kcu, int detector = 0);
+    // Decodes from any packet source, which the decoder takes over
+    decoder_source(packet_source *source, int num_kcu, int detector = 0);
+    ~decoder_source();
+    bool next(golden_event &event) override;
+    hgc_decoder *get_decoder() {return decoder;}
+};
+
+class h2d_source : public event_source {
+private:
+    binary_reader reader;
+    uint64_t count;
+
+public:
+    h2d_source(const std::string &file_name) : reader(file_name), count(0) {}
+    bool next(golden_event &event) override;
+};
+
+struct event_comparison {
+    bool match;
+    uint64_t events_compared;
+    uint64_t events_mismatched;
+    uint64_t events_a;
+    uint64_t events_b;
+    std::string first_mismatch;     // Empty when everything matched
+};
+
+// Describes the first field that differs, or returns an empty string
+std::string compare_events(const golden_event &a, const golden_event &b);
+// Compares every event of both sources, stopping after max_mismatches differing events
+event_comparison compare_sources(event_source &a, event_source &b, uint64_t max_mismatches = 10);
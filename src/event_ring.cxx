@@ -0,0 +1,194 @@
+#include "event_ring.h"
+
+#include "binary_writer.h"
+#include "debug_logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock free 64 bit atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the ring needs lock free 32 bit atomics");
+
+namespace {
+const uint64_t CACHE_LINE = 64;
+
+uint64_t round_up(uint64_t size) {
+    return (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+}
+
+// Shared memory names are a single '/' and then no other
+std::string shm_path(const std::string &name) {
+    std::string path = name.empty() || name[0] != '/' ? "/" + name : name;
+    if (path.size() < 2 || path.find('/', 1) != std::string::npos) {
+        throw std::runtime_error("Bad event ring name " + name + ", it cannot contain '/'");
+    }
+    return path;
+}
+}
+
+event_ring_writer::event_ring_writer(const std::string &name, int num_slots, int num_kcu, int num_samples, int detector,
+                                     int run_number)
+    : name(name), map(nullptr), map_size(0), header(nullptr), layout(num_kcu, 144 * num_kcu, num_samples),
+      num_kcu(num_kcu), num_samples(num_samples) {
+    if (num_slots < 1) {
+        throw std::runtime_error("An event ring needs at least one slot");
+    }
+    std::string path = shm_path(name);
+    // Left by an earlier run, or one that crashed
+    shm_unlink(path.c_str());
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create event ring " + name + ": " + strerror(errno));
+    }
+    uint64_t header_size = round_up(sizeof(ring_header));
+    uint64_t slot_size = round_up(sizeof(uint64_t) + layout.record_size);
+    map_size = header_size + num_slots * slot_size;
+    // The new pages are zero, so every slot starts with sequence 0, which no event has
+    void *m = ftruncate(fd, map_size) == 0 ? mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                           : MAP_FAILED;
+    int error = errno;
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        shm_unlink(path.c_str());
+        throw std::runtime_error("Cannot map event ring " + name + " of " + std::to_string(map_size) + " bytes: " +
+                                 strerror(error));
+    }
+    map = static_cast<uint8_t*>(m);
+
+    header = new (map) ring_header;
+    header->version = RING_VERSION;
+    header->num_kcu = num_kcu;
+    header->num_samples = num_samples;
+    header->num_channels = 144 * num_kcu;
+    header->detector = detector;
+    header->run_number = run_number;
+    header->reserved = 0;
+    header->num_slots = num_slots;
+    header->record_size = layout.record_size;
+    header->slot_size = slot_size;
+    header->header_size = header_size;
+    header->published.store(0, std::memory_order_relaxed);
+    header->finished.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < num_slots; i++) {
+        new (sequence(i)) std::atomic<uint64_t>(0);
+    }
+    header->magic.store(RING_MAGIC, std::memory_order_release);
+    LOG_MESSAGE(DEBUG_INFO, "EventRing", "Publishing events to /dev/shm" + path + ", " + std::to_string(num_slots) +
+                " slots of " + std::to_string(slot_size) + " bytes");
+}
+
+event_ring_writer::~event_ring_writer() {
+    close();
+}
+
+void event_ring_writer::publish(aligned_event *event, uint64_t event_number) {
+    uint64_t n = header->published.load(std::memory_order_relaxed);
+    std::atomic<uint64_t> *slot = sequence(n % header->num_slots);
+    slot->store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    pack_event(event, event_number, layout, num_kcu, num_samples, reinterpret_cast<uint8_t*>(slot + 1));
+    slot->store(2 * n + 2, std::memory_order_release);
+    header->published.store(n + 1, std::memory_order_release);
+}
+
+void event_ring_writer::close() {
+    if (header == nullptr) {
+        return;
+    }
+    header->finished.store(1, std::memory_order_release);
+    LOG_MESSAGE(DEBUG_DEBUG, "EventRing", "Closing event ring " + name + " after " +
+                std::to_string(header->published.load(std::memory_order_relaxed)) + " events");
+    header = nullptr;
+    munmap(map, map_size);
+    map = nullptr;
+    shm_unlink(shm_path(name).c_str());
+}
+
+event_ring_reader::event_ring_reader(const std::string &name)
+    : name(name), map(nullptr), map_size(0), header(nullptr), layout(0, 0, 0), next_event(0), read(0), skipped(0) {
+    std::string path = shm_path(name);
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw std::runtime_error("No event ring " + name + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ring_header)) {
+        ::close(fd);
+        throw std::runtime_error("Event ring " + name + " is not ready");
+    }
+    map_size = st.st_size;
+    void *m = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        throw std::runtime_error("Cannot map event ring " + name + ": " + strerror(errno));
+    }
+    map = static_cast<const uint8_t*>(m);
+    header = reinterpret_cast<const ring_header*>(map);
+
+    std::string problem;
+    if (header->magic.load(std::memory_order_acquire) != RING_MAGIC) {
+        problem = "is not ready";
+    } else if (header->version != RING_VERSION) {
+        problem = "has version " + std::to_string(header->version) + ", expected " + std::to_string(RING_VERSION);
+    } else {
+        layout = h2d_layout(header->num_kcu, header->num_channels, header->num_samples);
+        if (layout.record_size != header->record_size ||
+            header->header_size + header->num_slots * header->slot_size > map_size) {
+            problem = "has a different layout";
+        }
+    }
+    if (!problem.empty()) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+        throw std::runtime_error("Event ring " + name + " " + problem);
+    }
+    record.resize(header->record_size);
+    next_event = header->published.load(std::memory_order_acquire);
+    LOG_MESSAGE(DEBUG_INFO, "EventRing", "Reading event ring " + name + " of run " + std::to_string(header->run_number) +
+                ", from event " + std::to_string(next_event));
+}
+
+event_ring_reader::~event_ring_reader() {
+    munmap(const_cast<uint8_t*>(map), map_size);
+}
+
+bool event_ring_reader::next(event_view &event) {
+    uint64_t num_slots = header->num_slots;
+    while (true) {
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        if (next_event >= published) {
+            return false;
+        }
+        if (published - next_event > num_slots) {
+            skipped += published - num_slots - next_event;
+            next_event = published - num_slots;
+        }
+        const std::atomic<uint64_t> *slot = sequence(next_event % num_slots);
+        uint64_t before = slot->load(std::memory_order_acquire);
+        if (before == 2 * next_event + 2) {
+            memcpy(record.data(), slot + 1, record.size());
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->load(std::memory_order_relaxed) == before) {
+                next_event++;
+                read++;
+                event = make_event_view(record.data(), layout, header->num_channels, header->num_samples);
+                return true;
+            }
+        }
+        // The writer has come round again and overwritten it
+        skipped++;
+        next_event++;
+    }
+}
+
+bool event_ring_reader::finished() const {
+    return header->finished.load(std::memory_order_acquire) &&
+           next_event >= header->published.load(std::memory_order_acquire);
+}
@@ -0,0 +1,125 @@
+/*
+Publishes decoded events to a POSIX shared memory ring, so monitors on the same host can
+watch a run while it is decoded without decoding it again:
+
+    h2g_run -r 42 -F -Q h2g                 # every event to /dev/shm/h2g, 256 of them kept
+    h2g_monitor -q h2g -S 5                 # any number of readers, started at any time
+
+The ring is a header and a fixed number of slots, each holding one event in the fixed size
+record of binary_format.h.  Readers get the same event_view as binary_reader.
+
+The writer never waits for anyone.  It overwrites the oldest slot, and readers map the ring
+read only, so a slow or stuck monitor cannot hold up the decoder.  Instead a reader that
+falls a whole ring behind skips ahead to the oldest event still there, and counts the events
+it missed.
+
+Each slot has a sequence number that works as a seqlock.  While event n is copied into its
+slot the sequence is 2n + 1, and once it is complete it is 2n + 2.  A reader copies the
+record out and checks the sequence again, so it never returns a slot that was overwritten
+while it was reading.  The header counts the events published and marks the end of the run.
+*/
+
+#pragma once
+
+#include "binary_format.h"
+#include "binary_reader.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class aligned_event;
+
+constexpr uint32_t RING_MAGIC = 0x52324748;  // "HG2R"
+constexpr uint32_t RING_VERSION = 1;
+
+struct ring_header {
+    std::atomic<uint32_t> magic;    // Set last, a reader that finds it can use the rest
+    uint32_t version;
+    uint32_t num_kcu;
+    uint32_t num_samples;
+    uint32_t num_channels;
+    uint32_t detector;
+    int32_t run_number;
+    uint32_t reserved;
+    uint64_t num_slots;
+    uint64_t record_size;           // Of the .h2d record in each slot
+    uint64_t slot_size;             // The sequence and the record, in whole cache lines
+    uint64_t header_size;           // Offset of the first slot
+    std::atomic<uint64_t> published;
+    std::atomic<uint32_t> finished; // The writer has closed the ring, nothing more will come
+};
+
+class event_ring_writer {
+private:
+    std::string name;
+    uint8_t *map;
+    size_t map_size;
+    ring_header *header;
+    h2d_layout layout;
+    int num_kcu;
+    int num_samples;
+
+    // Each slot is a sequence number followed by the record
+    std::atomic<uint64_t> *sequence(uint64_t slot) {
+        return reinterpret_cast<std::atomic<uint64_t>*>(map + header->header_size + slot * header->slot_size);
+    }
+
+public:
+    // Replaces any ring of the same name, whose readers carry on with the old one until they
+    // reattach.  Throws std::runtime_error if the shared memory cannot be created.
+    event_ring_writer(const std::string &name, int num_slots, int num_kcu, int num_samples, int detector, int run_number);
+    ~event_ring_writer();
+
+    event_ring_writer(const event_ring_writer&) = delete;
+    event_ring_writer& operator=(const event_ring_writer&) = delete;
+
+    void publish(aligned_event *event, uint64_t event_number);
+    // Marks the end of the run and removes the name, readers keep what they have mapped
+    void close();
+
+    uint64_t get_published() const {return header ? header->published.load(std::memory_order_relaxed) : 0;}
+    const std::string &get_name() const {return name;}
+};
+
+class event_ring_reader {
+private:
+    std::string name;
+    const uint8_t *map;
+    size_t map_size;
+    const ring_header *header;
+    h2d_layout layout;
+    std::vector<uint8_t> record;    // Copy of the last event read
+    uint64_t next_event;            // Sequence of the next event to read
+    uint64_t read;
+    uint64_t skipped;
+
+    const std::atomic<uint64_t> *sequence(uint64_t slot) const {
+        return reinterpret_cast<const std::atomic<uint64_t>*>(map + header->header_size + slot * header->slot_size);
+    }
+
+public:
+    // Starts at the newest event.  Throws std::runtime_error if there is no ring of that
+    // name, or it is not ready yet.
+    event_ring_reader(const std::string &name);
+    ~event_ring_reader();
+
+    event_ring_reader(const event_ring_reader&) = delete;
+    event_ring_reader& operator=(const event_ring_reader&) = delete;
+
+    // The next event, valid until the next call; false if none has been published since
+    bool next(event_view &event);
+    // The writer has closed the ring and every event still in it has been read
+    bool finished() const;
+
+    uint64_t get_read() const {return read;}
+    uint64_t get_skipped() const {return skipped;}
+    uint32_t get_num_kcu() const {return header->num_kcu;}
+    uint32_t get_num_samples() const {return header->num_samples;}
+    uint32_t get_num_channels() const {return header->num_channels;}
+    uint32_t get_detector() const {return header->detector;}
+    int get_run_number() const {return header->run_number;}
+    uint64_t get_num_slots() const {return header->num_slots;}
+};
@@ -3,58 +3,82 @@
 #include <istream>
 #include <sstream>
 #include <cstdint>
+#include <filesystem>
+#include <thread>
 
-file_stream::file_stream(const char *fname, uint32_t num_fpgas) {
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+file_stream::file_stream(const char *fname, uint32_t num_fpgas, const follow_config &follow)
+    : file_name(fname), follow(follow) {
     this->num_fpgas = num_fpgas;
+    inotify_fd = -1;
+    bytes_remaining = 0;
+    last_growth = std::chrono::steady_clock::now();
+    if (this->follow.enabled && this->follow.end_marker.empty()) {
+        this->follow.end_marker = file_name + ".done";
+    }
 
-    log_message(DEBUG_INFO, "FileStream", "Initializing with " + std::to_string(num_fpgas) + " FPGAs");
-    log_message(DEBUG_INFO, "FileStream", "Attempting to open file " + std::string(fname));
+    LOG_MESSAGE(DEBUG_INFO, "FileStream", "Initializing with " + std::to_string(num_fpgas) + " FPGAs");
+    LOG_MESSAGE(DEBUG_INFO, "FileStream", "Attempting to open file " + std::string(fname));
     
+    if (this->follow.enabled) {
+        LOG_MESSAGE(DEBUG_INFO, "FileStream", "Following the file until " + this->follow.end_marker + " exists" +
+                    (this->follow.timeout > 0 ? " or no data arrives for " + std::to_string(this->follow.timeout) + " s" : ""));
+        // The DAQ may not have created the run yet
+        while (!std::filesystem::exists(file_name)) {
+            if (follow_finished()) {
+                LOG_MESSAGE(DEBUG_ERROR, "FileStream", "Gave up waiting for " + file_name);
+                throw std::runtime_error("Error opening file");
+            }
+            wait_for_change();
+        }
+    }
+
     file = std::ifstream(fname, std::ios::in | std::ios::binary);
     if (!file.good()) {
-        log_message(DEBUG_ERROR, "FileStream", "Error opening file " + std::string(fname));
+        LOG_MESSAGE(DEBUG_ERROR, "FileStream", "Error opening file " + std::string(fname));
         throw std::runtime_error("Error opening file");
     }
+
+#ifdef __linux__
+    if (this->follow.enabled) {
+        // Wake up as soon as the file is written to, the poll interval is only a fallback
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, fname, IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+        if (inotify_fd < 0) {
+            LOG_MESSAGE(DEBUG_WARNING, "FileStream", "inotify unavailable, polling every " +
+                        std::to_string(this->follow.poll_interval) + " s");
+        }
+    }
+#endif
     
-    log_message(DEBUG_DEBUG, "FileStream", "File opened successfully, parsing header");
+    LOG_MESSAGE(DEBUG_DEBUG, "FileStream", "File opened successfully, parsing header");
     
-    // read file until newline is found
-    char c;
-    // Read until '##################################################' is found twice
-    std::string line;
-    int hashline_count = 0;
-    int lines_read = 0;
-    
-    while (hashline_count < 2 && std::getline(file, line)) {
-        lines_read++;
-        log_message(DEBUG_TRACE, "FileStream", "Header line " + std::to_string(lines_read) + ": " + line);
-        
-        if (line.find("# Generator Setting machine_gun:") != std::string::npos) {
-            std::istringstream iss(line);
-            std::string token;
-            while (std::getline(iss, token, ' ')) {
-                if (token.find("machine_gun:") != std::string::npos) {
-                    std::getline(iss, token, ' ');
-                    number_samples = std::stoi(token) + 1;
-                    log_message(DEBUG_INFO, "FileStream", "Number of samples: " + std::to_string(number_samples));
-                }
-            }
-        }
-        if (line.find("##################################################") != std::string::npos) {
-            hashline_count++;
-            log_message(DEBUG_DEBUG, "FileStream", "Found delimiter line " + std::to_string(hashline_count) + "/2");
+    // A followed run may still be writing its header, so keep rereading until it is complete
+    while (!parse_header() && this->follow.enabled) {
+        if (follow_finished()) {
+            LOG_MESSAGE(DEBUG_ERROR, "FileStream", "Gave up waiting for the header of " + file_name);
+            throw std::runtime_error("Incomplete file header");
         }
+        wait_for_change();
     }
     
     current_head = file.tellg();
-    log_message(DEBUG_INFO, "FileStream", "Starting at byte " + std::to_string(static_cast<long long>(current_head)));
+    LOG_MESSAGE(DEBUG_INFO, "FileStream", "Starting at byte " + std::to_string(static_cast<long long>(current_head)));
     
     file.seekg(0, std::ios::end);
     end = file.tellg();
     file_size = end;
     
-    log_message(DEBUG_INFO, "FileStream", "File size is " + std::to_string(static_cast<long long>(end)) + " bytes");
-    log_message(DEBUG_DEBUG, "FileStream", "Data portion is " + 
+    LOG_MESSAGE(DEBUG_INFO, "FileStream", "File size is " + std::to_string(static_cast<long long>(end)) + " bytes");
+    LOG_MESSAGE(DEBUG_DEBUG, "FileStream", "Data portion is " + 
                 std::to_string(static_cast<long long>(end - current_head)) + " bytes (" + 
                 std::to_string(100.0 * (end - current_head) / end) + "% of file)");
     
@@ -63,20 +87,113 @@ file_stream::file_stream(const char *fname, uint32_t num_fpgas) {
     packets_processed = 0;
 }
 
+// Reads the text header up to the second delimiter line, returns false if the file ends first
+bool file_stream::parse_header() {
+    file.clear();
+    file.seekg(0, std::ios::beg);
+    // Read until '##################################################' is found twice
+    std::string line;
+    int hashline_count = 0;
+    int lines_read = 0;
+    
+    while (hashline_count < 2 && std::getline(file, line)) {
+        lines_read++;
+        LOG_MESSAGE(DEBUG_TRACE, "FileStream", "Header line " + std::to_string(lines_read) + ": " + line);
+        parse_header_line(line, hashline_count);
+    }
+    if (hashline_count < 2) {
+        LOG_MESSAGE(DEBUG_DEBUG, "FileStream", "Header incomplete after " + std::to_string(lines_read) + " lines");
+        return false;
+    }
+    return true;
+}
+
 file_stream::~file_stream() {
     file.close();
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+#endif
+}
+
+std::streamoff file_stream::bytes_available() {
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::streamoff available = file.tellg() - current_head;
+    if (file.tellg() > end) {
+        // The file grew while following, keep the progress and statistics in step
+        end = file.tellg();
+        file_size = end;
+        last_growth = std::chrono::steady_clock::now();
+        if (stats) {
+            stats->set_total_bytes(file_size);
+        }
+    }
+    return available;
+}
+
+// True once a followed run is over: the end marker exists, nothing was written for the
+// timeout, or the stream was interrupted
+bool file_stream::follow_finished() {
+    if (interrupted) {
+        LOG_MESSAGE(DEBUG_INFO, "FileStream", "Interrupted while waiting for data");
+        return true;
+    }
+    if (std::filesystem::exists(follow.end_marker)) {
+        LOG_MESSAGE(DEBUG_INFO, "FileStream", "Found end of run marker " + follow.end_marker);
+        return true;
+    }
+    double idle = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_growth).count();
+    if (follow.timeout > 0 && idle > follow.timeout) {
+        LOG_MESSAGE(DEBUG_WARNING, "FileStream", "No new data for " + std::to_string(follow.timeout) + " s, giving up");
+        return true;
+    }
+    return false;
+}
+
+// Sleeps until the file is written to or the poll interval passes
+void file_stream::wait_for_change() {
+    int timeout_ms = std::max(1, (int)(follow.poll_interval * 1000));
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        pollfd pfd = {inotify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            // Only the wake up matters, drop the queued events
+            char events[4096];
+            while (read(inotify_fd, events, sizeof(events)) > 0) {}
+        }
+        return;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+}
+
+// Blocks until `needed` bytes past the current head are in the file, returns false if the run ends first
+bool file_stream::wait_for_data(std::streamoff needed) {
+    while (bytes_available() < needed) {
+        if (follow_finished()) {
+            // Anything written before the marker appeared is already in the file
+            return bytes_available() >= needed;
+        }
+        wait_for_change();
+    }
+    return true;
 }
 
 int file_stream::read_packet(uint8_t *buffer) {
     uint32_t packet_size = 1452;
-    // Check if PACKET_SIZE bytes are available to read
+    // Check if PACKET_SIZE bytes are available to read, waiting for the DAQ when following
     file.seekg(0, std::ios::end);
-    if (file.tellg() - current_head < packet_size) {
+    if (file.tellg() - current_head < packet_size && !(follow.enabled && wait_for_data(packet_size))) {
         file.seekg(current_head, std::ios::beg);
         bytes_remaining = file.tellg() - current_head;
-        log_message(DEBUG_INFO, "\nFILE STREAM: Reached end of file with " + 
+        LOG_MESSAGE(DEBUG_INFO, "\nFILE STREAM: Reached end of file with " + 
                     std::to_string(static_cast<long long>(file.tellg() - current_head)) + " bytes remaining");
-        log_message(DEBUG_INFO, "current head is " + std::to_string(static_cast<long long>(current_head)));
+        LOG_MESSAGE(DEBUG_INFO, "current head is " + std::to_string(static_cast<long long>(current_head)));
+        if (stats) {
+            stats->set_bytes_remaining(bytes_remaining);
+        }
         return 0;   // Not enough bytes to read
     }
     file.seekg(current_head, std::ios::beg);    // Return to current point in file
@@ -85,28 +202,36 @@ int file_stream::read_packet(uint8_t *buffer) {
 
     if ((float)current_head / (float)end > current_percent + 0.0001) {
         current_percent = (float)current_head / (float)end;
-        log_message(DEBUG_DEBUG, "\rFILE STREAM: " + std::to_string((int)(100 * (float) current_head / (float)end)) + "% complete");
+        LOG_MESSAGE(DEBUG_DEBUG, "\rFILE STREAM: " + std::to_string((int)(100 * (float) current_head / (float)end)) + "% complete");
     }
 
     // Check if the read was successful
     if (file.rdstate() & std::ifstream::failbit || file.rdstate() & std::ifstream::badbit) {
         if (std::ifstream::failbit) {
-                log_message(DEBUG_ERROR, "Error reading line - failbit");
+                LOG_MESSAGE(DEBUG_ERROR, "Error reading line - failbit");
         }
         if (std::ifstream::badbit) {
-                log_message(DEBUG_ERROR, "Error reading line - badbit");
+                LOG_MESSAGE(DEBUG_ERROR, "Error reading line - badbit");
         }
         if (std::ifstream::eofbit) {
-                log_message(DEBUG_ERROR, "Error reading line - eofbit");
+                LOG_MESSAGE(DEBUG_ERROR, "Error reading line - eofbit");
         }
         perror("bad read");
         return 0;
     }
-    packets_processed++;
-    // Check if this is a heartbeat packet
-    if (buffer[0] == 0x23 && buffer[1] == 0x23 && buffer[2] == 0x23 && buffer[3] == 0x23) {
-        log_message(DEBUG_TRACE, "FileStream", "Heartbeat packet");
-        return 2;
+    return finish_packet(buffer);
+}
+
+bool file_stream::skip_packets(int64_t count) {
+    std::streamoff needed = count * PACKET_SIZE;
+    if (bytes_available() < needed && !(follow.enabled && wait_for_data(needed))) {
+        LOG_MESSAGE(DEBUG_ERROR, "FileStream", file_name + " ends before packet " + std::to_string(count));
+        return false;
     }
-    return 1;
+    current_head += needed;
+    file.seekg(current_head, std::ios::beg);
+    packets_processed += count;
+    LOG_MESSAGE(DEBUG_INFO, "FileStream", "Skipped " + std::to_string(count) + " packets to byte " +
+                std::to_string(static_cast<long long>(current_head)));
+    return true;
 }
@@ -1,32 +1,54 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <string>
 #include "debug_logger.h"
+#include "stat_logger.h"
+#include "packet_source.h"
 
-class file_stream {
+// Follow a run that the DAQ is still writing instead of stopping at the end of the file
+struct follow_config {
+    bool enabled = false;
+    double timeout = 0;             // Seconds without new data before giving up, 0 waits forever
+    double poll_interval = 0.2;     // Seconds between checks for the end marker and timeout
+    std::string end_marker;         // The run is over once this file exists, default <file>.done
+};
+
+class file_stream : public packet_source {
 private:
     std::ifstream file;
+    std::string file_name;
     std::streampos current_head;
     std::streampos end;
-    int file_size;
-    int bytes_remaining;
+    int64_t file_size;
+    int64_t bytes_remaining;
     float current_percent;
-    int packets_processed;
-
-    int number_samples;
     
     uint32_t num_fpgas;
 
+    follow_config follow;
+    int inotify_fd;
+    std::chrono::steady_clock::time_point last_growth;
+
+    bool parse_header();
+    std::streamoff bytes_available();
+    bool wait_for_data(std::streamoff needed);
+    void wait_for_change();
+    bool follow_finished();
+
 public:
-    file_stream(const char *fname, uint32_t num_fpgas);
+    file_stream(const char *fname, uint32_t num_fpgas, const follow_config &follow = follow_config());
     ~file_stream();
 
-    int read_packet(uint8_t *buffer);
+    int read_packet(uint8_t *buffer) override;
+    bool skip_packets(int64_t count) override;
     void print_packet_numbers();
-    int get_num_packets() {return packets_processed;}
-    int get_file_size() {return file_size;};
-    int get_bytes_remaining() {return bytes_remaining;}
-    int get_number_samples() {return number_samples;}
+    int64_t get_file_size() {return file_size;};
+    int64_t get_bytes_remaining() {return bytes_remaining;}
+    int64_t get_size() override {return file_size;}
+    bool is_live() override {return follow.enabled;}
 };
@@ -14,21 +14,151 @@ tlprotzman@gmail.com
 #include "tree_writer.h"
 #include "hgc_decoder.h"
 #include "debug_logger.h"
+#include "stage_profiler.h"
+#include "trace_recorder.h"
+#include "batch_runner.h"
+#include "run_logbook.h"
 
+#include <algorithm>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <getopt.h>
 #include <iostream>
 
+// "N-M", "N-" or "N", sets last to -1 for an open end; false if it is none of these
+bool parse_range(const std::string &text, int64_t &first, int64_t &last) {
+    try {
+        size_t dash = text.find('-');
+        size_t used = 0;
+        first = std::stoll(text.substr(0, dash), &used);
+        if (used != std::min(dash, text.size()) || first < 0) {
+            return false;
+        }
+        if (dash == std::string::npos) {
+            last = first;
+        } else if (dash + 1 == text.size()) {
+            last = -1;
+        } else {
+            last = std::stoll(text.substr(dash + 1), &used);
+            if (used != text.size() - dash - 1 || last < first) {
+                return false;
+            }
+        }
+        return true;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+// "LAYERS" or "LAYERS:ADC", leaves threshold alone without the ADC; false if it is neither
+bool parse_trigger(const std::string &text, int &layers, double &threshold) {
+    try {
+        size_t colon = text.find(':');
+        size_t used = 0;
+        layers = std::stoi(text.substr(0, colon), &used);
+        if (used != std::min(colon, text.size()) || layers < 1 || layers > 64) {
+            return false;
+        }
+        if (colon != std::string::npos) {
+            threshold = std::stod(text.substr(colon + 1), &used);
+            if (used != text.size() - colon - 1 || threshold < 0) {
+                return false;
+            }
+        }
+        return true;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+// "NAME" or "NAME:SLOTS", leaves slots alone without them; false if it is neither
+bool parse_ring(const std::string &text, std::string &name, int &slots) {
+    size_t colon = text.rfind(':');
+    name = text.substr(0, colon);
+    if (name.empty()) {
+        return false;
+    }
+    if (colon == std::string::npos) {
+        return true;
+    }
+    try {
+        size_t used = 0;
+        slots = std::stoi(text.substr(colon + 1), &used);
+        return used == text.size() - colon - 1 && slots > 0;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+// "SECONDS" or "SECONDS:THREADS", leaves threads alone without them; false if it is neither
+bool parse_dqm(const std::string &text, double &interval, int &threads) {
+    try {
+        size_t colon = text.find(':');
+        size_t used = 0;
+        interval = std::stod(text.substr(0, colon), &used);
+        if (used != std::min(colon, text.size()) || !(interval > 0)) {
+            return false;
+        }
+        if (colon != std::string::npos) {
+            threads = std::stoi(text.substr(colon + 1), &used);
+            if (used != text.size() - colon - 1 || threads < 1) {
+                return false;
+            }
+        }
+        return true;
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
 void print_usage() {
-    std::cout << "Usage: h2g_decode -r <run_number> [-d <detector_id>] [-n <num_kcu>] [-g] [-G LEVEL] [-T]" << std::endl;
-    std::cout << "  -r, --run         Run number (required)" << std::endl;
+    std::cout << "Usage: h2g_decode (-r <run_number> | -R RUNS [-j JOBS]) [-L LOGBOOK] [-d <detector_id>] [-n <num_kcu>] [-g] [-G LEVEL] [-T] [-b] [-H ADC [-p PEDESTALS]] [-m LAYERS[:ADC] [-O]] [-Q NAME[:SLOTS]] [-D SECONDS[:THREADS]] [-l FILE] [-P] [-t FILE] [-S SECONDS] [-J FILE] [-M FILE] [-e N-M | -W T0-T1] [-x] [-C SECONDS] [-F [-w SECONDS] [-E FILE]] [-i INPUT [-s SAMPLES]]" << std::endl;
+    std::cout << "  -r, --run         Run number (required unless -R is given)" << std::endl;
+    std::cout << "  -R, --runs        Decode a batch of runs: a list like 12,15-20,31 or @FILE with one run per line" << std::endl;
+    std::cout << "  -j, --jobs        Runs decoded at once in a batch (default: one per hardware thread)" << std::endl;
+    std::cout << "  -L, --logbook     Take each run's detector, KCUs and samples from this logbook CSV" << std::endl;
+    std::cout << "                      (-d and -n are used for runs and columns it does not have)" << std::endl;
     std::cout << "  -d, --detector    Detector ID (default: 0, LFHCAL: 1, EEEMCAL: 2)" << std::endl;
     std::cout << "  -n, --num-kcu     Number of KCUs (default: 4)" << std::endl;
     std::cout << "  -g, --debug       Enable debug output with INFO level" << std::endl;
     std::cout << "  -G, --debug-level Set debug level explicitly:" << std::endl;
     std::cout << "                      0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -l, --log-file    Write debug output to FILE from a background thread" << std::endl;
     std::cout << "  -T, --truncate    Enable ADC truncation" << std::endl;
+    std::cout << "  -P, --profile     Time each decode stage and print a summary at the end" << std::endl;
+    std::cout << "  -t, --trace       Write a Chrome/Perfetto trace of the pipeline stages to FILE" << std::endl;
+    std::cout << "  -S, --stats-interval Print live rates and loss every SECONDS" << std::endl;
+    std::cout << "  -J, --json-stats  Append statistics snapshots to FILE as JSON lines" << std::endl;
+    std::cout << "                      (for a batch, one line per run and the totals at the end)" << std::endl;
+    std::cout << "  -M, --prometheus  Write statistics to FILE in Prometheus text format" << std::endl;
+    std::cout << "                      (both are updated every -S SECONDS and at the end of the run)" << std::endl;
+    std::cout << "  -b, --binary      Also write memory-mappable .h2d output" << std::endl;
+    std::cout << "  -H, --hits        Also write the channels at least ADC counts over pedestal to RunXXX.h2h" << std::endl;
+    std::cout << "                      (and a hits tree in the ROOT output)" << std::endl;
+    std::cout << "  -p, --pedestals   Find hits (-H, -m) with the RunXXX.ped of an earlier run (default: this run's own)" << std::endl;
+    std::cout << "  -m, --mip-trigger Also write events with hits in LAYERS layers of an LFHCal column to" << std::endl;
+    std::cout << "                      RunXXX_mip.h2d, a hit being ADC counts over pedestal (default: 20)" << std::endl;
+    std::cout << "  -O, --mip-only    Write only those events, to every output, instead of RunXXX_mip.h2d" << std::endl;
+    std::cout << "  -Q, --ring        Publish every event to the shared memory ring /dev/shm/NAME for h2g_monitor" << std::endl;
+    std::cout << "                      and other readers, keeping the last SLOTS events (default: 256)" << std::endl;
+    std::cout << "  -D, --dqm         Fill ADC, TOA and TOT spectra, occupancy and hamming errors of each channel" << std::endl;
+    std::cout << "                      on THREADS threads (default: 1) and write them to RunXXX.dqm every SECONDS" << std::endl;
+    std::cout << "  -e, --events      Only write events N to M (N- for the rest of the run)" << std::endl;
+    std::cout << "  -W, --time-window Only write events whose KCU 0 timestamp is from T0 to T1" << std::endl;
+    std::cout << "                      (both seek with $OUTPUT_DIRECTORY/RunXXX.idx if it exists" << std::endl;
+    std::cout << "                      and stop once past the end)" << std::endl;
+    std::cout << "  -x, --index       Also write the RunXXX.idx packet index used by -e and -W" << std::endl;
+    std::cout << "  -C, --checkpoint  Checkpoint every SECONDS and on ctrl-c to $OUTPUT_DIRECTORY/RunXXX.ckpt," << std::endl;
+    std::cout << "                      and resume from it when there is one; ROOT output is split" << std::endl;
+    std::cout << "                      into RunXXX.root, RunXXX_1.root, ... at each checkpoint" << std::endl;
+    std::cout << "  -F, --follow      Keep decoding while the DAQ appends to the run file" << std::endl;
+    std::cout << "  -w, --follow-timeout Stop following after SECONDS without new data (default: wait forever)" << std::endl;
+    std::cout << "  -E, --end-marker  Stop following once FILE exists (default: <run file>.done)" << std::endl;
+    std::cout << "  -i, --input       Read packets from INPUT instead of $DATA_DIRECTORY/RunXXX.h2g:" << std::endl;
+    std::cout << "                      - for stdin, a FIFO or other stream, or udp://HOST:PORT" << std::endl;
+    std::cout << "                      (-w SECONDS also stops these after SECONDS without data)" << std::endl;
+    std::cout << "  -s, --samples     Number of samples, for UDP or a stream without the text header" << std::endl;
     std::cout << "  -h, --help        Show this help message" << std::endl;
 }
 
@@ -38,24 +168,83 @@ int main(int argc, char **argv) {
     int num_kcu = 4;       // Default value 4
     int debug_level = 0;   // Default value off
     bool adc_truncation = false; // Default value false
+    bool binary_output = false; // Default value false
+    std::string log_file;  // Default value console
+    std::string trace_file;  // Default value no trace
+    double stats_interval = 0;  // Default value no live statistics
+    std::string json_stats_file;  // Default value no JSON export
+    std::string prometheus_file;  // Default value no Prometheus export
+    follow_config follow;  // Default value stop at the end of the file
+    std::string input;  // Default value the run file
+    int input_samples = 0;  // Default value read from the header
+    std::string run_list;  // Default value a single run
+    unsigned jobs = 0;  // Default value one per hardware thread
+    std::string logbook_file;  // Default value configure from the command line only
+    double checkpoint_interval = 0;  // Default value no checkpoints
+    int64_t first_event = -1, last_event = -1;  // Default value every event
+    int64_t first_timestamp = -1, last_timestamp = -1;  // Default value every event
+    bool write_index = false;  // Default value no index
+    double hit_threshold = -1;  // Default value no hits
+    std::string pedestal_input;  // Default value the run's own pedestals
+    int trigger_layers = 0;  // Default value no trigger
+    double trigger_threshold = 20;  // Default value as draw_waveforms.cxx
+    bool trigger_only = false;  // Default value write every event
+    std::string ring_name;  // Default value no ring
+    int ring_slots = 256;  // Default value about 12 MB for 4 KCUs and 10 samples
+    double dqm_interval = 0;  // Default value no online histograms
+    int dqm_threads = 1;  // Default value one histogramming thread
     
     const struct option long_options[] = {
         {"run", required_argument, nullptr, 'r'},
+        {"runs", required_argument, nullptr, 'R'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"logbook", required_argument, nullptr, 'L'},
         {"detector", required_argument, nullptr, 'd'},
         {"num-kcu", required_argument, nullptr, 'n'},
         {"debug", optional_argument, nullptr, 'g'},
         {"debug-level", required_argument, nullptr, 'G'},
+        {"log-file", required_argument, nullptr, 'l'},
         {"truncate", no_argument, nullptr, 'T'},
+        {"binary", no_argument, nullptr, 'b'},
+        {"profile", no_argument, nullptr, 'P'},
+        {"trace", required_argument, nullptr, 't'},
+        {"stats-interval", required_argument, nullptr, 'S'},
+        {"json-stats", required_argument, nullptr, 'J'},
+        {"prometheus", required_argument, nullptr, 'M'},
+        {"events", required_argument, nullptr, 'e'},
+        {"time-window", required_argument, nullptr, 'W'},
+        {"index", no_argument, nullptr, 'x'},
+        {"hits", required_argument, nullptr, 'H'},
+        {"pedestals", required_argument, nullptr, 'p'},
+        {"mip-trigger", required_argument, nullptr, 'm'},
+        {"mip-only", no_argument, nullptr, 'O'},
+        {"ring", required_argument, nullptr, 'Q'},
+        {"dqm", required_argument, nullptr, 'D'},
+        {"checkpoint", required_argument, nullptr, 'C'},
+        {"follow", no_argument, nullptr, 'F'},
+        {"follow-timeout", required_argument, nullptr, 'w'},
+        {"end-marker", required_argument, nullptr, 'E'},
+        {"input", required_argument, nullptr, 'i'},
+        {"samples", required_argument, nullptr, 's'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "r:d:n:g::G:Th", long_options, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "r:R:j:L:d:n:g::G:l:TbPt:S:J:M:e:W:xH:p:m:OQ:D:C:Fw:E:i:s:h", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'r':
                 run_number = std::stoi(optarg);
                 break;
+            case 'R':
+                run_list = optarg;
+                break;
+            case 'j':
+                jobs = std::stoul(optarg);
+                break;
+            case 'L':
+                logbook_file = optarg;
+                break;
             case 'd':
                 det = std::stoi(optarg);
                 break;
@@ -63,7 +252,7 @@ int main(int argc, char **argv) {
                 if (optarg) {
                     debug_level = std::stoi(optarg);
                     if (debug_level < DEBUG_OFF || debug_level > DEBUG_TRACE) {
-                        log_message(DEBUG_ERROR, "Invalid debug level. Using INFO level (3).");
+                        LOG_MESSAGE(DEBUG_ERROR, "Invalid debug level. Using INFO level (3).");
                         debug_level = DEBUG_INFO;
                     }
                 } else {
@@ -73,16 +262,109 @@ int main(int argc, char **argv) {
             case 'G':
                 debug_level = std::stoi(optarg);
                 if (debug_level < DEBUG_OFF || debug_level > DEBUG_TRACE) {
-                    log_message(DEBUG_ERROR, "Invalid debug level. Using INFO level (3).");
+                    LOG_MESSAGE(DEBUG_ERROR, "Invalid debug level. Using INFO level (3).");
                     debug_level = DEBUG_INFO;
                 }
                 break;
+            case 'l':
+                log_file = optarg;
+                break;
             case 'n':
                 num_kcu = std::stoi(optarg);
                 break;
             case 'T':
                 adc_truncation = true;
                 break;
+            case 'b':
+                binary_output = true;
+                break;
+            case 'P':
+                stage_profiler::enable(true);
+                break;
+            case 't':
+                trace_file = optarg;
+                break;
+            case 'S':
+                stats_interval = std::stod(optarg);
+                break;
+            case 'J':
+                json_stats_file = optarg;
+                break;
+            case 'M':
+                prometheus_file = optarg;
+                break;
+            case 'e':
+                if (!parse_range(optarg, first_event, last_event)) {
+                    LOG_MESSAGE(DEBUG_ERROR, "Bad event range " + std::string(optarg));
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'W':
+                if (!parse_range(optarg, first_timestamp, last_timestamp)) {
+                    LOG_MESSAGE(DEBUG_ERROR, "Bad time window " + std::string(optarg));
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'x':
+                write_index = true;
+                break;
+            case 'H':
+                hit_threshold = std::stod(optarg);
+                if (hit_threshold < 0) {
+                    LOG_MESSAGE(DEBUG_ERROR, "The hit threshold cannot be negative");
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'p':
+                pedestal_input = optarg;
+                break;
+            case 'm':
+                if (!parse_trigger(optarg, trigger_layers, trigger_threshold)) {
+                    LOG_MESSAGE(DEBUG_ERROR, "Bad trigger " + std::string(optarg) + ", expected 1 to 64 layers");
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'O':
+                trigger_only = true;
+                break;
+            case 'Q':
+                if (!parse_ring(optarg, ring_name, ring_slots)) {
+                    LOG_MESSAGE(DEBUG_ERROR, "Bad ring " + std::string(optarg) + ", expected NAME or NAME:SLOTS");
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'D':
+                if (!parse_dqm(optarg, dqm_interval, dqm_threads)) {
+                    LOG_MESSAGE(DEBUG_ERROR, "Bad histogramming " + std::string(optarg) + ", expected SECONDS or SECONDS:THREADS");
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'C':
+                checkpoint_interval = std::stod(optarg);
+                break;
+            case 'F':
+                follow.enabled = true;
+                break;
+            case 'w':
+                follow.enabled = true;
+                follow.timeout = std::stod(optarg);
+                break;
+            case 'E':
+                follow.enabled = true;
+                follow.end_marker = optarg;
+                break;
+            case 'i':
+                input = optarg;
+                break;
+            case 's':
+                input_samples = std::stoi(optarg);
+                break;
             case 'h':
                 print_usage();
                 return 0;
@@ -94,10 +376,16 @@ int main(int argc, char **argv) {
 
     // Set the global debug level
     DebugLogger::getInstance()->setLevel(debug_level);
+    if (!log_file.empty()) {
+        DebugLogger::getInstance()->enableAsync(log_file);
+    }
+    if (!trace_file.empty()) {
+        trace_recorder::enable(trace_file);
+    }
 
     // Check if required parameter run_number was provided
-    if (run_number == -1) {
-        log_message(DEBUG_ERROR, "Run number (-r) is required");
+    if (run_number == -1 && run_list.empty()) {
+        LOG_MESSAGE(DEBUG_ERROR, "Run number (-r) is required");
         print_usage();
         return 1;
     }
@@ -105,19 +393,20 @@ int main(int argc, char **argv) {
     // Check if DATA_DIRECTORY is set
     const char *data_directory = std::getenv("DATA_DIRECTORY");
     if (data_directory == nullptr) {
-        log_message(DEBUG_WARNING, "DATA_DIRECTORY environment variable is not set.");
-        log_message(DEBUG_WARNING, "Setting to current directory.");
+        LOG_MESSAGE(DEBUG_WARNING, "DATA_DIRECTORY environment variable is not set.");
+        LOG_MESSAGE(DEBUG_WARNING, "Setting to current directory.");
         data_directory = ".";
     }
     // Check if OUTPUT_DIRECTORY is set
     const char *output_directory = std::getenv("OUTPUT_DIRECTORY");
     if (output_directory == nullptr) {
-        log_message(DEBUG_WARNING, "OUTPUT_DIRECTORY environment variable is not set.");
-        log_message(DEBUG_WARNING, "Setting to current directory.");
+        LOG_MESSAGE(DEBUG_WARNING, "OUTPUT_DIRECTORY environment variable is not set.");
+        LOG_MESSAGE(DEBUG_WARNING, "Setting to current directory.");
         output_directory = ".";
     }
 
-    log_message(DEBUG_INFO, "Running h2g_decode with run number " + std::to_string(run_number) + 
+    LOG_MESSAGE(DEBUG_INFO, "Running h2g_decode with " +
+              (run_list.empty() ? "run number " + std::to_string(run_number) : "runs " + run_list) +
               ", detector ID " + std::to_string(det) + 
               ", num KCU " + std::to_string(num_kcu) + 
               ", debug level " + std::to_string(debug_level) +
@@ -125,21 +414,108 @@ int main(int argc, char **argv) {
               ", data directory " + std::string(data_directory) + 
               ", and output directory " + std::string(output_directory));
     
+    if (!pedestal_input.empty() && hit_threshold < 0 && trigger_layers == 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "-p only applies to hit finding, it is ignored without -H or -m");
+    }
+    if (trigger_only && trigger_layers == 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "-O needs a trigger (-m)");
+        print_usage();
+        return 1;
+    }
+
     config cfg;
     cfg.run_number = run_number;
     cfg.detector_id = det;
     cfg.num_kcu = num_kcu;
     cfg.debug_level = debug_level;
     cfg.adc_truncation = adc_truncation;
-    char file_name[256];
-    snprintf(file_name, 256, "%s/Run%03d.h2g", data_directory, run_number);
-    cfg.file_name = std::string(file_name);
-    char output_file_name[256];
-    snprintf(output_file_name, 256, "%s/Run%03d.root", output_directory, run_number);
-    cfg.output_file_name = std::string(output_file_name);
-
-    test_line_builder(cfg);
-    return 0;
+    cfg.binary_output = binary_output;
+    cfg.stats_interval = stats_interval;
+    cfg.json_stats_file_name = json_stats_file;
+    cfg.prometheus_file_name = prometheus_file;
+    cfg.follow = follow;
+    cfg.input = input;
+    cfg.input_samples = input_samples;
+    cfg.input_timeout = follow.timeout;
+    cfg.pool = nullptr;
+    cfg.expected_samples = 0;
+    cfg.checkpoint_interval = checkpoint_interval;
+    cfg.first_event = first_event;
+    cfg.last_event = last_event;
+    cfg.first_timestamp = first_timestamp;
+    cfg.last_timestamp = last_timestamp;
+    cfg.write_index = write_index;
+    cfg.hit_threshold = hit_threshold;
+    cfg.pedestal_input = pedestal_input;
+    cfg.trigger_layers = trigger_layers;
+    cfg.trigger_threshold = trigger_threshold;
+    cfg.trigger_only = trigger_only;
+    cfg.ring_name = ring_name;
+    cfg.ring_slots = ring_slots;
+    cfg.dqm_interval = dqm_interval;
+    cfg.dqm_threads = dqm_threads;
+    cfg.stop_after_packets = -1;
+
+    run_logbook *logbook = nullptr;
+    if (!logbook_file.empty()) {
+        try {
+            logbook = new run_logbook(logbook_file);
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, e.what());
+            return 1;
+        }
+    }
+
+    if (!run_list.empty()) {
+        std::vector<int> runs;
+        try {
+            runs = parse_run_list(run_list);
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, e.what());
+            return 1;
+        }
+        if (follow.enabled || !input.empty()) {
+            LOG_MESSAGE(DEBUG_ERROR, "-F and -i decode a single run, they cannot be used with -R");
+            return 1;
+        }
+        if (!ring_name.empty()) {
+            LOG_MESSAGE(DEBUG_ERROR, "-Q publishes a single run, it cannot be used with -R");
+            return 1;
+        }
+        if (!prometheus_file.empty()) {
+            LOG_MESSAGE(DEBUG_WARNING, "-M is not supported for batches, use the -J report");
+        }
+        // Snapshots of every run would go to the same files, the batch writes its own report
+        cfg.json_stats_file_name.clear();
+        cfg.prometheus_file_name.clear();
+
+        batch_runner batch(cfg, data_directory, output_directory, jobs);
+        batch.set_logbook(logbook);
+        int failed = batch.run(runs);
+        batch.print_report(std::cout);
+        if (!json_stats_file.empty()) {
+            std::ofstream json(json_stats_file, std::ios::app);
+            batch.write_report_json(json);
+        }
+        if (stage_profiler::is_enabled()) {
+            stage_profiler::print_summary(std::cout);
+        }
+        trace_recorder::finish();
+        DebugLogger::getInstance()->disableAsync();
+        delete logbook;
+        return failed > 0 ? 1 : 0;
+    }
+
+    set_run_files(cfg, data_directory, output_directory);
+    if (logbook && !logbook->configure(cfg)) {
+        LOG_MESSAGE(DEBUG_WARNING, "Run " + std::to_string(run_number) + " is not in the logbook, using -d and -n");
+    }
+    delete logbook;
+
+    run_summary summary = test_line_builder(cfg);
+    trace_recorder::finish();
+    DebugLogger::getInstance()->disableAsync();
+    return summary.ok ? 0 : 1;
 
     // run_event_builder(argv[1]);
 }
\ No newline at end of file
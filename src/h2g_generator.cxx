@@ -0,0 +1,239 @@
+#include "h2g_generator.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+h2g_generator::h2g_generator(const generator_config &cfg) : cfg(cfg), rng(cfg.seed) {
+    out = nullptr;
+    timestamp_mask = cfg.timestamp_bits >= 32 ? 0xFFFFFFFF : (1u << cfg.timestamp_bits) - 1;
+    kcu_lines.resize(cfg.num_kcu);
+    packet_sequence = 0;
+    event_counter = 0;
+    packets_written = 0;
+    packets_dropped = 0;
+    packets_delayed = 0;
+    heartbeats_written = 0;
+}
+
+h2g_generator::~h2g_generator() {
+    if (out) {
+        fclose(out);
+    }
+}
+
+void h2g_generator::write(const std::string &file_name) {
+    out = fopen(file_name.c_str(), "wb");
+    if (out == nullptr) {
+        LOG_MESSAGE(DEBUG_ERROR, "Generator", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    LOG_MESSAGE(DEBUG_INFO, "Generator", "Writing " + std::to_string(cfg.num_events) + " events from " +
+                std::to_string(cfg.num_kcu) + " KCUs to " + file_name);
+    write_header();
+
+    // The waveform builder attaches a sample to a series that starts up to a full waveform
+    // later, so closer events would be merged; keep them at least two waveforms apart
+    double ticks_per_second = TICKS_PER_SAMPLE * 40e6;
+    uint64_t min_spacing = (2 * cfg.num_samples + 1) * TICKS_PER_SAMPLE;
+    std::exponential_distribution<double> spacing(cfg.rate / ticks_per_second);
+    uint64_t time = cfg.start_timestamp;
+    for (int64_t e = 0; e < cfg.num_events; e++) {
+        generate_event(time);
+        time += std::max(min_spacing, (uint64_t)spacing(rng));
+    }
+
+    for (int kcu = 0; kcu < cfg.num_kcu; kcu++) {
+        flush_kcu(kcu, true);
+    }
+    // Release whatever is still being held back
+    std::stable_sort(delayed.begin(), delayed.end(),
+                     [](const pending_packet &a, const pending_packet &b) {return a.release < b.release;});
+    for (auto &p : delayed) {
+        write_packet(p.data.data());
+    }
+    delayed.clear();
+
+    fclose(out);
+    out = nullptr;
+    LOG_MESSAGE(DEBUG_INFO, "Generator", "Wrote " + std::to_string(packets_written) + " data packets and " +
+                std::to_string(heartbeats_written) + " heartbeats, dropped " + std::to_string(packets_dropped) +
+                ", delayed " + std::to_string(packets_delayed));
+}
+
+void h2g_generator::write_header() {
+    fprintf(out, "# Synthetic data written by h2g_generate\n");
+    fprintf(out, "# KCUs: %d, events: %lld, rate: %g Hz, seed: %u\n",
+            cfg.num_kcu, (long long)cfg.num_events, cfg.rate, cfg.seed);
+    fprintf(out, "# Generator Setting machine_gun: %d\n", cfg.num_samples - 1);
+    fprintf(out, "##################################################\n");
+    fprintf(out, "##################################################\n");
+}
+
+void h2g_generator::generate_event(uint64_t start) {
+    // An all zero timestamp marks an idle line, so move the event off it
+    auto sample_time = [&](int s) {return (uint32_t)((start + s * TICKS_PER_SAMPLE) & timestamp_mask);};
+    for (bool moved = true; moved; ) {
+        moved = false;
+        for (int s = 0; s < cfg.num_samples; s++) {
+            if (sample_time(s) == 0) {
+                start++;
+                moved = true;
+                break;
+            }
+        }
+    }
+
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, 2);
+    std::vector<double> amplitude(36);
+    std::vector<double> pulse_start(36);
+    std::vector<uint32_t> adc(36 * cfg.num_samples);
+    std::vector<uint32_t> toa(36 * cfg.num_samples);
+    std::vector<uint32_t> tot(36 * cfg.num_samples);
+    double peak_sample = cfg.num_samples / 3;
+    const double shaping = 2;   // CR-RC^2 peaking time in samples
+
+    for (int kcu = 0; kcu < cfg.num_kcu; kcu++) {
+        for (int asic = 0; asic < 2; asic++) {
+            for (int half = 0; half < 2; half++) {
+                // Fill the waveforms of this asic half
+                for (int ch = 0; ch < 36; ch++) {
+                    amplitude[ch] = uniform(rng) < cfg.occupancy ? 20 + uniform(rng) * 1500 : 0;
+                    pulse_start[ch] = peak_sample - shaping + uniform(rng);
+                    bool crossed = false;
+                    for (int s = 0; s < cfg.num_samples; s++) {
+                        // Pedestals vary a little by channel but stay fixed for the run
+                        double pedestal = 60 + (kcu * 144 + asic * 72 + half * 36 + ch) * 7 % 40;
+                        double t = (s - pulse_start[ch]) / shaping;
+                        double signal = t > 0 ? amplitude[ch] * t * t * std::exp(2 * (1 - t)) : 0;
+                        double value = pedestal + noise(rng) + signal;
+                        int i = ch * cfg.num_samples + s;
+                        adc[i] = (uint32_t)std::clamp(value, 0.0, 1023.0);
+                        toa[i] = 0;
+                        tot[i] = 0;
+                        if (signal > 100 && !crossed) {
+                            crossed = true;
+                            toa[i] = 1 + (uint32_t)(uniform(rng) * 1022);
+                        }
+                        if (signal > 1023 - pedestal) {
+                            // TOT is a 12 bit counter sent as 10 bits, dropping the two low bits above 511
+                            uint32_t counts = std::min(4095, (int)(signal * 2));
+                            tot[i] = counts < 512 ? counts : 0x200 | (counts >> 3);
+                        }
+                    }
+                }
+
+                for (int s = 0; s < cfg.num_samples; s++) {
+                    uint64_t bunch = (start + s * TICKS_PER_SAMPLE) / TICKS_PER_SAMPLE;
+                    uint32_t bunch_counter = bunch % 3564;
+                    uint32_t orbit_counter = (bunch / 3564) & 0b111;
+                    uint32_t sample_counter = (event_counter + s) & 0b111111;
+                    uint32_t words[5][8];
+                    int ch = 0;
+                    for (int i = 0; i < 5; i++) {
+                        for (int j = 0; j < 8; j++) {
+                            if (i == 0 && j == 0) {
+                                words[i][j] = (0b0101u << 28) | (bunch_counter << 16) | (sample_counter << 10) |
+                                              (orbit_counter << 7) | 0b0101;
+                            } else if ((i == 0 && j == 1) || (i == 2 && j == 4) || (i == 4 && j == 7)) {
+                                words[i][j] = 0;    // cm, calib, and crc are not used by the decoder
+                            } else {
+                                int k = ch * cfg.num_samples + s;
+                                words[i][j] = (adc[k] << 20) | (tot[k] << 10) | toa[k];
+                                ch++;
+                            }
+                        }
+                    }
+                    for (int i = 0; i < 5; i++) {
+                        append_line(kcu, asic, half, i, sample_time(s), words[i]);
+                    }
+                }
+            }
+        }
+    }
+    event_counter = (event_counter + cfg.num_samples) & 0b111111;
+}
+
+void h2g_generator::append_line(int kcu, int asic, int half, int line_number, uint32_t timestamp, const uint32_t *words) {
+    auto &lines = kcu_lines[kcu];
+    lines.push_back(160 + asic);
+    lines.push_back(kcu);
+    lines.push_back(36 + half);
+    lines.push_back(line_number);
+    for (int b = 3; b >= 0; b--) {
+        lines.push_back((timestamp >> (8 * b)) & 0xFF);
+    }
+    for (int w = 0; w < 8; w++) {
+        for (int b = 3; b >= 0; b--) {
+            lines.push_back((words[w] >> (8 * b)) & 0xFF);
+        }
+    }
+    if (lines.size() == LINES_PER_PACKET * LINE_SIZE) {
+        flush_kcu(kcu, false);
+    }
+}
+
+void h2g_generator::flush_kcu(int kcu, bool pad) {
+    auto &lines = kcu_lines[kcu];
+    if (lines.empty() || (!pad && lines.size() < LINES_PER_PACKET * LINE_SIZE)) {
+        return;
+    }
+    // The decoder skips the packet header, so it is left zero filled
+    std::vector<uint8_t> packet(PACKET_SIZE, 0);
+    std::copy(lines.begin(), lines.end(), packet.begin() + PACKET_HEADER_SIZE);
+    // Idle lines have valid ids and a zero timestamp
+    for (size_t pos = PACKET_HEADER_SIZE + lines.size(); pos < PACKET_SIZE; pos += LINE_SIZE) {
+        packet[pos] = 160;
+        packet[pos + 1] = kcu;
+        packet[pos + 2] = 36;
+    }
+    lines.clear();
+    emit_packet(packet);
+}
+
+void h2g_generator::emit_packet(std::vector<uint8_t> &packet) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    packet_sequence++;
+    if (cfg.packet_loss > 0 && uniform(rng) < cfg.packet_loss) {
+        packets_dropped++;
+        return;
+    }
+    int64_t release = packet_sequence;
+    if (cfg.reorder > 0 && uniform(rng) < cfg.reorder) {
+        release += 1 + rng() % std::max(1, cfg.reorder_window);
+        packets_delayed++;
+    }
+    delayed.push_back({release, std::move(packet)});
+
+    // Write everything that is due, in release order
+    std::stable_sort(delayed.begin(), delayed.end(),
+                     [](const pending_packet &a, const pending_packet &b) {return a.release < b.release;});
+    size_t due = 0;
+    while (due < delayed.size() && delayed[due].release <= packet_sequence) {
+        write_packet(delayed[due].data.data());
+        due++;
+    }
+    delayed.erase(delayed.begin(), delayed.begin() + due);
+}
+
+void h2g_generator::write_packet(const uint8_t *packet) {
+    if (fwrite(packet, 1, PACKET_SIZE, out) != PACKET_SIZE) {
+        LOG_MESSAGE(DEBUG_ERROR, "Generator", "Error writing packet");
+        throw std::runtime_error("Error writing packet");
+    }
+    packets_written++;
+    if (cfg.heartbeat_interval > 0 && packets_written % cfg.heartbeat_interval == 0) {
+        write_heartbeat();
+    }
+}
+
+void h2g_generator::write_heartbeat() {
+    uint8_t packet[PACKET_SIZE] = {'#', '#', '#', '#'};
+    if (fwrite(packet, 1, PACKET_SIZE, out) != PACKET_SIZE) {
+        LOG_MESSAGE(DEBUG_ERROR, "Generator", "Error writing heartbeat");
+        throw std::runtime_error("Error writing packet");
+    }
+    heartbeats_written++;
+}
@@ -0,0 +1,91 @@
+/*
+Writes synthetic .h2g files for benchmarking and testing the decoder.
+
+The output has the same layout as a run taken with the DAQ: a text header with the
+machine_gun setting, then 1452 byte packets (a 12 byte header and 36 lines of 40 bytes),
+each packet holding lines from a single KCU.  Every sample of every asic/half is sent as
+5 lines carrying the sample header word, the 36 channels, and the cm/calib/crc words.
+Heartbeat packets, packet loss and packet reordering can be mixed in.
+
+Timestamps are assumed to tick 41 times per 25 ns bunch crossing, which is the spacing
+the waveform builder expects between consecutive samples.
+
+    generator_config cfg;
+    cfg.num_events = 100000;
+    cfg.packet_loss = 0.001;
+    h2g_generator gen(cfg);
+    gen.write("Run900.h2g");
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+struct generator_config {
+    int num_kcu = 4;
+    int num_samples = 10;
+    int64_t num_events = 1000;
+    double rate = 1000;                 // Mean event rate in Hz, event times are Poisson distributed
+    int timestamp_bits = 32;            // Timestamps wrap at 2^timestamp_bits
+    uint32_t start_timestamp = 1000;
+    double occupancy = 0.05;            // Chance a channel has a pulse in an event
+    double packet_loss = 0;             // Chance a data packet is dropped
+    double reorder = 0;                 // Chance a data packet is delayed
+    int reorder_window = 8;             // Maximum number of packets a delayed packet is held back
+    int heartbeat_interval = 0;         // Data packets between heartbeats, 0 for none
+    uint32_t seed = 1;
+};
+
+class h2g_generator {
+public:
+    static const int PACKET_SIZE = 1452;
+    static const int PACKET_HEADER_SIZE = 12;
+    static const int LINE_SIZE = 40;
+    static const int LINES_PER_PACKET = 36;
+    static const int TICKS_PER_SAMPLE = 41;
+
+private:
+    struct pending_packet {
+        int64_t release;
+        std::vector<uint8_t> data;
+    };
+
+    generator_config cfg;
+    std::mt19937_64 rng;
+    FILE *out;
+
+    uint32_t timestamp_mask;
+    std::vector<std::vector<uint8_t>> kcu_lines;    // Lines waiting to fill a packet, per KCU
+    std::vector<pending_packet> delayed;
+    int64_t packet_sequence;
+    uint32_t event_counter;
+
+    int64_t packets_written;
+    int64_t packets_dropped;
+    int64_t packets_delayed;
+    int64_t heartbeats_written;
+
+    void write_header();
+    void generate_event(uint64_t start);
+    void append_line(int kcu, int asic, int half, int line_number, uint32_t timestamp, const uint32_t *words);
+    void flush_kcu(int kcu, bool pad);
+    void emit_packet(std::vector<uint8_t> &packet);
+    void write_packet(const uint8_t *packet);
+    void write_heartbeat();
+
+public:
+    h2g_generator(const generator_config &cfg);
+    ~h2g_generator();
+
+    // Throws std::runtime_error if the file cannot be written
+    void write(const std::string &file_name);
+
+    int64_t get_packets_written() {return packets_written;}
+    int64_t get_packets_dropped() {return packets_dropped;}
+    int64_t get_packets_delayed() {return packets_delayed;}
+    int64_t get_heartbeats_written() {return heartbeats_written;}
+};
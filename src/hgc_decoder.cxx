@@ -4,112 +4,858 @@
 #include "event_aligner.h"
 #include "tree_writer.h"
 #include "stat_logger.h"
+#include "binary_writer.h"
+#include "stage_profiler.h"
+#include "checkpoint.h"
+#include "packet_index.h"
+#include "pedestal_accumulator.h"
+#include "hit_finder.h"
+#include "hit_writer.h"
+#include "track_trigger.h"
+#include "event_ring.h"
+#include "dqm_histogrammer.h"
 #include "hgc_decoder.h"
 
-#ifdef __APPLE__
-#include <os/log.h>
-#include <os/signpost.h>
-#endif
-
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <csignal>
-#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <memory>
 
 // catch ctrl-c
-bool stop = false;
+std::atomic<bool> stop(false);
 void signal_handler(int signal) {
     stop = true;
+    // A followed file may be blocked waiting for data
+    packet_source::interrupt();
 }
 
-void test_line_builder(config &cfg) {
-    // Set up signal handler for ctrl-c
-    std::signal(SIGINT, signal_handler);
-    
-    log_message(DEBUG_INFO, "Debug level: " + std::to_string(cfg.debug_level));
-    log_message(DEBUG_INFO, "Opening file: " + cfg.file_name);
-    
-    auto decoder = new hgc_decoder(cfg.file_name.c_str(), cfg.detector_id, cfg.num_kcu, cfg.debug_level, cfg.adc_truncation);
-    // Set up the decoder
-    if (decoder == nullptr) {
-        log_message(DEBUG_ERROR, "Failed to create decoder");
+bool stop_requested() {
+    return stop;
+}
+
+void set_run_files(config &cfg, const std::string &data_directory, const std::string &output_directory) {
+    char file_name[256];
+    snprintf(file_name, 256, "%s/Run%03d.h2g", data_directory.c_str(), cfg.run_number);
+    cfg.file_name = std::string(file_name);
+    // Archived runs may only be kept compressed
+    if (!cfg.follow.enabled && !std::filesystem::exists(cfg.file_name)) {
+        for (const char *extension : {".zst", ".gz"}) {
+            if (std::filesystem::exists(cfg.file_name + extension)) {
+                cfg.file_name += extension;
+                break;
+            }
+        }
+    }
+    char output_file_name[256];
+    snprintf(output_file_name, 256, "%s/Run%03d.root", output_directory.c_str(), cfg.run_number);
+    cfg.output_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.h2d", output_directory.c_str(), cfg.run_number);
+    cfg.binary_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.stats", output_directory.c_str(), cfg.run_number);
+    cfg.stats_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.ckpt", output_directory.c_str(), cfg.run_number);
+    cfg.checkpoint_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.idx", output_directory.c_str(), cfg.run_number);
+    cfg.index_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.ped", output_directory.c_str(), cfg.run_number);
+    cfg.pedestal_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.h2h", output_directory.c_str(), cfg.run_number);
+    cfg.hit_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d_mip.h2d", output_directory.c_str(), cfg.run_number);
+    cfg.mip_file_name = std::string(output_file_name);
+    snprintf(output_file_name, 256, "%s/Run%03d.dqm", output_directory.c_str(), cfg.run_number);
+    cfg.dqm_file_name = std::string(output_file_name);
+}
+
+namespace {
+const uint64_t CHECKPOINT_MAGIC = 0x3454504b43324848ULL;  // "HH2CKPT4"
+
+// Where a checkpointed run carries on from
+struct checkpoint_position {
+    int64_t events;
+    int root_chunk;
+    int64_t mip_events;     // Written to mip_file_name
+};
+
+// ROOT output of a checkpointed run is closed at every checkpoint and continued in the
+// next file, named as TTree::ChangeFile would: Run042.root, Run042_1.root, ...
+std::string chunk_file_name(const std::string &file_name, int chunk) {
+    if (chunk == 0) {
+        return file_name;
+    }
+    size_t dot = file_name.rfind(".root");
+    return file_name.substr(0, dot) + "_" + std::to_string(chunk) + file_name.substr(dot);
+}
+
+void write_checkpoint(const config &cfg, hgc_decoder *decoder, const pedestal_accumulator &pedestals,
+                      const checkpoint_position &position) {
+    checkpoint_writer out(cfg.checkpoint_file_name);
+    out.put(CHECKPOINT_MAGIC);
+    out.put<int32_t>(cfg.run_number);
+    out.put_string(cfg.file_name);
+    out.put<int32_t>(cfg.num_kcu);
+    out.put<int32_t>(decoder->get_num_samples());
+    out.put<int32_t>(cfg.detector_id);
+    out.put<uint8_t>(cfg.adc_truncation);
+    out.put<uint8_t>(cfg.binary_output);
+    out.put<double>(cfg.hit_threshold);
+    out.put_string(cfg.pedestal_input);
+    out.put<int32_t>(cfg.trigger_layers);
+    out.put<double>(cfg.trigger_threshold);
+    out.put(position.events);
+    out.put<int32_t>(position.root_chunk);
+    out.put(position.mip_events);
+    decoder->save_state(out);
+    pedestals.save_state(out);
+    out.commit();
+}
+
+// Timestamps of an event on every KCU, as the packet index records them
+std::vector<int64_t> event_timestamps(aligned_event *event) {
+    std::vector<int64_t> timestamps;
+    for (uint32_t i = 0; i < event->get_num_fpga(); i++) {
+        timestamps.push_back(event->get_event(i)->get_timestamp());
+    }
+    return timestamps;
+}
+
+checkpoint_position read_checkpoint(const config &cfg, hgc_decoder *decoder, pedestal_accumulator &pedestals) {
+    checkpoint_reader in(cfg.checkpoint_file_name);
+    if (in.get<uint64_t>() != CHECKPOINT_MAGIC) {
+        throw std::runtime_error(cfg.checkpoint_file_name + " is not a checkpoint");
+    }
+    if (in.get<int32_t>() != cfg.run_number || in.get_string() != cfg.file_name ||
+        in.get<int32_t>() != cfg.num_kcu || in.get<int32_t>() != decoder->get_num_samples() ||
+        in.get<int32_t>() != cfg.detector_id || in.get<uint8_t>() != cfg.adc_truncation ||
+        in.get<uint8_t>() != cfg.binary_output || in.get<double>() != cfg.hit_threshold ||
+        in.get_string() != cfg.pedestal_input || in.get<int32_t>() != cfg.trigger_layers ||
+        in.get<double>() != cfg.trigger_threshold) {
+        throw std::runtime_error("the checkpoint was written with different settings or input");
+    }
+    checkpoint_position position;
+    position.events = in.get<int64_t>();
+    position.root_chunk = in.get<int32_t>();
+    position.mip_events = in.get<int64_t>();
+    decoder->load_state(in);
+    pedestals.load_state(in);
+    return position;
+}
+}
+
+namespace {
+// The files a run writes, opened, numbered and closed together: the ROOT tree, and when
+// asked for the .h2d events, the .h2h hits and the events with a track.  The ROOT output of
+// a checkpointed run moves on to the next chunk file at every checkpoint.
+class output_set {
+    private:
+        const config &cfg;
+        int num_samples;
+        int root_chunk;
+        std::unique_ptr<event_writer> writer;
+        std::unique_ptr<binary_writer> bwriter;
+        std::unique_ptr<hit_writer> hwriter;
+        std::unique_ptr<binary_writer> mwriter;
+
+    public:
+        // A resumed run continues every file after the events of position.  Throws
+        // std::runtime_error if a file cannot be opened.
+        output_set(const config &cfg, int num_samples, const checkpoint_position &position, bool resumed);
+
+        void write_event(aligned_event *event, int64_t event_number);
+        // Of the event just written
+        void write_hits(const std::vector<h2h_hit> &hits);
+        void write_mip(aligned_event *event, int64_t event_number);
+        int64_t get_mip_events() const {return mwriter ? (int64_t)mwriter->get_num_events() : 0;}
+        bool has_mip() const {return mwriter != nullptr;}
+
+        // Makes everything written so far complete on disk and closes the ROOT file, for a
+        // checkpoint; throws std::runtime_error if a file cannot be written
+        void flush();
+        // Continues the ROOT output in the chunk file after a flush
+        void next_chunk(int chunk);
+        // Adds the pedestals tree to the ROOT output, to the first chunk as well
+        void write_pedestals(const pedestal_accumulator &pedestals);
+        void close();
+};
+
+output_set::output_set(const config &cfg, int num_samples, const checkpoint_position &position, bool resumed)
+    : cfg(cfg), num_samples(num_samples), root_chunk(position.root_chunk) {
+    LOG_MESSAGE(DEBUG_INFO, "Writing output to: " + cfg.output_file_name);
+    writer.reset(new event_writer(chunk_file_name(cfg.output_file_name, root_chunk), cfg.num_kcu, num_samples,
+                                  cfg.detector_id));
+    if (cfg.binary_output) {
+        LOG_MESSAGE(DEBUG_INFO, "Writing binary output to: " + cfg.binary_file_name);
+        bwriter.reset(new binary_writer(cfg.binary_file_name, cfg.num_kcu, num_samples, cfg.detector_id,
+                                        resumed ? position.events : -1));
+    }
+    if (cfg.hit_threshold >= 0) {
+        LOG_MESSAGE(DEBUG_INFO, "Writing hits to: " + cfg.hit_file_name);
+        hwriter.reset(new hit_writer(cfg.hit_file_name, cfg.num_kcu, num_samples, cfg.detector_id,
+                                     cfg.hit_threshold, resumed ? position.events : -1));
+    }
+    if (cfg.trigger_layers > 0 && !cfg.trigger_only) {
+        LOG_MESSAGE(DEBUG_INFO, "Writing events with a track to: " + cfg.mip_file_name);
+        mwriter.reset(new binary_writer(cfg.mip_file_name, cfg.num_kcu, num_samples, cfg.detector_id,
+                                        resumed ? position.mip_events : -1));
+    }
+}
+
+void output_set::write_event(aligned_event *event, int64_t event_number) {
+    scoped_timer timer(STAGE_WRITE_EVENT);
+    // Selected and triggered events are not consecutive, so each is numbered as it is written
+    writer->set_event_number(event_number);
+    writer->write_event(event);
+    if (bwriter) {
+        bwriter->set_event_number(event_number);
+        bwriter->write_event(event);
+    }
+    if (hwriter) {
+        hwriter->set_event_number(event_number);
+    }
+}
+
+void output_set::write_hits(const std::vector<h2h_hit> &hits) {
+    hwriter->write_event(hits);
+    writer->write_hits(hits);
+}
+
+void output_set::write_mip(aligned_event *event, int64_t event_number) {
+    if (mwriter) {
+        scoped_timer timer(STAGE_WRITE_EVENT);
+        mwriter->set_event_number(event_number);
+        mwriter->write_event(event);
+    }
+}
+
+void output_set::flush() {
+    if (bwriter) {
+        bwriter->flush();
+    }
+    if (hwriter) {
+        hwriter->flush();
+    }
+    if (mwriter) {
+        mwriter->flush();
+    }
+    writer.reset();
+}
+
+void output_set::next_chunk(int chunk) {
+    root_chunk = chunk;
+    writer.reset(new event_writer(chunk_file_name(cfg.output_file_name, root_chunk), cfg.num_kcu, num_samples,
+                                  cfg.detector_id));
+}
+
+void output_set::write_pedestals(const pedestal_accumulator &pedestals) {
+    if (writer) {
+        writer->write_pedestals(pedestals);
+    }
+    // Readers of a single file, such as draw_waveforms, open the first one
+    if (root_chunk > 0) {
+        add_pedestals(chunk_file_name(cfg.output_file_name, 0), pedestals);
+    }
+}
+
+void output_set::close() {
+    writer.reset();
+    bwriter.reset();
+    hwriter.reset();
+    mwriter.reset();
+}
+
+// Which events of a run are written, for -e and -t.  Part of a run starts from the index
+// when there is one, and after the seek the events have no number until one of them is
+// found in the index.
+class event_selection {
+    private:
+        const config &cfg;
+        bool active;
+        std::unique_ptr<packet_index> seek_index;
+        bool numbered;
+        int64_t sync_limit;
+
+    public:
+        enum verdict {WRITE, SKIP, STOP};
+
+        // Seeks the decoder towards the first selected event if the index allows
+        event_selection(const config &cfg, hgc_decoder *decoder);
+
+        bool is_active() const {return active;}
+        // Whether the event numbers are known, they are not until the decode is back in
+        // step with the index after a seek
+        bool is_numbered() const {return numbered;}
+        // Picks up event_number after a seek, and says what to do with the event
+        verdict check(aligned_event *event, int64_t &event_number, int64_t packets);
+};
+
+event_selection::event_selection(const config &cfg, hgc_decoder *decoder) : cfg(cfg) {
+    active = cfg.first_event >= 0 || cfg.last_event >= 0 || cfg.first_timestamp >= 0 || cfg.last_timestamp >= 0;
+    numbered = true;
+    sync_limit = -1;
+    if (!active || !cfg.input.empty()) {
         return;
     }
+    if (!std::filesystem::exists(cfg.index_file_name)) {
+        if (!cfg.index_file_name.empty()) {
+            LOG_MESSAGE(DEBUG_INFO, "No index at " + cfg.index_file_name + ", decoding from the start (-x writes one)");
+        }
+        return;
+    }
+    try {
+        seek_index.reset(new packet_index(cfg.index_file_name));
+    } catch (const std::exception &e) {
+        LOG_MESSAGE(DEBUG_WARNING, std::string(e.what()) + ", decoding from the start");
+        return;
+    }
+    if (seek_index->get_num_kcu() != cfg.num_kcu || seek_index->get_num_samples() != decoder->get_num_samples()) {
+        LOG_MESSAGE(DEBUG_WARNING, cfg.index_file_name + " was written with other settings, decoding from the start");
+        seek_index.reset();
+        return;
+    }
+    const index_entry *start = nullptr;
+    if (cfg.first_event >= 0) {
+        start = seek_index->start_for_event(cfg.first_event);
+    } else if (cfg.first_timestamp >= 0) {
+        start = seek_index->start_for_timestamp(cfg.first_timestamp);
+    }
+    if (start) {
+        LOG_MESSAGE(DEBUG_INFO, "Seeking to packet " + std::to_string(start->packets) + ", event " +
+                    std::to_string(start->events) + ", with " + cfg.index_file_name);
+        if (!decoder->seek(*start)) {
+            LOG_MESSAGE(DEBUG_WARNING, "The run is shorter than its index");
+        }
+        numbered = false;
+        sync_limit = seek_index->sync_limit(start);
+    }
+}
+
+event_selection::verdict event_selection::check(aligned_event *event, int64_t &event_number, int64_t packets) {
+    if (!active) {
+        return WRITE;
+    }
+    int64_t timestamp = event->get_event(0)->get_timestamp();
+    if (!numbered) {
+        int64_t number = seek_index->event_number(event_timestamps(event));
+        if (number >= 0) {
+            event_number = number;
+            numbered = true;
+            LOG_MESSAGE(DEBUG_DEBUG, "Numbering picked up at event " + std::to_string(event_number));
+        } else if (sync_limit >= 0 && packets > sync_limit) {
+            return STOP;
+        }
+    }
+    if (numbered && ((cfg.last_event >= 0 && event_number > cfg.last_event) ||
+                     (cfg.last_timestamp >= 0 && timestamp > cfg.last_timestamp))) {
+        LOG_MESSAGE(DEBUG_INFO, "Past the selected events, stopping");
+        return STOP;
+    }
+    // Reordered packets can leave events outside a time window between those in it
+    return numbered && event_number >= cfg.first_event && timestamp >= cfg.first_timestamp ? WRITE : SKIP;
+}
+
+// What is done with each event that is written: the pedestals, the monitors, hits and the
+// trigger, and the outputs
+class event_step {
+    private:
+        const config &cfg;
+        int num_samples;
+        pedestal_accumulator &pedestals;
+        std::unique_ptr<hit_finder> finder;
+        std::unique_ptr<track_trigger> trigger;
+        std::unique_ptr<hit_finder> own_trigger_finder;
+        hit_finder *trigger_finder;     // finder itself when its hits include all the trigger counts
+        std::unique_ptr<event_ring_writer> ring;
+        std::unique_ptr<dqm_histogrammer> dqm;
+        output_set *outputs;
+        int64_t tracks;
+
+        std::unique_ptr<hit_finder> make_finder(double threshold);
+
+    public:
+        // Throws std::runtime_error if the pedestals of -p cannot be read
+        event_step(const config &cfg, int num_samples, pedestal_accumulator &pedestals);
+
+        // Writes to outputs from now on, and starts the ring and the histograms
+        void start(output_set *outputs);
+        void process(aligned_event *event, int64_t event_number);
+        // Reports the tracks found and closes the monitors
+        void finish();
+};
+
+std::unique_ptr<hit_finder> event_step::make_finder(double threshold) {
+    std::unique_ptr<hit_finder> f(new hit_finder(cfg.num_kcu, num_samples, threshold));
+    if (cfg.pedestal_input.empty()) {
+        f->use_pedestals(&pedestals);
+    } else {
+        f->load_pedestals(cfg.pedestal_input);
+    }
+    return f;
+}
+
+event_step::event_step(const config &cfg, int num_samples, pedestal_accumulator &pedestals)
+    : cfg(cfg), num_samples(num_samples), pedestals(pedestals), trigger_finder(nullptr), outputs(nullptr), tracks(0) {
+    if (cfg.hit_threshold >= 0) {
+        finder = make_finder(cfg.hit_threshold);
+    }
+    if (cfg.trigger_layers > 0) {
+        if (cfg.detector_id != 1) {
+            LOG_MESSAGE(DEBUG_WARNING, "Run " + std::to_string(cfg.run_number) +
+                        " is not LFHCal data, triggering on the LFHCal geometry anyway");
+        }
+        trigger.reset(new track_trigger(144 * cfg.num_kcu, cfg.trigger_layers, cfg.trigger_threshold));
+        if (finder && cfg.hit_threshold <= cfg.trigger_threshold) {
+            trigger_finder = finder.get();
+        } else {
+            own_trigger_finder = make_finder(cfg.trigger_threshold);
+            trigger_finder = own_trigger_finder.get();
+        }
+    }
+}
+
+void event_step::start(output_set *outputs) {
+    this->outputs = outputs;
+    // Monitoring is no reason to lose the run, so it is decoded without the ring if need be
+    if (!cfg.ring_name.empty()) {
+        try {
+            ring.reset(new event_ring_writer(cfg.ring_name, cfg.ring_slots, cfg.num_kcu, num_samples,
+                                             cfg.detector_id, cfg.run_number));
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, std::string(e.what()) + ", decoding without it");
+        }
+    }
+    if (cfg.dqm_interval > 0) {
+        dqm.reset(new dqm_histogrammer(cfg.dqm_file_name, cfg.num_kcu, num_samples, cfg.detector_id,
+                                       cfg.run_number, cfg.dqm_interval, cfg.dqm_threads));
+    }
+}
+
+void event_step::process(aligned_event *event, int64_t event_number) {
+    if (event_number % 100 == 0) {
+        LOG_MESSAGE(DEBUG_DEBUG, "Processing event " + std::to_string(event_number));
+    }
+    {
+        scoped_timer timer(STAGE_PEDESTALS);
+        pedestals.add(event);
+    }
+    if (ring) {
+        scoped_timer timer(STAGE_PUBLISH);
+        ring->publish(event, event_number);
+    }
+    if (dqm) {
+        scoped_timer timer(STAGE_HISTOGRAM);
+        dqm->add(event, event_number);
+    }
+    // Hits found for the trigger are reused when they are the hits being written
+    const std::vector<h2h_hit> *hits = nullptr;
+    bool track = false;
+    if (trigger) {
+        scoped_timer timer(STAGE_FIND_HITS);
+        const std::vector<h2h_hit> &trigger_hits = trigger_finder->find(event);
+        if (trigger_finder == finder.get()) {
+            hits = &trigger_hits;
+        }
+        track = trigger->fire(trigger_hits);
+        tracks += track;
+    }
+    if (track) {
+        outputs->write_mip(event, event_number);
+    }
+    if (cfg.trigger_only && !track) {
+        return;
+    }
+    outputs->write_event(event, event_number);
+    if (finder) {
+        scoped_timer timer(STAGE_FIND_HITS);
+        if (hits == nullptr) {
+            hits = &finder->find(event);
+        }
+        outputs->write_hits(*hits);
+    }
+}
+
+void event_step::finish() {
+    if (trigger) {
+        LOG_MESSAGE(DEBUG_INFO, std::to_string(tracks) + " events with a track of " + std::to_string(cfg.trigger_layers) +
+                    " layers" + (outputs->has_mip() ? ", " + std::to_string(outputs->get_mip_events()) + " in " +
+                    cfg.mip_file_name : ""));
+    }
+    if (ring) {
+        LOG_MESSAGE(DEBUG_INFO, "Published " + std::to_string(ring->get_published()) + " events to " + cfg.ring_name);
+        ring.reset();
+    }
+    if (dqm) {
+        try {
+            dqm->close();
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, e.what());
+        }
+        dqm.reset();
+    }
+}
+
+std::unique_ptr<hgc_decoder> open_decoder(const config &cfg) {
+    std::unique_ptr<hgc_decoder> decoder;
+    if (cfg.pool && cfg.input.empty() && compressed_source::detect(cfg.file_name) != compressed_source::NONE) {
+        LOG_MESSAGE(DEBUG_INFO, "Opening file: " + cfg.file_name);
+        packet_source *source = new compressed_source(cfg.file_name, cfg.num_kcu, 0, 0, cfg.pool);
+        decoder.reset(new hgc_decoder(source, cfg.detector_id, cfg.num_kcu, cfg.debug_level, cfg.adc_truncation));
+    } else if (cfg.input.empty()) {
+        LOG_MESSAGE(DEBUG_INFO, "Opening file: " + cfg.file_name);
+        decoder.reset(new hgc_decoder(cfg.file_name.c_str(), cfg.detector_id, cfg.num_kcu, cfg.debug_level,
+                                      cfg.adc_truncation, cfg.follow));
+    } else {
+        LOG_MESSAGE(DEBUG_INFO, "Opening input: " + cfg.input);
+        packet_source *source = open_packet_source(cfg.input, cfg.num_kcu, cfg.input_samples, cfg.input_timeout);
+        decoder.reset(new hgc_decoder(source, cfg.detector_id, cfg.num_kcu, cfg.debug_level, cfg.adc_truncation));
+    }
+    return decoder;
+}
+
+// Checkpoints are taken of whole runs read from a file
+bool use_checkpoints(const config &cfg, const event_selection &selection) {
+    if (cfg.checkpoint_interval <= 0) {
+        return false;
+    }
+    if (!cfg.input.empty()) {
+        LOG_MESSAGE(DEBUG_WARNING, "Checkpoints need a run file, not -i, running without them");
+        return false;
+    }
+    if (selection.is_active()) {
+        LOG_MESSAGE(DEBUG_WARNING, "Checkpoints are for whole runs, decoding the selected events without them");
+        return false;
+    }
+    if (cfg.trigger_layers > 0 && cfg.trigger_only) {
+        LOG_MESSAGE(DEBUG_WARNING, "Checkpoints are for whole runs, decoding the triggered events without them");
+        return false;
+    }
+    return true;
+}
+
+void write_pedestals(const config &cfg, const pedestal_accumulator &pedestals, output_set &outputs) {
+    try {
+        if (!cfg.pedestal_file_name.empty()) {
+            pedestals.write(cfg.pedestal_file_name);
+            LOG_MESSAGE(DEBUG_INFO, "Wrote pedestals to " + cfg.pedestal_file_name);
+        }
+    } catch (const std::exception &e) {
+        LOG_MESSAGE(DEBUG_ERROR, e.what());
+    }
+    outputs.write_pedestals(pedestals);
+}
+
+// Statistics of the run, and its .stats file
+void finish_statistics(const config &cfg, stat_logger *stats, run_summary &summary) {
+    stats->stop_sampling();
+    stats->export_snapshot(true);
+    if (!cfg.stats_file_name.empty()) {
+        std::ofstream stats_file(cfg.stats_file_name);
+        if (stats_file.good()) {
+            stats->write_stats(stats_file);
+        } else {
+            LOG_MESSAGE(DEBUG_ERROR, "Could not write statistics to " + cfg.stats_file_name);
+        }
+    }
+    summary.input_bytes = stats->get_total_bytes();
+    summary.packets = stats->get_num_packets();
+    summary.bytes_read = stats->get_bytes_read();
+    summary.complete_lines = stats->get_complete_lines();
+    summary.incomplete_lines = stats->get_incomplete_lines();
+    for (int i = 0; i < cfg.num_kcu; i++) {
+        summary.waveforms_in_order += stats->get_in_order(i);
+        summary.waveforms_aborted += stats->get_aborted(i);
+    }
+}
+
+// One attempt at a run.  Everything it opens is released when it returns, on any path.
+// start_over is set when a seek with the index has to be given up before anything was
+// written, and the run should be decoded again from the start.
+run_summary decode_run(const config &cfg, std::chrono::steady_clock::time_point start, bool &start_over) {
+    run_summary summary = {};
+    summary.run_number = cfg.run_number;
+    auto fail = [&](const std::string &error) {
+        summary.error = error;
+        LOG_MESSAGE(DEBUG_ERROR, "Run " + std::to_string(cfg.run_number) + " not decoded: " + error);
+        return summary;
+    };
     
-    log_message(DEBUG_INFO, "Writing output to: " + cfg.output_file_name);
-    
-    event_writer *writer = new event_writer(cfg.output_file_name.c_str(), cfg.num_kcu, decoder->get_num_samples(), cfg.detector_id);
+    LOG_MESSAGE(DEBUG_INFO, "Debug level: " + std::to_string(cfg.debug_level));
+    std::unique_ptr<hgc_decoder> decoder = open_decoder(cfg);
+    int num_samples = decoder->get_num_samples();
+    if (cfg.expected_samples > 0 && num_samples != cfg.expected_samples) {
+        return fail("header has " + std::to_string(num_samples) + " samples, logbook " +
+                    std::to_string(cfg.expected_samples));
+    }
+
+    stat_logger *stats = decoder->get_stat_logger();
+    stats->set_run_number(cfg.run_number);
+    if (!cfg.json_stats_file_name.empty()) {
+        LOG_MESSAGE(DEBUG_INFO, "Writing JSON statistics to: " + cfg.json_stats_file_name);
+        stats->set_json_file(cfg.json_stats_file_name);
+    }
+    if (!cfg.prometheus_file_name.empty()) {
+        LOG_MESSAGE(DEBUG_INFO, "Writing Prometheus statistics to: " + cfg.prometheus_file_name);
+        stats->set_prometheus_file(cfg.prometheus_file_name);
+    }
+
+    pedestal_accumulator pedestals(cfg.num_kcu, num_samples);
+    std::unique_ptr<event_step> step;
+    try {
+        step.reset(new event_step(cfg, num_samples, pedestals));
+    } catch (const std::exception &e) {
+        return fail(e.what());
+    }
+    event_selection selection(cfg, decoder.get());
+
+    // Pick up an interrupted run where its last checkpoint left off
+    bool checkpointing = use_checkpoints(cfg, selection);
+    checkpoint_position position = {0, 0, 0};
+    bool resumed = false;
+    if (checkpointing && std::filesystem::exists(cfg.checkpoint_file_name)) {
+        try {
+            position = read_checkpoint(cfg, decoder.get(), pedestals);
+            resumed = true;
+        } catch (const std::exception &e) {
+            return fail("cannot resume from " + cfg.checkpoint_file_name + ": " + e.what() + " (delete it to start over)");
+        }
+        LOG_MESSAGE(DEBUG_INFO, "Resuming run " + std::to_string(cfg.run_number) + " after event " +
+                    std::to_string(position.events) + " from " + cfg.checkpoint_file_name);
+        // Left over from an attempt that stopped before its next checkpoint
+        for (int chunk = position.root_chunk + 1;
+             std::filesystem::remove(chunk_file_name(cfg.output_file_name, chunk)); chunk++) {}
+    }
+
+    std::unique_ptr<output_set> outputs;
+    try {
+        outputs.reset(new output_set(cfg, num_samples, position, resumed));
+    } catch (const std::exception &e) {
+        return fail(e.what());
+    }
+    step->start(outputs.get());
+    if (cfg.stats_interval > 0) {
+        stats->start_sampling(cfg.stats_interval, std::cout);
+    }
+
+    // Makes the output written so far complete and records where it ends, next_chunk starts
+    // the ROOT file that the run continues in
+    auto checkpoint = [&](int64_t events, bool next_chunk) {
+        try {
+            outputs->flush();
+            position = {events, position.root_chunk + 1, outputs->get_mip_events()};
+            write_checkpoint(cfg, decoder.get(), pedestals, position);
+            LOG_MESSAGE(DEBUG_INFO, "Checkpoint after event " + std::to_string(events) + " in " + cfg.checkpoint_file_name);
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, std::string("Checkpoint failed: ") + e.what());
+        }
+        if (next_chunk) {
+            outputs->next_chunk(position.root_chunk);
+        }
+    };
+
+    std::unique_ptr<packet_index> index;
+    if (cfg.write_index && !selection.is_active()) {
+        if (resumed) {
+            LOG_MESSAGE(DEBUG_WARNING, "Not writing an index for a resumed run");
+        } else {
+            index.reset(new packet_index(cfg.num_kcu, num_samples));
+            index->add({decoder->get_num_packets(), 0, std::vector<int64_t>(cfg.num_kcu, -1),
+                        decoder->get_unwrap_states()});
+        }
+    }
 
     // Loop over the events
-    int event_count = 0;
-    for (auto event : *decoder) {
-        if (event_count % 100 == 0) {
-            log_message(DEBUG_DEBUG, "Processing event " + std::to_string(event_count));
-        }
-        
-        writer->write_event(event);
-        event_count++;
-        
-        if (stop) {
-            log_message(DEBUG_INFO, "Stopping...");
+    int64_t event_count = position.events;
+    int64_t events_written = 0;
+    bool interrupted = false;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    for (auto it = decoder->begin(); it != decoder->end(); ++it) {
+        aligned_event *event = *it;
+        event_selection::verdict verdict = selection.check(event, event_count, decoder->get_num_packets());
+        if (verdict == event_selection::STOP) {
+            break;
+        }
+        if (verdict == event_selection::WRITE) {
+            step->process(event, event_count);
+            events_written++;
+        }
+        if (selection.is_numbered()) {
+            event_count++;
+        }
+        if (index && it.last_of_packet() && event_count - index->get_last_events() >= packet_index::SPACING) {
+            index->add({decoder->get_num_packets(), event_count, event_timestamps(event),
+                        decoder->get_unwrap_states()});
+        }
+
+        // Checkpoints are only taken between packets, with nothing left in the aligner
+        bool between_packets = !checkpointing || it.last_of_packet();
+        interrupted = stop || (cfg.stop_after_packets >= 0 && decoder->get_num_packets() >= cfg.stop_after_packets);
+        if (interrupted && between_packets) {
+            LOG_MESSAGE(DEBUG_INFO, "Stopping...");
             break;
         }
+        if (checkpointing && between_packets && std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                    last_checkpoint).count() >= cfg.checkpoint_interval) {
+            checkpoint(event_count, true);
+            last_checkpoint = std::chrono::steady_clock::now();
+        }
+    }
+    // Also when the interrupt ended the input rather than the loop
+    interrupted = interrupted || stop;
+    if (!selection.is_numbered() && !interrupted) {
+        // Nothing has been written yet, so the run can start over
+        LOG_MESSAGE(DEBUG_WARNING, "The decode did not come back in step with " + cfg.index_file_name +
+                    " after the seek, decoding from the start");
+        stats->stop_sampling();
+        start_over = true;
+        return summary;
+    }
+    if (checkpointing) {
+        if (interrupted) {
+            checkpoint(event_count, false);
+            LOG_MESSAGE(DEBUG_INFO, "Run " + std::to_string(cfg.run_number) + " interrupted, run it again to resume");
+        } else {
+            std::filesystem::remove(cfg.checkpoint_file_name);
+        }
     }
     
-    log_message(DEBUG_INFO, "Processed " + std::to_string(event_count) + " events");
-    writer->close();
-    delete decoder;
-}
+    if (index) {
+        try {
+            index->write(cfg.index_file_name);
+            LOG_MESSAGE(DEBUG_INFO, "Wrote " + std::to_string(index->size()) + " index entries to " + cfg.index_file_name);
+        } catch (const std::exception &e) {
+            LOG_MESSAGE(DEBUG_ERROR, e.what());
+        }
+    }
+    if (selection.is_active()) {
+        event_count = events_written;
+    }
+    LOG_MESSAGE(DEBUG_INFO, "Processed " + std::to_string(event_count) + " events");
+    step->finish();
+    finish_statistics(cfg, stats, summary);
 
-void hgc_decoder::signpost_begin(std::string msg) {
-    #ifdef __APPLE__
-    // os_signpost_interval_begin(signpost_logger, signpost_id, msg.c_str());
-    #endif
-}
-void hgc_decoder::signpost_end(std::string msg) {
-    #ifdef __APPLE__
-    // os_signpost_interval_end(signpost_logger, signpost_id, msg.c_str());
-    #endif
+    // An interrupted run that will be resumed has its pedestals written when it completes
+    if (!(checkpointing && interrupted)) {
+        write_pedestals(cfg, pedestals, *outputs);
+    }
+    outputs->close();
+
+    summary.ok = !(checkpointing && interrupted);
+    if (!summary.ok) {
+        summary.error = "interrupted, checkpointed";
+    }
+    summary.events = event_count;
+    decoder.reset();
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // A batch prints one summary for all its runs at the end
+    if (stage_profiler::is_enabled() && cfg.pool == nullptr) {
+        stage_profiler::print_summary(std::cout);
+    }
+    return summary;
 }
-void hgc_decoder::signpost_detailed_begin(std::string msg) {
-    #ifdef __APPLE__
-    // os_signpost_interval_begin(signpost_logger, detailed_signpost_id, msg.c_str());
-    #endif
 }
-void hgc_decoder::signpost_detailed_end(std::string msg) {
-    #ifdef __APPLE__
-    // os_signpost_interval_end(signpost_logger, detailed_signpost_id, msg.c_str());
-    #endif
+
+run_summary test_line_builder(config &cfg) {
+    // Set up signal handler for ctrl-c
+    std::signal(SIGINT, signal_handler);
+    auto start = std::chrono::steady_clock::now();
+    config attempt = cfg;
+    while (true) {
+        bool start_over = false;
+        run_summary summary = decode_run(attempt, start, start_over);
+        if (!start_over) {
+            return summary;
+        }
+        attempt.index_file_name.clear();
+    }
 }
 
 // start moving to the class based structure
-hgc_decoder::hgc_decoder(const char *file_name, const int detector_id, const int num_kcu, const int debug_level, bool adc_truncation)
+hgc_decoder::hgc_decoder(const char *file_name, const int detector_id, const int num_kcu, const int debug_level, bool adc_truncation,
+                         const follow_config &follow)
+    : NUM_KCU(num_kcu), DETECTOR_ID(detector_id), debug_level(debug_level) {
+    if (compressed_source::detect(file_name) != compressed_source::NONE) {
+        if (follow.enabled) {
+            LOG_MESSAGE(DEBUG_WARNING, "Decoder", "Compressed runs cannot be followed, reading to the end");
+        }
+        init(new compressed_source(file_name, NUM_KCU), adc_truncation);
+        return;
+    }
+    init(new file_stream(file_name, NUM_KCU, follow), adc_truncation);
+}
+
+hgc_decoder::hgc_decoder(packet_source *source, const int detector_id, const int num_kcu, const int debug_level, bool adc_truncation)
     : NUM_KCU(num_kcu), DETECTOR_ID(detector_id), debug_level(debug_level) {
+    init(source, adc_truncation);
+}
 
-    // Set up debug logging
+void hgc_decoder::init(packet_source *source, bool adc_truncation) {
+    // Run statistics, shared by all the modules
     logger = new stat_logger(NUM_KCU);
-    #ifdef __APPLE__
-    signpost_logger = os_log_create("com.tristan.app", "run_decoder");
-    signpost_id = os_signpost_id_generate(signpost_logger);
-    detailed_signpost_id = os_signpost_id_generate(signpost_logger);
-    assert(signpost_id != OS_SIGNPOST_ID_INVALID);
-    assert(detailed_signpost_id != OS_SIGNPOST_ID_INVALID);
-    #endif
 
     // decoder modules
-    logger = new stat_logger(NUM_KCU);
-    fs = new file_stream(file_name, NUM_KCU);
+    fs = source;
+    fs->set_stat_logger(logger);
     NUM_SAMPLES = fs->get_number_samples();
+    logger->set_num_samples(NUM_SAMPLES);
+    logger->set_total_bytes(fs->get_size());
     lb = new line_builder(NUM_KCU, adc_truncation);
+    lb->set_stat_logger(logger);
     for (int i = 0; i < NUM_KCU; i++) {
         wbs.push_back(new waveform_builder(i, NUM_SAMPLES));
+        wbs.back()->set_stat_logger(logger);
     }
     aligner = new event_aligner(NUM_KCU);
+    aligner->set_stat_logger(logger);
     heartbeat_counter = 0;
 
     aligned_buffer = new std::list<aligned_event*>();
 }
 
+void hgc_decoder::save_state(checkpoint_writer &out) {
+    out.put<int64_t>(fs->get_num_packets());
+    out.put(heartbeat_counter);
+    lb->save_state(out);
+    for (auto wb : wbs) {
+        wb->save_state(out);
+    }
+    logger->save_state(out);
+}
+
+void hgc_decoder::load_state(checkpoint_reader &in) {
+    int64_t packets = in.get<int64_t>();
+    if (!fs->skip_packets(packets)) {
+        throw std::runtime_error("Input ends before the checkpoint at packet " + std::to_string(packets));
+    }
+    heartbeat_counter = in.get<int>();
+    lb->load_state(in);
+    for (auto wb : wbs) {
+        wb->load_state(in);
+    }
+    logger->load_state(in);
+}
+
+bool hgc_decoder::seek(const index_entry &entry) {
+    if (!fs->skip_packets(entry.packets)) {
+        return false;
+    }
+    for (int i = 0; i < NUM_KCU; i++) {
+        wbs[i]->set_unwrap_state(entry.unwrap[i]);
+    }
+    return true;
+}
+
+std::vector<unwrap_state> hgc_decoder::get_unwrap_states() {
+    std::vector<unwrap_state> states;
+    for (auto wb : wbs) {
+        states.push_back(wb->get_unwrap_state());
+    }
+    return states;
+}
+
 hgc_decoder::~hgc_decoder() {
     delete fs;
     delete lb;
@@ -123,39 +869,69 @@ hgc_decoder::~hgc_decoder() {
 }
 
 bool hgc_decoder::get_next_events() {
-    int ret = fs->read_packet(buffer);
+    trace_scope packet_span("packet");
+    int ret;
+    {
+        scoped_timer timer(STAGE_READ_PACKET);
+        ret = fs->read_packet(buffer);
+    }
     if (ret == 0) { // we have reached the end of the file, nothing left to do
-        log_message(DEBUG_DEBUG, "End of file reached");
+        LOG_MESSAGE(DEBUG_DEBUG, "End of file reached");
         return false;
     }
     if (ret == 2) { // heartbeat packet
-        log_message(DEBUG_TRACE, "Heartbeat packet received");
+        LOG_MESSAGE(DEBUG_TRACE, "Heartbeat packet received");
         return true;
     }
     if (ret == 1) {
-        lb->process_packet(buffer);
-        lb->process_complete();
+        {
+            scoped_timer timer(STAGE_PROCESS_PACKET);
+            lb->process_packet(buffer);
+        }
+        {
+            scoped_timer timer(STAGE_PROCESS_COMPLETE);
+            lb->process_complete();
+        }
+        logger->update_lines_in_progress(lb->get_num_in_progress());
         for (int i = 0; i < NUM_KCU; i++) {
-            wbs[i]->build(lb->get_completed(i));
-            wbs[i]->unwrap_counters();
+            {
+                scoped_timer timer(STAGE_BUILD);
+                wbs[i]->build(lb->get_completed(i));
+            }
+            {
+                scoped_timer timer(STAGE_UNWRAP_COUNTERS);
+                wbs[i]->unwrap_counters();
+            }
         }
         std::list<kcu_event*> **single_kcu_events = new std::list<kcu_event*>*[NUM_KCU];
         for (int i = 0; i < NUM_KCU; i++) {
             single_kcu_events[i] = wbs[i]->get_complete();
+            logger->update_waveforms_in_progress(wbs[i]->get_num_in_progress(), i);
+            logger->update_waiting_waveforms(single_kcu_events[i]->size(), i);
+        }
+        if (trace_recorder::is_enabled()) {
+            // Waveforms waiting for alignment, a KCU that falls behind shows up as the others piling up
+            for (int i = 0; i < NUM_KCU; i++) {
+                trace_recorder::counter("waiting_waveforms", i, single_kcu_events[i]->size());
+            }
+        }
+        {
+            scoped_timer timer(STAGE_ALIGN);
+            aligner->align(single_kcu_events);
         }
-        aligner->align(single_kcu_events);
         aligned_buffer = aligner->get_complete();
         if (aligned_buffer->size() > 0) {
             heartbeat_counter = 0;
-            log_message(DEBUG_TRACE, "Found " + std::to_string(aligned_buffer->size()) + " aligned events");
+            LOG_MESSAGE(DEBUG_TRACE, "Found " + std::to_string(aligned_buffer->size()) + " aligned events");
         } else {
             heartbeat_counter++;
             if (heartbeat_counter % 10000 == 0) {
-                log_message(DEBUG_DEBUG, "No events found for " + std::to_string(heartbeat_counter) + " packets");
+                LOG_MESSAGE(DEBUG_DEBUG, "No events found for " + std::to_string(heartbeat_counter) + " packets");
             }
         }
-        if (heartbeat_counter > 100000) {
-            log_message(DEBUG_WARNING, "No events found for 100000 packets, giving up");
+        // A live source may sit idle between spills, it only ends with the source
+        if (heartbeat_counter > 100000 && !fs->is_live()) {
+            LOG_MESSAGE(DEBUG_WARNING, "No events found for 100000 packets, giving up");
             return false;
         }
         delete[] single_kcu_events;
@@ -181,20 +957,20 @@ hgc_decoder::iterator::iterator(hgc_decoder *decoder) {
 // The ++ operator either gets the next entry from the buffer if it exists, or 
 // attempts to align more events, or returns the end iterator if there are no more events
 hgc_decoder::iterator hgc_decoder::iterator::operator++() {
-    log_message(DEBUG_TRACE, "HGCDecoder", "Iterator increment");
+    LOG_MESSAGE(DEBUG_TRACE, "HGCDecoder", "Iterator increment");
     ++aligned_iterator;
     if (aligned_iterator != decoder->aligned_buffer->end()) {
-        log_message(DEBUG_TRACE, "HGCDecoder", "Current event: " + 
+        LOG_MESSAGE(DEBUG_TRACE, "HGCDecoder", "Current event: " + 
                    std::to_string((uint64_t)*aligned_iterator));
     } else {
-        log_message(DEBUG_TRACE, "HGCDecoder", "End of aligned buffer");
+        LOG_MESSAGE(DEBUG_TRACE, "HGCDecoder", "End of aligned buffer");
     }
     
     if (aligned_iterator != decoder->aligned_buffer->end()) {
-        log_message(DEBUG_TRACE, "HGCDecoder", "Returning current iterator");
+        LOG_MESSAGE(DEBUG_TRACE, "HGCDecoder", "Returning current iterator");
         return *this;
     }
-    log_message(DEBUG_DEBUG, "HGCDecoder", "Getting new events");
+    LOG_MESSAGE(DEBUG_DEBUG, "HGCDecoder", "Getting new events");
     decoder->aligned_buffer->clear();
     while (decoder->aligned_buffer->size() == 0) {
         if (!decoder->get_next_events()) {
@@ -211,7 +987,7 @@ hgc_decoder::iterator hgc_decoder::iterator::operator++() {
 }
 
 aligned_event* hgc_decoder::iterator::operator*() {
-    log_message(DEBUG_TRACE, "HGCDecoder", "Iterator dereference");
+    LOG_MESSAGE(DEBUG_TRACE, "HGCDecoder", "Iterator dereference");
     auto e = *aligned_iterator;
     return *aligned_iterator;
 }
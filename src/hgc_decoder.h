@@ -1,6 +1,8 @@
 #pragma once
 
 #include "file_stream.h"
+#include "packet_source.h"
+#include "compressed_source.h"
 #include "line_builder.h"
 #include "waveform_builder.h"
 #include "event_aligner.h"
@@ -8,15 +10,15 @@
 #include "stat_logger.h"
 #include "debug_logger.h"
 
-// For debugging/profiling
-#ifdef __APPLE__
-#include <os/log.h>
-#include <os/signpost.h>
-#endif
-
+#include <iterator>
 #include <list>
 #include <string>
 
+class thread_pool;
+class checkpoint_writer;
+class checkpoint_reader;
+struct index_entry;
+
 struct config {
     int run_number;
     int detector_id;
@@ -25,9 +27,65 @@ struct config {
     std::string output_file_name;
     int debug_level;
     bool adc_truncation;
+    bool binary_output;
+    std::string binary_file_name;
+    std::string stats_file_name;
+    double stats_interval;
+    std::string json_stats_file_name;
+    std::string prometheus_file_name;
+    follow_config follow;
+    std::string input;      // Read packets from here instead of file_name, see open_packet_source
+    int input_samples;      // Number of samples for inputs without a header, 0 to read the header
+    double input_timeout;
+    thread_pool *pool;      // Shared with other runs of a batch for decompression, may be null
+    int expected_samples;   // From the logbook, a run whose header disagrees is not decoded; 0 to skip the check
+    double checkpoint_interval;     // Seconds between checkpoints, 0 for none; see checkpoint.h
+    std::string checkpoint_file_name;
+    int64_t first_event;        // Only write events first_event to last_event, -1 for no limit
+    int64_t last_event;
+    int64_t first_timestamp;    // Only write events whose KCU 0 timestamp is in this window, -1 for no limit
+    int64_t last_timestamp;
+    bool write_index;           // Write index_file_name while decoding, see packet_index.h
+    std::string index_file_name;
+    std::string pedestal_file_name;     // Pedestals and noise of the channels, see pedestal_accumulator.h
+    double hit_threshold;       // Write hits this far above pedestal to hit_file_name, negative for none; see hit_finder.h
+    std::string hit_file_name;
+    std::string pedestal_input; // Pedestals of an earlier run to find hits with, empty for the run's own
+    int trigger_layers;         // Also write events with a track this many layers long to mip_file_name, 0 for none;
+    double trigger_threshold;   // with a hit this far above pedestal in each layer, see track_trigger.h
+    bool trigger_only;          // Write only those events, to every output, instead of mip_file_name
+    std::string mip_file_name;
+    std::string ring_name;      // Also publish every event decoded to this shared memory ring, empty for none;
+    int ring_slots;             // of this many events, see event_ring.h
+    double dqm_interval;        // Seconds between snapshots of the online histograms in dqm_file_name, 0 for none;
+    int dqm_threads;            // filled by this many threads, see dqm_histogrammer.h
+    std::string dqm_file_name;
+    int64_t stop_after_packets; // Stop as ctrl-c would once this many packets are read, -1 to run to the end;
+                                // h2g_compare uses it to interrupt and resume a run
 };
 
-void test_line_builder(config &cfg);
+// What a decoded run produced, for batch reports
+struct run_summary {
+    int run_number;
+    bool ok;
+    std::string error;
+    double seconds;
+    int64_t input_bytes;
+    int64_t packets;
+    int64_t bytes_read;
+    int64_t complete_lines;
+    int64_t incomplete_lines;
+    int64_t waveforms_in_order;
+    int64_t waveforms_aborted;
+    int64_t events;
+};
+
+// Fills in the input and output file names of cfg.run_number.  A run kept only as
+// RunXXX.h2g.zst or RunXXX.h2g.gz is read compressed, unless it is being followed.
+void set_run_files(config &cfg, const std::string &data_directory, const std::string &output_directory);
+run_summary test_line_builder(config &cfg);
+// Set by ctrl-c, every run in progress stops at the next event
+bool stop_requested();
 std::list<aligned_event*> *run_event_builder(char *file_name);
 
 class hgc_decoder {
@@ -41,7 +99,7 @@ class hgc_decoder {
 
         // decoder modules
         stat_logger *logger;
-        file_stream *fs;
+        packet_source *fs;
         line_builder *lb;
         std::vector<waveform_builder*> wbs;
         event_aligner *aligner;
@@ -50,22 +108,28 @@ class hgc_decoder {
         int heartbeat_counter;
         std::list<aligned_event*> *aligned_buffer;
 
-        #ifdef __APPLE__
-        os_log_t signpost_logger;
-        os_signpost_id_t signpost_id;
-        os_signpost_id_t detailed_signpost_id;
-        #endif
-        void signpost_begin(std::string msg);
-        void signpost_end(std::string msg);
-        void signpost_detailed_begin(std::string msg);
-        void signpost_detailed_end(std::string msg);
-
         bool get_next_events();
+        void init(packet_source *source, bool adc_truncation);
 
     public:
-        hgc_decoder(const char *file_name, const int detector_id, const int num_kcu, const int debug_level = 0, bool adc_truncation=false);
+        hgc_decoder(const char *file_name, const int detector_id, const int num_kcu, const int debug_level = 0, bool adc_truncation=false,
+                    const follow_config &follow = follow_config());
+        // Decodes packets from any source, which the decoder then owns
+        hgc_decoder(packet_source *source, const int detector_id, const int num_kcu, const int debug_level = 0, bool adc_truncation=false);
         ~hgc_decoder();
         int get_num_samples() {return NUM_SAMPLES;};
+        stat_logger *get_stat_logger() {return logger;}
+
+        // Only valid once every event of the last packet was taken, see iterator::last_of_packet
+        void save_state(checkpoint_writer &out);
+        // Restores a saved state into a decoder that has not read any packets yet, and skips
+        // the packets that were already decoded.  Throws std::runtime_error if it does not fit.
+        void load_state(checkpoint_reader &in);
+        // Starts reading at an index entry instead of the first packet, see packet_index.h.
+        // Returns false if the input ends first.
+        bool seek(const index_entry &entry);
+        int64_t get_num_packets() {return fs->get_num_packets();}
+        std::vector<unwrap_state> get_unwrap_states();
 
         class iterator {
             friend class hgc_decoder;
@@ -79,6 +143,8 @@ class hgc_decoder {
             aligned_event* operator*();
             hgc_decoder::iterator operator++();
             bool operator!=(const hgc_decoder::iterator &other) {return aligned_iterator != other.aligned_iterator;};
+            // True for the last event aligned from the packets read so far
+            bool last_of_packet() {return std::next(aligned_iterator) == decoder->aligned_buffer->end();}
             
         };
 
@@ -0,0 +1,94 @@
+#include "histogram.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+histogram::histogram(const std::string &name, int bins, double low, double high)
+    : name(name), bins(bins), low(low), high(high), underflow(0), overflow(0), entries(0) {
+    if (bins <= 0 || !(high > low)) {
+        throw std::invalid_argument("Bad binning for histogram " + name);
+    }
+    width = (high - low) / bins;
+    contents.assign(bins, 0);
+}
+
+void histogram::add(const histogram &other) {
+    if (other.bins != bins || other.low != low || other.high != high) {
+        throw std::runtime_error("Cannot add histogram " + other.name + " to " + name + ", the binning differs");
+    }
+    for (int i = 0; i < bins; i++) {
+        contents[i] += other.contents[i];
+    }
+    underflow += other.underflow;
+    overflow += other.overflow;
+    entries += other.entries;
+}
+
+void histogram::set_contents(const double *contents, uint64_t entries, double underflow, double overflow) {
+    this->contents.assign(contents, contents + bins);
+    this->entries = entries;
+    this->underflow = underflow;
+    this->overflow = overflow;
+}
+
+double histogram::get_integral() const {
+    double sum = 0;
+    for (double content : contents) {
+        sum += content;
+    }
+    return sum;
+}
+
+void write_histograms(const std::string &file_name, const std::vector<histogram> &histograms) {
+    FILE *out = fopen(file_name.c_str(), "w");
+    if (out == nullptr) {
+        throw std::runtime_error("Error opening " + file_name);
+    }
+    fprintf(out, "name,bins,low,high,entries,underflow,overflow,contents\n");
+    for (auto &h : histograms) {
+        fprintf(out, "%s,%d,%.17g,%.17g,%llu,%.17g,%.17g", h.get_name().c_str(), h.get_bins(), h.get_low(),
+                h.get_high(), (unsigned long long)h.get_entries(), h.get_underflow(), h.get_overflow());
+        for (int i = 0; i < h.get_bins(); i++) {
+            fprintf(out, ",%.17g", h.get_content(i));
+        }
+        fprintf(out, "\n");
+    }
+    if (fclose(out) != 0) {
+        throw std::runtime_error("Error writing " + file_name);
+    }
+}
+
+std::vector<histogram> read_histograms(const std::string &file_name) {
+    std::ifstream in(file_name);
+    if (!in.good()) {
+        throw std::runtime_error("Error opening " + file_name);
+    }
+    std::vector<histogram> histograms;
+    std::string line;
+    std::getline(in, line);     // Header
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name, field;
+        std::vector<double> values;
+        std::getline(fields, name, ',');
+        try {
+            while (std::getline(fields, field, ',')) {
+                values.push_back(std::stod(field));
+            }
+        } catch (const std::exception &) {
+            throw std::runtime_error("Bad line in " + file_name + ": " + line.substr(0, 80));
+        }
+        if (values.size() < 7 || values[0] < 1 || !(values[2] > values[1]) ||
+            values.size() != 6 + (size_t)values[0]) {
+            throw std::runtime_error("Bad line in " + file_name + ": " + line.substr(0, 80));
+        }
+        histograms.emplace_back(name, values[0], values[1], values[2]);
+        histograms.back().set_contents(values.data() + 6, values[3], values[4], values[5]);
+    }
+    return histograms;
+}
@@ -0,0 +1,69 @@
+/*
+A fixed binning 1D histogram for the compiled analysis tools, without ROOT.  Each thread
+fills its own and they are added together at the end:
+
+    histogram amplitude("cb_norm_12", 250, 0, 1000);
+    amplitude.fill(N);
+    total.add(amplitude);
+
+Entries have unit weight, so the error of a bin is the square root of its content.
+
+write_histograms and read_histograms keep a set of histograms in a CSV with one line per
+histogram: name, bins, low, high, entries, underflow, overflow and then the content of
+each bin.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class histogram {
+private:
+    std::string name;
+    int bins;
+    double low;
+    double high;
+    double width;
+    std::vector<double> contents;
+    double underflow;
+    double overflow;
+    uint64_t entries;
+
+public:
+    // Throws std::invalid_argument for no bins or high <= low
+    histogram(const std::string &name, int bins, double low, double high);
+
+    void fill(double x) {
+        entries++;
+        if (x < low) {
+            underflow++;
+        } else if (x >= high) {
+            overflow++;
+        } else {
+            int bin = (x - low) / width;
+            contents[bin < bins ? bin : bins - 1]++;
+        }
+    }
+    // Throws std::runtime_error if the binning differs
+    void add(const histogram &other);
+    // Replaces everything filled so far, contents has one value per bin
+    void set_contents(const double *contents, uint64_t entries, double underflow, double overflow);
+
+    const std::string &get_name() const {return name;}
+    int get_bins() const {return bins;}
+    double get_low() const {return low;}
+    double get_high() const {return high;}
+    double get_bin_center(int bin) const {return low + (bin + 0.5) * width;}
+    double get_content(int bin) const {return contents[bin];}
+    double get_underflow() const {return underflow;}
+    double get_overflow() const {return overflow;}
+    uint64_t get_entries() const {return entries;}
+    // Sum of the bins, without underflow and overflow
+    double get_integral() const;
+};
+
+// Throws std::runtime_error if the file cannot be written or read
+void write_histograms(const std::string &file_name, const std::vector<histogram> &histograms);
+std::vector<histogram> read_histograms(const std::string &file_name);
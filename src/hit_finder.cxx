@@ -0,0 +1,73 @@
+#include "hit_finder.h"
+#include "pedestal_accumulator.h"
+#include "debug_logger.h"
+
+hit_finder::hit_finder(int num_kcu, int num_samples, float threshold)
+    : num_kcu(num_kcu), num_samples(num_samples), threshold(threshold), online(nullptr),
+      kcu_pedestals(144), samples(144 * num_samples), amplitude(144), peak(144), charge(144) {
+    hits.reserve(144 * num_kcu);
+}
+
+void hit_finder::load_pedestals(const std::string &file_name) {
+    std::vector<double> loaded = read_pedestals(file_name, 144 * num_kcu);
+    pedestals.assign(loaded.begin(), loaded.end());
+    online = nullptr;
+    LOG_MESSAGE(DEBUG_INFO, "HitFinder", "Subtracting the pedestals in " + file_name);
+}
+
+const std::vector<h2h_hit> &hit_finder::find(aligned_event *event) {
+    hits.clear();
+    for (int i = 0; i < num_kcu; i++) {
+        kcu_event *e = event->get_event(i);
+        for (int j = 0; j < 144; j++) {
+            kcu_pedestals[j] = online ? online->get_pedestal(i * 144 + j) : pedestals.empty() ? 0 : pedestals[i * 144 + j];
+        }
+        for (int j = 0; j < 144; j++) {
+            for (int k = 0; k < num_samples; k++) {
+                samples[k * 144 + j] = e->get_sample_adc(j, k) - kcu_pedestals[j];
+            }
+        }
+
+        // Whole rows of channels at a time
+        float *max = amplitude.data();
+        int32_t *at = peak.data();
+        float *sum = charge.data();
+        const float *row = samples.data();
+        for (int j = 0; j < 144; j++) {
+            max[j] = row[j];
+            at[j] = 0;
+            sum[j] = row[j];
+        }
+        for (int k = 1; k < num_samples; k++) {
+            row = samples.data() + k * 144;
+            for (int j = 0; j < 144; j++) {
+                // Arithmetic on the comparison rather than a branch, which gcc leaves unvectorized
+                float value = row[j];
+                int32_t higher = value > max[j];
+                max[j] = value > max[j] ? value : max[j];
+                at[j] = higher * k + (1 - higher) * at[j];
+                sum[j] += value;
+            }
+        }
+
+        for (int j = 0; j < 144; j++) {
+            if (amplitude[j] < threshold) {
+                continue;
+            }
+            h2h_hit hit;
+            hit.channel = i * 144 + j;
+            hit.peak_sample = peak[j];
+            hit.toa = 0;
+            for (int k = 0; k < num_samples; k++) {
+                if (e->get_sample_toa(j, k) != 0) {
+                    hit.toa = e->get_sample_toa(j, k);
+                    break;
+                }
+            }
+            hit.amplitude = amplitude[j];
+            hit.charge = charge[j];
+            hits.push_back(hit);
+        }
+    }
+    return hits;
+}
@@ -0,0 +1,61 @@
+/*
+Finds the channels that fired in an aligned event, so an analysis can read a short list of
+hits instead of every sample of every channel:
+
+    h2g_run -r 42 -H 30                     # hits 30 ADC counts over the run's own pedestals
+    h2g_run -r 43 -H 30 -p Run042.ped       # or over the pedestals of an earlier run
+
+Each channel has its pedestal subtracted, and a hit is kept if its largest sample is at
+least the threshold above it.  A hit holds the amplitude and sample of that peak, the TOA
+of the first sample that has one, and the charge, which is the sum of all the samples
+after subtraction.
+
+The samples of a KCU are laid out sample by sample, so each pass runs over 144 channels
+of contiguous floats with no branches.  The compiler vectorizes those loops.
+
+With the run's own pedestals, pedestal_accumulator's running means are used.  These are
+still settling over the first events of a run, when they rest on only a few samples.
+*/
+
+#pragma once
+
+#include "event_aligner.h"
+#include "binary_format.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class pedestal_accumulator;
+
+class hit_finder {
+private:
+    int num_kcu;
+    int num_samples;
+    float threshold;
+    std::vector<float> pedestals;               // From a file, one per channel
+    const pedestal_accumulator *online;         // Or the running pedestals of this run
+
+    // Scratch for one KCU
+    std::vector<float> kcu_pedestals;
+    std::vector<float> samples;                 // [sample][channel], pedestal subtracted
+    std::vector<float> amplitude;
+    std::vector<int32_t> peak;
+    std::vector<float> charge;
+
+    std::vector<h2h_hit> hits;
+
+public:
+    hit_finder(int num_kcu, int num_samples, float threshold);
+
+    // Pedestals written to RunXXX.ped by an earlier run, throws std::runtime_error if the
+    // file cannot be read or is for fewer channels
+    void load_pedestals(const std::string &file_name);
+    // Use the running pedestals of the run being decoded instead
+    void use_pedestals(const pedestal_accumulator *pedestals) {online = pedestals;}
+
+    // Hits of the event, valid until the next call
+    const std::vector<h2h_hit> &find(aligned_event *event);
+
+    float get_threshold() const {return threshold;}
+};
@@ -0,0 +1,116 @@
+#include "hit_writer.h"
+
+#include "debug_logger.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+hit_writer::hit_writer(const std::string &file_name, int num_kcu, int num_samples, int detector, float threshold,
+                       int64_t resume_events) {
+    this->file_name = file_name;
+    closed = false;
+    first_event_number = 0;
+
+    header.magic = H2H_MAGIC;
+    header.version = H2H_VERSION;
+    header.num_kcu = num_kcu;
+    header.num_samples = num_samples;
+    header.num_channels = 144 * num_kcu;
+    header.detector = detector;
+    header.num_events = 0;
+    header.threshold = threshold;
+    header.reserved = 0;
+    header.header_size = sizeof(h2h_header);
+
+    if (resume_events >= 0) {
+        resume(resume_events);
+        return;
+    }
+    file.open(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good()) {
+        LOG_MESSAGE(DEBUG_ERROR, "HitWriter", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void hit_writer::resume(uint64_t num_events) {
+    h2h_header existing;
+    std::ifstream in(file_name, std::ios::in | std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(&existing), sizeof(existing)) || existing.magic != H2H_MAGIC ||
+        existing.version != H2H_VERSION || existing.num_kcu != header.num_kcu ||
+        existing.num_samples != header.num_samples || existing.threshold != header.threshold ||
+        existing.header_size != header.header_size) {
+        throw std::runtime_error("Cannot continue " + file_name + ", it is missing or has different settings");
+    }
+    // Records vary in length, so walk them to where the checkpoint ends
+    uint64_t size = header.header_size;
+    for (uint64_t i = 0; i < num_events; i++) {
+        h2h_record_header record;
+        in.seekg(size);
+        if (!in.read(reinterpret_cast<char*>(&record), sizeof(record)) || record.num_hits > header.num_channels) {
+            throw std::runtime_error("Cannot continue " + file_name + ", it has fewer than " +
+                                     std::to_string(num_events) + " events");
+        }
+        size += sizeof(record) + record.num_hits * sizeof(h2h_hit);
+    }
+    in.close();
+    std::error_code error;
+    if (std::filesystem::file_size(file_name, error) < size || error) {
+        throw std::runtime_error("Cannot continue " + file_name + ", it has fewer than " +
+                                 std::to_string(num_events) + " events");
+    }
+    // Events written after the checkpoint are decoded again
+    std::filesystem::resize_file(file_name, size);
+    file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.good()) {
+        LOG_MESSAGE(DEBUG_ERROR, "HitWriter", "Error opening file " + file_name);
+        throw std::runtime_error("Error opening file");
+    }
+    file.seekp(0, std::ios::end);
+    header.num_events = num_events;
+    LOG_MESSAGE(DEBUG_INFO, "HitWriter", "Continuing " + file_name + " after event " + std::to_string(num_events));
+}
+
+hit_writer::~hit_writer() {
+    close();
+}
+
+void hit_writer::write_event(const std::vector<h2h_hit> &hits) {
+    h2h_record_header record;
+    record.event_number = first_event_number + header.num_events;
+    record.num_hits = hits.size();
+    record.reserved = 0;
+    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    file.write(reinterpret_cast<const char*>(hits.data()), hits.size() * sizeof(h2h_hit));
+    header.num_events++;
+}
+
+void hit_writer::flush() {
+    if (closed) {
+        return;
+    }
+    std::streampos end = file.tellp();
+    file.seekp(0, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.seekp(end);
+    file.flush();
+    if (!file.good()) {
+        throw std::runtime_error("Error writing " + file_name);
+    }
+}
+
+void hit_writer::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+    LOG_MESSAGE(DEBUG_DEBUG, "HitWriter", "Closing file " + file_name + " with " +
+               std::to_string(header.num_events) + " events");
+    // Patch the event count now that it is known
+    file.seekp(0, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+}
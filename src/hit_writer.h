@@ -0,0 +1,39 @@
+/*
+Writes the hits found by hit_finder in the native .h2h format described in binary_format.h.
+Like binary_writer this does not depend on ROOT.
+*/
+
+#pragma once
+
+#include "binary_format.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class hit_writer {
+private:
+    std::string file_name;
+    std::ofstream file;
+    h2h_header header;
+    bool closed;
+    uint64_t first_event_number;
+
+    void resume(uint64_t num_events);
+
+public:
+    // resume_events >= 0 continues an existing file after its first resume_events events,
+    // dropping any written after them; throws std::runtime_error if it does not match
+    hit_writer(const std::string &file_name, int num_kcu, int num_samples, int detector, float threshold,
+               int64_t resume_events = -1);
+    ~hit_writer();
+
+    void write_event(const std::vector<h2h_hit> &hits);
+    // Numbering of the next event, for part of a run (events are numbered from 0 by default)
+    void set_event_number(uint64_t event_number) {first_event_number = event_number - header.num_events;}
+    // Updates the event count in the header and flushes, the file is complete up to here
+    void flush();
+    void close();
+    uint64_t get_num_events() {return header.num_events;}
+};
@@ -0,0 +1,251 @@
+#include "landau_fitter.h"
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// CERNLIB G110 DENLAN, as in ROOT::Math::landau_pdf
+double denlan(double v) {
+    static const double p1[5] = {0.4259894875, -0.1249762550, 0.03984243700, -0.006298287635, 0.001511162253};
+    static const double q1[5] = {1.0, -0.3388260629, 0.09594393323, -0.01608042283, 0.003778942063};
+    static const double p2[5] = {0.1788541609, 0.1173957403, 0.01488850518, -0.001394989411, 0.0001283617211};
+    static const double q2[5] = {1.0, 0.7428795082, 0.3153932961, 0.06694219548, 0.008790609714};
+    static const double p3[5] = {0.1788544503, 0.09359161662, 0.006325387654, 0.00006611667319, -0.000002031049101};
+    static const double q3[5] = {1.0, 0.6097809921, 0.2560616665, 0.04746722384, 0.006957301675};
+    static const double p4[5] = {0.9874054407, 118.6723273, 849.2794360, -743.7792444, 427.0262186};
+    static const double q4[5] = {1.0, 106.8615961, 337.6496214, 2016.712389, 1597.063511};
+    static const double p5[5] = {1.003675074, 167.5702434, 4789.711289, 21217.86767, -22324.94910};
+    static const double q5[5] = {1.0, 156.9424537, 3745.310488, 9834.698876, 66924.28357};
+    static const double p6[5] = {1.000827619, 664.9143136, 62972.92665, 475554.6998, -5743609.109};
+    static const double q6[5] = {1.0, 651.4101098, 56974.73333, 165917.4725, -2815759.939};
+    static const double a1[3] = {0.04166666667, -0.01996527778, 0.02709538966};
+    static const double a2[2] = {-1.845568670, -4.284640743};
+
+    auto ratio = [](const double *p, const double *q, double u) {
+        return (p[0] + (p[1] + (p[2] + (p[3] + p[4] * u) * u) * u) * u) /
+               (q[0] + (q[1] + (q[2] + (q[3] + q[4] * u) * u) * u) * u);
+    };
+    if (v < -5.5) {
+        double u = std::exp(v + 1.0);
+        if (u < 1e-10) {
+            return 0;
+        }
+        return 0.3989422803 * (std::exp(-1 / u) / std::sqrt(u)) * (1 + (a1[0] + (a1[1] + a1[2] * u) * u) * u);
+    } else if (v < -1) {
+        double u = std::exp(-v - 1);
+        return std::exp(-u) * std::sqrt(u) * ratio(p1, q1, v);
+    } else if (v < 1) {
+        return ratio(p2, q2, v);
+    } else if (v < 5) {
+        return ratio(p3, q3, v);
+    } else if (v < 12) {
+        double u = 1 / v;
+        return u * u * ratio(p4, q4, u);
+    } else if (v < 50) {
+        double u = 1 / v;
+        return u * u * ratio(p5, q5, u);
+    } else if (v < 300) {
+        double u = 1 / v;
+        return u * u * ratio(p6, q6, u);
+    }
+    double u = 1 / (v - v * std::log(v) / (v + 1));
+    return u * u * (1 + (a2[0] + a2[1] * u) * u);
+}
+
+// Inverse of a symmetric 3x3 matrix by cofactors, false if it is singular
+bool invert3(const double a[3][3], double inverse[3][3]) {
+    double c[3][3];
+    c[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    c[0][1] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    c[0][2] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    double det = a[0][0] * c[0][0] + a[0][1] * c[0][1] + a[0][2] * c[0][2];
+    if (!(std::fabs(det) > 1e-300)) {
+        return false;
+    }
+    c[1][0] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    c[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    c[1][2] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    c[2][0] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    c[2][1] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    c[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            inverse[i][j] = c[j][i] / det;
+        }
+    }
+    return true;
+}
+
+struct fit_bin {
+    double x;
+    double content;
+};
+
+double chi2_of(const std::vector<fit_bin> &bins, const double *p) {
+    double chi2 = 0;
+    for (auto &bin : bins) {
+        double r = bin.content - p[0] * landau(bin.x, p[1], p[2]);
+        chi2 += r * r / bin.content;
+    }
+    return chi2;
+}
+
+// Normal equations J^T W J and J^T W r for p = (amplitude, mpv, width)
+void normal_equations(const std::vector<fit_bin> &bins, const double *p, double jtj[3][3], double jtr[3]) {
+    for (int a = 0; a < 3; a++) {
+        jtr[a] = 0;
+        for (int b = 0; b < 3; b++) {
+            jtj[a][b] = 0;
+        }
+    }
+    const double h = 1e-5;
+    for (auto &bin : bins) {
+        double v = (bin.x - p[1]) / p[2];
+        double g = denlan(v);
+        double dg = (denlan(v + h) - denlan(v - h)) / (2 * h);
+        double j[3] = {g, -p[0] * dg / p[2], -p[0] * dg * v / p[2]};
+        double weight = 1 / bin.content;
+        double r = bin.content - p[0] * g;
+        for (int a = 0; a < 3; a++) {
+            jtr[a] += weight * j[a] * r;
+            for (int b = 0; b < 3; b++) {
+                jtj[a][b] += weight * j[a] * j[b];
+            }
+        }
+    }
+}
+
+}
+
+double landau(double x, double mpv, double width) {
+    if (width <= 0) {
+        return 0;
+    }
+    return denlan((x - mpv) / width);
+}
+
+landau_fit landau_fitter::fit(const histogram &h) const {
+    landau_fit result = {0, 0, 0, 0, 0, 0, 0, 0, 0, false};
+    std::vector<fit_bin> bins;
+    int peak = -1;
+    for (int i = 0; i < h.get_bins(); i++) {
+        double x = h.get_bin_center(i);
+        if (x < low || x > high || h.get_content(i) <= 0) {
+            continue;
+        }
+        if (peak < 0 || h.get_content(i) > bins[peak].content) {
+            peak = bins.size();
+        }
+        bins.push_back({x, h.get_content(i)});
+    }
+    result.ndf = (int)bins.size() - 3;
+    if (bins.size() < 4) {
+        return result;
+    }
+
+    // Start from the peak and the full width at half maximum, which is about 4 widths
+    double half = bins[peak].content / 2;
+    int left = peak;
+    while (left > 0 && bins[left - 1].content > half) {
+        left--;
+    }
+    int right = peak;
+    while (right < (int)bins.size() - 1 && bins[right + 1].content > half) {
+        right++;
+    }
+    double bin_width = (h.get_high() - h.get_low()) / h.get_bins();
+    double p[3];
+    p[2] = std::min(std::max((bins[right].x - bins[left].x + bin_width) / 4.02, bounds.width_min), bounds.width_max);
+    p[1] = std::min(std::max(bins[peak].x + 0.22278 * p[2], bounds.mpv_min), bounds.mpv_max);
+    // The best amplitude for that shape, sum(g) / sum(g^2 / content)
+    double sum_g = 0;
+    double sum_g2 = 0;
+    for (auto &bin : bins) {
+        double g = landau(bin.x, p[1], p[2]);
+        sum_g += g;
+        sum_g2 += g * g / bin.content;
+    }
+    p[0] = sum_g2 > 0 ? sum_g / sum_g2 : bins[peak].content / 0.18;
+
+    double low_limit[3] = {0, bounds.mpv_min, bounds.width_min};
+    double high_limit[3] = {std::numeric_limits<double>::infinity(), bounds.mpv_max, bounds.width_max};
+    double chi2 = chi2_of(bins, p);
+    double lambda = 1e-3;
+    int iteration = 0;
+    bool converged = false;
+    while (iteration < max_iterations && !converged) {
+        iteration++;
+        double jtj[3][3];
+        double jtr[3];
+        normal_equations(bins, p, jtj, jtr);
+        // Hold a parameter at its limit while chi2 would fall past it
+        for (int a = 0; a < 3; a++) {
+            if ((p[a] <= low_limit[a] && jtr[a] < 0) || (p[a] >= high_limit[a] && jtr[a] > 0)) {
+                for (int b = 0; b < 3; b++) {
+                    jtj[a][b] = 0;
+                    jtj[b][a] = 0;
+                }
+                jtj[a][a] = 1;
+                jtr[a] = 0;
+            }
+        }
+
+        bool improved = false;
+        while (!improved && lambda < 1e10) {
+            double damped[3][3];
+            double inverse[3][3];
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < 3; b++) {
+                    damped[a][b] = jtj[a][b];
+                }
+                damped[a][a] += lambda * jtj[a][a] + 1e-12;
+            }
+            if (!invert3(damped, inverse)) {
+                lambda *= 10;
+                continue;
+            }
+            double trial[3];
+            for (int a = 0; a < 3; a++) {
+                double step = inverse[a][0] * jtr[0] + inverse[a][1] * jtr[1] + inverse[a][2] * jtr[2];
+                trial[a] = std::min(std::max(p[a] + step, low_limit[a]), high_limit[a]);
+            }
+            double trial_chi2 = chi2_of(bins, trial);
+            if (trial_chi2 <= chi2) {
+                improved = true;
+                converged = chi2 - trial_chi2 <= 1e-8 * chi2 + 1e-10;
+                for (int a = 0; a < 3; a++) {
+                    p[a] = trial[a];
+                }
+                chi2 = trial_chi2;
+                lambda = std::max(lambda * 0.1, 1e-7);
+            } else {
+                lambda *= 10;
+            }
+        }
+        if (!improved) {
+            // No step lowers chi2 any further, so this is the minimum within the limits
+            converged = true;
+        }
+    }
+
+    double jtj[3][3];
+    double jtr[3];
+    double covariance[3][3];
+    normal_equations(bins, p, jtj, jtr);
+    if (invert3(jtj, covariance)) {
+        result.amplitude_error = std::sqrt(std::fabs(covariance[0][0]));
+        result.mpv_error = std::sqrt(std::fabs(covariance[1][1]));
+        result.width_error = std::sqrt(std::fabs(covariance[2][2]));
+    }
+    result.amplitude = p[0];
+    result.mpv = p[1];
+    result.width = p[2];
+    result.chi2 = chi2;
+    result.iterations = iteration;
+    result.converged = converged;
+    return result;
+}
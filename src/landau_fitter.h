@@ -0,0 +1,63 @@
+/*
+Fits a Landau to a histogram the way analysis/fit_mip.cxx does with ROOT's "landau",
+
+    f(x) = amplitude * landau((x - mpv) / width)
+
+where landau is the density of the CERNLIB DENLAN approximation, the same as
+TMath::Landau.  As in ROOT, mpv is the location parameter; the peak of the density is
+0.22278 * width below it.
+
+The fit is a chi2 over the bins whose centers are in [low, high], each weighted by its
+content as the error of a bin is its square root; empty bins are left out, as ROOT does.
+Levenberg-Marquardt starts from the highest bin and the width at half maximum.  Errors are
+the square roots of the diagonal of the inverse curvature, as MINUIT's parabolic errors.
+
+fit() keeps no state, so one fitter can be shared between threads that fit different
+channels.
+*/
+
+#pragma once
+
+class histogram;
+
+// The Landau density of TMath::Landau(x, mpv, width), not divided by width
+double landau(double x, double mpv, double width);
+
+struct landau_fit {
+    double amplitude;
+    double mpv;
+    double width;
+    double amplitude_error;
+    double mpv_error;
+    double width_error;
+    double chi2;
+    int ndf;                // Bins fitted less fitted parameters
+    int iterations;
+    bool converged;
+};
+
+class landau_fitter {
+public:
+    // Parameter limits, as in fit_mip.cxx; the amplitude is in counts so it has none
+    struct limits {
+        double mpv_min = 5;
+        double mpv_max = 250;
+        double width_min = 0.4;
+        double width_max = 10000;
+    };
+
+private:
+    double low;
+    double high;
+    limits bounds;
+    int max_iterations;
+
+public:
+    landau_fitter(double low, double high) : low(low), high(high), max_iterations(200) {}
+
+    void set_limits(const limits &bounds) {this->bounds = bounds;}
+    void set_max_iterations(int iterations) {max_iterations = iterations;}
+
+    // A histogram with fewer than four filled bins in range returns converged = false and ndf <= 0
+    landau_fit fit(const histogram &h) const;
+};
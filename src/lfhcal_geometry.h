@@ -0,0 +1,30 @@
+/*
+Position of each readout channel in the LFHCal test beam prototype: 4 columns across (x),
+2 rows (y) and 64 layers (z).  The ASIC channels that are not connected to a tile return
+false with all coordinates -1.
+
+make_mapping prints the table in analysis/lfhcal_hgcroc.mapping.
+
+lfhcal_columns is the same table as the column (x + 4 y) and layer of each channel, for
+finding tracks along a column as track_trigger and h2g_amplitudes do.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+bool decode_position(int channel, int &x, int &y, int &z);
+void make_mapping();
+
+struct lfhcal_columns {
+    static const int COLUMNS = 8;       // 4 across and 2 high
+    static const int LAYERS = 64;
+
+    // Of each channel, -1 if it is not connected to a tile
+    std::vector<int8_t> column;
+    std::vector<int8_t> layer;
+
+    // Channels past the 576 of the prototype's 4 KCUs have no position
+    lfhcal_columns(int num_channels);
+};
@@ -1,11 +1,13 @@
 #include "line_builder.h"
 #include "debug_logger.h"
+#include "checkpoint.h"
 
 #include <cstdint>
 #include <list>
 #include <vector>
 #include <memory>
 #include <iostream>
+#include <stdexcept>
 
 line_builder::line_builder(uint32_t num_fpga, bool truncate_adc) {
     this->num_fpga = num_fpga;
@@ -26,7 +28,7 @@ line_builder::line_builder(uint32_t num_fpga, bool truncate_adc) {
 line_builder::~line_builder() {
     auto percent_lost = (float)(in_progress->size() + events_aborted) / (float)(in_progress->size() + events_aborted + complete->size() + events_completed);
     percent_lost *= 100;
-    log_message(DEBUG_DEBUG, "LineBuilder", "Ended with " + std::to_string(in_progress->size() + events_aborted) + 
+    LOG_MESSAGE(DEBUG_DEBUG, "LineBuilder", "Ended with " + std::to_string(in_progress->size() + events_aborted) + 
                 " in progress and " + std::to_string(complete->size() + events_completed) + 
                 " complete (" + std::to_string(percent_lost) + "% lost)");
 
@@ -36,9 +38,9 @@ line_builder::~line_builder() {
     }
     mean /= 16;
 
-    log_message(DEBUG_DEBUG, "LineBuilder", "Each device found:");
+    LOG_MESSAGE(DEBUG_DEBUG, "LineBuilder", "Each device found:");
     for (int i = 0; i < 16; i++) {
-        log_message(DEBUG_DEBUG, "LineBuilder", "Device " + std::to_string(i) + 
+        LOG_MESSAGE(DEBUG_DEBUG, "LineBuilder", "Device " + std::to_string(i) + 
                     " found " + std::to_string(num_found[i]) + 
                     " times (" + std::to_string(num_found[i] - mean) + " away from mean)");
     }
@@ -101,7 +103,13 @@ void line_builder::decode_line(uint8_t *buffer, line *l) {
     l->asic = decode_asic(buffer[0]);
     l->fpga = decode_fpga(buffer[1]);
     l->half = decode_half(buffer[2]);
-    num_found[l->fpga * 4 + l->asic * 2 + l->half]++;
+    uint32_t device = l->fpga * 4 + l->asic * 2 + l->half;
+    if (device < 16) {  // Garbage or idle lines decode to out of range ids
+        num_found[device]++;
+        if (stats) {
+            stats->add_lines_found(1, device);
+        }
+    }
     l->line_number = buffer[3];
     l->timestamp = bit_converter(buffer, 4);
     for (int i = 0; i < 8; i++) {
@@ -123,6 +131,9 @@ bool line_builder::process_packet(uint8_t *packet) {
         delete ls;
         in_progress->pop_front();
         events_aborted++;
+        if (stats) {
+            stats->add_incomplete_lines(1);
+        }
     }
 
     int decode_ptr = 12; // Skip the packet header
@@ -144,7 +155,7 @@ bool line_builder::process_packet(uint8_t *packet) {
             if ((*ls)->fpga == l->fpga && (*ls)->asic == l->asic && (*ls)->half == l->half && (*ls)->timestamp == l->timestamp) {
                 found = true;
                 if ((*ls)->lines[l->line_number] != nullptr) {
-                    log_message(DEBUG_ERROR, "LineBuilder", "Duplicate line " + std::to_string(l->line_number) + 
+                    LOG_MESSAGE(DEBUG_ERROR, "LineBuilder", "Duplicate line " + std::to_string(l->line_number) + 
                                 " for FPGA " + std::to_string(l->fpga) + 
                                 " at timestamp " + std::to_string(l->timestamp));
                     return false;
@@ -188,7 +199,7 @@ bool line_builder::process_complete() {
         // Check if any lines are null
         for (int i = 0; i < 5; i++) {
             if (ls->lines[i] == nullptr) {
-                log_message(DEBUG_ERROR, "LineBuilder", "Missing line " + std::to_string(i));
+                LOG_MESSAGE(DEBUG_ERROR, "LineBuilder", "Missing line " + std::to_string(i));
                 return false;
             }
         }
@@ -206,16 +217,16 @@ bool line_builder::process_complete() {
         uint32_t header_end_aligment = header & 0b1111;
         if (header_start_alignment != 0b0101) {
             slipped++;
-            log_message(DEBUG_TRACE, "LineBuilder", "Start header out of alignment! Got " + std::to_string(header_start_alignment));
+            LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "Start header out of alignment! Got " + std::to_string(header_start_alignment));
         }
         if (header_end_aligment != 0b0101) {
             slipped++;
-            log_message(DEBUG_TRACE, "LineBuilder", "End header out of alignment! Got " + std::to_string(header_end_aligment));
+            LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "End header out of alignment! Got " + std::to_string(header_end_aligment));
         }
         if (slipped == 1) {
-            log_message(DEBUG_TRACE, "LineBuilder", "Only one header slipped...");
+            LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "Only one header slipped...");
         } else if (slipped == 2) {
-            log_message(DEBUG_TRACE, "LineBuilder", "Both headers slipped");
+            LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "Both headers slipped");
         }
 
         // auto idle = ls->lines[4][] // never mind, we don't get the idle packet... 
@@ -223,7 +234,7 @@ bool line_builder::process_complete() {
         auto cm = ls->lines[0]->package[1];
         auto calib = ls->lines[2]->package[4];
         auto crc = ls->lines[4]->package[7];
-        log_message(DEBUG_TRACE, "LineBuilder", "CRC is " + std::to_string(crc));
+        LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "CRC is " + std::to_string(crc));
 
         int ch = 0;
         for (int i = 0; i < 5; i++) {
@@ -254,15 +265,21 @@ bool line_builder::process_complete() {
             }
         }
         if (slipped > 0) {
-            log_message(DEBUG_TRACE, "LineBuilder", "Using sample with " + std::to_string(slipped) + " slipped headers");
+            LOG_MESSAGE(DEBUG_TRACE, "LineBuilder", "Using sample with " + std::to_string(slipped) + " slipped headers");
         }
         samples->at(s->fpga)->push_back(s);
+        if (stats) {
+            stats->add_complete_lines_per_device(1, s->fpga * 4 + s->asic * 2 + s->half);
+        }
         for (int i = 0; i < 5; i++) {
             delete ls->lines[i];
         }
         delete ls;
     }
     events_completed += complete->size();
+    if (stats) {
+        stats->add_complete_lines(complete->size());
+    }
     complete->clear();
     return true;
 }
@@ -281,4 +298,70 @@ int line_builder::get_num_events_completed() {
 
 int line_builder::get_num_found(int fpga, int asic, int half) {
     return num_found[fpga * 4 + asic * 2 + half];
-}
\ No newline at end of file
+}
+namespace {
+void save_line_streams(checkpoint_writer &out, std::list<line_stream*> *streams) {
+    out.put<uint64_t>(streams->size());
+    for (auto ls : *streams) {
+        out.put(*ls);
+        for (int i = 0; i < 5; i++) {
+            out.put<uint8_t>(ls->lines[i] != nullptr);
+            if (ls->lines[i]) {
+                out.put(*ls->lines[i]);
+            }
+        }
+    }
+}
+
+void load_line_streams(checkpoint_reader &in, std::list<line_stream*> *streams) {
+    uint64_t count = in.get<uint64_t>();
+    for (uint64_t n = 0; n < count; n++) {
+        auto ls = new struct line_stream;
+        *ls = in.get<line_stream>();
+        for (int i = 0; i < 5; i++) {
+            ls->lines[i] = nullptr;
+        }
+        streams->push_back(ls);
+        for (int i = 0; i < 5; i++) {
+            if (in.get<uint8_t>()) {
+                ls->lines[i] = new struct line;
+                *ls->lines[i] = in.get<line>();
+            }
+        }
+    }
+}
+}
+
+void line_builder::save_state(checkpoint_writer &out) {
+    out.put(num_fpga);
+    out.put(events_aborted);
+    out.put(events_completed);
+    out.put_array(num_found, 16);
+    save_line_streams(out, in_progress);
+    save_line_streams(out, complete);
+    for (auto fpga : *samples) {
+        out.put<uint64_t>(fpga->size());
+        for (auto s : *fpga) {
+            out.put(*s);
+        }
+    }
+}
+
+void line_builder::load_state(checkpoint_reader &in) {
+    if (in.get<uint32_t>() != num_fpga) {
+        throw std::runtime_error("Checkpoint was written for a different number of KCUs");
+    }
+    events_aborted = in.get<uint32_t>();
+    events_completed = in.get<uint32_t>();
+    in.get_array(num_found, 16);
+    load_line_streams(in, in_progress);
+    load_line_streams(in, complete);
+    for (auto fpga : *samples) {
+        uint64_t count = in.get<uint64_t>();
+        for (uint64_t n = 0; n < count; n++) {
+            auto s = new struct sample;
+            *s = in.get<sample>();
+            fpga->push_back(s);
+        }
+    }
+}
@@ -4,10 +4,15 @@ Collects lines from the input stream and builds a 40 byte packet from them.
 
 #pragma once
 
+#include "stat_logger.h"
+
 #include <cstdint>
 #include <list>
 #include <vector>
 
+class checkpoint_writer;
+class checkpoint_reader;
+
 struct line {
     uint32_t fpga;
     uint32_t asic;
@@ -54,14 +59,13 @@ private:
     uint32_t events_completed;
     int32_t num_found[16];
     bool truncate_adc;
+    stat_logger *stats = nullptr;
 
     uint32_t bit_converter(uint8_t *buffer, int start, bool big_endian=true);
     uint8_t decode_fpga(uint8_t fpga_id);
     uint8_t decode_asic(uint8_t asic_id);
     uint8_t decode_half(uint8_t half_id);
 
-
-    void decode_line(uint8_t *buffer, line *l);
     bool is_complete(line_stream *ls);
 
 
@@ -69,12 +73,20 @@ public:
     line_builder(uint32_t num_fpga, bool truncate_adc=false);
     ~line_builder();
 
+    // Decode one 40 byte line, public so it can be benchmarked on its own
+    void decode_line(uint8_t *buffer, line *l);
     bool process_packet(uint8_t *packet);
     bool process_complete();
     std::list<sample*> *get_completed(uint32_t fpga);
+    size_t get_num_in_progress() {return in_progress->size();}
+    void set_stat_logger(stat_logger *stats) {this->stats = stats;}
 
     int get_num_events_aborted();
     int get_num_events_completed();
     int get_num_found(int fpga, int asic, int half);
 
+    // Line streams and samples still in flight, see checkpoint.h
+    void save_state(checkpoint_writer &out);
+    void load_state(checkpoint_reader &in);
+
 };
@@ -1,3 +1,6 @@
+#include "lfhcal_geometry.h"
+
+#include <algorithm>
 #include <iostream>
 
 bool decode_position(int channel, int &x, int &y, int &z) {
@@ -56,6 +59,16 @@ bool decode_position(int channel, int &x, int &y, int &z) {
     return true;
 }
 
+lfhcal_columns::lfhcal_columns(int num_channels) : column(num_channels, -1), layer(num_channels, -1) {
+    for (int i = 0; i < std::min(num_channels, 576); i++) {
+        int x, y, z;
+        if (decode_position(i, x, y, z)) {
+            column[i] = x + 4 * y;
+            layer[i] = z;
+        }
+    }
+}
+
 void make_mapping() {
     int x, y, z;
     for (int i = 0; i < 576; i++) {
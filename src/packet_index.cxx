@@ -0,0 +1,89 @@
+#include "packet_index.h"
+#include "checkpoint.h"
+#include "debug_logger.h"
+
+#include <stdexcept>
+
+namespace {
+const uint64_t INDEX_MAGIC = 0x3158444932474848ULL;  // "HHG2IDX1"
+}
+
+packet_index::packet_index(int num_kcu, int num_samples) : num_kcu(num_kcu), num_samples(num_samples) {}
+
+packet_index::packet_index(const std::string &file_name) {
+    checkpoint_reader in(file_name);
+    if (in.get<uint64_t>() != INDEX_MAGIC) {
+        throw std::runtime_error(file_name + " is not a packet index");
+    }
+    num_kcu = in.get<int32_t>();
+    num_samples = in.get<int32_t>();
+    uint64_t count = in.get<uint64_t>();
+    if (num_kcu <= 0 || num_kcu > 64 || count > (1 << 24)) {
+        throw std::runtime_error(file_name + " is corrupt");
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        index_entry entry;
+        entry.packets = in.get<int64_t>();
+        entry.events = in.get<int64_t>();
+        entry.last_timestamps.resize(num_kcu);
+        in.get_array(entry.last_timestamps.data(), num_kcu);
+        entry.unwrap.resize(num_kcu);
+        in.get_array(entry.unwrap.data(), num_kcu);
+        add(entry);
+    }
+    LOG_MESSAGE(DEBUG_INFO, "PacketIndex", "Loaded " + std::to_string(entries.size()) + " entries from " + file_name);
+}
+
+void packet_index::add(const index_entry &entry) {
+    entries.push_back(entry);
+    if (entry.events > 0) {
+        by_timestamp[entry.last_timestamps[0]] = entries.size() - 1;
+    }
+}
+
+void packet_index::write(const std::string &file_name) {
+    checkpoint_writer out(file_name);
+    out.put(INDEX_MAGIC);
+    out.put<int32_t>(num_kcu);
+    out.put<int32_t>(num_samples);
+    out.put<uint64_t>(entries.size());
+    for (auto &entry : entries) {
+        out.put(entry.packets);
+        out.put(entry.events);
+        out.put_array(entry.last_timestamps.data(), num_kcu);
+        out.put_array(entry.unwrap.data(), num_kcu);
+    }
+    out.commit();
+}
+
+const index_entry *packet_index::start_for_event(int64_t first_event) const {
+    // The entry after the start has to come at or before the first event wanted
+    for (size_t i = entries.size(); i >= 2; i--) {
+        if (entries[i - 1].events <= first_event && entries[i - 1].events > 0) {
+            return &entries[i - 2];
+        }
+    }
+    return nullptr;
+}
+
+const index_entry *packet_index::start_for_timestamp(int64_t first_timestamp) const {
+    for (size_t i = entries.size(); i >= 2; i--) {
+        if (entries[i - 1].last_timestamps[0] < first_timestamp && entries[i - 1].events > 0) {
+            return &entries[i - 2];
+        }
+    }
+    return nullptr;
+}
+
+int64_t packet_index::sync_limit(const index_entry *start) const {
+    size_t after_next = start - entries.data() + 2;
+    return after_next < entries.size() ? entries[after_next].packets : -1;
+}
+
+int64_t packet_index::event_number(const std::vector<int64_t> &timestamps) const {
+    auto it = by_timestamp.find(timestamps[0]);
+    if (it == by_timestamp.end() || entries[it->second].last_timestamps != timestamps) {
+        return -1;
+    }
+    return entries[it->second].events - 1;
+}
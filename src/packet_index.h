@@ -0,0 +1,71 @@
+/*
+Index of where the events of a run are in its packets, so a quick look at part of a run
+does not have to decode it from the start:
+
+    h2g_run -r 42 -x                 # full decode, also writes $OUTPUT_DIRECTORY/Run042.idx
+    h2g_run -r 42 -e 250000-252000   # seeks close to event 250000 instead of decoding up to it
+    h2g_run -r 42 -W 180000-190000   # KCU 0 timestamps as written to the outputs
+
+Every SPACING events, at a point between packets, the index records how many packets and
+events came before, the timestamps of the last of those events, and the unwrap counters of
+every waveform builder.  A seek skips that many packets and restores the counters, so the
+timestamps and event numbers come out as in a full decode.  Events in flight at that point
+are lost, so the decoder starts one entry before the one it needs.  It picks up the event
+numbering again at the first event whose timestamps on every KCU match a later entry, and
+drops everything before that.
+
+With lost or reordered packets, which KCU events end up aligned together can depend on
+everything decoded before, and a seek does not always come back in step with the full
+decode.  If no entry has matched by the time the decoder has passed the entry after next,
+it gives up on the index and decodes the run from the start.
+*/
+
+#pragma once
+
+#include "waveform_builder.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+struct index_entry {
+    int64_t packets;            // Packets read before this point
+    int64_t events;             // Events decoded before this point
+    std::vector<int64_t> last_timestamps;   // Timestamps of event number events - 1, one per KCU
+    std::vector<unwrap_state> unwrap;   // One per KCU
+};
+
+class packet_index {
+private:
+    int num_kcu;
+    int num_samples;
+    std::vector<index_entry> entries;
+    std::map<int64_t, size_t> by_timestamp;   // KCU 0 timestamp of the last event to its entry
+
+public:
+    static const int64_t SPACING = 1000;
+
+    packet_index(int num_kcu, int num_samples);
+    // Throws std::runtime_error if the file cannot be read
+    packet_index(const std::string &file_name);
+
+    void add(const index_entry &entry);
+    // Throws std::runtime_error if the file cannot be written
+    void write(const std::string &file_name);
+
+    size_t size() const {return entries.size();}
+    int get_num_kcu() const {return num_kcu;}
+    int get_num_samples() const {return num_samples;}
+    int64_t get_last_events() const {return entries.empty() ? 0 : entries.back().events;}
+
+    // Where to start decoding so the numbering is picked up again before the first event
+    // wanted, nullptr to start from the beginning of the run
+    const index_entry *start_for_event(int64_t first_event) const;
+    const index_entry *start_for_timestamp(int64_t first_timestamp) const;
+    // Packets after which a decode that started at start should have matched an entry,
+    // -1 if it has until the end of the run
+    int64_t sync_limit(const index_entry *start) const;
+    // Event number of the event with these timestamps if an entry ends with it, else -1
+    int64_t event_number(const std::vector<int64_t> &timestamps) const;
+};
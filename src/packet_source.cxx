@@ -0,0 +1,90 @@
+#include "packet_source.h"
+#include "stream_source.h"
+#include "udp_source.h"
+#include "compressed_source.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <poll.h>
+#include <sstream>
+
+std::atomic<bool> packet_source::interrupted(false);
+
+void packet_source::parse_header_line(const std::string &line, int &hashline_count) {
+    if (line.find("# Generator Setting machine_gun:") != std::string::npos) {
+        std::istringstream iss(line);
+        std::string token;
+        while (std::getline(iss, token, ' ')) {
+            if (token.find("machine_gun:") != std::string::npos) {
+                std::getline(iss, token, ' ');
+                try {
+                    number_samples = std::stoi(token) + 1;
+                    LOG_MESSAGE(DEBUG_INFO, "PacketSource", "Number of samples: " + std::to_string(number_samples));
+                } catch (const std::exception &) {
+                    LOG_MESSAGE(DEBUG_ERROR, "PacketSource", "Bad machine_gun setting \"" + token + "\" in the header");
+                }
+            }
+        }
+    }
+    if (line.find("##################################################") != std::string::npos) {
+        hashline_count++;
+        LOG_MESSAGE(DEBUG_DEBUG, "PacketSource", "Found delimiter line " + std::to_string(hashline_count) + "/2");
+    }
+}
+
+int packet_source::finish_packet(const uint8_t *buffer) {
+    packets_processed++;
+    if (stats) {
+        stats->add_packet(PACKET_SIZE);
+    }
+    // Check if this is a heartbeat packet
+    if (buffer[0] == 0x23 && buffer[1] == 0x23 && buffer[2] == 0x23 && buffer[3] == 0x23) {
+        LOG_MESSAGE(DEBUG_TRACE, "PacketSource", "Heartbeat packet");
+        if (stats) {
+            stats->add_heartbeat();
+        }
+        return 2;
+    }
+    return 1;
+}
+
+bool packet_source::wait_readable(int fd) {
+    int timeout_ms = std::max(1, (int)(poll_interval * 1000));
+    while (true) {
+        if (interrupted) {
+            LOG_MESSAGE(DEBUG_INFO, "PacketSource", "Interrupted while waiting for data");
+            return false;
+        }
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            // Errors and hang ups are picked up by the read that follows
+            last_data = std::chrono::steady_clock::now();
+            return true;
+        }
+        double idle = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_data).count();
+        if (timeout > 0 && idle > timeout) {
+            LOG_MESSAGE(DEBUG_WARNING, "PacketSource", "No data for " + std::to_string(timeout) + " s, giving up");
+            return false;
+        }
+    }
+}
+
+bool packet_source::skip_packets(int64_t count) {
+    uint8_t buffer[PACKET_SIZE];
+    for (int64_t i = 0; i < count; i++) {
+        if (read_packet(buffer) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+packet_source *open_packet_source(const std::string &input, uint32_t num_fpgas, int num_samples, double timeout) {
+    if (input.rfind("udp://", 0) == 0) {
+        return new udp_source(input.substr(6), num_fpgas, num_samples, timeout);
+    }
+    if (input != "-" && compressed_source::detect(input) != compressed_source::NONE) {
+        return new compressed_source(input, num_fpgas, num_samples);
+    }
+    return new stream_source(input, num_fpgas, num_samples, timeout);
+}
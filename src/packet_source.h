@@ -0,0 +1,70 @@
+/*
+Where the decoder gets its 1452 byte packets from.
+
+file_stream reads a .h2g file from disk, stream_source reads the same layout from stdin,
+a FIFO or any other pipe, and udp_source receives the packets directly as the UDP
+payloads sent by the KCUs.  All of them hand out one packet per read_packet call:
+
+    0   no more packets, the run is over
+    1   a data packet was copied into the buffer
+    2   a heartbeat packet was copied into the buffer
+
+    packet_source *source = open_packet_source("udp://0.0.0.0:5000", 4, 10);
+    hgc_decoder decoder(source, 0, 4);
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "stat_logger.h"
+
+class packet_source {
+protected:
+    static const uint32_t PACKET_SIZE = 1452;
+    static std::atomic<bool> interrupted;
+
+    int number_samples = 0;
+    int packets_processed = 0;
+    stat_logger *stats = nullptr;
+
+    double timeout = 0;     // Seconds without data before a live source gives up, 0 waits forever
+    double poll_interval = 0.2;
+    std::chrono::steady_clock::time_point last_data = std::chrono::steady_clock::now();
+
+    // Picks the number of samples and the delimiter lines out of a header line
+    void parse_header_line(const std::string &line, int &hashline_count);
+    // Counts a packet that was read into buffer and returns 1, or 2 for a heartbeat
+    int finish_packet(const uint8_t *buffer);
+    // Waits until fd can be read, returns false when interrupted or after the timeout
+    bool wait_readable(int fd);
+
+public:
+    virtual ~packet_source() {}
+
+    virtual int read_packet(uint8_t *buffer) = 0;
+    // Sources that wait for data instead of ending, the decoder does not give up on them
+    virtual bool is_live() {return false;}
+    // Size of the input in bytes, 0 if it is not known in advance
+    virtual int64_t get_size() {return 0;}
+    // Passes over the next count packets, for resuming a run from a checkpoint.  Reads and
+    // drops them unless the source can seek.  Returns false if the run ends first.
+    virtual bool skip_packets(int64_t count);
+
+    int get_number_samples() {return number_samples;}
+    int get_num_packets() {return packets_processed;}
+    void set_stat_logger(stat_logger *stats) {this->stats = stats;}
+
+    // Wakes up any source waiting for data and makes it report the end of the run,
+    // safe to call from a signal handler
+    static void interrupt() {interrupted = true;}
+};
+
+// Opens "-" as stdin, "udp://HOST:PORT" as a UDP socket, a gzip or zstd file through
+// compressed_source, and anything else as a stream read from start to end.  num_samples is needed by inputs without the text header: UDP,
+// or a stream when it is not 0.  A timeout stops the run after that many seconds without
+// data.  Throws std::runtime_error if the input cannot be opened.
+packet_source *open_packet_source(const std::string &input, uint32_t num_fpgas, int num_samples = 0, double timeout = 0);
@@ -0,0 +1,105 @@
+#include "pedestal_accumulator.h"
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+pedestal_accumulator::pedestal_accumulator(int num_kcu, int num_samples)
+    : num_channels(144 * num_kcu), num_samples(num_samples),
+      pedestals(num_channels), noise_m2(num_channels, 0), quiet(num_channels, 0) {}
+
+void pedestal_accumulator::add(aligned_event *event) {
+    for (uint32_t i = 0; i < event->get_num_fpga(); i++) {
+        kcu_event *e = event->get_event(i);
+        for (int j = 0; j < 144; j++) {
+            int channel = i * 144 + j;
+            pedestals[channel].add(e->get_sample_adc(j, 0));
+
+            welford waveform;
+            uint32_t low = e->get_sample_adc(j, 0);
+            uint32_t high = low;
+            for (int k = 0; k < num_samples; k++) {
+                uint32_t adc = e->get_sample_adc(j, k);
+                waveform.add(adc);
+                low = std::min(low, adc);
+                high = std::max(high, adc);
+            }
+            if (high - low <= QUIET_SPREAD) {
+                noise_m2[channel] += waveform.m2;
+                quiet[channel]++;
+            }
+        }
+    }
+}
+
+double pedestal_accumulator::get_noise(int channel) const {
+    if (quiet[channel] == 0 || num_samples < 2) {
+        return 0;
+    }
+    return std::sqrt(noise_m2[channel] / (quiet[channel] * (num_samples - 1)));
+}
+
+void pedestal_accumulator::write(const std::string &file_name) const {
+    std::ofstream out(file_name);
+    if (!out.good()) {
+        throw std::runtime_error("Error opening " + file_name);
+    }
+    out << "channel,kcu,entries,pedestal,pedestal_rms,quiet,noise" << std::endl;
+    for (int channel = 0; channel < num_channels; channel++) {
+        out << channel << "," << channel / 144 << "," << get_entries(channel) << "," << get_pedestal(channel) << ","
+            << get_pedestal_rms(channel) << "," << get_quiet(channel) << "," << get_noise(channel) << "\n";
+    }
+    out.close();
+    if (out.fail()) {
+        throw std::runtime_error("Error writing " + file_name);
+    }
+}
+
+void pedestal_accumulator::save_state(checkpoint_writer &out) const {
+    out.put_array(pedestals.data(), num_channels);
+    out.put_array(noise_m2.data(), num_channels);
+    out.put_array(quiet.data(), num_channels);
+}
+
+void pedestal_accumulator::load_state(checkpoint_reader &in) {
+    in.get_array(pedestals.data(), num_channels);
+    in.get_array(noise_m2.data(), num_channels);
+    in.get_array(quiet.data(), num_channels);
+}
+
+std::vector<double> read_pedestals(const std::string &file_name, int num_channels) {
+    std::ifstream in(file_name);
+    if (!in.good()) {
+        throw std::runtime_error("Error opening pedestals " + file_name);
+    }
+    std::vector<double> pedestals(num_channels, 0);
+    std::vector<bool> found(num_channels, false);
+    std::string line;
+    std::getline(in, line);     // Header
+    while (std::getline(in, line)) {
+        // channel,kcu,entries,pedestal,...
+        std::istringstream fields(line);
+        std::string channel, kcu, entries, pedestal;
+        if (!std::getline(fields, channel, ',') || !std::getline(fields, kcu, ',') ||
+            !std::getline(fields, entries, ',') || !std::getline(fields, pedestal, ',')) {
+            continue;
+        }
+        try {
+            int index = std::stoi(channel);
+            if (index >= 0 && index < num_channels) {
+                pedestals[index] = std::stod(pedestal);
+                found[index] = true;
+            }
+        } catch (const std::exception &) {
+            throw std::runtime_error("Bad line in pedestals " + file_name + ": " + line);
+        }
+    }
+    for (int i = 0; i < num_channels; i++) {
+        if (!found[i]) {
+            throw std::runtime_error("Pedestals " + file_name + " have no channel " + std::to_string(i));
+        }
+    }
+    return pedestals;
+}
@@ -0,0 +1,75 @@
+/*
+Per-channel pedestal and noise, accumulated while a run is decoded so the analysis does
+not need a pass of its own over the events to find them.
+
+The pedestal of a channel is the mean of sample 0 (hit_pedestal in the ROOT output) over
+every event written, with its event to event RMS.  The noise is the RMS of the samples
+around each waveform's own mean, pooled over the quiet waveforms, those whose samples
+spread over at most QUIET_SPREAD ADC counts.  Both are streaming (Welford) sums, so they
+cost a pass over the ADC values already in cache from writing the event and are exact
+however long the run.
+
+The decoder writes them to $OUTPUT_DIRECTORY/RunXXX.ped as CSV, and to a "pedestals" tree
+in the ROOT output.
+*/
+
+#pragma once
+
+#include "event_aligner.h"
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class checkpoint_writer;
+class checkpoint_reader;
+
+// Running mean and sum of squared differences from it, see Welford (1962)
+struct welford {
+    uint64_t count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double x) {
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+    double variance() const {return count > 1 ? m2 / (count - 1) : 0;}
+};
+
+class pedestal_accumulator {
+private:
+    int num_channels;
+    int num_samples;
+    std::vector<welford> pedestals;     // Sample 0 of every waveform
+    std::vector<double> noise_m2;       // Summed over the quiet waveforms
+    std::vector<uint64_t> quiet;        // Number of quiet waveforms
+
+public:
+    static const int QUIET_SPREAD = 20;
+
+    pedestal_accumulator(int num_kcu, int num_samples);
+
+    void add(aligned_event *event);
+
+    int get_num_channels() const {return num_channels;}
+    uint64_t get_entries(int channel) const {return pedestals[channel].count;}
+    double get_pedestal(int channel) const {return pedestals[channel].mean;}
+    double get_pedestal_rms(int channel) const {return std::sqrt(pedestals[channel].variance());}
+    uint64_t get_quiet(int channel) const {return quiet[channel];}
+    // 0 until the channel has had a quiet waveform
+    double get_noise(int channel) const;
+
+    // CSV with a line per channel, throws std::runtime_error if the file cannot be written
+    void write(const std::string &file_name) const;
+
+    void save_state(checkpoint_writer &out) const;
+    void load_state(checkpoint_reader &in);
+};
+
+// Pedestals of channels 0 to num_channels - 1 from a file written by write(), throws
+// std::runtime_error if it cannot be read or misses a channel
+std::vector<double> read_pedestals(const std::string &file_name, int num_channels);
@@ -0,0 +1,124 @@
+#include "run_compressor.h"
+#include "thread_pool.h"
+#include "debug_logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef H2G_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+#ifdef H2G_HAVE_ZSTD
+const size_t PACKET_SIZE = 1452;
+
+std::vector<uint8_t> compress_frame(const std::vector<uint8_t> &data, int level) {
+    std::vector<uint8_t> out(ZSTD_compressBound(data.size()));
+    size_t n = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), level);
+    if (ZSTD_isError(n)) {
+        throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+    }
+    out.resize(n);
+    return out;
+}
+
+// Length of the text header, up to and including the second delimiter line
+size_t header_length(FILE *in) {
+    std::vector<char> start(1 << 16);
+    size_t n = fread(start.data(), 1, start.size(), in);
+    std::string text(start.data(), n);
+    const std::string delimiter(50, '#');
+    size_t pos = text.find(delimiter);
+    if (pos != std::string::npos) {
+        pos = text.find(delimiter, pos + delimiter.size());
+    }
+    size_t end = pos == std::string::npos ? std::string::npos : text.find('\n', pos);
+    fseek(in, 0, SEEK_SET);
+    return end == std::string::npos ? 0 : end + 1;
+}
+#endif
+}
+
+#ifdef H2G_HAVE_ZSTD
+compress_summary compress_run(const std::string &input_file, const std::string &output_file, int level,
+                              size_t block_mb, unsigned num_threads) {
+    if (block_mb == 0) {
+        throw std::runtime_error("Frames need at least 1 MB");
+    }
+    FILE *in = fopen(input_file.c_str(), "rb");
+    if (in == nullptr) {
+        throw std::runtime_error("Error opening file " + input_file);
+    }
+    FILE *out = fopen(output_file.c_str(), "wb");
+    if (out == nullptr) {
+        fclose(in);
+        throw std::runtime_error("Error opening file " + output_file);
+    }
+
+    compress_summary summary = {0, 0, 0};
+    thread_pool pool(num_threads);
+    std::deque<std::future<std::vector<uint8_t>>> pending;
+    size_t block = (block_mb << 20) / PACKET_SIZE * PACKET_SIZE;
+    // The header gets a frame of its own so every other frame starts on a packet
+    size_t next_size = header_length(in);
+    if (next_size == 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "Compress", "No .h2g header found, compressing " + input_file + " as packets only");
+        next_size = block;
+    }
+    std::string error;
+
+    auto write_oldest = [&]() {
+        std::vector<uint8_t> frame = pending.front().get();
+        pending.pop_front();
+        if (fwrite(frame.data(), 1, frame.size(), out) != frame.size()) {
+            throw std::runtime_error("Error writing " + output_file);
+        }
+        summary.bytes_out += frame.size();
+    };
+
+    try {
+        while (true) {
+            std::vector<uint8_t> data(next_size);
+            size_t n = fread(data.data(), 1, data.size(), in);
+            if (n == 0) {
+                break;
+            }
+            data.resize(n);
+            summary.bytes_in += n;
+            summary.frames++;
+            pending.push_back(pool.submit([data = std::move(data), level] {return compress_frame(data, level);}));
+            if (pending.size() >= 2 * pool.get_num_threads()) {
+                write_oldest();
+            }
+            next_size = block;
+        }
+        while (!pending.empty()) {
+            write_oldest();
+        }
+    } catch (const std::exception &e) {
+        error = e.what();
+        // The frames still queued must finish before the pool goes
+        for (auto &frame : pending) {
+            frame.wait();
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0 && error.empty()) {
+        error = "Error writing " + output_file;
+    }
+    if (!error.empty()) {
+        std::remove(output_file.c_str());
+        throw std::runtime_error(error);
+    }
+    return summary;
+}
+#else
+compress_summary compress_run(const std::string &input_file, const std::string &, int, size_t, unsigned) {
+    throw std::runtime_error("Cannot compress " + input_file + ", this build has no zstd support");
+}
+#endif
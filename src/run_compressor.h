@@ -0,0 +1,26 @@
+/*
+Compresses a .h2g run with zstd as many independent frames, so compressed_source can
+decompress it on several threads.  The text header gets a frame of its own, and every other
+frame holds whole packets and records its size.  The output is an ordinary zstd file that
+`zstd -d` unpacks as well.  Used by h2g_compress, and by h2g_compare to check the parallel
+decompression.
+
+Needs zstd at build time (H2G_HAVE_ZSTD), without it compress_run throws.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct compress_summary {
+    int frames;
+    size_t bytes_in;
+    size_t bytes_out;
+};
+
+// block_mb is the uncompressed size of a frame, rounded down to whole packets, and 0 threads
+// uses one per hardware thread.  Throws std::runtime_error if the input cannot be read or the
+// output written, and removes a partial output.
+compress_summary compress_run(const std::string &input_file, const std::string &output_file, int level = 3,
+                              size_t block_mb = 8, unsigned num_threads = 0);
@@ -0,0 +1,208 @@
+#include "run_logbook.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// One record of a CSV file, quoted cells may hold commas, quotes ("") and newlines
+bool read_record(std::istream &in, std::vector<std::string> &cells) {
+    cells.clear();
+    std::string cell;
+    bool quoted = false;
+    bool any = false;
+    char c;
+    while (in.get(c)) {
+        any = true;
+        if (quoted) {
+            if (c == '"') {
+                if (in.peek() == '"') {
+                    in.get(c);
+                    cell.push_back('"');
+                } else {
+                    quoted = false;
+                }
+            } else {
+                cell.push_back(c);
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            cells.push_back(cell);
+            cell.clear();
+        } else if (c == '\n') {
+            break;
+        } else if (c != '\r') {
+            cell.push_back(c);
+        }
+    }
+    if (any) {
+        cells.push_back(cell);
+    }
+    return any;
+}
+
+std::string normalize(const std::string &text) {
+    std::string out;
+    for (char c : text) {
+        if (!std::isspace((unsigned char)c)) {
+            out.push_back(std::tolower((unsigned char)c));
+        }
+    }
+    return out;
+}
+
+std::string trim(const std::string &text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return "";
+    }
+    return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+// Whole-cell integer, fallback for empty cells and spreadsheet junk like #DIV/0!
+int to_int(const std::string &cell, int fallback) {
+    std::string text = trim(cell);
+    try {
+        size_t used = 0;
+        int value = std::stoi(text, &used);
+        if (used == text.size()) {
+            return value;
+        }
+    } catch (const std::exception &) {
+    }
+    return fallback;
+}
+
+double to_double(const std::string &cell, double fallback) {
+    std::string text = trim(cell);
+    try {
+        size_t used = 0;
+        double value = std::stod(text, &used);
+        if (used == text.size()) {
+            return value;
+        }
+    } catch (const std::exception &) {
+    }
+    return fallback;
+}
+}
+
+int parse_detector_id(const std::string &text) {
+    std::string name = normalize(text);
+    if (name == "lfhcal") {
+        return 1;
+    }
+    if (name == "eeemcal" || name == "eemcal") {
+        return 2;
+    }
+    int id = to_int(name, -1);
+    return id >= 0 && id <= 2 ? id : -1;
+}
+
+run_logbook::run_logbook(const std::string &file_name) : file_name(file_name) {
+    std::ifstream in(file_name);
+    if (!in.good()) {
+        throw std::runtime_error("Error opening logbook " + file_name);
+    }
+    std::vector<std::string> cells;
+    if (!read_record(in, cells)) {
+        throw std::runtime_error("Logbook " + file_name + " is empty");
+    }
+
+    // Column of each setting, matched on the start of the header without spaces or case
+    auto column = [&cells](std::initializer_list<const char*> names) {
+        for (size_t i = 0; i < cells.size(); i++) {
+            std::string header = normalize(cells[i]);
+            for (const char *name : names) {
+                if (header.rfind(name, 0) == 0) {
+                    return (int)i;
+                }
+            }
+        }
+        return -1;
+    };
+    int run_column = column({"runnumber", "run"});
+    int gun_column = column({"machinegun"});
+    int detector_column = column({"detector"});
+    int kcu_column = column({"kcus", "numkcu", "numberofkcu"});
+    int delay_column = column({"trigdelay", "triggerdelay"});
+    int species_column = column({"beamspecies"});
+    int energy_column = column({"beamenergy"});
+    int comments_column = column({"comments"});
+    if (run_column < 0) {
+        throw std::runtime_error("Logbook " + file_name + " has no Run Number column");
+    }
+    if (gun_column < 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "Logbook", file_name + " has no machine gun column, samples will not be checked");
+    }
+
+    int line = 1;
+    while (read_record(in, cells)) {
+        line++;
+        auto cell = [&cells](int column) {
+            return column >= 0 && column < (int)cells.size() ? cells[column] : std::string();
+        };
+        run_info info;
+        info.run_number = to_int(cell(run_column), -1);
+        if (info.run_number < 0) {
+            continue;
+        }
+        info.machine_gun = to_int(cell(gun_column), -1);
+        info.detector_id = trim(cell(detector_column)).empty() ? -1 : parse_detector_id(cell(detector_column));
+        if (detector_column >= 0 && info.detector_id < 0 && !trim(cell(detector_column)).empty()) {
+            LOG_MESSAGE(DEBUG_WARNING, "Logbook", "Unknown detector \"" + cell(detector_column) + "\" for run " +
+                        std::to_string(info.run_number));
+        }
+        info.num_kcu = std::max(0, to_int(cell(kcu_column), 0));
+        info.trigger_delay = to_int(cell(delay_column), -1);
+        info.beam_energy = to_double(cell(energy_column), 0);
+        info.beam_species = trim(cell(species_column));
+        info.comments = trim(cell(comments_column));
+        if (runs.count(info.run_number)) {
+            LOG_MESSAGE(DEBUG_WARNING, "Logbook", "Run " + std::to_string(info.run_number) + " is listed twice in " +
+                        file_name + ", using the entry ending on record " + std::to_string(line));
+        }
+        runs[info.run_number] = info;
+    }
+    LOG_MESSAGE(DEBUG_INFO, "Logbook", "Loaded " + std::to_string(runs.size()) + " runs from " + file_name);
+}
+
+const run_info *run_logbook::find(int run_number) const {
+    auto it = runs.find(run_number);
+    return it == runs.end() ? nullptr : &it->second;
+}
+
+bool run_logbook::configure(config &cfg) const {
+    const run_info *info = find(cfg.run_number);
+    if (info == nullptr) {
+        return false;
+    }
+    if (info->detector_id >= 0) {
+        cfg.detector_id = info->detector_id;
+    }
+    if (info->num_kcu > 0) {
+        cfg.num_kcu = info->num_kcu;
+    }
+    cfg.expected_samples = info->num_samples();
+    std::ostringstream message;
+    message << "Run " << info->run_number << ": detector " << cfg.detector_id << ", " << cfg.num_kcu << " KCUs";
+    if (info->machine_gun >= 0) {
+        message << ", " << info->num_samples() << " samples";
+    }
+    if (!info->beam_species.empty()) {
+        message << ", " << info->beam_species;
+        if (info->beam_energy > 0) {
+            message << " " << info->beam_energy << " GeV";
+        }
+    }
+    if (info->trigger_delay >= 0) {
+        message << ", trigger delay " << info->trigger_delay;
+    }
+    LOG_MESSAGE(DEBUG_INFO, "Logbook", message.str());
+    return true;
+}
@@ -0,0 +1,59 @@
+/*
+The run logbook, loaded once and looked up by run number, so a campaign can be decoded
+without giving -d, -n and friends run by run:
+
+    h2g_run -R @runs.txt -L logbook.csv
+
+The file is the CSV export of the shift logbook (see logbook.csv).  Columns are found by
+their header, so a derived file with extra columns works too:
+
+    Run Number         the run, rows without one are skipped
+    machine gun number samples per waveform minus one, checked against the run header
+    detector           optional, 0 / 1 / 2 or a name (LFHCAL, EEEMCAL)
+    KCUs               optional, number of KCUs read out
+    beam species, beam energy (GeV), trig delay, comments
+                       kept for the batch log
+
+Empty cells leave the setting given on the command line.
+*/
+
+#pragma once
+
+#include "hgc_decoder.h"
+
+#include <map>
+#include <string>
+
+struct run_info {
+    int run_number;
+    int machine_gun;        // -1 if not recorded
+    int detector_id;        // -1 if not recorded
+    int num_kcu;            // 0 if not recorded
+    int trigger_delay;      // -1 if not recorded
+    double beam_energy;     // 0 if not recorded
+    std::string beam_species;
+    std::string comments;
+
+    int num_samples() const {return machine_gun < 0 ? 0 : machine_gun + 1;}
+};
+
+class run_logbook {
+private:
+    std::string file_name;
+    std::map<int, run_info> runs;
+
+public:
+    // Throws std::runtime_error if the file cannot be read or has no run number column
+    run_logbook(const std::string &file_name);
+
+    size_t size() const {return runs.size();}
+    // nullptr if the run is not in the logbook
+    const run_info *find(int run_number) const;
+
+    // Sets the detector, KCU count and expected number of samples of cfg.run_number from
+    // the logbook.  Returns false, leaving cfg alone, if the run is not in the logbook.
+    bool configure(config &cfg) const;
+};
+
+// LFHCAL, EEEMCAL or a plain number, -1 if it is none of these
+int parse_detector_id(const std::string &text);
@@ -0,0 +1,107 @@
+#include "stage_profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+
+std::atomic<bool> stage_profiler::enabled(false);
+stage_profiler::stage_stats stage_profiler::stats[NUM_PROFILE_STAGES];
+std::chrono::steady_clock::time_point stage_profiler::run_start = std::chrono::steady_clock::now();
+
+void stage_profiler::enable(bool enable) {
+    if (enable && !is_enabled()) {
+        reset();
+    }
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+void stage_profiler::reset() {
+    for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+        stats[i].count.store(0, std::memory_order_relaxed);
+        stats[i].total_ns.store(0, std::memory_order_relaxed);
+        stats[i].max_ns.store(0, std::memory_order_relaxed);
+        for (int j = 0; j < NUM_BUCKETS; j++) {
+            stats[i].histogram[j].store(0, std::memory_order_relaxed);
+        }
+    }
+    run_start = std::chrono::steady_clock::now();
+}
+
+void stage_profiler::record(profile_stage stage, uint64_t ns) {
+    auto &s = stats[stage];
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = s.max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !s.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    s.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+const char *stage_profiler::stage_name(int stage) {
+    const char *names[] = {"read_packet", "process_packet", "process_complete", "build",
+                           "unwrap_counters", "align", "write_event", "pedestals", "find_hits", "publish",
+                           "histogram"};
+    if (stage >= 0 && stage < NUM_PROFILE_STAGES) {
+        return names[stage];
+    }
+    return "unknown";
+}
+
+uint64_t stage_profiler::get_quantile_ns(int stage, double quantile) {
+    uint64_t count = get_count(stage);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = quantile * count;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += get_bucket(stage, i);
+        if (seen > target) {
+            return i == 0 ? 0 : (uint64_t)1 << i;
+        }
+    }
+    return get_max_ns(stage);
+}
+
+double stage_profiler::get_elapsed_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+}
+
+void stage_profiler::print_summary(std::ostream &out) {
+    double elapsed = get_elapsed_seconds();
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+        total += get_total_ns(i);
+    }
+
+    out << "Stage timing over " << std::fixed << std::setprecision(3) << elapsed << " s" << std::endl;
+    out << std::left << std::setw(18) << "stage"
+        << std::right << std::setw(12) << "calls"
+        << std::setw(12) << "total ms"
+        << std::setw(8) << "share"
+        << std::setw(12) << "mean ns"
+        << std::setw(12) << "p50 ns <"
+        << std::setw(12) << "p99 ns <"
+        << std::setw(12) << "max ns"
+        << std::setw(14) << "calls/s" << std::endl;
+    for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+        uint64_t count = get_count(i);
+        uint64_t ns = get_total_ns(i);
+        out << std::left << std::setw(18) << stage_name(i)
+            << std::right << std::setw(12) << count
+            << std::setw(12) << std::setprecision(1) << ns / 1e6
+            << std::setw(7) << (total > 0 ? 100.0 * ns / total : 0.0) << "%"
+            << std::setw(12) << (count > 0 ? ns / count : 0)
+            << std::setw(12) << get_quantile_ns(i, 0.5)
+            << std::setw(12) << get_quantile_ns(i, 0.99)
+            << std::setw(12) << get_max_ns(i)
+            << std::setw(14) << std::setprecision(0) << (ns > 0 ? count / (ns / 1e9) : 0.0) << std::endl;
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,104 @@
+/*
+Low overhead timing of the decode pipeline stages.
+
+Wrap a stage in a scoped_timer and its count, total time, and a log2 latency
+histogram are accumulated.  The same timers feed trace_recorder when a trace is being
+recorded.  When both are disabled a timer is just a branch.
+
+    {
+        scoped_timer timer(STAGE_ALIGN);
+        aligner->align(events);
+    }
+    stage_profiler::print_summary(std::cout);
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "trace_recorder.h"
+
+enum profile_stage {
+    STAGE_READ_PACKET = 0,
+    STAGE_PROCESS_PACKET,
+    STAGE_PROCESS_COMPLETE,
+    STAGE_BUILD,
+    STAGE_UNWRAP_COUNTERS,
+    STAGE_ALIGN,
+    STAGE_WRITE_EVENT,
+    STAGE_PEDESTALS,
+    STAGE_FIND_HITS,
+    STAGE_PUBLISH,
+    STAGE_HISTOGRAM,
+    NUM_PROFILE_STAGES
+};
+
+class stage_profiler {
+public:
+    // Bucket i holds calls that took [2^(i-1), 2^i) ns
+    static const int NUM_BUCKETS = 40;
+
+private:
+    struct stage_stats {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> total_ns;
+        std::atomic<uint64_t> max_ns;
+        std::atomic<uint64_t> histogram[NUM_BUCKETS];
+    };
+
+    static std::atomic<bool> enabled;
+    static stage_stats stats[NUM_PROFILE_STAGES];
+    static std::chrono::steady_clock::time_point run_start;
+
+public:
+    static void enable(bool enable);
+    static bool is_enabled() {return enabled.load(std::memory_order_relaxed);}
+    static void reset();
+
+    static void record(profile_stage stage, uint64_t ns);
+
+    static const char *stage_name(int stage);
+    static uint64_t get_count(int stage) {return stats[stage].count.load(std::memory_order_relaxed);}
+    static uint64_t get_total_ns(int stage) {return stats[stage].total_ns.load(std::memory_order_relaxed);}
+    static uint64_t get_max_ns(int stage) {return stats[stage].max_ns.load(std::memory_order_relaxed);}
+    static uint64_t get_bucket(int stage, int bucket) {return stats[stage].histogram[bucket].load(std::memory_order_relaxed);}
+    // Upper edge of the histogram bucket containing the given quantile
+    static uint64_t get_quantile_ns(int stage, double quantile);
+    // Wall clock time since profiling was enabled
+    static double get_elapsed_seconds();
+
+    static void print_summary(std::ostream &out);
+};
+
+class scoped_timer {
+private:
+    profile_stage stage;
+    bool profile;
+    bool trace;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    scoped_timer(profile_stage stage)
+        : stage(stage), profile(stage_profiler::is_enabled()), trace(trace_recorder::is_enabled()) {
+        if (profile || trace) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~scoped_timer() {
+        if (profile || trace) {
+            auto end = std::chrono::steady_clock::now();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            if (profile) {
+                stage_profiler::record(stage, ns);
+            }
+            if (trace) {
+                trace_recorder::span(stage_profiler::stage_name(stage), trace_recorder::to_ns(start), ns);
+            }
+        }
+    }
+    scoped_timer(const scoped_timer&) = delete;
+    scoped_timer& operator=(const scoped_timer&) = delete;
+};
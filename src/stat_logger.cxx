@@ -1,36 +1,64 @@
 #include "stat_logger.h"
+#include "stage_profiler.h"
+#include "debug_logger.h"
+#include "checkpoint.h"
 
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 stat_logger::stat_logger(int _num_kcu) {
     run_number = 0;
-    first_timestamp = 0;
+    first_timestamp = -1;
     last_timestamp = 0;
     num_kcu = _num_kcu;
     num_samples = 0;
     num_packets = 0;
+    num_heartbeats = 0;
+    total_bytes = 0;
+    bytes_read = 0;
+    bytes_remaining = 0;
     complete_lines = 0;
     incomplete_lines = 0;
-    complete_lines_per_device = new int[num_kcu * 4];
+    complete_lines_per_device = new std::atomic<int64_t>[num_kcu * 4];
+    lines_found = new std::atomic<int64_t>[num_kcu * 4];
     for (int i = 0; i < num_kcu * 4; i++) {
         complete_lines_per_device[i] = 0;
+        lines_found[i] = 0;
     }
-    aborted = new int[num_kcu];
-    completed = new int[num_kcu];
-    in_order = new int[num_kcu];
+    max_lines_in_progress = 0;
+    aborted = new std::atomic<int64_t>[num_kcu];
+    completed = new std::atomic<int64_t>[num_kcu];
+    in_order = new std::atomic<int64_t>[num_kcu];
+    max_waveforms_in_progress = new std::atomic<int64_t>[num_kcu];
+    max_waiting_waveforms = new std::atomic<int64_t>[num_kcu];
     for (int i = 0; i < num_kcu; i++) {
         aborted[i] = 0;
         completed[i] = 0;
         in_order[i] = 0;
+        max_waveforms_in_progress[i] = 0;
+        max_waiting_waveforms[i] = 0;
     }
     aligned_events = 0;
+    sampling = false;
+    json_file = nullptr;
+    start_time = std::chrono::steady_clock::now();
 }
 
 stat_logger::~stat_logger() {
+    stop_sampling();
+    if (json_file) {
+        fclose(json_file);
+    }
     delete[] complete_lines_per_device;
+    delete[] lines_found;
     delete[] aborted;
     delete[] completed;
     delete[] in_order;
+    delete[] max_waveforms_in_progress;
+    delete[] max_waiting_waveforms;
 }
 
 // Setters for Run information
@@ -38,17 +66,20 @@ void stat_logger::set_run_number(int run_number) {
     this->run_number = run_number;
 }
 
-void stat_logger::set_first_timestamp(int first_timestamp) {
+void stat_logger::set_first_timestamp(int64_t first_timestamp) {
     this->first_timestamp = first_timestamp;
 }
 
-void stat_logger::set_last_timestamp(int last_timestamp) {
+void stat_logger::set_last_timestamp(int64_t last_timestamp) {
     this->last_timestamp = last_timestamp;
 }
 
 // Setters for Run configuration
 void stat_logger::set_num_kcu(int num_kcu) {
-    this->num_kcu = num_kcu;
+    // The per device arrays are sized at construction, so this cannot grow them
+    if (num_kcu <= this->num_kcu) {
+        this->num_kcu = num_kcu;
+    }
 }
 
 void stat_logger::set_num_samples(int num_samples) {
@@ -61,11 +92,11 @@ void stat_logger::set_num_packets(int num_packets) {
     this->num_packets = num_packets;
 }
 
-void stat_logger::set_total_bytes(int total_bytes) {
+void stat_logger::set_total_bytes(int64_t total_bytes) {
     this->total_bytes = total_bytes;
 }
 
-void stat_logger::set_bytes_remaining(int bytes_remaining) {
+void stat_logger::set_bytes_remaining(int64_t bytes_remaining) {
     this->bytes_remaining = bytes_remaining;
 }
 
@@ -82,6 +113,18 @@ void stat_logger::set_complete_lines_per_device(int complete_lines_per_device, i
     this->complete_lines_per_device[device] = complete_lines_per_device;
 }
 
+void stat_logger::add_complete_lines_per_device(int64_t n, int device) {
+    if (device >= 0 && device < num_kcu * 4) {
+        complete_lines_per_device[device].fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+void stat_logger::add_lines_found(int64_t n, int device) {
+    if (device >= 0 && device < num_kcu * 4) {
+        lines_found[device].fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
 // Waveform builder
 void stat_logger::set_aborted(int aborted, int device) {
     this->aborted[device] = aborted;
@@ -100,9 +143,96 @@ void stat_logger::set_aligned_events(int aligned_events) {
     this->aligned_events = aligned_events;
 }
 
+void stat_logger::update_timestamps(int64_t timestamp) {
+    if (first_timestamp.load(std::memory_order_relaxed) < 0) {
+        first_timestamp = timestamp;
+    }
+    last_timestamp.store(timestamp, std::memory_order_relaxed);
+}
+
+double stat_logger::get_elapsed_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void stat_logger::start_sampling(double interval, std::ostream &out) {
+    stop_sampling();
+    {
+        std::lock_guard<std::mutex> lock(sampler_mutex);
+        sampling = true;
+    }
+    sampler = std::thread(&stat_logger::sample_loop, this, interval, &out);
+}
+
+void stat_logger::stop_sampling() {
+    {
+        std::lock_guard<std::mutex> lock(sampler_mutex);
+        if (!sampling) {
+            return;
+        }
+        sampling = false;
+    }
+    sampler_cv.notify_all();
+    sampler.join();
+}
+
+void stat_logger::sample_loop(double interval, std::ostream *out) {
+    auto last_time = std::chrono::steady_clock::now();
+    int64_t last_packets = get_num_packets();
+    int64_t last_bytes = get_bytes_read();
+    int64_t last_events = get_aligned_events();
+
+    std::unique_lock<std::mutex> lock(sampler_mutex);
+    while (sampling) {
+        sampler_cv.wait_for(lock, std::chrono::duration<double>(interval));
+        if (!sampling) {
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last_time).count();
+        int64_t packets = get_num_packets();
+        int64_t bytes = get_bytes_read();
+        int64_t events = get_aligned_events();
+
+        int64_t lines_good = get_complete_lines();
+        int64_t lines_bad = get_incomplete_lines();
+        int64_t waveforms_good = 0;
+        int64_t waveforms_bad = 0;
+        int64_t min_in_order = -1;
+        for (int i = 0; i < num_kcu; i++) {
+            waveforms_good += get_in_order(i);
+            waveforms_bad += get_aborted(i);
+            if (min_in_order < 0 || get_in_order(i) < min_in_order) {
+                min_in_order = get_in_order(i);
+            }
+        }
+        int64_t total = get_total_bytes();
+
+        char line[320];
+        snprintf(line, sizeof(line),
+                 "[stats] %7.1f s | %5.1f%% | %9.0f packets/s | %7.1f MB/s | %8.0f events/s | %lld events | "
+                 "lines lost %.2f%% | waveforms lost %.2f%% | unaligned %.2f%%",
+                 get_elapsed_seconds(),
+                 total > 0 ? 100.0 * bytes / total : 0.0,
+                 (packets - last_packets) / dt,
+                 (bytes - last_bytes) / dt / 1e6,
+                 (events - last_events) / dt,
+                 (long long)events,
+                 lines_good + lines_bad > 0 ? 100.0 * lines_bad / (lines_good + lines_bad) : 0.0,
+                 waveforms_good + waveforms_bad > 0 ? 100.0 * waveforms_bad / (waveforms_good + waveforms_bad) : 0.0,
+                 min_in_order > 0 ? 100.0 * (min_in_order - events) / min_in_order : 0.0);
+        *out << line << std::endl;
+        export_snapshot(false);
+
+        last_time = now;
+        last_packets = packets;
+        last_bytes = bytes;
+        last_events = events;
+    }
+}
+
 void stat_logger::write_stats(std::ostream &out) {
     out << "Run Number: " << run_number << std::endl;
-    out << "First Timestamp: " << first_timestamp << std::endl;
+    out << "First Timestamp: " << (first_timestamp < 0 ? 0 : first_timestamp.load()) << std::endl;
     out << "Last Timestamp: " << last_timestamp << std::endl;
     out << "Number of KCUs: " << num_kcu << std::endl;
     out << "Number of Samples: " << num_samples << std::endl;
@@ -130,4 +260,223 @@ void stat_logger::write_stats(std::ostream &out) {
     }
     out << std::endl;
     out << "Aligned Events: " << aligned_events << std::endl;
-}
\ No newline at end of file
+}
+
+bool stat_logger::set_json_file(const std::string &file_name) {
+    std::lock_guard<std::mutex> lock(export_mutex);
+    if (json_file) {
+        fclose(json_file);
+    }
+    json_file_name = file_name;
+    // Appended to, like the batch report, so a resumed or repeated run keeps the earlier snapshots
+    json_file = fopen(file_name.c_str(), "a");
+    if (json_file == nullptr) {
+        LOG_MESSAGE(DEBUG_ERROR, "StatLogger", "Error opening JSON statistics file " + file_name);
+        return false;
+    }
+    return true;
+}
+
+void stat_logger::set_prometheus_file(const std::string &file_name) {
+    std::lock_guard<std::mutex> lock(export_mutex);
+    prometheus_file_name = file_name;
+}
+
+void stat_logger::export_snapshot(bool final) {
+    std::lock_guard<std::mutex> lock(export_mutex);
+    if (json_file) {
+        std::ostringstream line;
+        write_json(line, final);
+        fputs(line.str().c_str(), json_file);
+        fflush(json_file);
+    }
+    if (!prometheus_file_name.empty()) {
+        // Write next to the target and rename, so readers only ever see a complete file
+        std::string tmp_name = prometheus_file_name + ".tmp";
+        std::ostringstream text;
+        write_prometheus(text);
+        FILE *out = fopen(tmp_name.c_str(), "w");
+        if (out == nullptr) {
+            LOG_MESSAGE(DEBUG_ERROR, "StatLogger", "Error opening Prometheus statistics file " + tmp_name);
+            return;
+        }
+        fputs(text.str().c_str(), out);
+        fclose(out);
+        if (rename(tmp_name.c_str(), prometheus_file_name.c_str()) != 0) {
+            LOG_MESSAGE(DEBUG_ERROR, "StatLogger", "Error renaming " + tmp_name + " to " + prometheus_file_name);
+        }
+    }
+}
+
+// One JSON object on a single line
+void stat_logger::write_json(std::ostream &out, bool final) {
+    double elapsed = get_elapsed_seconds();
+    int64_t packets = get_num_packets();
+    int64_t bytes = get_bytes_read();
+    int64_t events = get_aligned_events();
+    int64_t lines_good = get_complete_lines();
+    int64_t lines_bad = get_incomplete_lines();
+    int64_t waveforms_good = 0;
+    int64_t waveforms_bad = 0;
+    for (int i = 0; i < num_kcu; i++) {
+        waveforms_good += get_in_order(i);
+        waveforms_bad += get_aborted(i);
+    }
+    auto array = [&](std::atomic<int64_t> *values, int n) {
+        out << "[";
+        for (int i = 0; i < n; i++) {
+            out << (i ? "," : "") << values[i].load(std::memory_order_relaxed);
+        }
+        out << "]";
+    };
+
+    out << "{\"type\":\"" << (final ? "final" : "progress") << "\"";
+    out << ",\"time_ms\":" << std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+    out << ",\"run\":" << run_number;
+    out << ",\"num_kcu\":" << num_kcu;
+    out << ",\"num_samples\":" << num_samples;
+    out << ",\"elapsed_s\":" << elapsed;
+    out << ",\"total_bytes\":" << get_total_bytes();
+    out << ",\"bytes_read\":" << bytes;
+    out << ",\"packets\":" << packets;
+    out << ",\"heartbeats\":" << get_num_heartbeats();
+    out << ",\"aligned_events\":" << events;
+    out << ",\"first_timestamp\":" << (first_timestamp < 0 ? 0 : first_timestamp.load());
+    out << ",\"last_timestamp\":" << last_timestamp;
+    out << ",\"mb_per_s\":" << (elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+    out << ",\"packets_per_s\":" << (elapsed > 0 ? packets / elapsed : 0.0);
+    out << ",\"events_per_s\":" << (elapsed > 0 ? events / elapsed : 0.0);
+    out << ",\"complete_lines\":" << lines_good;
+    out << ",\"incomplete_lines\":" << lines_bad;
+    out << ",\"line_loss\":" << (lines_good + lines_bad > 0 ? (double)lines_bad / (lines_good + lines_bad) : 0.0);
+    out << ",\"waveform_loss\":" << (waveforms_good + waveforms_bad > 0 ? (double)waveforms_bad / (waveforms_good + waveforms_bad) : 0.0);
+    out << ",\"lines_found\":";
+    array(lines_found, num_kcu * 4);
+    out << ",\"complete_lines_per_device\":";
+    array(complete_lines_per_device, num_kcu * 4);
+    out << ",\"aborted_waveforms\":";
+    array(aborted, num_kcu);
+    out << ",\"completed_waveforms\":";
+    array(completed, num_kcu);
+    out << ",\"in_order_waveforms\":";
+    array(in_order, num_kcu);
+    out << ",\"max_lines_in_progress\":" << max_lines_in_progress;
+    out << ",\"max_waveforms_in_progress\":";
+    array(max_waveforms_in_progress, num_kcu);
+    out << ",\"max_waiting_waveforms\":";
+    array(max_waiting_waveforms, num_kcu);
+    if (stage_profiler::is_enabled()) {
+        out << ",\"stages\":{";
+        for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+            uint64_t count = stage_profiler::get_count(i);
+            uint64_t total = stage_profiler::get_total_ns(i);
+            out << (i ? "," : "") << "\"" << stage_profiler::stage_name(i) << "\":{";
+            out << "\"count\":" << count;
+            out << ",\"total_ns\":" << total;
+            out << ",\"mean_ns\":" << (count > 0 ? total / count : 0);
+            out << ",\"p50_ns\":" << stage_profiler::get_quantile_ns(i, 0.5);
+            out << ",\"p99_ns\":" << stage_profiler::get_quantile_ns(i, 0.99);
+            out << ",\"max_ns\":" << stage_profiler::get_max_ns(i) << "}";
+        }
+        out << "}";
+    }
+    out << "}" << std::endl;
+}
+
+void stat_logger::write_prometheus(std::ostream &out) {
+    std::string run = "run=\"" + std::to_string(get_run_number()) + "\"";
+    auto header = [&](const char *name, const char *type, const char *help) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+    };
+    auto scalar = [&](const char *name, const char *type, const char *help, double value) {
+        header(name, type, help);
+        out << name << "{" << run << "} " << value << "\n";
+    };
+    auto per_kcu = [&](const char *name, const char *type, const char *help, std::atomic<int64_t> *values) {
+        header(name, type, help);
+        for (int i = 0; i < num_kcu; i++) {
+            out << name << "{" << run << ",kcu=\"" << i << "\"} " << values[i] << "\n";
+        }
+    };
+    auto per_device = [&](const char *name, const char *type, const char *help, std::atomic<int64_t> *values) {
+        header(name, type, help);
+        for (int i = 0; i < num_kcu * 4; i++) {
+            out << name << "{" << run << ",kcu=\"" << i / 4 << "\",asic=\"" << (i / 2) % 2
+                << "\",half=\"" << i % 2 << "\"} " << values[i] << "\n";
+        }
+    };
+
+    out.precision(15);
+    scalar("h2g_elapsed_seconds", "gauge", "Wall clock time since the decoder started", get_elapsed_seconds());
+    scalar("h2g_input_bytes", "gauge", "Size of the input file", get_total_bytes());
+    scalar("h2g_read_bytes_total", "counter", "Bytes read from the input", get_bytes_read());
+    scalar("h2g_packets_total", "counter", "Data packets read", get_num_packets());
+    scalar("h2g_heartbeats_total", "counter", "Heartbeat packets read", get_num_heartbeats());
+    scalar("h2g_complete_lines_total", "counter", "Line groups completed by the line builder", get_complete_lines());
+    scalar("h2g_incomplete_lines_total", "counter", "Line groups dropped before they were complete", get_incomplete_lines());
+    per_device("h2g_lines_found_total", "counter", "Lines decoded per device", lines_found);
+    per_device("h2g_complete_lines_per_device_total", "counter", "Samples completed per device", complete_lines_per_device);
+    per_kcu("h2g_waveforms_completed_total", "counter", "Waveforms completed", completed);
+    per_kcu("h2g_waveforms_aborted_total", "counter", "Waveforms aborted", aborted);
+    per_kcu("h2g_waveforms_in_order_total", "counter", "Waveforms completed with consecutive event counters", in_order);
+    scalar("h2g_aligned_events_total", "counter", "Events aligned across all KCUs", get_aligned_events());
+    scalar("h2g_max_lines_in_progress", "gauge", "High-water mark of line groups waiting for completion", max_lines_in_progress);
+    per_kcu("h2g_max_waveforms_in_progress", "gauge", "High-water mark of waveforms being built", max_waveforms_in_progress);
+    per_kcu("h2g_max_waiting_waveforms", "gauge", "High-water mark of waveforms waiting for alignment", max_waiting_waveforms);
+
+    if (stage_profiler::is_enabled()) {
+        header("h2g_stage_calls_total", "counter", "Calls per decoder stage");
+        for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+            out << "h2g_stage_calls_total{" << run << ",stage=\"" << stage_profiler::stage_name(i) << "\"} "
+                << stage_profiler::get_count(i) << "\n";
+        }
+        header("h2g_stage_seconds_total", "counter", "Time spent per decoder stage");
+        for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+            out << "h2g_stage_seconds_total{" << run << ",stage=\"" << stage_profiler::stage_name(i) << "\"} "
+                << stage_profiler::get_total_ns(i) / 1e9 << "\n";
+        }
+        header("h2g_stage_max_seconds", "gauge", "Slowest single call per decoder stage");
+        for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+            out << "h2g_stage_max_seconds{" << run << ",stage=\"" << stage_profiler::stage_name(i) << "\"} "
+                << stage_profiler::get_max_ns(i) / 1e9 << "\n";
+        }
+    }
+}
+
+void stat_logger::save_state(checkpoint_writer &out) {
+    out.put<int32_t>(num_kcu);
+    for (auto counter : {&first_timestamp, &last_timestamp, &num_packets, &num_heartbeats, &bytes_read,
+                         &complete_lines, &incomplete_lines, &max_lines_in_progress, &aligned_events}) {
+        out.put<int64_t>(counter->load(std::memory_order_relaxed));
+    }
+    for (int i = 0; i < num_kcu * 4; i++) {
+        out.put<int64_t>(complete_lines_per_device[i].load(std::memory_order_relaxed));
+        out.put<int64_t>(lines_found[i].load(std::memory_order_relaxed));
+    }
+    for (int i = 0; i < num_kcu; i++) {
+        for (auto counters : {aborted, completed, in_order, max_waveforms_in_progress, max_waiting_waveforms}) {
+            out.put<int64_t>(counters[i].load(std::memory_order_relaxed));
+        }
+    }
+}
+
+void stat_logger::load_state(checkpoint_reader &in) {
+    if (in.get<int32_t>() != num_kcu) {
+        throw std::runtime_error("Checkpoint was written for a different number of KCUs");
+    }
+    for (auto counter : {&first_timestamp, &last_timestamp, &num_packets, &num_heartbeats, &bytes_read,
+                         &complete_lines, &incomplete_lines, &max_lines_in_progress, &aligned_events}) {
+        counter->store(in.get<int64_t>(), std::memory_order_relaxed);
+    }
+    for (int i = 0; i < num_kcu * 4; i++) {
+        complete_lines_per_device[i].store(in.get<int64_t>(), std::memory_order_relaxed);
+        lines_found[i].store(in.get<int64_t>(), std::memory_order_relaxed);
+    }
+    for (int i = 0; i < num_kcu; i++) {
+        for (auto counters : {aborted, completed, in_order, max_waveforms_in_progress, max_waiting_waveforms}) {
+            counters[i].store(in.get<int64_t>(), std::memory_order_relaxed);
+        }
+    }
+}
@@ -1,36 +1,78 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
 
+class checkpoint_writer;
+class checkpoint_reader;
+
+// Counters are relaxed atomics so the decoder modules can bump them on the hot path
+// while a sampling thread reads them to report live rates.
+//
+// Besides the text .stats file, snapshots can be exported as JSON lines (one object
+// per snapshot, appended) and in the Prometheus text exposition format (the file is
+// replaced atomically so a node_exporter textfile collector never reads half of it).
 class stat_logger {
 private:
     // Run information
-    int run_number;
-    int first_timestamp;
-    int last_timestamp;
-    
+    std::atomic<int64_t> run_number;
+    std::atomic<int64_t> first_timestamp;
+    std::atomic<int64_t> last_timestamp;
+
     // Run configuration
     int num_kcu;
-    int num_samples;
-    
+    std::atomic<int64_t> num_samples;
+
     // Run statistics
     // File stream
-    int num_packets;
-    int total_bytes;
-    int bytes_remaining;
-    
+    std::atomic<int64_t> num_packets;
+    std::atomic<int64_t> num_heartbeats;
+    std::atomic<int64_t> total_bytes;
+    std::atomic<int64_t> bytes_read;
+    std::atomic<int64_t> bytes_remaining;
+
     // Line builder
-    int complete_lines;
-    int incomplete_lines;
-    int *complete_lines_per_device;
+    std::atomic<int64_t> complete_lines;
+    std::atomic<int64_t> incomplete_lines;
+    std::atomic<int64_t> *complete_lines_per_device;
+    std::atomic<int64_t> *lines_found;
+    std::atomic<int64_t> max_lines_in_progress;
 
     // Waveform builder
-    int *aborted;
-    int *completed;
-    int *in_order;
+    std::atomic<int64_t> *aborted;
+    std::atomic<int64_t> *completed;
+    std::atomic<int64_t> *in_order;
+    std::atomic<int64_t> *max_waveforms_in_progress;
+    std::atomic<int64_t> *max_waiting_waveforms;
 
     // Event aligner
-    int aligned_events;
+    std::atomic<int64_t> aligned_events;
+
+    // Periodic sampling
+    std::thread sampler;
+    std::mutex sampler_mutex;
+    std::condition_variable sampler_cv;
+    bool sampling;
+    std::chrono::steady_clock::time_point start_time;
+
+    // Machine readable export
+    std::mutex export_mutex;
+    FILE *json_file;
+    std::string json_file_name;
+    std::string prometheus_file_name;
+
+    void sample_loop(double interval, std::ostream *out);
+    static void update_max(std::atomic<int64_t> &max, int64_t value) {
+        int64_t current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
 
 public:
 stat_logger(int _num_kcu);
@@ -38,8 +80,8 @@ stat_logger(int _num_kcu);
 
 // Setters for Run information
 void set_run_number(int run_number);
-void set_first_timestamp(int first_timestamp);
-void set_last_timestamp(int last_timestamp);
+void set_first_timestamp(int64_t first_timestamp);
+void set_last_timestamp(int64_t last_timestamp);
 
 // Setters for Run configuration
 void set_num_kcu(int num_kcu);
@@ -48,8 +90,8 @@ void set_num_samples(int num_samples);
 // Setters for Run statistics
 // File stream
 void set_num_packets(int num_packets);
-void set_total_bytes(int total_bytes);
-void set_bytes_remaining(int bytes_remaining);
+void set_total_bytes(int64_t total_bytes);
+void set_bytes_remaining(int64_t bytes_remaining);
 
 // Line builder
 void set_complete_lines(int complete_lines);
@@ -64,5 +106,56 @@ void set_in_order(int in_order, int device);
 // Event aligner
 void set_aligned_events(int aligned_events);
 
+// Incrementers used by the decoder modules while running
+void add_packet(int64_t bytes) {num_packets.fetch_add(1, std::memory_order_relaxed); bytes_read.fetch_add(bytes, std::memory_order_relaxed);}
+void add_heartbeat() {num_heartbeats.fetch_add(1, std::memory_order_relaxed);}
+void add_complete_lines(int64_t n) {complete_lines.fetch_add(n, std::memory_order_relaxed);}
+void add_incomplete_lines(int64_t n) {incomplete_lines.fetch_add(n, std::memory_order_relaxed);}
+void add_complete_lines_per_device(int64_t n, int device);
+void add_lines_found(int64_t n, int device);
+void add_aborted(int64_t n, int device) {aborted[device].fetch_add(n, std::memory_order_relaxed);}
+void add_completed(int64_t n, int device) {completed[device].fetch_add(n, std::memory_order_relaxed);}
+void add_in_order(int64_t n, int device) {in_order[device].fetch_add(n, std::memory_order_relaxed);}
+void add_aligned_events(int64_t n) {aligned_events.fetch_add(n, std::memory_order_relaxed);}
+void update_timestamps(int64_t timestamp);
+
+// Queue high-water marks
+void update_lines_in_progress(int64_t size) {update_max(max_lines_in_progress, size);}
+void update_waveforms_in_progress(int64_t size, int device) {update_max(max_waveforms_in_progress[device], size);}
+void update_waiting_waveforms(int64_t size, int device) {update_max(max_waiting_waveforms[device], size);}
+
+// Getters
+int get_num_kcu() {return num_kcu;}
+int64_t get_run_number() {return run_number.load(std::memory_order_relaxed);}
+int64_t get_num_packets() {return num_packets.load(std::memory_order_relaxed);}
+int64_t get_num_heartbeats() {return num_heartbeats.load(std::memory_order_relaxed);}
+int64_t get_total_bytes() {return total_bytes.load(std::memory_order_relaxed);}
+int64_t get_bytes_read() {return bytes_read.load(std::memory_order_relaxed);}
+int64_t get_complete_lines() {return complete_lines.load(std::memory_order_relaxed);}
+int64_t get_incomplete_lines() {return incomplete_lines.load(std::memory_order_relaxed);}
+int64_t get_aborted(int device) {return aborted[device].load(std::memory_order_relaxed);}
+int64_t get_completed(int device) {return completed[device].load(std::memory_order_relaxed);}
+int64_t get_in_order(int device) {return in_order[device].load(std::memory_order_relaxed);}
+int64_t get_aligned_events() {return aligned_events.load(std::memory_order_relaxed);}
+int64_t get_lines_found(int device) {return lines_found[device].load(std::memory_order_relaxed);}
+double get_elapsed_seconds();
+
+// Print a one line summary of rates every interval seconds until stop_sampling, and
+// export a snapshot to the JSON lines / Prometheus files if they are set
+void start_sampling(double interval, std::ostream &out);
+void stop_sampling();
+
+// Returns false if the file cannot be opened
+bool set_json_file(const std::string &file_name);
+void set_prometheus_file(const std::string &file_name);
+// Write a snapshot to whichever export files are set, final marks the end of run one
+void export_snapshot(bool final);
+
+// Counters and high-water marks, so a resumed run reports the whole run, see checkpoint.h
+void save_state(checkpoint_writer &out);
+void load_state(checkpoint_reader &in);
+
 void write_stats(std::ostream &out);
-};
\ No newline at end of file
+void write_json(std::ostream &out, bool final);
+void write_prometheus(std::ostream &out);
+};
@@ -0,0 +1,127 @@
+#include "stream_source.h"
+#include "debug_logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+stream_source::stream_source(const std::string &name, uint32_t num_fpgas)
+    : name(name), fd(-1), owns_fd(false), num_fpgas(num_fpgas), buffer(1 << 20) {
+    eof = false;
+    bytes_read = 0;
+    buffer_start = 0;
+    buffer_end = 0;
+}
+
+stream_source::stream_source(const std::string &name, uint32_t num_fpgas, int num_samples, double timeout)
+    : stream_source(name, num_fpgas) {
+    this->timeout = timeout;
+
+    LOG_MESSAGE(DEBUG_INFO, "StreamSource", "Reading packets from " + (name == "-" ? std::string("stdin") : name));
+    if (name == "-") {
+        fd = STDIN_FILENO;
+        owns_fd = false;
+    } else {
+        // Opening a FIFO blocks until the writer opens its end
+        fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        owns_fd = true;
+        if (fd < 0) {
+            LOG_MESSAGE(DEBUG_ERROR, "StreamSource", "Error opening " + name + ": " + strerror(errno));
+            throw std::runtime_error("Error opening file");
+        }
+    }
+    read_header(num_samples);
+}
+
+void stream_source::read_header(int num_samples) {
+    if (num_samples > 0) {
+        number_samples = num_samples;
+        LOG_MESSAGE(DEBUG_INFO, "StreamSource", "No header expected, " + std::to_string(number_samples) + " samples");
+        return;
+    }
+    // Read until '##################################################' is found twice
+    std::string line;
+    int hashline_count = 0;
+    while (hashline_count < 2 && read_line(line)) {
+        LOG_MESSAGE(DEBUG_TRACE, "StreamSource", "Header line: " + line);
+        parse_header_line(line, hashline_count);
+    }
+    if (hashline_count < 2 || number_samples == 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "StreamSource", "No complete .h2g header in " + name);
+        throw std::runtime_error("Incomplete file header");
+    }
+}
+
+stream_source::~stream_source() {
+    if (owns_fd) {
+        close(fd);
+    }
+    LOG_MESSAGE(DEBUG_INFO, "StreamSource", "Read " + std::to_string(bytes_read) + " bytes, " +
+                std::to_string(packets_processed) + " packets");
+}
+
+ssize_t stream_source::read_some(uint8_t *dst, size_t n) {
+    while (wait_readable(fd)) {
+        ssize_t got = read(fd, dst, n);
+        if (got >= 0) {
+            return got;
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            LOG_MESSAGE(DEBUG_ERROR, "StreamSource", "Error reading " + name + ": " + strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Reads until at least `needed` bytes are buffered, returns false if the stream ends first
+bool stream_source::fill(size_t needed) {
+    while (buffer_end - buffer_start < needed) {
+        if (eof) {
+            return false;
+        }
+        if (buffer_start > 0) {
+            std::memmove(buffer.data(), buffer.data() + buffer_start, buffer_end - buffer_start);
+            buffer_end -= buffer_start;
+            buffer_start = 0;
+        }
+        ssize_t n = read_some(buffer.data() + buffer_end, buffer.size() - buffer_end);
+        if (n <= 0) {
+            eof = true;
+            return false;
+        }
+        buffer_end += n;
+        bytes_read += n;
+    }
+    return true;
+}
+
+bool stream_source::read_line(std::string &line) {
+    line.clear();
+    while (true) {
+        if (buffer_start == buffer_end && !fill(1)) {
+            return !line.empty();
+        }
+        uint8_t c = buffer[buffer_start++];
+        if (c == '\n') {
+            return true;
+        }
+        line.push_back(c);
+    }
+}
+
+int stream_source::read_packet(uint8_t *packet) {
+    if (!fill(PACKET_SIZE)) {
+        size_t remaining = buffer_end - buffer_start;
+        LOG_MESSAGE(DEBUG_INFO, "StreamSource", "End of stream with " + std::to_string(remaining) + " bytes remaining");
+        if (stats) {
+            stats->set_bytes_remaining(remaining);
+        }
+        return 0;
+    }
+    std::memcpy(packet, buffer.data() + buffer_start, PACKET_SIZE);
+    buffer_start += PACKET_SIZE;
+    return finish_packet(packet);
+}
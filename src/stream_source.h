@@ -0,0 +1,51 @@
+/*
+Reads packets from stdin, a FIFO or any other byte stream that cannot seek, for decoding
+directly behind the DAQ receiver or a capture replay without writing the run to disk:
+
+    cat Run042.h2g | h2g_run -r 42 -i -
+    h2g_run -r 42 -i /tmp/daq.fifo
+
+The stream starts with the usual .h2g text header, unless the number of samples is given,
+in which case it is taken to be packets only.  It ends when the writer closes its end.
+*/
+
+#pragma once
+
+#include "packet_source.h"
+
+#include <string>
+#include <vector>
+
+class stream_source : public packet_source {
+protected:
+    std::string name;
+    int fd;
+    bool owns_fd;
+    bool eof;
+    uint32_t num_fpgas;
+    int64_t bytes_read;
+
+    // For sources that produce the stream themselves, they call read_header once ready
+    stream_source(const std::string &name, uint32_t num_fpgas);
+    void read_header(int num_samples);
+    // Copies up to n bytes of the stream to dst, returns 0 at the end and -1 on errors
+    virtual ssize_t read_some(uint8_t *dst, size_t n);
+
+private:
+
+    // Bytes read from the stream but not handed out yet are buffer[buffer_start, buffer_end)
+    std::vector<uint8_t> buffer;
+    size_t buffer_start;
+    size_t buffer_end;
+
+    bool fill(size_t needed);
+    bool read_line(std::string &line);
+
+public:
+    // num_samples is 0 for a stream that starts with the text header
+    stream_source(const std::string &name, uint32_t num_fpgas, int num_samples, double timeout = 0);
+    ~stream_source();
+
+    int read_packet(uint8_t *packet) override;
+    bool is_live() override {return true;}
+};
@@ -0,0 +1,55 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    stopping = false;
+    for (unsigned i = 0; i < num_threads; i++) {
+        workers.emplace_back(&thread_pool::run, this);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void thread_pool::run() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] {return stopping || !jobs.empty() || !urgent_jobs.empty();});
+            auto &queue = urgent_jobs.empty() ? jobs : urgent_jobs;
+            if (queue.empty()) {
+                return;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        job();
+    }
+}
+
+bool thread_pool::run_urgent_job() {
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (urgent_jobs.empty()) {
+            return false;
+        }
+        job = std::move(urgent_jobs.front());
+        urgent_jobs.pop_front();
+    }
+    job();
+    return true;
+}
@@ -0,0 +1,77 @@
+/*
+A fixed set of worker threads taking jobs from a shared queue.
+
+submit returns a std::future for the job's result, so callers that need results in
+order keep the futures in order and wait on the oldest:
+
+    thread_pool pool(4);
+    std::deque<std::future<std::vector<uint8_t>>> pending;
+    pending.push_back(pool.submit([=] {return decompress(frame);}));
+    auto data = pending.front().get();
+
+Jobs still queued when the pool is destroyed are run before the workers exit.
+
+A job may itself queue work on the pool and wait for it, as a batch of runs does with
+their decompression.  Such short inner jobs are submitted as urgent, which puts them
+ahead of everything else, and are waited for with wait_for, which runs urgent jobs on the
+waiting thread instead of blocking; so the pool cannot deadlock with every worker
+waiting on work still in the queue.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class thread_pool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::deque<std::function<void()>> urgent_jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void run();
+    bool run_urgent_job();
+
+public:
+    // 0 threads uses one per hardware thread
+    thread_pool(unsigned num_threads = 0);
+    ~thread_pool();
+
+    unsigned get_num_threads() {return workers.size();}
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F job, bool urgent = false) {
+        // std::function needs a copyable target, so the packaged task is shared
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(job));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            (urgent ? urgent_jobs : jobs).push_back([task] {(*task)();});
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // Gets the result of a job from this pool, running urgent jobs while it is not ready
+    template <typename T>
+    T wait_for(std::future<T> &result) {
+        while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!run_urgent_job()) {
+                // The job is already running on another thread
+                break;
+            }
+        }
+        return result.get();
+    }
+};
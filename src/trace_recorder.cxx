@@ -0,0 +1,129 @@
+#include "trace_recorder.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+std::atomic<bool> trace_recorder::enabled(false);
+trace_event *trace_recorder::events = nullptr;
+uint64_t trace_recorder::capacity = 0;
+std::atomic<uint64_t> trace_recorder::next(0);
+std::atomic<uint64_t> trace_recorder::dropped(0);
+std::atomic<uint32_t> trace_recorder::writers(0);
+std::chrono::steady_clock::time_point trace_recorder::start;
+std::string trace_recorder::file_name;
+
+void trace_recorder::enable(const std::string &file_name, uint64_t capacity) {
+    if (is_enabled()) {
+        return;
+    }
+    trace_recorder::file_name = file_name;
+    trace_recorder::capacity = capacity;
+    events = new trace_event[capacity];
+    next.store(0);
+    dropped.store(0);
+    start = std::chrono::steady_clock::now();
+    enabled.store(true);
+    LOG_MESSAGE(DEBUG_INFO, "TraceRecorder", "Recording up to " + std::to_string(capacity) +
+                " trace events for " + file_name);
+}
+
+uint64_t trace_recorder::now_ns() {
+    return to_ns(std::chrono::steady_clock::now());
+}
+
+uint64_t trace_recorder::to_ns(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - start).count();
+}
+
+uint32_t trace_recorder::thread_id() {
+    static std::atomic<uint32_t> next_thread(1);
+    thread_local uint32_t id = next_thread.fetch_add(1);
+    return id;
+}
+
+trace_event *trace_recorder::claim() {
+    // Registered before checking enabled, so finish() cannot free the buffer under a writer
+    writers.fetch_add(1);
+    if (!enabled.load()) {
+        return nullptr;
+    }
+    uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= capacity) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &events[index];
+}
+
+void trace_recorder::release() {
+    writers.fetch_sub(1, std::memory_order_release);
+}
+
+void trace_recorder::span(const char *name, uint64_t start_ns, uint64_t duration_ns) {
+    auto e = claim();
+    if (e != nullptr) {
+        e->name = name;
+        e->start_ns = start_ns;
+        e->value = duration_ns;
+        e->thread = thread_id();
+        e->series = -1;
+    }
+    release();
+}
+
+void trace_recorder::counter(const char *name, int series, uint64_t value) {
+    auto e = claim();
+    if (e != nullptr) {
+        e->name = name;
+        e->start_ns = now_ns();
+        e->value = value;
+        e->thread = thread_id();
+        e->series = series;
+    }
+    release();
+}
+
+void trace_recorder::finish() {
+    if (!enabled.exchange(false)) {
+        return;
+    }
+    // Threads still running, e.g. in the pool, may be filling an event they claimed
+    while (writers.load() != 0) {
+        std::this_thread::yield();
+    }
+    uint64_t count = std::min(next.load(), capacity);
+    FILE *out = fopen(file_name.c_str(), "w");
+    if (out == nullptr) {
+        LOG_MESSAGE(DEBUG_ERROR, "TraceRecorder", "Error opening trace file " + file_name);
+    } else {
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"h2g_decode\"}}");
+        for (uint64_t i = 0; i < count; i++) {
+            const trace_event &e = events[i];
+            // Trace event timestamps are in microseconds
+            if (e.series < 0) {
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        e.name, e.thread, e.start_ns / 1e3, e.value / 1e3);
+            } else {
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"%d\":%llu}}",
+                        e.name, e.thread, e.start_ns / 1e3, e.series, (unsigned long long)e.value);
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        LOG_MESSAGE(DEBUG_INFO, "TraceRecorder", "Wrote " + std::to_string(count) + " trace events to " + file_name);
+    }
+    if (dropped.load() > 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "TraceRecorder", "Trace buffer was full, dropped " +
+                    std::to_string(dropped.load()) + " events");
+    }
+    delete[] events;
+    events = nullptr;
+    capacity = 0;
+}
@@ -0,0 +1,79 @@
+/*
+Records spans and counters of the decode pipeline into a preallocated in-memory
+buffer and dumps them as Chrome trace-event JSON, which opens in Perfetto
+(ui.perfetto.dev) or chrome://tracing.
+
+Spans are stored as complete ("X") events, i.e. a begin time plus a duration, so each
+costs one slot.  Once the buffer is full further events are counted and dropped.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct trace_event {
+    const char *name;       // Must point at a string that outlives the recorder
+    uint64_t start_ns;
+    uint64_t value;         // Duration for spans, sample value for counters
+    uint32_t thread;
+    int32_t series;         // -1 for spans, otherwise the counter series
+};
+
+class trace_recorder {
+private:
+    static std::atomic<bool> enabled;
+    static trace_event *events;
+    static uint64_t capacity;
+    static std::atomic<uint64_t> next;
+    static std::atomic<uint64_t> dropped;
+    static std::atomic<uint32_t> writers;   // Threads between claim() and release()
+    static std::chrono::steady_clock::time_point start;
+    static std::string file_name;
+
+    // A slot for one event, or nullptr; either way release() must follow
+    static trace_event *claim();
+    static void release();
+
+public:
+    // Start recording; the trace is written to file_name by finish()
+    static void enable(const std::string &file_name, uint64_t capacity = 1 << 21);
+    static bool is_enabled() {return enabled.load(std::memory_order_relaxed);}
+
+    static uint64_t now_ns();
+    static uint64_t to_ns(std::chrono::steady_clock::time_point t);
+    static uint32_t thread_id();
+
+    // A span that started at start_ns and lasted duration_ns
+    static void span(const char *name, uint64_t start_ns, uint64_t duration_ns);
+    // A sample of counter name, series distinguishes e.g. one KCU from another
+    static void counter(const char *name, int series, uint64_t value);
+
+    // Write the JSON file and release the buffer
+    static void finish();
+    static uint64_t get_dropped() {return dropped.load(std::memory_order_relaxed);}
+};
+
+// Records a span covering its own lifetime, for pieces of work that are not a profile_stage
+class trace_scope {
+private:
+    const char *name;
+    uint64_t start_ns;
+    bool active;
+
+public:
+    trace_scope(const char *name) : name(name), active(trace_recorder::is_enabled()) {
+        if (active) {
+            start_ns = trace_recorder::now_ns();
+        }
+    }
+    ~trace_scope() {
+        if (active) {
+            trace_recorder::span(name, start_ns, trace_recorder::now_ns() - start_ns);
+        }
+    }
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+};
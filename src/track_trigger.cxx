@@ -0,0 +1,27 @@
+#include "track_trigger.h"
+
+track_trigger::track_trigger(int num_channels, int min_layers, float threshold)
+    : min_layers(min_layers), threshold(threshold), geometry(num_channels), track_column(-1), track_layers(0) {
+}
+
+bool track_trigger::fire(const std::vector<h2h_hit> &hits) {
+    for (int i = 0; i < COLUMNS; i++) {
+        layers_hit[i] = 0;
+    }
+    for (auto &hit : hits) {
+        if (hit.amplitude < threshold || hit.channel >= geometry.column.size() || geometry.column[hit.channel] < 0) {
+            continue;
+        }
+        layers_hit[geometry.column[hit.channel]] |= uint64_t(1) << geometry.layer[hit.channel];
+    }
+    track_column = -1;
+    track_layers = 0;
+    for (int i = 0; i < COLUMNS; i++) {
+        int count = __builtin_popcountll(layers_hit[i]);
+        if (count > track_layers) {
+            track_column = i;
+            track_layers = count;
+        }
+    }
+    return track_layers >= min_layers;
+}
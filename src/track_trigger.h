@@ -0,0 +1,50 @@
+/*
+Picks out muon-like events while decoding, so a MIP calibration reads only the events that
+can contribute to it:
+
+    h2g_run -r 42 -m 5              # events with a 5 layer track also go to Run042_mip.h2d
+    h2g_run -r 42 -m 5:30 -O -b     # or only those events are written, 30 ADC counts a layer
+
+A column is one (x, y) tower of the LFHCal prototype, see lfhcal_geometry.h.  An event fires
+when some column has at least min_layers layers with a hit threshold ADC counts over
+pedestal.  This is the track selection of identify_muon_track_b in draw_waveforms.cxx,
+which asks for more than 4 layers over 20 in the fitted amplitude, made on the hits of
+hit_finder instead, whose amplitude is the largest sample over pedestal.
+
+The layers with a hit in each column are a 64 bit mask, so an event costs one pass over
+its hits and a popcount per column.
+*/
+
+#pragma once
+
+#include "binary_format.h"
+#include "lfhcal_geometry.h"
+
+#include <cstdint>
+#include <vector>
+
+class track_trigger {
+public:
+    static const int COLUMNS = lfhcal_columns::COLUMNS;
+    static const int LAYERS = lfhcal_columns::LAYERS;
+
+private:
+    int min_layers;
+    float threshold;
+    lfhcal_columns geometry;
+    uint64_t layers_hit[COLUMNS];
+    int track_column;
+    int track_layers;
+
+public:
+    track_trigger(int num_channels, int min_layers, float threshold);
+
+    // Whether the hits of an event have a track
+    bool fire(const std::vector<h2h_hit> &hits);
+
+    // Column (x + 4 y) with the most layers hit in the last event, -1 if none were
+    int get_track_column() const {return track_column;}
+    int get_track_layers() const {return track_layers;}
+    int get_min_layers() const {return min_layers;}
+    float get_threshold() const {return threshold;}
+};
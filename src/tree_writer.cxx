@@ -5,6 +5,8 @@
 #include "event_aligner.h"
 #include "waveform_builder.h"
 #include "debug_logger.h"
+#include "pedestal_accumulator.h"
+#include "lfhcal_geometry.h"
 
 #include <cstdint>
 #include <vector>
@@ -22,9 +24,11 @@ event_writer::event_writer(const std::string &file_name, int num_kcu, int num_sa
     this->detector = detector;
     num_channels = 144 * num_kcu;
     event_number = 0;
-    log_message(DEBUG_INFO, "TreeWriter", "Detector is " + std::to_string(detector));
+    closed = false;
+    hit_tree = nullptr;
+    LOG_MESSAGE(DEBUG_INFO, "TreeWriter", "Detector is " + std::to_string(detector));
 
-    log_message(DEBUG_DEBUG, "TreeWriter", "Making event writer with " + std::to_string(num_kcu) + 
+    LOG_MESSAGE(DEBUG_DEBUG, "TreeWriter", "Making event writer with " + std::to_string(num_kcu) + 
                " KCUs, " + std::to_string(num_samples) + " samples, and " + 
                std::to_string(num_channels) + " channels");
 
@@ -110,68 +114,47 @@ event_writer::event_writer(const std::string &file_name, int num_kcu, int num_sa
 
 event_writer::~event_writer() {
     close();
+    // Closing the file deletes its trees, so the branch buffers are free to go
+    delete file;
+    delete[] event_values.timestamps;
+    delete[] event_values.adc_block;
+    delete[] event_values.toa_block;
+    delete[] event_values.tot_block;
+    delete[] event_values.hamming_block;
+    delete[] event_values.samples_adc;
+    delete[] event_values.samples_toa;
+    delete[] event_values.samples_tot;
+    delete[] event_values.sample_hamming_err;
+    delete[] event_values.hit_x;
+    delete[] event_values.hit_y;
+    delete[] event_values.hit_z;
+    delete[] event_values.hit_crystal;
+    delete[] event_values.hit_sipm_16i;
+    delete[] event_values.hit_sipm_4x4;
+    delete[] event_values.hit_sipm_16p;
+    delete[] event_values.good_channel;
+    delete[] event_values.good_channel_16i;
+    delete[] event_values.good_channel_4x4;
+    delete[] event_values.good_channel_16p;
+    delete[] event_values.hit_max;
+    delete[] event_values.hit_pedestal;
+    if (hit_tree != nullptr) {
+        delete[] hit_values.channel;
+        delete[] hit_values.peak_sample;
+        delete[] hit_values.toa;
+        delete[] hit_values.amplitude;
+        delete[] hit_values.charge;
+    }
 }
 
 bool event_writer::decode_position(int channel, int &x, int &y, int &z) {
-    int channel_map[72] = {64, 63, 66, 65, 69, 70, 67, 68,  // this goes from 0 to 63 in lhfcal space to 0 to 71 in asic space
-                           55, 56, 57, 58, 62, 61, 60, 59,  // So channel 0 on the detector is channel 64 on the asic
-                           45, 46, 47, 48, 52, 51, 50, 49,  // What we want is the reverse of this, going from 0 to 71 in asic
-                           37, 36, 39, 38, 42, 43, 40, 41,  // space to 0 to 63 in lhfcal space
-                           34, 33, 32, 31, 27, 28, 29, 30,
-                           25, 26, 23, 24, 20, 19, 22, 21,
-                           16, 14, 15, 12,  9, 11, 10, 13,
-                            7,  6,  5,  4,  0,  1,  2,  3,
-                            -1, -1, -1, -1, -1, -1, -1, -1};
-
-    int fpga_factor[4] = {1, 3, 0, 2};
-
-    int asic_channel = channel % 72;
-    // find the lhfcal channel
-    int lhfcal_channel = -1;
-    for (int i = 0; i < 72; i++) {
-        if (channel_map[i] == asic_channel) {
-            lhfcal_channel = i;
-            break;
-        }
-    }
-
-    if (lhfcal_channel == -1) {
-        // These are the empty channels
-        x = -1;
-        y = -1;
-        z = -1;
-        return false;
-    }
-
-    int candy_bar_index = lhfcal_channel % 8;
-    if (candy_bar_index < 4) {
-        y = 1;
-    } else {
-        y = 0;
-    }
-
-    if (candy_bar_index == 0 || candy_bar_index == 7) {
-        x = 0;
-    } else if (candy_bar_index == 1 || candy_bar_index == 6) {
-        x = 1;
-    } else if (candy_bar_index == 2 || candy_bar_index == 5) {
-        x = 2;
-    } else {
-        x = 3;
-    }
-
-    int fpga = channel / 144;
-    int asic = (channel % 144) / 72;
-
-    z = fpga_factor[fpga] * 16 + asic * 8 + lhfcal_channel / 8;
-
-    return true;
+    return ::decode_position(channel, x, y, z);
 }
 
 void event_writer::write_event(aligned_event *event) {
-    log_message(DEBUG_TRACE, "TreeWriter", "Writing event: " + std::to_string((uint64_t)event));
+    LOG_MESSAGE(DEBUG_TRACE, "TreeWriter", "Writing event: " + std::to_string((uint64_t)event));
     for (int i = 0; i < num_kcu; i++) {
-        log_message(DEBUG_TRACE, "TreeWriter", std::to_string(i) + ": " + 
+        LOG_MESSAGE(DEBUG_TRACE, "TreeWriter", std::to_string(i) + ": " + 
                    std::to_string((uint64_t)event->get_event(i)));
     }
     event_values.event_number = event_number;
@@ -273,11 +256,91 @@ void event_writer::write_event(aligned_event *event) {
     }
 
     tree->Fill();
-    log_message(DEBUG_TRACE, "TreeWriter", "Filled tree with event number " + std::to_string(event_number));
+    LOG_MESSAGE(DEBUG_TRACE, "TreeWriter", "Filled tree with event number " + std::to_string(event_number));
+}
+
+void event_writer::write_hits(const std::vector<h2h_hit> &hits) {
+    if (hit_tree == nullptr) {
+        file->cd();
+        hit_tree = new TTree("hits", "Hits");
+        hit_values.channel = new uint32_t[num_channels];
+        hit_values.peak_sample = new uint32_t[num_channels];
+        hit_values.toa = new uint32_t[num_channels];
+        hit_values.amplitude = new float[num_channels];
+        hit_values.charge = new float[num_channels];
+        hit_tree->Branch("event_number", &hit_values.event_number, "event_number/i");
+        hit_tree->Branch("num_hits", &hit_values.num_hits, "num_hits/i");
+        hit_tree->Branch("channel", hit_values.channel, "channel[num_hits]/i");
+        hit_tree->Branch("peak_sample", hit_values.peak_sample, "peak_sample[num_hits]/i");
+        hit_tree->Branch("toa", hit_values.toa, "toa[num_hits]/i");
+        hit_tree->Branch("amplitude", hit_values.amplitude, "amplitude[num_hits]/F");
+        hit_tree->Branch("charge", hit_values.charge, "charge[num_hits]/F");
+    }
+    hit_values.event_number = event_values.event_number;
+    hit_values.num_hits = hits.size();
+    for (size_t i = 0; i < hits.size(); i++) {
+        hit_values.channel[i] = hits[i].channel;
+        hit_values.peak_sample[i] = hits[i].peak_sample;
+        hit_values.toa[i] = hits[i].toa;
+        hit_values.amplitude[i] = hits[i].amplitude;
+        hit_values.charge[i] = hits[i].charge;
+    }
+    hit_tree->Fill();
+}
+
+namespace {
+// Fills a "pedestals" tree in the current ROOT directory
+void fill_pedestal_tree(const pedestal_accumulator &pedestals) {
+    TTree *pedestal_tree = new TTree("pedestals", "Pedestals");
+    uint32_t channel;
+    uint64_t entries, quiet;
+    double pedestal, pedestal_rms, noise;
+    pedestal_tree->Branch("channel", &channel, "channel/i");
+    pedestal_tree->Branch("entries", &entries, "entries/l");
+    pedestal_tree->Branch("pedestal", &pedestal, "pedestal/D");
+    pedestal_tree->Branch("pedestal_rms", &pedestal_rms, "pedestal_rms/D");
+    pedestal_tree->Branch("quiet", &quiet, "quiet/l");
+    pedestal_tree->Branch("noise", &noise, "noise/D");
+    for (int i = 0; i < pedestals.get_num_channels(); i++) {
+        channel = i;
+        entries = pedestals.get_entries(i);
+        pedestal = pedestals.get_pedestal(i);
+        pedestal_rms = pedestals.get_pedestal_rms(i);
+        quiet = pedestals.get_quiet(i);
+        noise = pedestals.get_noise(i);
+        pedestal_tree->Fill();
+    }
+}
+}
+
+void event_writer::write_pedestals(const pedestal_accumulator &pedestals) {
+    if (closed) {
+        return;
+    }
+    file->cd();
+    fill_pedestal_tree(pedestals);
+    LOG_MESSAGE(DEBUG_DEBUG, "TreeWriter", "Added pedestals of " + std::to_string(pedestals.get_num_channels()) + " channels");
+}
+
+void add_pedestals(const std::string &file_name, const pedestal_accumulator &pedestals) {
+    TFile file(file_name.c_str(), "UPDATE");
+    if (file.IsZombie()) {
+        LOG_MESSAGE(DEBUG_ERROR, "TreeWriter", "Error opening " + file_name + " to add pedestals");
+        return;
+    }
+    fill_pedestal_tree(pedestals);
+    file.Write();
+    file.Close();
+    LOG_MESSAGE(DEBUG_DEBUG, "TreeWriter", "Added pedestals of " + std::to_string(pedestals.get_num_channels()) +
+                " channels to " + file_name);
 }
 
 void event_writer::close() {
-    log_message(DEBUG_DEBUG, "TreeWriter", "Closing file " + file_name);
+    if (closed) {
+        return;
+    }
+    closed = true;
+    LOG_MESSAGE(DEBUG_DEBUG, "TreeWriter", "Closing file " + file_name);
     file->Write();
     file->Close();
 }
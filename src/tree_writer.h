@@ -2,12 +2,15 @@
 
 #include "event_aligner.h"
 #include "waveform_builder.h"
+#include "binary_format.h"
 
 #include <cstdint>
 #include <vector>
 #include <list>
 #include <string>
 
+class pedestal_accumulator;
+
 #ifdef USE_ROOT
 #include <TROOT.h>
 #include <TFile.h>
@@ -51,11 +54,25 @@ private:
     };
     tree_vars event_values;
 
+    // Hits of the event, see hit_finder.h
+    struct hit_vars {
+        uint32_t event_number;
+        uint32_t num_hits;
+        uint32_t *channel;
+        uint32_t *peak_sample;
+        uint32_t *toa;
+        float *amplitude;
+        float *charge;
+    };
+    hit_vars hit_values;
+    TTree *hit_tree;
+
     int num_kcu;
     int num_samples;
     int num_channels;
-    int event_number;
+    int64_t event_number;
     int detector;
+    bool closed;
 
     std::string file_name;
     TFile *file;
@@ -122,9 +139,19 @@ public:
     ~event_writer();
 
     void write_event(aligned_event *event);
+    // Adds the hits of the event just written to a "hits" tree, entry for entry with "events"
+    void write_hits(const std::vector<h2h_hit> &hits);
+    // Adds a "pedestals" tree with an entry per channel, written on close
+    void write_pedestals(const pedestal_accumulator &pedestals);
     void close();
+    // Numbering of the next event, for a run continued in another file
+    void set_event_number(int64_t event_number) {this->event_number = event_number;}
 };
 
+// Adds a "pedestals" tree to a ROOT file that is already closed, such as the first file of a
+// checkpointed run
+void add_pedestals(const std::string &file_name, const pedestal_accumulator &pedestals);
+
 #endif // USE_ROOT
 #ifndef USE_ROOT 
 
@@ -135,6 +162,11 @@ public:
     ~event_writer() {};
 
     void write_event(aligned_event *event) {};
+    void write_hits(const std::vector<h2h_hit> &hits) {};
+    void write_pedestals(const pedestal_accumulator &pedestals) {};
     void close() {};
+    void set_event_number(int64_t event_number) {};
 };
+
+inline void add_pedestals(const std::string &file_name, const pedestal_accumulator &pedestals) {}
 #endif
@@ -0,0 +1,104 @@
+#include "udp_source.h"
+#include "debug_logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+udp_source::udp_source(const std::string &address, uint32_t num_fpgas, int num_samples, double timeout)
+    : address(address), num_fpgas(num_fpgas) {
+    this->timeout = timeout;
+    number_samples = num_samples;
+    wrong_size = 0;
+    kernel_drops = 0;
+    if (number_samples <= 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "UdpSource", "The number of samples is needed to decode UDP input");
+        throw std::runtime_error("Number of samples not given");
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        LOG_MESSAGE(DEBUG_ERROR, "UdpSource", "Expected HOST:PORT, got " + address);
+        throw std::runtime_error("Bad UDP address");
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *info = nullptr;
+    int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info);
+    if (err != 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "UdpSource", "Cannot resolve " + address + ": " + gai_strerror(err));
+        throw std::runtime_error("Bad UDP address");
+    }
+    fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if (fd < 0 || bind(fd, info->ai_addr, info->ai_addrlen) < 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "UdpSource", "Cannot listen on " + address + ": " + strerror(errno));
+        freeaddrinfo(info);
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("Error opening socket");
+    }
+    freeaddrinfo(info);
+
+    // The kernel caps this at net.core.rmem_max
+    int rcvbuf = 64 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    socklen_t len = sizeof(rcvbuf);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    LOG_MESSAGE(DEBUG_INFO, "UdpSource", "Listening on " + address + " with a " + std::to_string(rcvbuf / 1024) +
+                " kB receive buffer, " + std::to_string(number_samples) + " samples");
+}
+
+udp_source::~udp_source() {
+    close(fd);
+    LOG_MESSAGE(DEBUG_INFO, "UdpSource", "Received " + std::to_string(packets_processed) + " packets");
+    if (wrong_size > 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "UdpSource", "Skipped " + std::to_string(wrong_size) + " datagrams of the wrong size");
+    }
+    if (kernel_drops > 0) {
+        LOG_MESSAGE(DEBUG_WARNING, "UdpSource", "The kernel dropped " + std::to_string(kernel_drops) +
+                    " datagrams, consider raising net.core.rmem_max");
+    }
+}
+
+int udp_source::read_packet(uint8_t *packet) {
+    while (wait_readable(fd)) {
+        iovec iov = {packet, PACKET_SIZE};
+        char control[CMSG_SPACE(sizeof(uint32_t))];
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &msg, MSG_TRUNC);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            LOG_MESSAGE(DEBUG_ERROR, "UdpSource", std::string("Error receiving: ") + strerror(errno));
+            return 0;
+        }
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+                // A running total of the datagrams dropped on this socket
+                std::memcpy(&kernel_drops, CMSG_DATA(c), sizeof(kernel_drops));
+            }
+        }
+        if (n != PACKET_SIZE) {
+            wrong_size++;
+            LOG_MESSAGE(DEBUG_DEBUG, "UdpSource", "Skipping a " + std::to_string(n) + " byte datagram");
+            continue;
+        }
+        return finish_packet(packet);
+    }
+    return 0;
+}
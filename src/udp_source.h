@@ -0,0 +1,33 @@
+/*
+Receives packets straight from the KCUs, or from a capture replayed with tcpreplay or
+similar, as UDP datagrams.  Each datagram carries one 1452 byte packet; anything else is
+counted and skipped.  There is no text header, so the number of samples must be given.
+
+    h2g_run -r 42 -i udp://0.0.0.0:5000 -s 10 -w 30
+
+The socket asks for a large receive buffer so bursts are not lost while the decoder is
+busy, and the number of datagrams the kernel still had to drop is logged at the end.
+*/
+
+#pragma once
+
+#include "packet_source.h"
+
+#include <string>
+
+class udp_source : public packet_source {
+private:
+    std::string address;
+    int fd;
+    uint32_t num_fpgas;
+    int64_t wrong_size;
+    uint32_t kernel_drops;
+
+public:
+    // address is HOST:PORT, an empty host listens on every interface
+    udp_source(const std::string &address, uint32_t num_fpgas, int num_samples, double timeout = 0);
+    ~udp_source();
+
+    int read_packet(uint8_t *packet) override;
+    bool is_live() override {return true;}
+};
@@ -1,25 +1,29 @@
 #include "waveform_builder.h"
 
 #include "line_builder.h"
+#include "checkpoint.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <list>
+#include <stdexcept>
 
 kcu_event::kcu_event(uint32_t fpga, uint32_t samples) {
     this->fpga = fpga;
     this->samples = samples;
     found = 0;
     added = 0;
-    bunch_counter = new uint32_t[samples];
-    event_counter = new uint32_t[samples];
-    orbit_counter = new uint32_t[samples];
-    timestamp = new uint32_t[samples];
+    // Zeroed so a sample that never arrives reads as 0 instead of leftover heap contents
+    bunch_counter = new uint32_t[samples]();
+    event_counter = new uint32_t[samples]();
+    orbit_counter = new uint32_t[samples]();
+    timestamp = new uint32_t[samples]();
     for (int i = 0; i < 144; i++) {
-        adc[i] = new uint32_t[samples];
-        toa[i] = new uint32_t[samples];
-        tot[i] = new uint32_t[samples];
-        hamming[i] = new uint32_t[samples];
+        adc[i] = new uint32_t[samples]();
+        toa[i] = new uint32_t[samples]();
+        tot[i] = new uint32_t[samples]();
+        hamming[i] = new uint32_t[samples]();
     }
     unwrapped = false;
     aligned = false;
@@ -145,8 +149,16 @@ bool waveform_builder::build(std::list<sample*> *samples) {
                         if ((*event)->is_ordered()) {
                             complete->push_back(*event);
                             completed++;
+                            if (stats) {
+                                stats->add_completed(1, fpga_id);
+                                stats->add_in_order(1, fpga_id);
+                            }
                         } else {
                             aborted++;
+                            if (stats) {
+                                stats->add_completed(1, fpga_id);
+                                stats->add_aborted(1, fpga_id);
+                            }
                         }
                         in_progress->erase(std::next(event).base());
                     }
@@ -204,7 +216,8 @@ bool waveform_builder::build(std::list<sample*> *samples) {
             
             // Next, check if it's the next timestamp in the series
             // std::cout << (*event)->timestamp[(*event)->found - 1] - s->timestamp << std::endl;
-            if (s->timestamp - (*event)->timestamp[(*event)->found - 1] <= 41) {
+            // (a full series has no room left, the sample belongs to another event)
+            if ((*event)->found < num_samples && s->timestamp - (*event)->timestamp[(*event)->found - 1] <= 41) {
                 // std::cout << "Adding to next sample" << std::endl;
                 auto offset = 72 * s->asic + 36 * s->half;
                 for (int j = 0; j < 36; j++) {
@@ -269,6 +282,9 @@ bool waveform_builder::build(std::list<sample*> *samples) {
         // std::cout << "list too long" << std::endl;
         auto e = in_progress->front();
         aborted++;
+        if (stats) {
+            stats->add_aborted(1, fpga_id);
+        }
         in_progress->pop_front();
         delete e;
     }
@@ -326,4 +342,90 @@ uint32_t waveform_builder::get_num_in_order() {
         }
     }
     return in_order;
-}
\ No newline at end of file
+}
+void kcu_event::save_state(checkpoint_writer &out) {
+    out.put(found);
+    out.put(added);
+    out.put(unwrapped_timestamp);
+    out.put(unwrapped_event_number);
+    out.put(unwrapped);
+    out.put_array(bunch_counter, samples);
+    out.put_array(event_counter, samples);
+    out.put_array(orbit_counter, samples);
+    out.put_array(timestamp, samples);
+    for (int i = 0; i < 144; i++) {
+        out.put_array(adc[i], samples);
+        out.put_array(toa[i], samples);
+        out.put_array(tot[i], samples);
+        out.put_array(hamming[i], samples);
+    }
+}
+
+void kcu_event::load_state(checkpoint_reader &in) {
+    found = in.get<uint32_t>();
+    added = in.get<uint32_t>();
+    unwrapped_timestamp = in.get<long>();
+    unwrapped_event_number = in.get<long>();
+    unwrapped = in.get<bool>();
+    in.get_array(bunch_counter, samples);
+    in.get_array(event_counter, samples);
+    in.get_array(orbit_counter, samples);
+    in.get_array(timestamp, samples);
+    for (int i = 0; i < 144; i++) {
+        in.get_array(adc[i], samples);
+        in.get_array(toa[i], samples);
+        in.get_array(tot[i], samples);
+        in.get_array(hamming[i], samples);
+    }
+}
+
+void waveform_builder::save_state(checkpoint_writer &out) {
+    out.put(fpga_id);
+    out.put(num_samples);
+    out.put(attempted);
+    out.put(aborted);
+    out.put(completed);
+    out.put(unwrap_last_timestamp);
+    out.put(unwrap_wrap_counter);
+    out.put(unwrap_last_event_number);
+    out.put(unwrap_event_wrap_counter);
+    out.put<uint64_t>(in_progress->size());
+    for (auto e : *in_progress) {
+        e->save_state(out);
+    }
+    uint64_t waiting = std::count_if(complete->begin(), complete->end(), [](kcu_event *e) {return !e->aligned;});
+    out.put(waiting);
+    for (auto e : *complete) {
+        if (!e->aligned) {
+            e->save_state(out);
+        }
+    }
+}
+
+void waveform_builder::load_state(checkpoint_reader &in) {
+    if (in.get<uint32_t>() != fpga_id || in.get<uint32_t>() != num_samples) {
+        throw std::runtime_error("Checkpoint was written for a different KCU or number of samples");
+    }
+    attempted = in.get<uint32_t>();
+    aborted = in.get<uint32_t>();
+    completed = in.get<uint32_t>();
+    unwrap_last_timestamp = in.get<uint32_t>();
+    unwrap_wrap_counter = in.get<uint32_t>();
+    unwrap_last_event_number = in.get<uint32_t>();
+    unwrap_event_wrap_counter = in.get<uint32_t>();
+    for (auto list : {in_progress, complete}) {
+        uint64_t count = in.get<uint64_t>();
+        for (uint64_t n = 0; n < count; n++) {
+            auto e = new kcu_event(fpga_id, num_samples);
+            list->push_back(e);
+            e->load_state(in);
+        }
+    }
+}
+
+void waveform_builder::set_unwrap_state(const unwrap_state &state) {
+    unwrap_last_timestamp = state.last_timestamp;
+    unwrap_wrap_counter = state.wrap_counter;
+    unwrap_last_event_number = state.last_event_number;
+    unwrap_event_wrap_counter = state.event_wrap_counter;
+}
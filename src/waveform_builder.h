@@ -5,11 +5,23 @@ Collects individual samples built by line_builder and builds waveforms from them
 #pragma once
 
 #include "line_builder.h"
+#include "stat_logger.h"
 
 #include <cstdint>
 #include <list>
 #include <vector>
 
+class checkpoint_writer;
+class checkpoint_reader;
+
+// Counters used to unwrap the event number and timestamp, see waveform_builder::unwrap_counters
+struct unwrap_state {
+    uint32_t last_timestamp;
+    uint32_t wrap_counter;
+    uint32_t last_event_number;
+    uint32_t event_wrap_counter;
+};
+
 class kcu_event {
 private:
     uint32_t fpga;
@@ -49,8 +61,13 @@ public:
     uint32_t get_sample_toa(int channel, int sample) {return toa[channel][sample];}
     uint32_t get_sample_tot(int channel, int sample) {return tot[channel][sample];}
     uint32_t get_sample_hamming(int channel, int sample) {return hamming[channel][sample];}
+    // All samples of a channel
+    const uint32_t *get_adc(int channel) {return adc[channel];}
 
     uint32_t get_n_samples() {return samples;}
+
+    void save_state(checkpoint_writer &out);
+    void load_state(checkpoint_reader &in);
     
     friend class waveform_builder;
 };
@@ -72,14 +89,28 @@ private:
     std::list<kcu_event*> *in_progress;
     std::list<kcu_event*> *complete;
 
+    stat_logger *stats = nullptr;
+
 public:
     waveform_builder(uint32_t fpga_id, uint32_t num_samples);
     ~waveform_builder();
     bool build(std::list<sample*> *samples);
     void unwrap_counters();
     std::list<kcu_event*>* get_complete() {return complete;}
+    size_t get_num_in_progress() {return in_progress->size();}
+    void set_stat_logger(stat_logger *stats) {this->stats = stats;}
 
     uint32_t get_num_aborted();
     uint32_t get_num_completed() {return completed;}
     uint32_t get_num_in_order();
+
+    // For starting part way into a run with the counters it had there, see packet_index.h
+    unwrap_state get_unwrap_state() {return {unwrap_last_timestamp, unwrap_wrap_counter, unwrap_last_event_number, unwrap_event_wrap_counter};}
+    void set_unwrap_state(const unwrap_state &state);
+
+    // Partial waveforms, waveforms waiting for alignment and the unwrap counters, see
+    // checkpoint.h.  Waveforms already aligned are left out, they are only kept until
+    // the next unwrap_counters.
+    void save_state(checkpoint_writer &out);
+    void load_state(checkpoint_reader &in);
 };
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "waveform_fitter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+double clamp(double value, double low, double high) {
+    return std::min(std::max(value, low), high);
+}
+
+// Solves the symmetric 3x3 system a x = b by Cramer's rule, false if it is singular
+bool solve3(const double a[3][3], const double b[3], double x[3]) {
+    double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    double det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+    if (!(std::fabs(det) > 1e-300)) {
+        return false;
+    }
+    double c10 = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    double c11 = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    double c12 = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    double c20 = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    double c21 = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    double c22 = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+    x[0] = (c00 * b[0] + c10 * b[1] + c20 * b[2]) / det;
+    x[1] = (c01 * b[0] + c11 * b[1] + c21 * b[2]) / det;
+    x[2] = (c02 * b[0] + c12 * b[1] + c22 * b[2]) / det;
+    return true;
+}
+
+}
+
+waveform_fitter::waveform_fitter(int num_samples, double alpha, double n)
+    : num_samples(num_samples), alpha(alpha), n(n), max_iterations(50) {
+    if (num_samples < 4 || num_samples > MAX_SAMPLES) {
+        throw std::invalid_argument("Cannot fit waveforms of " + std::to_string(num_samples) + " samples");
+    }
+    if (!(alpha > 0) || !(n > 0)) {
+        throw std::invalid_argument("Crystal ball tail needs alpha > 0 and n > 0");
+    }
+    tail_a = std::pow(n / alpha, n) * std::exp(-0.5 * alpha * alpha);
+    tail_b = n / alpha - alpha;
+    make_templates();
+}
+
+double waveform_fitter::grid_x_bar(int i) const {
+    return num_x_bar > 1 ? bounds.x_bar_min + (bounds.x_bar_max - bounds.x_bar_min) * i / (num_x_bar - 1) : bounds.x_bar_min;
+}
+
+double waveform_fitter::grid_sigma(int i) const {
+    return num_sigma > 1 ? bounds.sigma_min + (bounds.sigma_max - bounds.sigma_min) * i / (num_sigma - 1) : bounds.sigma_min;
+}
+
+void waveform_fitter::make_templates() {
+    if (!(bounds.x_bar_max >= bounds.x_bar_min) || !(bounds.sigma_max >= bounds.sigma_min) ||
+        !(bounds.sigma_min > 0) || !(bounds.amplitude_max > 0)) {
+        throw std::invalid_argument("Bad waveform fit limits");
+    }
+    num_x_bar = 1 + (int)std::ceil((bounds.x_bar_max - bounds.x_bar_min) / X_BAR_STEP - 1e-9);
+    num_sigma = 1 + (int)std::ceil((bounds.sigma_max - bounds.sigma_min) / SIGMA_STEP - 1e-9);
+    num_templates = num_x_bar * num_sigma;
+    templates.assign((size_t)num_templates * num_samples, 0);
+    template_norm.assign(num_templates, 0);
+    template_inverse.assign(num_templates, 0);
+    for (int k = 0; k < num_templates; k++) {
+        double x_bar = grid_x_bar(k / num_sigma);
+        double sigma = grid_sigma(k % num_sigma);
+        for (int s = 0; s < num_samples; s++) {
+            double g, dg;
+            shape((s - x_bar) / sigma, g, dg);
+            templates[(size_t)s * num_templates + k] = g;
+            template_norm[k] += g * g;
+        }
+        template_inverse[k] = 1 / template_norm[k];
+    }
+}
+
+void waveform_fitter::shape(double t, double &g, double &dg) const {
+    if (t < alpha) {
+        g = std::exp(-0.5 * t * t);
+        dg = -t * g;
+    } else {
+        // B + t >= n / alpha > 0 here
+        g = tail_a * std::pow(tail_b + t, -n);
+        dg = -n * g / (tail_b + t);
+    }
+}
+
+double waveform_fitter::residuals(const double *y, double pedestal, const double *p) const {
+    double chi2 = 0;
+    for (int i = 0; i < num_samples; i++) {
+        double g, dg;
+        shape((i - p[1]) / p[2], g, dg);
+        double r = y[i] - pedestal - p[0] * g;
+        chi2 += r * r;
+    }
+    return chi2;
+}
+
+double waveform_fitter::evaluate(double x, const waveform_fit &fit, double pedestal) const {
+    double g, dg;
+    shape((x - fit.peak_time) / fit.sigma, g, dg);
+    return fit.amplitude * g + pedestal;
+}
+
+waveform_fit waveform_fitter::estimate_samples(const double *y, double pedestal) const {
+    float signal[MAX_SAMPLES];
+    float signal_norm = 0;
+    int peak = 0;
+    for (int i = 0; i < num_samples; i++) {
+        signal[i] = y[i] - pedestal;
+        signal_norm += signal[i] * signal[i];
+        if (y[i] > y[peak]) {
+            peak = i;
+        }
+    }
+
+    // The core is narrower than a sample, so x_bar is within a sample of the largest one
+    int first = std::max(0, (int)std::floor((peak - 1 - bounds.x_bar_min) / X_BAR_STEP));
+    int last = std::min(num_x_bar - 1, (int)std::ceil((peak + 1 - bounds.x_bar_min) / X_BAR_STEP));
+    if (first > last) {
+        first = 0;
+        last = num_x_bar - 1;
+    }
+
+    // For a fixed shape T, chi2(N) = y.y - 2 N y.T + N^2 T.T is least at N = y.T / T.T.
+    // Blocks of templates at a time, each pass over a block vectorizes.
+    const int BLOCK = 256;
+    float dot[BLOCK];
+    float amplitude[BLOCK];
+    float chi2[BLOCK];
+    const float amplitude_max = bounds.amplitude_max;
+    int best = first * num_sigma;
+    float best_amplitude = 0;
+    float best_chi2 = signal_norm;
+    for (int start = first * num_sigma; start < (last + 1) * num_sigma; start += BLOCK) {
+        int count = std::min(BLOCK, (last + 1) * num_sigma - start);
+        for (int k = 0; k < count; k++) {
+            dot[k] = 0;
+        }
+        for (int i = 0; i < num_samples; i++) {
+            const float *row = templates.data() + (size_t)i * num_templates + start;
+            float value = signal[i];
+            for (int k = 0; k < count; k++) {
+                dot[k] += value * row[k];
+            }
+        }
+        const float *norm = template_norm.data() + start;
+        const float *inverse = template_inverse.data() + start;
+        for (int k = 0; k < count; k++) {
+            float a = std::min(std::max(dot[k] * inverse[k], 0.0f), amplitude_max);
+            amplitude[k] = a;
+            chi2[k] = signal_norm - 2 * a * dot[k] + a * a * norm[k];
+        }
+        for (int k = 0; k < count; k++) {
+            if (chi2[k] < best_chi2) {
+                best = start + k;
+                best_amplitude = amplitude[k];
+                best_chi2 = chi2[k];
+            }
+        }
+    }
+
+    double p[3] = {best_amplitude, grid_x_bar(best / num_sigma), grid_sigma(best % num_sigma)};
+    waveform_fit result;
+    result.amplitude = p[0];
+    result.peak_time = p[1];
+    result.sigma = p[2];
+    result.chi2 = residuals(y, pedestal, p);
+    result.ndf = num_samples - 3;
+    result.iterations = 0;
+    result.converged = false;
+    return result;
+}
+
+waveform_fit waveform_fitter::fit_samples(const double *y, double pedestal) const {
+    waveform_fit result = estimate_samples(y, pedestal);
+    double p[3] = {result.amplitude, result.peak_time, result.sigma};
+    double low[3] = {0, bounds.x_bar_min, bounds.sigma_min};
+    double high[3] = {bounds.amplitude_max, bounds.x_bar_max, bounds.sigma_max};
+    double chi2 = result.chi2;
+    double lambda = 1;
+
+    int iteration = 0;
+    bool converged = false;
+    while (iteration < max_iterations && !converged) {
+        iteration++;
+        // Normal equations J^T J d = J^T r for p = (N, x_bar, sigma)
+        double jtj[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double jtr[3] = {0, 0, 0};
+        for (int i = 0; i < num_samples; i++) {
+            double t = (i - p[1]) / p[2];
+            double g, dg;
+            shape(t, g, dg);
+            double r = y[i] - pedestal - p[0] * g;
+            double j[3] = {g, -p[0] * dg / p[2], -p[0] * dg * t / p[2]};
+            for (int a = 0; a < 3; a++) {
+                jtr[a] += j[a] * r;
+                for (int b = 0; b <= a; b++) {
+                    jtj[a][b] += j[a] * j[b];
+                }
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            for (int b = a + 1; b < 3; b++) {
+                jtj[a][b] = jtj[b][a];
+            }
+        }
+        // Hold a parameter at its limit while chi2 would fall past it, otherwise every step is
+        // clamped and the others crawl
+        for (int a = 0; a < 3; a++) {
+            if ((p[a] <= low[a] && jtr[a] < 0) || (p[a] >= high[a] && jtr[a] > 0)) {
+                for (int b = 0; b < 3; b++) {
+                    jtj[a][b] = 0;
+                    jtj[b][a] = 0;
+                }
+                jtj[a][a] = 1;
+                jtr[a] = 0;
+            }
+        }
+
+        // Raise the damping until a step improves chi2, clamping each step to the limits
+        bool improved = false;
+        while (!improved && lambda < 1e10) {
+            double damped[3][3];
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < 3; b++) {
+                    damped[a][b] = jtj[a][b];
+                }
+                damped[a][a] += lambda * jtj[a][a] + 1e-12;
+            }
+            double step[3];
+            if (!solve3(damped, jtr, step)) {
+                lambda *= 10;
+                continue;
+            }
+            double trial[3];
+            for (int a = 0; a < 3; a++) {
+                trial[a] = clamp(p[a] + step[a], low[a], high[a]);
+            }
+            double trial_chi2 = residuals(y, pedestal, trial);
+            if (trial_chi2 <= chi2) {
+                improved = true;
+                converged = chi2 - trial_chi2 <= 1e-5 * chi2 + 1e-2 ||
+                            (std::fabs(trial[1] - p[1]) < 1e-4 && std::fabs(trial[2] - p[2]) < 1e-4 &&
+                             std::fabs(trial[0] - p[0]) < 1e-4 * p[0] + 1e-3);
+                for (int a = 0; a < 3; a++) {
+                    p[a] = trial[a];
+                }
+                chi2 = trial_chi2;
+                lambda = std::max(lambda * 0.1, 1e-7);
+            } else {
+                lambda *= 10;
+            }
+        }
+        if (!improved) {
+            // No step lowers chi2 any further, so this is the minimum within the limits
+            converged = true;
+        }
+    }
+
+    result.amplitude = p[0];
+    result.peak_time = p[1];
+    result.sigma = p[2];
+    result.chi2 = chi2;
+    result.iterations = iteration;
+    result.converged = converged;
+    return result;
+}
@@ -0,0 +1,126 @@
+/*
+Fits the crystal ball shape of analysis/draw_waveforms.cxx to one channel's waveform,
+without ROOT and without allocating, so amplitudes can be extracted per channel per event
+at about the rate the decoder produces them.
+
+    f(x) = N g((x - x_bar) / sigma) + pedestal
+    g(t) = exp(-t^2 / 2)                        t < alpha
+         = A (B + t)^-n                         t >= alpha
+
+The tail, alpha and n, is a property of the shaper and fixed per fitter; the pedestal is
+given.  This leaves N, x_bar and sigma.  With sigma near a third of a sample the peak is
+covered by two or three samples and chi2 has local minima in x_bar, so the fit starts from
+a scan of templates: the shape is tabulated when the fitter is made on a grid of x_bar and
+sigma, and for each N follows in closed form from two dot products.  Only x_bar within a
+sample of the largest sample is scanned.  The best template is then refined by
+Levenberg-Marquardt on a 3x3 system held on the stack.  estimate() returns the best
+template on its own, for when that is good enough.
+
+fit() keeps no state, so one fitter can be shared by any number of threads, each fitting
+its own channels:
+
+    waveform_fitter fitter(10);
+    waveform_fit result = fitter.fit(adc, pedestal);
+    fitter.fit(adc, 10, pedestals, 576, results);     // a whole event, channel by channel
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct waveform_fit {
+    float amplitude;        // N, ADC counts above pedestal at the peak of the gaussian core
+    float peak_time;        // x_bar, in samples
+    float sigma;            // Width of the gaussian core, in samples
+    float chi2;             // Sum of squared residuals, ADC counts^2
+    int ndf;                // Samples less fitted parameters
+    int iterations;
+    bool converged;
+};
+
+class waveform_fitter {
+public:
+    static const int MAX_SAMPLES = 32;
+    static constexpr double X_BAR_STEP = 0.05;     // Template spacing, samples
+    static constexpr double SIGMA_STEP = 0.025;
+
+    // Parameter limits, as in draw_waveforms.cxx
+    struct limits {
+        double x_bar_min = 0.5;
+        double x_bar_max = 4.5;
+        double sigma_min = 0.25;
+        double sigma_max = 0.65;
+        double amplitude_max = 2000;
+    };
+
+private:
+    int num_samples;
+    double alpha;
+    double n;
+    double tail_a;          // A and B of the power law, from alpha and n
+    double tail_b;
+    limits bounds;
+    int max_iterations;
+
+    // Scan grid, shape[sample][template] so a scan runs over contiguous templates, and the
+    // sum of squares of each template and its inverse.  Template k has x_bar k / num_sigma and
+    // sigma k % num_sigma.
+    int num_x_bar;
+    int num_sigma;
+    int num_templates;
+    std::vector<float> templates;
+    std::vector<float> template_norm;
+    std::vector<float> template_inverse;
+
+    void make_templates();
+    double grid_x_bar(int i) const;
+    double grid_sigma(int i) const;
+
+    // Shape and its derivative in t
+    void shape(double t, double &g, double &dg) const;
+    double residuals(const double *y, double pedestal, const double *p) const;
+    waveform_fit fit_samples(const double *y, double pedestal) const;
+    waveform_fit estimate_samples(const double *y, double pedestal) const;
+
+public:
+    // Throws std::invalid_argument for more than MAX_SAMPLES samples or a bad tail
+    waveform_fitter(int num_samples, double alpha = 1.1, double n = 0.43);
+
+    void set_limits(const limits &bounds) {this->bounds = bounds; make_templates();}
+    void set_max_iterations(int iterations) {max_iterations = iterations;}
+
+    // Best template only, no fit
+    template <typename T>
+    waveform_fit estimate(const T *samples, double pedestal) const {
+        double y[MAX_SAMPLES];
+        for (int i = 0; i < num_samples; i++) {
+            y[i] = samples[i];
+        }
+        return estimate_samples(y, pedestal);
+    }
+
+    template <typename T>
+    waveform_fit fit(const T *samples, double pedestal) const {
+        double y[MAX_SAMPLES];
+        for (int i = 0; i < num_samples; i++) {
+            y[i] = samples[i];
+        }
+        return fit_samples(y, pedestal);
+    }
+
+    // Channel i's samples start at samples + i * stride
+    template <typename T>
+    void fit(const T *samples, int stride, const double *pedestals, int num_channels, waveform_fit *results) const {
+        for (int i = 0; i < num_channels; i++) {
+            results[i] = fit(samples + (int64_t)i * stride, pedestals[i]);
+        }
+    }
+
+    // Value of a fitted waveform at x samples
+    double evaluate(double x, const waveform_fit &fit, double pedestal) const;
+
+    int get_num_samples() const {return num_samples;}
+    double get_alpha() const {return alpha;}
+    double get_n() const {return n;}
+};
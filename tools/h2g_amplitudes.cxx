@@ -0,0 +1,297 @@
+/*
+Amplitude spectra for the MIP calibration: the event loop of analysis/draw_waveforms.cxx,
+compiled and spread over threads.
+
+    h2g_amplitudes -o muons Run305.h2d Run306.h2d     # writes muons.hist, and muons.root with ROOT
+    h2g_fit_mip -i muons.hist                         # then the Landau fits
+
+Each file is cut into one block of consecutive events per thread.  A thread fits the
+waveforms of its block with waveform_fitter and fills its own histograms, which are added
+together at the end, so the threads share nothing but the memory mapped input.
+
+For each channel cb_norm_N gets the fitted amplitude in every event, and muon_cb_norm_N
+the amplitudes along muon tracks: columns (x, y) with more than MUON_LAYERS layers over
+MUON_AMPLITUDE, as identify_muon_track_b in draw_waveforms.cxx.  As there, waveforms that
+stay close to the pedestal (sum of squared deviations up to -c, 500 by default) are not
+fitted and count as 0.
+
+The pedestals are RunXXX.ped next to each RunXXX.h2d or RunXXX_mip.h2d, or -p FILE for
+every input; without either, the mean of the first and last sample of each waveform.
+*/
+
+#include "binary_reader.h"
+#include "histogram.h"
+#include "lfhcal_geometry.h"
+#include "pedestal_accumulator.h"
+#include "thread_pool.h"
+#include "waveform_fitter.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef USE_ROOT
+#include <TFile.h>
+#include <TH1F.h>
+#endif
+
+const int LAYERS = lfhcal_columns::LAYERS;
+const int COLUMNS = lfhcal_columns::COLUMNS;
+const double MUON_AMPLITUDE = 20;
+const int MUON_LAYERS = 4;
+
+struct amplitude_histograms {
+    std::vector<histogram> all;     // cb_norm_N
+    std::vector<histogram> muon;    // muon_cb_norm_N
+    uint64_t events = 0;
+    uint64_t muon_events = 0;
+    uint64_t fits = 0;
+    double max_amplitude = 0;
+
+    amplitude_histograms(int num_channels) {
+        for (int i = 0; i < num_channels; i++) {
+            all.emplace_back("cb_norm_" + std::to_string(i), 250, 0, 1000);
+        }
+        for (int i = 0; i < num_channels; i++) {
+            muon.emplace_back("muon_cb_norm_" + std::to_string(i), 250, 0, 1000);
+        }
+    }
+
+    void add(const amplitude_histograms &other) {
+        for (size_t i = 0; i < all.size(); i++) {
+            all[i].add(other.all[i]);
+            muon[i].add(other.muon[i]);
+        }
+        events += other.events;
+        muon_events += other.muon_events;
+        fits += other.fits;
+        max_amplitude = std::max(max_amplitude, other.max_amplitude);
+    }
+};
+
+void print_usage() {
+    std::cout << "Usage: h2g_amplitudes [-o BASE] [-p FILE] [-j THREADS] [-c CHI2] FILE.h2d..." << std::endl;
+    std::cout << "  -o, --output      Write BASE.hist, and BASE.root with ROOT (default: amplitudes)" << std::endl;
+    std::cout << "  -p, --pedestals   Pedestals for every input (default: RunXXX.ped next to each)" << std::endl;
+    std::cout << "  -j, --threads     Threads (default: one per hardware thread)" << std::endl;
+    std::cout << "  -c, --min-chi2    Fit waveforms that stray further from the pedestal, as a sum of" << std::endl;
+    std::cout << "                    squared deviations (default: 500)" << std::endl;
+    std::cout << "  -G, --debug-level 0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+}
+
+// Fits the waveforms of events [first, last) and fills their amplitudes into out
+void fill_block(const binary_reader &reader, const std::vector<double> &pedestals, const lfhcal_columns &geometry,
+                double min_chi2, uint64_t first, uint64_t last, amplitude_histograms &out) {
+    int num_channels = reader.get_num_channels();
+    int num_samples = reader.get_num_samples();
+    waveform_fitter fitter(num_samples);
+    int channel_at[COLUMNS][LAYERS];
+    double amplitude_at[COLUMNS][LAYERS];
+    for (uint64_t e = first; e < last; e++) {
+        event_view event = reader.event(e);
+        for (int i = 0; i < COLUMNS; i++) {
+            for (int j = 0; j < LAYERS; j++) {
+                channel_at[i][j] = -1;
+                amplitude_at[i][j] = 0;
+            }
+        }
+        for (int channel = 0; channel < num_channels; channel++) {
+            if (geometry.column[channel] < 0) {
+                continue;
+            }
+            sample_view adc = event.adc(channel);
+            double pedestal = pedestals.empty() ? (adc[0] + adc[num_samples - 1]) / 2.0 : pedestals[channel];
+            // How far the waveform strays from a flat pedestal, if not far there probably isn't a signal
+            double chi2 = 0;
+            for (int k = 0; k < num_samples; k++) {
+                chi2 += (adc[k] - pedestal) * (adc[k] - pedestal);
+            }
+            double amplitude = 0;
+            if (chi2 > min_chi2) {
+                amplitude = fitter.fit(adc.data, pedestal).amplitude;
+                out.fits++;
+            }
+            out.all[channel].fill(amplitude);
+            out.max_amplitude = std::max(out.max_amplitude, amplitude);
+            channel_at[geometry.column[channel]][geometry.layer[channel]] = channel;
+            amplitude_at[geometry.column[channel]][geometry.layer[channel]] = amplitude;
+        }
+
+        bool muon = false;
+        for (int i = 0; i < COLUMNS; i++) {
+            int above = 0;
+            for (int j = 0; j < LAYERS; j++) {
+                above += amplitude_at[i][j] > MUON_AMPLITUDE;
+            }
+            if (above <= MUON_LAYERS) {
+                continue;
+            }
+            muon = true;
+            for (int j = 0; j < LAYERS; j++) {
+                if (channel_at[i][j] >= 0) {
+                    out.muon[channel_at[i][j]].fill(amplitude_at[i][j]);
+                }
+            }
+        }
+        out.events++;
+        out.muon_events += muon;
+    }
+}
+
+#ifdef USE_ROOT
+void write_root(const std::string &file_name, const std::vector<histogram> &histograms) {
+    TFile *file = TFile::Open(file_name.c_str(), "RECREATE");
+    if (!file || file->IsZombie()) {
+        throw std::runtime_error("Error opening " + file_name);
+    }
+    for (auto &h : histograms) {
+        TH1F *root_histogram = new TH1F(h.get_name().c_str(), h.get_name().c_str(), h.get_bins(), h.get_low(),
+                                        h.get_high());
+        for (int i = 0; i < h.get_bins(); i++) {
+            root_histogram->SetBinContent(i + 1, h.get_content(i));
+        }
+        root_histogram->SetBinContent(0, h.get_underflow());
+        root_histogram->SetBinContent(h.get_bins() + 1, h.get_overflow());
+        root_histogram->SetEntries(h.get_entries());
+    }
+    file->Write();
+    file->Close();
+    delete file;
+}
+#endif
+
+int main(int argc, char **argv) {
+    std::string output_base = "amplitudes";
+    std::string pedestal_file;
+    unsigned threads = 0;
+    double min_chi2 = 500;
+    int debug_level = DEBUG_INFO;
+
+    const struct option long_options[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"pedestals", required_argument, nullptr, 'p'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"min-chi2", required_argument, nullptr, 'c'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:p:j:c:G:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'o':
+                output_base = optarg;
+                break;
+            case 'p':
+                pedestal_file = optarg;
+                break;
+            case 'j':
+                threads = std::stoul(optarg);
+                break;
+            case 'c':
+                min_chi2 = std::stod(optarg);
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+    if (optind >= argc) {
+        LOG_MESSAGE(DEBUG_ERROR, "No input files");
+        print_usage();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    thread_pool pool(threads);
+    amplitude_histograms total(0);
+    bool first_file = true;
+    try {
+        for (int f = optind; f < argc; f++) {
+            std::string input = argv[f];
+            binary_reader reader(input);
+            if (reader.get_detector() != 1) {
+                LOG_MESSAGE(DEBUG_WARNING, "Amplitudes", input + " is not marked as LFHCal data, using its geometry anyway");
+            }
+            std::string pedestals_name = pedestal_file;
+            if (pedestals_name.empty()) {
+                // The events with a track of RunXXX_mip.h2d have the pedestals of the whole run
+                std::string candidate = std::filesystem::path(input).replace_extension(".ped").string();
+                size_t mip = candidate.rfind("_mip.ped");
+                if (!std::filesystem::exists(candidate) && mip != std::string::npos && mip + 8 == candidate.size()) {
+                    candidate.replace(mip, 8, ".ped");
+                }
+                if (std::filesystem::exists(candidate)) {
+                    pedestals_name = candidate;
+                }
+            }
+            std::vector<double> pedestals;
+            if (pedestals_name.empty()) {
+                LOG_MESSAGE(DEBUG_WARNING, "Amplitudes", "No pedestals for " + input + ", using the ends of each waveform");
+            } else {
+                pedestals = read_pedestals(pedestals_name, reader.get_num_channels());
+            }
+            if (first_file) {
+                total = amplitude_histograms(reader.get_num_channels());
+                first_file = false;
+            } else if ((size_t)reader.get_num_channels() != total.all.size()) {
+                throw std::runtime_error(input + " has a different number of channels");
+            }
+            lfhcal_columns geometry(reader.get_num_channels());
+
+            // One block of consecutive events per thread
+            uint64_t num_events = reader.get_num_events();
+            unsigned blocks = pool.get_num_threads();
+            std::vector<std::future<amplitude_histograms>> partial;
+            for (unsigned b = 0; b < blocks; b++) {
+                uint64_t first = num_events * b / blocks;
+                uint64_t last = num_events * (b + 1) / blocks;
+                partial.push_back(pool.submit([&, first, last] {
+                    amplitude_histograms out(reader.get_num_channels());
+                    fill_block(reader, pedestals, geometry, min_chi2, first, last, out);
+                    return out;
+                }));
+            }
+            for (auto &p : partial) {
+                total.add(p.get());
+            }
+            LOG_MESSAGE(DEBUG_INFO, "Amplitudes", input + ": " + std::to_string(num_events) + " events");
+        }
+
+        std::vector<histogram> histograms = total.all;
+        histograms.insert(histograms.end(), total.muon.begin(), total.muon.end());
+        write_histograms(output_base + ".hist", histograms);
+#ifdef USE_ROOT
+        write_root(output_base + ".root", histograms);
+#endif
+    } catch (const std::exception &e) {
+        LOG_MESSAGE(DEBUG_ERROR, std::string("Failed: ") + e.what());
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Events:         %llu\n", (unsigned long long)total.events);
+    printf("Muon events:    %llu\n", (unsigned long long)total.muon_events);
+    printf("Waveform fits:  %llu\n", (unsigned long long)total.fits);
+    printf("Max amplitude:  %.1f\n", total.max_amplitude);
+    printf("Threads:        %u\n", pool.get_num_threads());
+    printf("Time:           %.2f s, %.0f events/s\n", seconds, seconds > 0 ? total.events / seconds : 0.0);
+    return 0;
+}
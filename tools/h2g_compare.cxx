@@ -0,0 +1,800 @@
+/*
+Golden output regression check: decode a .h2g file through the reference path and
+through each alternative mode, and compare the aligned events field by field.
+
+    h2g_compare -f Run001.h2g                  # every mode against the reference
+    h2g_compare -e 2000 -L 0.001 -O 0.01       # on generated data with loss and reordering
+    h2g_compare -f Run001.h2g -s golden.h2d    # store the reference output ...
+    h2g_compare -f Run001.h2g -g golden.h2d    # ... and later check against it
+
+Exits with 1 if any mode differs from the reference.  New decode paths register
+themselves in the modes table below.  Outputs that are not events, such as the online
+histograms, are checked by modes that work them out from the reference events instead.
+*/
+
+#include "event_compare.h"
+#include "binary_writer.h"
+#include "dqm_histogrammer.h"
+#include "event_ring.h"
+#include "hit_finder.h"
+#include "lfhcal_geometry.h"
+#include "pedestal_accumulator.h"
+#include "h2g_generator.h"
+#include "run_compressor.h"
+#include "waveform_fitter.h"
+#include "debug_logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef H2G_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+const size_t PACKET_SIZE = 1452;
+const double HIT_THRESHOLD = 30;    // ADC counts over pedestal, as h2g_run -H 30
+const int TRACK_LAYERS = 5;         // h2g_run -m 5, with its default 20 ADC counts
+const double TRACK_THRESHOLD = 20;
+// Pulses of the crystal ball that waveform_fitter fits, with the generator's noise of 2 ADC
+// counts.  A fit is off if its amplitude or peak time is outside these of the truth; at 50
+// ADC counts a pulse is only a few samples over the noise, so some are, but no more than
+// FIT_MAX_OFF of them, and no more than FIT_MAX_LOCAL may stop at a chi2 over the truth's.
+const int FIT_PULSES = 20000;
+const double FIT_NOISE = 2;
+const double FIT_AMPLITUDE_TOLERANCE = 0.2;     // Relative
+const double FIT_TIME_TOLERANCE = 0.25;         // Samples
+const double FIT_MAX_OFF = 0.015;
+const double FIT_MAX_LOCAL = 0.0025;
+
+struct compare_mode {
+    const char *name;
+    const char *description;
+    // Builds the source of events to compare against the reference; scratch is a path
+    // prefix for any temporary files.  A mode that decodes only part of the run replaces
+    // reference with a source that wraps it and keeps the same part.
+    std::function<event_source*(const std::string &input, int num_kcu, const std::string &scratch,
+                                event_source *&reference)> make;
+    // Or checks an output that is not events against what the reference events give
+    std::function<event_comparison(const std::string &input, int num_kcu, const std::string &scratch)> check;
+};
+
+// Events first to last of another source, which it takes over
+class range_source : public event_source {
+private:
+    event_source *all;
+    uint64_t first;
+    uint64_t last;
+
+public:
+    range_source(event_source *all, uint64_t first, uint64_t last) : all(all), first(first), last(last) {}
+    ~range_source() {delete all;}
+    bool next(golden_event &event) override {
+        while (all->next(event)) {
+            if (event.event_number > last) {
+                return false;
+            }
+            if (event.event_number >= first) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// The events of another source, which it takes over, that have a track: a column with
+// min_layers layers whose largest sample is threshold over pedestal, counted directly
+class track_source : public event_source {
+private:
+    event_source *all;
+    std::vector<double> pedestals;
+    int min_layers;
+    float threshold;
+    lfhcal_columns geometry;
+
+    bool has_track(const golden_event &event) {
+        uint64_t layers_hit[lfhcal_columns::COLUMNS] = {};
+        for (size_t channel = 0; channel < pedestals.size(); channel++) {
+            if (geometry.column[channel] < 0) {
+                continue;
+            }
+            const uint16_t *adc = event.adc.data() + channel * event.num_samples;
+            float max = *std::max_element(adc, adc + event.num_samples) - (float)pedestals[channel];
+            if (max >= threshold) {
+                layers_hit[geometry.column[channel]] |= uint64_t(1) << geometry.layer[channel];
+            }
+        }
+        for (int i = 0; i < lfhcal_columns::COLUMNS; i++) {
+            if (__builtin_popcountll(layers_hit[i]) >= min_layers) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    track_source(event_source *all, const std::vector<double> &pedestals, int min_layers, float threshold)
+        : all(all), pedestals(pedestals), min_layers(min_layers), threshold(threshold), geometry(pedestals.size()) {}
+    ~track_source() {delete all;}
+    bool next(golden_event &event) override {
+        while (all->next(event)) {
+            if (has_track(event)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Settings for decoding the input as h2g_run would, to scratch.h2d and no other output
+config compare_config(const std::string &input, int num_kcu, const std::string &scratch) {
+    config cfg = {};
+    cfg.run_number = 0;
+    cfg.detector_id = 0;
+    cfg.num_kcu = num_kcu;
+    cfg.file_name = input;
+    cfg.output_file_name = scratch + ".root";
+    cfg.debug_level = DebugLogger::getInstance()->getLevel();
+    cfg.binary_output = true;
+    cfg.binary_file_name = scratch + ".h2d";
+    cfg.first_event = -1;
+    cfg.last_event = -1;
+    cfg.first_timestamp = -1;
+    cfg.last_timestamp = -1;
+    cfg.index_file_name = scratch + ".idx";
+    cfg.checkpoint_file_name = scratch + ".ckpt";
+    cfg.hit_threshold = -1;
+    cfg.stop_after_packets = -1;
+    return cfg;
+}
+
+// Runs test_line_builder, throws std::runtime_error unless the run completed
+run_summary decode(config &cfg) {
+    run_summary summary = test_line_builder(cfg);
+    if (!summary.ok) {
+        throw std::runtime_error("decoding " + cfg.file_name + " failed: " + summary.error);
+    }
+    return summary;
+}
+
+// Decode with the reference path and write the events as .h2d
+void write_reference(const std::string &input, int num_kcu, const std::string &output) {
+    hgc_decoder decoder(input.c_str(), 0, num_kcu);
+    binary_writer writer(output, num_kcu, decoder.get_num_samples(), 0);
+    for (auto e : decoder) {
+        writer.write_event(e);
+        delete e;
+    }
+    writer.close();
+}
+
+#ifdef H2G_HAVE_ZLIB
+// Copy the input as two concatenated gzip members, the way pigz or cat would leave it
+void write_gzip(const std::string &input, const std::string &output) {
+    FILE *in = fopen(input.c_str(), "rb");
+    if (in == nullptr) {
+        throw std::runtime_error("Error opening " + input);
+    }
+    fseek(in, 0, SEEK_END);
+    long half = ftell(in) / 2;
+    fseek(in, 0, SEEK_SET);
+    std::vector<char> buffer(1 << 20);
+    for (int member = 0; member < 2; member++) {
+        gzFile out = gzopen(output.c_str(), member == 0 ? "wb1" : "ab1");
+        if (out == nullptr) {
+            fclose(in);
+            throw std::runtime_error("Error opening " + output);
+        }
+        long remaining = member == 0 ? half : -1;
+        while (remaining != 0) {
+            size_t want = remaining < 0 ? buffer.size() : std::min((long)buffer.size(), remaining);
+            size_t n = fread(buffer.data(), 1, want, in);
+            if (n == 0) {
+                break;
+            }
+            gzwrite(out, buffer.data(), n);
+            if (remaining > 0) {
+                remaining -= n;
+            }
+        }
+        gzclose(out);
+    }
+    fclose(in);
+}
+#endif
+
+// Events read back from the shared memory ring of a run that is decoded on another thread
+// meanwhile.  A reader that falls a whole ring behind skips events, ring_reference leaves
+// those out of the reference.
+class ring_source : public event_source {
+private:
+    config cfg;
+    std::thread decode_thread;
+    std::atomic<bool> decoded;
+    run_summary summary;
+    event_ring_reader *reader;
+    golden_event pending;
+    bool has_pending;
+
+public:
+    // Starts decoding cfg, throws std::runtime_error if its ring never appears
+    ring_source(const config &cfg) : cfg(cfg), decoded(false), reader(nullptr), has_pending(false) {
+        decode_thread = std::thread([this] {
+            summary = test_line_builder(this->cfg);
+            decoded = true;
+        });
+        while (reader == nullptr) {
+            try {
+                reader = new event_ring_reader(cfg.ring_name);
+            } catch (const std::runtime_error &) {
+                if (decoded) {
+                    decode_thread.join();
+                    throw std::runtime_error("the ring " + cfg.ring_name + " was gone before it could be read" +
+                                             (summary.error.empty() ? "" : ": " + summary.error));
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    ~ring_source() {
+        decode_thread.join();
+        LOG_MESSAGE(DEBUG_INFO, "Read " + std::to_string(reader->get_read()) + " events from the ring, skipped " +
+                    std::to_string(reader->get_skipped()));
+        delete reader;
+    }
+
+    // Number of the next event, false once the ring is finished.  Throws std::runtime_error
+    // if the decode failed.
+    bool peek(uint64_t &event_number) {
+        if (!has_pending) {
+            event_view view;
+            while (!reader->next(view)) {
+                if (reader->finished()) {
+                    // The writer closes the ring before the decode returns its summary
+                    while (!decoded) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    if (!summary.ok) {
+                        throw std::runtime_error("decoding " + cfg.file_name + " failed: " + summary.error);
+                    }
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            pending.fill(view, reader->get_num_kcu());
+            has_pending = true;
+        }
+        event_number = pending.event_number;
+        return true;
+    }
+    bool next(golden_event &event) override {
+        uint64_t event_number;
+        if (!peek(event_number)) {
+            return false;
+        }
+        std::swap(event, pending);
+        has_pending = false;
+        return true;
+    }
+};
+
+// The events of another source, which it takes over, that ring also has
+class ring_reference : public event_source {
+private:
+    event_source *all;
+    ring_source *ring;
+
+public:
+    ring_reference(event_source *all, ring_source *ring) : all(all), ring(ring) {}
+    ~ring_reference() {delete all;}
+    bool next(golden_event &event) override {
+        uint64_t event_number;
+        if (!ring->peek(event_number)) {
+            return false;
+        }
+        while (all->next(event)) {
+            if (event.event_number >= event_number) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Histograms of dqm_histogrammer, filled here from the reference events as it should fill them
+struct dqm_counts {
+    std::vector<uint32_t> adc;      // [channel * BINS + bin]
+    std::vector<uint32_t> toa;
+    std::vector<uint32_t> tot;
+    std::vector<uint64_t> occupied;
+    std::vector<uint64_t> hamming_errors;
+
+    dqm_counts(int num_channels)
+        : adc((size_t)num_channels * dqm_histogrammer::BINS), toa(adc.size()), tot(adc.size()),
+          occupied(num_channels), hamming_errors(num_channels) {}
+
+    void add(const golden_event &event) {
+        const int BINS = dqm_histogrammer::BINS;
+        for (size_t channel = 0; channel < occupied.size(); channel++) {
+            size_t offset = channel * event.num_samples;
+            size_t row = channel * BINS;
+            uint16_t max = event.adc[offset];
+            for (int k = 0; k < event.num_samples; k++) {
+                max = std::max(max, event.adc[offset + k]);
+                if (event.toa[offset + k] != 0) {
+                    toa[row + std::min<int>(event.toa[offset + k], BINS - 1)]++;
+                }
+                if (event.tot[offset + k] != 0) {
+                    tot[row + std::min<int>(event.tot[offset + k] >> dqm_histogrammer::TOT_SHIFT, BINS - 1)]++;
+                }
+                hamming_errors[channel] += event.hamming[offset + k] != 0;
+            }
+            adc[row + std::min<int>(max, BINS - 1)]++;
+            occupied[channel] += max - event.adc[offset] > dqm_histogrammer::THRESHOLD;
+        }
+    }
+};
+
+// Describes the first count of the snapshot that differs from expected, or returns an empty string
+std::string compare_dqm(const dqm_counts &expected, const dqm_reader &snapshot) {
+    const char *names[3] = {"ADC", "TOA", "TOT"};
+    for (uint32_t channel = 0; channel < snapshot.get_num_channels(); channel++) {
+        std::string where = "channel " + std::to_string(channel) + " ";
+        count_view histograms[3] = {snapshot.adc(channel), snapshot.toa(channel), snapshot.tot(channel)};
+        const std::vector<uint32_t> *counts[3] = {&expected.adc, &expected.toa, &expected.tot};
+        for (int h = 0; h < 3; h++) {
+            for (size_t bin = 0; bin < histograms[h].size(); bin++) {
+                uint32_t n = (*counts[h])[channel * dqm_histogrammer::BINS + bin];
+                if (histograms[h][bin] != n) {
+                    return where + names[h] + " bin " + std::to_string(bin) + ": " + std::to_string(n) + " != " +
+                           std::to_string(histograms[h][bin]);
+                }
+            }
+        }
+        if (snapshot.occupied(channel) != expected.occupied[channel]) {
+            return where + "occupied " + std::to_string(expected.occupied[channel]) + " != " +
+                   std::to_string(snapshot.occupied(channel));
+        }
+        if (snapshot.hamming_errors(channel) != expected.hamming_errors[channel]) {
+            return where + "hamming errors " + std::to_string(expected.hamming_errors[channel]) + " != " +
+                   std::to_string(snapshot.hamming_errors(channel));
+        }
+    }
+    return "";
+}
+
+// Histograms every event of the input with dqm_histogrammer, and reads its last snapshot
+// back with dqm_reader
+event_comparison check_dqm(const std::string &input, int num_kcu, const std::string &scratch) {
+    hgc_decoder decoder(input.c_str(), 0, num_kcu);
+    int num_samples = decoder.get_num_samples();
+    int num_channels = 144 * num_kcu;
+    dqm_counts expected(num_channels);
+    uint64_t events = 0;
+    {
+        dqm_histogrammer dqm(scratch + ".dqm", num_kcu, num_samples, 0, 0, 1e9, 2);
+        golden_event golden;
+        for (auto e : decoder) {
+            golden.fill(e, num_samples, events);
+            expected.add(golden);
+            // The decoder would drop an event when the ring is full, here it waits for room
+            // so that every event is histogrammed
+            while (!dqm.add(e, events)) {
+                std::this_thread::yield();
+            }
+            delete e;
+            events++;
+        }
+        dqm.close();
+    }
+
+    dqm_reader snapshot(scratch + ".dqm");
+    event_comparison result = {true, events, 0, events, snapshot.get_events(), ""};
+    if (snapshot.get_num_kcu() != (uint32_t)num_kcu || snapshot.get_num_samples() != (uint32_t)num_samples ||
+        snapshot.get_num_channels() != (uint32_t)num_channels || snapshot.get_num_bins() != dqm_histogrammer::BINS ||
+        snapshot.get_tot_shift() != dqm_histogrammer::TOT_SHIFT || snapshot.get_threshold() != dqm_histogrammer::THRESHOLD) {
+        result.first_mismatch = "header of " + std::to_string(snapshot.get_num_kcu()) + " KCUs, " +
+                                std::to_string(snapshot.get_num_samples()) + " samples, " +
+                                std::to_string(snapshot.get_num_bins()) + " bins";
+    } else if (snapshot.get_events() != events) {
+        result.first_mismatch = "event count " + std::to_string(events) + " != " + std::to_string(snapshot.get_events());
+    } else {
+        result.first_mismatch = compare_dqm(expected, snapshot);
+    }
+    // A wrong snapshot is wrong for all its events
+    result.match = result.first_mismatch.empty();
+    result.events_mismatched = result.match ? 0 : events;
+    return result;
+}
+
+// Describes the first hit that differs, or returns an empty string
+std::string compare_hits(uint64_t event, const std::vector<h2h_hit> &expected, const hit_view &written) {
+    std::string where = "event " + std::to_string(event) + ": ";
+    if (written.event_number != event) {
+        return where + "event number " + std::to_string(event) + " != " + std::to_string(written.event_number);
+    }
+    if (written.size() != expected.size()) {
+        return where + std::to_string(expected.size()) + " hits != " + std::to_string(written.size());
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        const h2h_hit &a = expected[i];
+        const h2h_hit &b = written[i];
+        if (a.channel != b.channel || a.peak_sample != b.peak_sample || a.toa != b.toa ||
+            a.amplitude != b.amplitude || a.charge != b.charge) {
+            return where + "hit " + std::to_string(i) + " channel " + std::to_string(a.channel) + " amplitude " +
+                   std::to_string(a.amplitude) + " charge " + std::to_string(a.charge) + " != channel " +
+                   std::to_string(b.channel) + " amplitude " + std::to_string(b.amplitude) + " charge " +
+                   std::to_string(b.charge);
+        }
+    }
+    return "";
+}
+
+// Decodes with -H and reads the .h2h back through hit_reader, against hit_finder run on the
+// reference events with the running pedestals, as the decoder finds them
+event_comparison check_hits(const std::string &input, int num_kcu, const std::string &scratch) {
+    config cfg = compare_config(input, num_kcu, scratch);
+    cfg.binary_output = false;
+    cfg.hit_threshold = HIT_THRESHOLD;
+    cfg.hit_file_name = scratch + ".h2h";
+    decode(cfg);
+    hit_reader written(cfg.hit_file_name);
+
+    hgc_decoder decoder(input.c_str(), 0, num_kcu);
+    pedestal_accumulator pedestals(num_kcu, decoder.get_num_samples());
+    hit_finder finder(num_kcu, decoder.get_num_samples(), HIT_THRESHOLD);
+    finder.use_pedestals(&pedestals);
+    event_comparison result = {true, 0, 0, 0, written.get_num_events(), ""};
+    uint64_t hits = 0;
+    for (auto e : decoder) {
+        pedestals.add(e);
+        const std::vector<h2h_hit> &expected = finder.find(e);
+        delete e;
+        hits += expected.size();
+        uint64_t event = result.events_a++;
+        if (event >= written.get_num_events()) {
+            continue;
+        }
+        result.events_compared++;
+        std::string mismatch = compare_hits(event, expected, written.event(event));
+        if (!mismatch.empty()) {
+            if (result.first_mismatch.empty()) {
+                result.first_mismatch = mismatch;
+            }
+            result.events_mismatched++;
+        }
+    }
+    if (result.first_mismatch.empty() && result.events_a != result.events_b) {
+        result.first_mismatch = "event count " + std::to_string(result.events_a) + " != " + std::to_string(result.events_b);
+    }
+    if (result.first_mismatch.empty() && hits == 0) {
+        result.first_mismatch = "no hits over " + std::to_string(HIT_THRESHOLD) + " ADC counts to compare";
+    }
+    result.match = result.first_mismatch.empty();
+    return result;
+}
+
+// Fits pulses of known amplitude, peak time and width, the input is not used
+event_comparison check_fit(const std::string &, int, const std::string &) {
+    const int num_samples = 10;
+    waveform_fitter fitter(num_samples);
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, FIT_NOISE);
+    const double pedestal = 100;
+    event_comparison result = {true, 0, 0, FIT_PULSES, FIT_PULSES, ""};
+    uint64_t local = 0;
+    double amplitude_error = 0;
+    double time_error = 0;
+    for (int i = 0; i < FIT_PULSES; i++) {
+        waveform_fit truth;
+        truth.amplitude = 50 + uniform(rng) * 1450;
+        truth.peak_time = 1 + uniform(rng) * 3;
+        truth.sigma = 0.3 + uniform(rng) * 0.3;
+        uint16_t adc[num_samples];
+        double truth_chi2 = 0;
+        for (int s = 0; s < num_samples; s++) {
+            double expected = fitter.evaluate(s, truth, pedestal);
+            adc[s] = (uint16_t)std::lround(expected + noise(rng));
+            truth_chi2 += (adc[s] - expected) * (adc[s] - expected);
+        }
+        waveform_fit fit = fitter.fit(adc, pedestal);
+        result.events_compared++;
+
+        double relative = (fit.amplitude - truth.amplitude) / truth.amplitude;
+        double shift = fit.peak_time - truth.peak_time;
+        amplitude_error += relative * relative;
+        time_error += shift * shift;
+        if (fit.chi2 > truth_chi2 + 1) {
+            local++;
+        }
+        if (std::fabs(relative) > FIT_AMPLITUDE_TOLERANCE || std::fabs(shift) > FIT_TIME_TOLERANCE) {
+            result.events_mismatched++;
+        }
+    }
+    char summary[256];
+    snprintf(summary, sizeof(summary), "%llu off, %llu at a local minimum, amplitude rms %.2f%%, peak time rms %.3f samples",
+             (unsigned long long)result.events_mismatched, (unsigned long long)local,
+             100 * std::sqrt(amplitude_error / FIT_PULSES), std::sqrt(time_error / FIT_PULSES));
+    LOG_MESSAGE(DEBUG_INFO, std::string("Fitted ") + std::to_string(FIT_PULSES) + " pulses: " + summary);
+    result.match = result.events_mismatched <= FIT_MAX_OFF * FIT_PULSES && local <= FIT_MAX_LOCAL * FIT_PULSES;
+    if (!result.match) {
+        result.first_mismatch = summary;
+    }
+    return result;
+}
+
+std::vector<compare_mode> modes = {
+    {"binary", "write .h2d output and read it back through binary_reader",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&) -> event_source* {
+         write_reference(input, num_kcu, scratch + ".h2d");
+         return new h2d_source(scratch + ".h2d");
+     }, nullptr},
+    {"stream", "read the file front to back through stream_source, as from a pipe",
+     [](const std::string &input, int num_kcu, const std::string &, event_source *&) -> event_source* {
+         return new decoder_source(open_packet_source(input, num_kcu), num_kcu);
+     }, nullptr},
+    {"seek", "write an index (-x), then decode the middle of the run (-e) seeking with it",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&reference) -> event_source* {
+         config cfg = compare_config(input, num_kcu, scratch);
+         cfg.binary_output = false;
+         cfg.write_index = true;
+         int64_t events = decode(cfg).events;
+         cfg.binary_output = true;
+         cfg.write_index = false;
+         cfg.first_event = events / 2;
+         cfg.last_event = events / 2 + events / 4;
+         decode(cfg);
+         reference = new range_source(reference, cfg.first_event, cfg.last_event);
+         return new h2d_source(scratch + ".h2d");
+     }, nullptr},
+    {"resume", "stop a run with checkpoints (-C) halfway, run it again to resume and read its .h2d",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&) -> event_source* {
+         config cfg = compare_config(input, num_kcu, scratch);
+         // Only the checkpoint taken when it stops
+         cfg.checkpoint_interval = 1e9;
+         cfg.stop_after_packets = std::filesystem::file_size(input) / PACKET_SIZE / 2;
+         run_summary first = test_line_builder(cfg);
+         if (first.ok || !std::filesystem::exists(cfg.checkpoint_file_name)) {
+             throw std::runtime_error("the run was not checkpointed after " + std::to_string(cfg.stop_after_packets) +
+                                      " packets" + (first.error.empty() ? "" : ": " + first.error));
+         }
+         cfg.stop_after_packets = -1;
+         decode(cfg);
+         return new h2d_source(scratch + ".h2d");
+     }, nullptr},
+    {"trigger", "write the events with a track (-m) to _mip.h2d, against a popcount of the layers over the reference",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&reference) -> event_source* {
+         // Pedestals of the whole run, given with -p, so that they do not change along the run
+         config cfg = compare_config(input, num_kcu, scratch);
+         cfg.binary_output = false;
+         cfg.pedestal_file_name = scratch + ".ped";
+         decode(cfg);
+         cfg.pedestal_file_name.clear();
+         cfg.pedestal_input = scratch + ".ped";
+         cfg.trigger_layers = TRACK_LAYERS;
+         cfg.trigger_threshold = TRACK_THRESHOLD;
+         cfg.mip_file_name = scratch + "_mip.h2d";
+         decode(cfg);
+         if (binary_reader(cfg.mip_file_name).get_num_events() == 0) {
+             throw std::runtime_error("no event had a track of " + std::to_string(TRACK_LAYERS) + " layers to compare");
+         }
+         reference = new track_source(reference, read_pedestals(cfg.pedestal_input, 144 * num_kcu),
+                                      TRACK_LAYERS, TRACK_THRESHOLD);
+         return new h2d_source(cfg.mip_file_name);
+     }, nullptr},
+    {"ring", "publish every event to a shared memory ring (-Q) and read them back while the run is decoded",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&reference) -> event_source* {
+         // The reference is read from .h2d so that it keeps up with the ring
+         write_reference(input, num_kcu, scratch + "_reference.h2d");
+         config cfg = compare_config(input, num_kcu, scratch);
+         cfg.binary_output = false;
+         cfg.ring_name = std::filesystem::path(scratch).filename().string();
+         cfg.ring_slots = 1024;
+         ring_source *ring = new ring_source(cfg);
+         delete reference;
+         reference = new ring_reference(new h2d_source(scratch + "_reference.h2d"), ring);
+         return ring;
+     }, nullptr},
+#ifdef H2G_HAVE_ZLIB
+    {"gzip", "gzip the input in two members and read it through compressed_source",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&) -> event_source* {
+         write_gzip(input, scratch + ".h2g.gz");
+         return new decoder_source(scratch + ".h2g.gz", num_kcu);
+     }, nullptr},
+#endif
+#ifdef H2G_HAVE_ZSTD
+    {"zstd", "compress the input as h2g_compress does, in 1 MB frames, and decompress them in parallel",
+     [](const std::string &input, int num_kcu, const std::string &scratch, event_source *&) -> event_source* {
+         compress_run(input, scratch + ".h2g.zst", 3, 1);
+         return new decoder_source(scratch + ".h2g.zst", num_kcu);
+     }, nullptr},
+#endif
+    {"hits", "find hits with -H and read the .h2h back through hit_reader, against hit_finder on the reference",
+     nullptr, check_hits},
+    {"dqm", "histogram every event with dqm_histogrammer and read the snapshot back through dqm_reader",
+     nullptr, check_dqm},
+    {"fit", "fit crystal ball pulses of known amplitude and peak time with waveform_fitter, with noise of 2 ADC counts",
+     nullptr, check_fit},
+};
+
+void print_usage() {
+    std::cout << "Usage: h2g_compare (-f FILE | -e EVENTS) [-n KCU] [-m MODE[,MODE]] [-s GOLDEN] [-g GOLDEN]" << std::endl;
+    std::cout << "  -f, --file        Input .h2g file" << std::endl;
+    std::cout << "  -e, --events      Generate an input with this many events instead" << std::endl;
+    std::cout << "  -L, --loss        Packet loss for the generated input (default: 0)" << std::endl;
+    std::cout << "  -O, --reorder     Packet reordering for the generated input (default: 0)" << std::endl;
+    std::cout << "  -H, --heartbeat   Heartbeat interval for the generated input (default: 0)" << std::endl;
+    std::cout << "  -n, --num-kcu     Number of KCUs (default: 4)" << std::endl;
+    std::cout << "  -m, --modes       Comma separated modes to check (default: all)" << std::endl;
+    std::cout << "  -s, --save        Write the reference output to GOLDEN (.h2d) and exit" << std::endl;
+    std::cout << "  -g, --golden      Also compare the reference output against GOLDEN" << std::endl;
+    std::cout << "  -G, --debug-level 0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+    std::cout << "Modes:" << std::endl;
+    for (auto &m : modes) {
+        printf("  %-16s %s\n", m.name, m.description);
+    }
+}
+
+bool report(const std::string &name, const event_comparison &result) {
+    if (result.match) {
+        printf("%-16s OK        %llu events\n", name.c_str(), (unsigned long long)result.events_compared);
+    } else {
+        printf("%-16s MISMATCH  %llu of %llu events differ (reference %llu, %s %llu), first: %s\n", name.c_str(),
+               (unsigned long long)result.events_mismatched, (unsigned long long)result.events_compared,
+               (unsigned long long)result.events_a, name.c_str(), (unsigned long long)result.events_b,
+               result.first_mismatch.c_str());
+    }
+    return result.match;
+}
+
+int main(int argc, char **argv) {
+    generator_config gen;
+    std::string input_file;
+    std::string save_file;
+    std::string golden_file;
+    std::string selected;
+    bool generate = false;
+    int debug_level = DEBUG_ERROR;
+
+    const struct option long_options[] = {
+        {"file", required_argument, nullptr, 'f'},
+        {"events", required_argument, nullptr, 'e'},
+        {"loss", required_argument, nullptr, 'L'},
+        {"reorder", required_argument, nullptr, 'O'},
+        {"heartbeat", required_argument, nullptr, 'H'},
+        {"num-kcu", required_argument, nullptr, 'n'},
+        {"modes", required_argument, nullptr, 'm'},
+        {"save", required_argument, nullptr, 's'},
+        {"golden", required_argument, nullptr, 'g'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:e:L:O:H:n:m:s:g:G:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'f':
+                input_file = optarg;
+                break;
+            case 'e':
+                gen.num_events = std::stoll(optarg);
+                generate = true;
+                break;
+            case 'L':
+                gen.packet_loss = std::stod(optarg);
+                break;
+            case 'O':
+                gen.reorder = std::stod(optarg);
+                break;
+            case 'H':
+                gen.heartbeat_interval = std::stoi(optarg);
+                break;
+            case 'n':
+                gen.num_kcu = std::stoi(optarg);
+                break;
+            case 'm':
+                selected = optarg;
+                break;
+            case 's':
+                save_file = optarg;
+                break;
+            case 'g':
+                golden_file = optarg;
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+
+    if (input_file.empty() && !generate) {
+        LOG_MESSAGE(DEBUG_ERROR, "An input file (-f) or a number of events to generate (-e) is required");
+        print_usage();
+        return 1;
+    }
+
+    std::string scratch = (std::filesystem::temp_directory_path() / ("h2g_compare_" + std::to_string(getpid()))).string();
+    bool all_match = true;
+    try {
+        if (input_file.empty()) {
+            input_file = scratch + ".h2g";
+            h2g_generator generator(gen);
+            generator.write(input_file);
+        }
+
+        if (!save_file.empty()) {
+            write_reference(input_file, gen.num_kcu, save_file);
+            printf("Wrote reference output to %s\n", save_file.c_str());
+        } else {
+            if (!golden_file.empty()) {
+                decoder_source reference(input_file, gen.num_kcu);
+                h2d_source golden(golden_file);
+                all_match &= report("golden", compare_sources(reference, golden));
+            }
+            for (auto &m : modes) {
+                if (!selected.empty() && ("," + selected + ",").find("," + std::string(m.name) + ",") == std::string::npos) {
+                    continue;
+                }
+                if (m.check) {
+                    all_match &= report(m.name, m.check(input_file, gen.num_kcu, scratch + "_" + m.name));
+                    continue;
+                }
+                event_source *reference = new decoder_source(input_file, gen.num_kcu);
+                event_source *candidate = nullptr;
+                try {
+                    candidate = m.make(input_file, gen.num_kcu, scratch + "_" + m.name, reference);
+                } catch (const std::runtime_error &) {
+                    delete reference;
+                    throw;
+                }
+                try {
+                    all_match &= report(m.name, compare_sources(*reference, *candidate));
+                } catch (const std::runtime_error &) {
+                    delete candidate;
+                    delete reference;
+                    throw;
+                }
+                delete candidate;
+                delete reference;
+            }
+        }
+    } catch (const std::runtime_error &e) {
+        LOG_MESSAGE(DEBUG_ERROR, std::string("Comparison failed: ") + e.what());
+        all_match = false;
+    }
+
+    // Remove the scratch files
+    std::vector<std::filesystem::path> scratch_files;
+    for (auto &entry : std::filesystem::directory_iterator(std::filesystem::temp_directory_path())) {
+        if (entry.path().filename().string().rfind("h2g_compare_" + std::to_string(getpid()), 0) == 0) {
+            scratch_files.push_back(entry.path());
+        }
+    }
+    for (auto &path : scratch_files) {
+        std::filesystem::remove(path);
+    }
+    return all_match ? 0 : 1;
+}
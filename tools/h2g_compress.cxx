@@ -0,0 +1,99 @@
+/*
+Compress a .h2g run with zstd as many independent frames, so compressed_source can
+decompress it on several threads.  Frames hold whole packets and record their size.
+
+    h2g_compress Run042.h2g                    # writes Run042.h2g.zst
+    h2g_compress -l 9 -b 16 -o /archive/Run042.h2g.zst Run042.h2g
+
+The output is an ordinary zstd file, `zstd -d` unpacks it as well.
+*/
+
+#include "run_compressor.h"
+#include "debug_logger.h"
+
+#include <chrono>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+void print_usage() {
+    std::cout << "Usage: h2g_compress [-l LEVEL] [-b MB] [-T THREADS] [-o FILE] INPUT" << std::endl;
+    std::cout << "  -o, --output      Output file (default: INPUT.zst)" << std::endl;
+    std::cout << "  -l, --level       zstd compression level (default: 3)" << std::endl;
+    std::cout << "  -b, --block       Uncompressed MB per frame (default: 8)" << std::endl;
+    std::cout << "  -T, --threads     Compression threads (default: one per hardware thread)" << std::endl;
+    std::cout << "  -G, --debug-level 0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    std::string output_file;
+    int level = 3;
+    size_t block_mb = 8;
+    unsigned num_threads = 0;
+    int debug_level = DEBUG_INFO;
+
+    const struct option long_options[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"level", required_argument, nullptr, 'l'},
+        {"block", required_argument, nullptr, 'b'},
+        {"threads", required_argument, nullptr, 'T'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:l:b:T:G:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'l':
+                level = std::stoi(optarg);
+                break;
+            case 'b':
+                block_mb = std::stoul(optarg);
+                break;
+            case 'T':
+                num_threads = std::stoul(optarg);
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+
+    if (optind != argc - 1 || block_mb == 0) {
+        print_usage();
+        return 1;
+    }
+    std::string input_file = argv[optind];
+    if (output_file.empty()) {
+        output_file = input_file + ".zst";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    compress_summary summary;
+    try {
+        summary = compress_run(input_file, output_file, level, block_mb, num_threads);
+    } catch (const std::exception &e) {
+        LOG_MESSAGE(DEBUG_ERROR, "Compress", std::string("Compression failed: ") + e.what());
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_MESSAGE(DEBUG_INFO, "Compress", "Wrote " + output_file + ": " + std::to_string(summary.frames) + " frames, " +
+                std::to_string(summary.bytes_in) + " -> " + std::to_string(summary.bytes_out) + " bytes (" +
+                std::to_string(summary.bytes_in > 0 ? 100.0 * summary.bytes_out / summary.bytes_in : 0.0) + "%) in " +
+                std::to_string(seconds) + " s");
+    return 0;
+}
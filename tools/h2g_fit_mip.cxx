@@ -0,0 +1,183 @@
+/*
+MIP calibration: the Landau fits of analysis/fit_mip.cxx, one per channel, run in
+parallel on the muon spectra written by h2g_amplitudes.
+
+    h2g_fit_mip -i muons.hist -o mip.csv -j 8
+
+Each channel's histogram is fitted in [-l, -u] (5 to 200 by default) with landau_fitter on
+a thread_pool.  mip.csv has a line per connected channel with its position, the fit and
+whether it passes the cuts of fit_mip.cxx: chi2 / NDF between 0.5 and 2.5, an MPV over 11
+and an MPV error of at most 5.  The amplitude is in counts, where fit_mip.cxx scales each
+histogram to unit area first; the other parameters are the same.
+*/
+
+#include "histogram.h"
+#include "landau_fitter.h"
+#include "lfhcal_geometry.h"
+#include "thread_pool.h"
+#include "debug_logger.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void print_usage() {
+    std::cout << "Usage: h2g_fit_mip -i FILE.hist [-o FILE] [-n PREFIX] [-l LOW] [-u HIGH] [-j THREADS]" << std::endl;
+    std::cout << "  -i, --input       Histograms written by h2g_amplitudes" << std::endl;
+    std::cout << "  -o, --output      Fit results as CSV (default: mip.csv)" << std::endl;
+    std::cout << "  -n, --name        Histograms to fit, the name before the channel (default: muon_cb_norm_)" << std::endl;
+    std::cout << "  -l, --low         Start of the fit range (default: 5)" << std::endl;
+    std::cout << "  -u, --high        End of the fit range (default: 200)" << std::endl;
+    std::cout << "  -j, --threads     Threads (default: one per hardware thread)" << std::endl;
+    std::cout << "  -G, --debug-level 0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+}
+
+// The cuts of fit_mip.cxx
+bool good_fit(const landau_fit &fit) {
+    if (!fit.converged || fit.ndf <= 0) {
+        return false;
+    }
+    double chi2_per_ndf = fit.chi2 / fit.ndf;
+    return chi2_per_ndf > 0.5 && chi2_per_ndf < 2.5 && fit.mpv > 11 && fit.mpv_error <= 5;
+}
+
+int main(int argc, char **argv) {
+    std::string input_file;
+    std::string output_file = "mip.csv";
+    std::string prefix = "muon_cb_norm_";
+    double low = 5;
+    double high = 200;
+    unsigned threads = 0;
+    int debug_level = DEBUG_INFO;
+
+    const struct option long_options[] = {
+        {"input", required_argument, nullptr, 'i'},
+        {"output", required_argument, nullptr, 'o'},
+        {"name", required_argument, nullptr, 'n'},
+        {"low", required_argument, nullptr, 'l'},
+        {"high", required_argument, nullptr, 'u'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:o:n:l:u:j:G:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                input_file = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'n':
+                prefix = optarg;
+                break;
+            case 'l':
+                low = std::stod(optarg);
+                break;
+            case 'u':
+                high = std::stod(optarg);
+                break;
+            case 'j':
+                threads = std::stoul(optarg);
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+    if (input_file.empty()) {
+        LOG_MESSAGE(DEBUG_ERROR, "No input file (-i)");
+        print_usage();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<histogram> histograms;
+    try {
+        histograms = read_histograms(input_file);
+    } catch (const std::runtime_error &e) {
+        LOG_MESSAGE(DEBUG_ERROR, e.what());
+        return 1;
+    }
+    // Channel number of each histogram with the prefix
+    std::map<int, const histogram*> spectra;
+    for (auto &h : histograms) {
+        const std::string &name = h.get_name();
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        try {
+            size_t used = 0;
+            int channel = std::stoi(name.substr(prefix.size()), &used);
+            if (used == name.size() - prefix.size()) {
+                spectra[channel] = &h;
+            }
+        } catch (const std::exception &) {
+        }
+    }
+    if (spectra.empty()) {
+        LOG_MESSAGE(DEBUG_ERROR, "No histograms named " + prefix + "N in " + input_file);
+        return 1;
+    }
+
+    landau_fitter fitter(low, high);
+    thread_pool pool(threads);
+    std::vector<int> channels;
+    std::vector<std::future<landau_fit>> fits;
+    for (auto &spectrum : spectra) {
+        int x, y, z;
+        if (spectrum.first >= 576 || !decode_position(spectrum.first, x, y, z)) {
+            continue;   // Not connected to a tile
+        }
+        const histogram *h = spectrum.second;
+        channels.push_back(spectrum.first);
+        fits.push_back(pool.submit([&fitter, h] {return fitter.fit(*h);}));
+    }
+
+    FILE *out = fopen(output_file.c_str(), "w");
+    if (out == nullptr) {
+        LOG_MESSAGE(DEBUG_ERROR, "Error opening " + output_file);
+        return 1;
+    }
+    fprintf(out, "channel,x,y,z,entries,amplitude,amplitude_error,mpv,mpv_error,width,width_error,chi2,ndf,good\n");
+    int num_good = 0;
+    for (size_t i = 0; i < channels.size(); i++) {
+        landau_fit fit = fits[i].get();
+        int x, y, z;
+        decode_position(channels[i], x, y, z);
+        bool good = good_fit(fit);
+        num_good += good;
+        fprintf(out, "%d,%d,%d,%d,%llu,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%d,%d\n", channels[i], x, y, z,
+                (unsigned long long)spectra[channels[i]]->get_entries(), fit.amplitude, fit.amplitude_error,
+                fit.mpv, fit.mpv_error, fit.width, fit.width_error, fit.chi2, fit.ndf, good ? 1 : 0);
+    }
+    if (fclose(out) != 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "Error writing " + output_file);
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Channels fitted: %zu\n", channels.size());
+    printf("Good fits:       %d\n", num_good);
+    printf("Threads:         %u\n", pool.get_num_threads());
+    printf("Time:            %.2f s\n", seconds);
+    return 0;
+}
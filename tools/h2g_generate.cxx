@@ -0,0 +1,150 @@
+/*
+Write a synthetic .h2g file, for benchmarking the decoder without beam data.
+
+    h2g_generate -r 900 -e 100000 --loss 0.001
+    h2g_run -r 900
+*/
+
+#include "h2g_generator.h"
+#include "debug_logger.h"
+
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+void print_usage() {
+    std::cout << "Usage: h2g_generate (-r <run_number> | -o FILE) [options]" << std::endl;
+    std::cout << "  -r, --run            Write $DATA_DIRECTORY/RunXXX.h2g" << std::endl;
+    std::cout << "  -o, --output         Write FILE instead" << std::endl;
+    std::cout << "  -n, --num-kcu        Number of KCUs (default: 4)" << std::endl;
+    std::cout << "  -s, --samples        Samples per waveform (default: 10)" << std::endl;
+    std::cout << "  -e, --events         Number of events (default: 1000)" << std::endl;
+    std::cout << "  -R, --rate           Mean event rate in Hz (default: 1000)" << std::endl;
+    std::cout << "  -w, --timestamp-bits Timestamps wrap at 2^BITS (default: 32)" << std::endl;
+    std::cout << "  -t, --start          First timestamp, set close to the wrap to test it (default: 1000)" << std::endl;
+    std::cout << "  -x, --occupancy      Chance a channel has a pulse (default: 0.05)" << std::endl;
+    std::cout << "  -L, --loss           Chance a data packet is dropped (default: 0)" << std::endl;
+    std::cout << "  -O, --reorder        Chance a data packet is delayed (default: 0)" << std::endl;
+    std::cout << "  -W, --reorder-window Maximum packets a delayed packet is held back (default: 8)" << std::endl;
+    std::cout << "  -H, --heartbeat      Write a heartbeat every N data packets (default: 0, none)" << std::endl;
+    std::cout << "  -S, --seed           Random seed (default: 1)" << std::endl;
+    std::cout << "  -G, --debug-level    0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help           Show this help message" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    generator_config cfg;
+    int run_number = -1;
+    std::string output_file;
+    int debug_level = DEBUG_INFO;
+
+    const struct option long_options[] = {
+        {"run", required_argument, nullptr, 'r'},
+        {"output", required_argument, nullptr, 'o'},
+        {"num-kcu", required_argument, nullptr, 'n'},
+        {"samples", required_argument, nullptr, 's'},
+        {"events", required_argument, nullptr, 'e'},
+        {"rate", required_argument, nullptr, 'R'},
+        {"timestamp-bits", required_argument, nullptr, 'w'},
+        {"start", required_argument, nullptr, 't'},
+        {"occupancy", required_argument, nullptr, 'x'},
+        {"loss", required_argument, nullptr, 'L'},
+        {"reorder", required_argument, nullptr, 'O'},
+        {"reorder-window", required_argument, nullptr, 'W'},
+        {"heartbeat", required_argument, nullptr, 'H'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:o:n:s:e:R:w:t:x:L:O:W:H:S:G:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'r':
+                run_number = std::stoi(optarg);
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'n':
+                cfg.num_kcu = std::stoi(optarg);
+                break;
+            case 's':
+                cfg.num_samples = std::stoi(optarg);
+                break;
+            case 'e':
+                cfg.num_events = std::stoll(optarg);
+                break;
+            case 'R':
+                cfg.rate = std::stod(optarg);
+                break;
+            case 'w':
+                cfg.timestamp_bits = std::stoi(optarg);
+                break;
+            case 't':
+                cfg.start_timestamp = std::stoul(optarg, nullptr, 0);
+                break;
+            case 'x':
+                cfg.occupancy = std::stod(optarg);
+                break;
+            case 'L':
+                cfg.packet_loss = std::stod(optarg);
+                break;
+            case 'O':
+                cfg.reorder = std::stod(optarg);
+                break;
+            case 'W':
+                cfg.reorder_window = std::stoi(optarg);
+                break;
+            case 'H':
+                cfg.heartbeat_interval = std::stoi(optarg);
+                break;
+            case 'S':
+                cfg.seed = std::stoul(optarg);
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+
+    if (output_file.empty()) {
+        if (run_number == -1) {
+            LOG_MESSAGE(DEBUG_ERROR, "Either a run number (-r) or an output file (-o) is required");
+            print_usage();
+            return 1;
+        }
+        const char *data_directory = std::getenv("DATA_DIRECTORY");
+        if (data_directory == nullptr) {
+            data_directory = ".";
+        }
+        char file_name[256];
+        snprintf(file_name, 256, "%s/Run%03d.h2g", data_directory, run_number);
+        output_file = file_name;
+    }
+    if (cfg.num_kcu < 1 || cfg.num_kcu > 4 || cfg.num_samples < 1 || cfg.num_samples > 64 ||
+        cfg.timestamp_bits < 8 || cfg.timestamp_bits > 32 || cfg.rate <= 0) {
+        LOG_MESSAGE(DEBUG_ERROR, "Invalid generator settings");
+        print_usage();
+        return 1;
+    }
+
+    try {
+        h2g_generator generator(cfg);
+        generator.write(output_file);
+    } catch (const std::runtime_error &e) {
+        LOG_MESSAGE(DEBUG_ERROR, std::string("Generation failed: ") + e.what());
+        return 1;
+    }
+    return 0;
+}
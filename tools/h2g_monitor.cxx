@@ -0,0 +1,173 @@
+/*
+Online monitor: reads the events h2g_run publishes with -Q and prints the event rate,
+occupancy and pedestals every few seconds.
+
+    h2g_run -r 42 -F -Q h2g &
+    h2g_monitor -q h2g -S 5            # as many as wanted, each reads the ring by itself
+    h2g_monitor -q h2g -f              # and carry on with the next run published to it
+
+A channel is occupied when its largest sample is more than -t ADC counts (30 by default)
+over its first, and the pedestal is the mean first sample over all channels.  The monitor
+starts at the newest event.  When it cannot keep up it skips the events that were
+overwritten, and reports how many it missed, but never slows the decoder.  It is also a
+starting point for other monitors, which only need another fill().
+*/
+
+#include "event_ring.h"
+#include "debug_logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+std::atomic<bool> stop(false);
+void signal_handler(int) {
+    stop = true;
+}
+
+void print_usage() {
+    std::cout << "Usage: h2g_monitor -q NAME [-S SECONDS] [-t ADC] [-f]" << std::endl;
+    std::cout << "  -q, --ring        Shared memory ring given to h2g_run -Q" << std::endl;
+    std::cout << "  -S, --stats-interval Print a line every SECONDS (default: 5)" << std::endl;
+    std::cout << "  -t, --threshold   A channel is occupied this many ADC counts over its first sample (default: 30)" << std::endl;
+    std::cout << "  -f, --follow      Wait for the next run when one ends (default: stop)" << std::endl;
+    std::cout << "  -G, --debug-level 0: OFF, 1: ERROR, 2: WARNING, 3: INFO, 4: DEBUG, 5: TRACE" << std::endl;
+    std::cout << "  -h, --help        Show this help message" << std::endl;
+}
+
+// What the monitor has seen since the last line it printed
+struct monitor_stats {
+    uint64_t events = 0;
+    uint64_t last_event_number = 0;
+    uint64_t occupied = 0;
+    uint64_t channels = 0;
+    double pedestal_sum = 0;
+
+    void fill(const event_view &event, int threshold) {
+        for (uint32_t channel = 0; channel < event.num_channels; channel++) {
+            sample_view adc = event.adc(channel);
+            uint16_t max = adc[0];
+            for (uint16_t value : adc) {
+                max = value > max ? value : max;
+            }
+            occupied += max - adc[0] > threshold;
+            pedestal_sum += adc[0];
+        }
+        channels += event.num_channels;
+        last_event_number = event.event_number;
+        events++;
+    }
+};
+
+void print_line(const event_ring_reader &ring, const monitor_stats &stats, double seconds) {
+    printf("Run %d  event %llu  %llu events, %.1f/s  skipped %llu  occupancy %.2f%%  pedestal %.2f\n",
+           ring.get_run_number(), (unsigned long long)stats.last_event_number, (unsigned long long)stats.events,
+           seconds > 0 ? stats.events / seconds : 0.0, (unsigned long long)ring.get_skipped(),
+           stats.channels ? 100.0 * stats.occupied / stats.channels : 0.0,
+           stats.channels ? stats.pedestal_sum / stats.channels : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    std::string ring_name;
+    double interval = 5;
+    int threshold = 30;
+    bool follow = false;
+    int debug_level = DEBUG_INFO;
+
+    const struct option long_options[] = {
+        {"ring", required_argument, nullptr, 'q'},
+        {"stats-interval", required_argument, nullptr, 'S'},
+        {"threshold", required_argument, nullptr, 't'},
+        {"follow", no_argument, nullptr, 'f'},
+        {"debug-level", required_argument, nullptr, 'G'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "q:S:t:fG:h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'q':
+                ring_name = optarg;
+                break;
+            case 'S':
+                interval = std::stod(optarg);
+                break;
+            case 't':
+                threshold = std::stoi(optarg);
+                break;
+            case 'f':
+                follow = true;
+                break;
+            case 'G':
+                debug_level = std::stoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    DebugLogger::getInstance()->setLevel(debug_level);
+    if (ring_name.empty()) {
+        LOG_MESSAGE(DEBUG_ERROR, "No ring (-q)");
+        print_usage();
+        return 1;
+    }
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+
+    bool waiting = false;
+    while (!stop) {
+        event_ring_reader *ring = nullptr;
+        try {
+            ring = new event_ring_reader(ring_name);
+        } catch (const std::runtime_error &e) {
+            // Not published yet, or between runs
+            if (!waiting) {
+                LOG_MESSAGE(DEBUG_INFO, std::string(e.what()) + ", waiting for it");
+                waiting = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            continue;
+        }
+        waiting = false;
+
+        monitor_stats stats;
+        auto last_line = std::chrono::steady_clock::now();
+        event_view event;
+        while (!stop) {
+            if (ring->next(event)) {
+                stats.fill(event, threshold);
+            } else if (ring->finished()) {
+                break;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_line).count();
+            if (seconds >= interval) {
+                print_line(*ring, stats, seconds);
+                stats = monitor_stats();
+                last_line = std::chrono::steady_clock::now();
+            }
+        }
+        print_line(*ring, stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - last_line).count());
+        printf("Run %d: read %llu events, skipped %llu\n", ring->get_run_number(),
+               (unsigned long long)ring->get_read(), (unsigned long long)ring->get_skipped());
+        bool finished = ring->finished();
+        delete ring;
+        if (finished && !follow) {
+            break;
+        }
+    }
+    return 0;
+}